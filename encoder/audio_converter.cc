@@ -0,0 +1,429 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/audio_converter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define WEBMLIVE_AUDIO_CONVERTER_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#include "glog/logging.h"
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+// -3 dB gain used when folding center and surround channels into stereo.
+const float kMinus3dB = 0.70710678f;
+
+// WAVE channel order positions used by the stereo downmix.
+enum {
+  kFrontLeft = 0,
+  kFrontRight = 1,
+  kFrontCenter = 2,
+  kLowFrequency = 3,
+  kBackLeft = 4,
+  kBackRight = 5,
+  kSideLeft = 6,
+  kSideRight = 7,
+};
+
+// Returns the sum of the products of the first |length| elements of |a| and
+// |b|.
+float DotProduct(const float* a, const float* b, int length) {
+  int i = 0;
+  float total = 0;
+#ifdef WEBMLIVE_AUDIO_CONVERTER_SSE
+  __m128 sum = _mm_setzero_ps();
+  for (; i + 4 <= length; i += 4) {
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+  float partial[4];
+  _mm_storeu_ps(partial, sum);
+  total = partial[0] + partial[1] + partial[2] + partial[3];
+#endif
+  for (; i < length; ++i) {
+    total += a[i] * b[i];
+  }
+  return total;
+}
+
+// Blackman window evaluated at |u|, where |u| is in the range -1 to 1.
+double BlackmanWindow(double u) {
+  if (u <= -1.0 || u >= 1.0) {
+    return 0;
+  }
+  return 0.42 + 0.5 * cos(kPi * u) + 0.08 * cos(2 * kPi * u);
+}
+
+double Sinc(double x) {
+  if (x == 0) {
+    return 1.0;
+  }
+  return sin(kPi * x) / (kPi * x);
+}
+
+int TapsForQuality(webmlive::ResamplerQuality quality) {
+  switch (quality) {
+    case webmlive::kResamplerQualityLinear:
+      return 2;
+    case webmlive::kResamplerQualityMedium:
+      return 16;
+    case webmlive::kResamplerQualityHigh:
+      return 32;
+  }
+  return 16;
+}
+
+}  // namespace
+
+namespace webmlive {
+
+AudioConverter::AudioConverter()
+    : quality_(kResamplerQualityMedium),
+      work_channels_(0),
+      taps_(0),
+      planar_frames_(0),
+      planar_offset_(0),
+      limiter_gain_(1.0f),
+      limiter_release_(0),
+      position_(0),
+      first_input_timestamp_(-1),
+      frames_output_(0) {
+}
+
+AudioConverter::~AudioConverter() {
+}
+
+bool AudioConverter::ConversionRequired(
+    const AudioConfig& input_config,
+    const AudioConverterConfig& converter_config) {
+  const AudioConverterConfig& cc = converter_config;
+  return (cc.sample_rate != 0 && cc.sample_rate != input_config.sample_rate) ||
+      (cc.channels != 0 && cc.channels != input_config.channels);
+}
+
+int AudioConverter::Init(const AudioConfig& input_config,
+                         const AudioConverterConfig& converter_config) {
+  const uint16 format_tag = input_config.format_tag;
+  if (!(format_tag == kAudioFormatPcm && input_config.bits_per_sample == 16) &&
+      !(format_tag == kAudioFormatIeeeFloat &&
+        input_config.bits_per_sample == 32)) {
+    LOG(ERROR) << "AudioConverter input must be 16 bit PCM or 32 bit float.";
+    return kInvalidArg;
+  }
+  if (input_config.channels == 0 || input_config.sample_rate == 0) {
+    LOG(ERROR) << "AudioConverter input has no channels or sample rate.";
+    return kInvalidArg;
+  }
+  input_config_ = input_config;
+  input_config_.block_align =
+      input_config.channels * input_config.bits_per_sample / 8;
+
+  output_config_ = input_config;
+  if (converter_config.sample_rate) {
+    output_config_.sample_rate = converter_config.sample_rate;
+  }
+  if (converter_config.channels) {
+    output_config_.channels = converter_config.channels;
+  }
+  const int kBitsPerIeeeFloat = sizeof(float) * 8;  // NOLINT(runtime/sizeof)
+  output_config_.format_tag = kAudioFormatIeeeFloat;
+  output_config_.bits_per_sample = kBitsPerIeeeFloat;
+  output_config_.valid_bits_per_sample = kBitsPerIeeeFloat;
+  output_config_.block_align = output_config_.channels * sizeof(float);
+  output_config_.bytes_per_second =
+      output_config_.block_align * output_config_.sample_rate;
+  output_config_.channel_mask = 0;
+
+  quality_ = converter_config.quality;
+  work_channels_ = std::min(input_config_.channels, output_config_.channels);
+  InitDownmix();
+
+  planar_.assign(work_channels_, std::vector<float>());
+  resampled_.assign(work_channels_, std::vector<float>());
+  planar_frames_ = 0;
+  planar_offset_ = 0;
+  position_ = 0;
+  limiter_gain_ = 1.0f;
+  limiter_release_ =
+      1000.0f / (kLimiterReleaseMs * static_cast<float>(
+          input_config_.sample_rate));
+  if (input_config_.sample_rate != output_config_.sample_rate) {
+    taps_ = TapsForQuality(quality_);
+    InitFilterBank();
+    phase_filter_.assign(taps_, 0.0f);
+
+    // Prime the history so that the first output sample lines up with the
+    // first input sample.
+    const int32 history_frames = taps_ / 2 - 1;
+    for (int32 c = 0; c < work_channels_; ++c) {
+      planar_[c].assign(history_frames, 0.0f);
+    }
+    planar_frames_ = history_frames;
+  }
+  LOG(INFO) << "AudioConverter " << input_config_.sample_rate << " Hz "
+            << input_config_.channels << " ch -> "
+            << output_config_.sample_rate << " Hz "
+            << output_config_.channels << " ch, taps=" << taps_;
+  return kSuccess;
+}
+
+int AudioConverter::Convert(const AudioBuffer& input_buffer,
+                            AudioBuffer* ptr_output_buffer) {
+  if (!ptr_output_buffer || !input_buffer.buffer()) {
+    LOG(ERROR) << "AudioConverter cannot Convert NULL buffers.";
+    return kInvalidArg;
+  }
+  const AudioConfig& ic = input_buffer.config();
+  if (ic.format_tag != input_config_.format_tag ||
+      ic.channels != input_config_.channels ||
+      ic.bits_per_sample != input_config_.bits_per_sample) {
+    LOG(ERROR) << "AudioConverter input format changed.";
+    return kInvalidArg;
+  }
+  if (first_input_timestamp_ == -1) {
+    first_input_timestamp_ = input_buffer.timestamp();
+  }
+  const int32 num_frames =
+      input_buffer.buffer_length() / input_config_.block_align;
+  Deinterleave(input_buffer.buffer(), num_frames);
+
+  const int32 output_frames = Resample();
+  if (output_frames == 0) {
+    return kNoSamples;
+  }
+  Interleave(output_frames);
+
+  const int64 sample_rate = output_config_.sample_rate;
+  const int64 start_time = frames_output_ * 1000 / sample_rate;
+  const int64 end_time = (frames_output_ + output_frames) * 1000 / sample_rate;
+  const int status = ptr_output_buffer->Init(
+      output_config_,
+      first_input_timestamp_ + start_time,
+      end_time - start_time,
+      reinterpret_cast<const uint8*>(&interleaved_[0]),
+      static_cast<int32>(interleaved_.size() * sizeof(float)));
+  if (status) {
+    LOG(ERROR) << "AudioBuffer Init failed: " << status;
+    return kNoMemory;
+  }
+  frames_output_ += output_frames;
+  return kSuccess;
+}
+
+int32 AudioConverter::InputFramesFor(int32 num_frames) const {
+  if (output_config_.sample_rate == 0) {
+    return num_frames;
+  }
+  const int64 input_frames =
+      (static_cast<int64>(num_frames) * input_config_.sample_rate +
+       output_config_.sample_rate - 1) / output_config_.sample_rate;
+  return static_cast<int32>(std::max<int64>(input_frames, 1));
+}
+
+void AudioConverter::Deinterleave(const uint8* ptr_data, int32 num_frames) {
+  const int32 in_channels = input_config_.channels;
+  if (planar_offset_ > 0 && planar_offset_ >= planar_frames_ - planar_offset_) {
+    // The consumed prefix outweighs the retained frames; moving the retained
+    // frames to the front now costs less than the copies already avoided.
+    for (int32 c = 0; c < work_channels_; ++c) {
+      std::copy(planar_[c].begin() + planar_offset_,
+                planar_[c].begin() + planar_frames_, planar_[c].begin());
+    }
+    planar_frames_ -= planar_offset_;
+    planar_offset_ = 0;
+  }
+  for (int32 c = 0; c < work_channels_; ++c) {
+    planar_[c].resize(planar_frames_ + num_frames);
+  }
+  const bool downmix = work_channels_ < in_channels;
+  const bool pcm = input_config_.format_tag == kAudioFormatPcm;
+  const int16* const ptr_pcm = reinterpret_cast<const int16*>(ptr_data);
+  const float* const ptr_float = reinterpret_cast<const float*>(ptr_data);
+  std::vector<float> frame(in_channels);
+  for (int32 i = 0; i < num_frames; ++i) {
+    for (int32 c = 0; c < in_channels; ++c) {
+      frame[c] = pcm ? ptr_pcm[i * in_channels + c] / 32768.f :
+          ptr_float[i * in_channels + c];
+    }
+    float peak = 0;
+    for (int32 w = 0; w < work_channels_; ++w) {
+      const float sample =
+          DotProduct(&downmix_[w * in_channels], &frame[0], in_channels);
+      planar_[w][planar_frames_ + i] = sample;
+      peak = std::max(peak, static_cast<float>(fabs(sample)));
+    }
+    if (!downmix) {
+      continue;
+    }
+
+    // Limiter: attack instantly so that no mixed sample exceeds full scale,
+    // then release linearly back toward unity gain.
+    limiter_gain_ = std::min(1.0f, limiter_gain_ + limiter_release_);
+    if (peak * limiter_gain_ > 1.0f) {
+      limiter_gain_ = 1.0f / peak;
+    }
+    if (limiter_gain_ < 1.0f) {
+      for (int32 w = 0; w < work_channels_; ++w) {
+        planar_[w][planar_frames_ + i] *= limiter_gain_;
+      }
+    }
+  }
+  planar_frames_ += num_frames;
+}
+
+// Output sample positions are tracked in units of 1/|out_rate| input samples,
+// which makes the step between output samples exactly |in_rate| units.
+int32 AudioConverter::Resample() {
+  if (taps_ == 0) {
+    // No rate change: move the input straight to the output. |planar_offset_|
+    // is always 0 here because every frame is consumed on each call.
+    for (int32 c = 0; c < work_channels_; ++c) {
+      resampled_[c].swap(planar_[c]);
+      planar_[c].clear();
+    }
+    const int32 num_frames = planar_frames_;
+    planar_frames_ = 0;
+    return num_frames;
+  }
+  const int64 in_rate = input_config_.sample_rate;
+  const int64 out_rate = output_config_.sample_rate;
+  int32 output_frames = 0;
+  for (int32 c = 0; c < work_channels_; ++c) {
+    resampled_[c].clear();
+  }
+  const int64 available = planar_frames_ - planar_offset_;
+  for (;;) {
+    const int64 index = position_ / out_rate;
+    if (index + taps_ > available) {
+      break;
+    }
+
+    // Blend the two phases around the exact position. The filter bank has
+    // |kNumPhases| + 1 rows, so |phase| + 1 is always valid.
+    const int64 scaled_fraction = (position_ % out_rate) * kNumPhases;
+    const int64 phase = scaled_fraction / out_rate;
+    const float weight =
+        static_cast<float>(scaled_fraction % out_rate) / out_rate;
+    const float* const ptr_lower = &filter_bank_[phase * taps_];
+    const float* const ptr_upper = ptr_lower + taps_;
+    for (int32 k = 0; k < taps_; ++k) {
+      phase_filter_[k] = ptr_lower[k] + weight * (ptr_upper[k] - ptr_lower[k]);
+    }
+    for (int32 c = 0; c < work_channels_; ++c) {
+      resampled_[c].push_back(
+          DotProduct(&planar_[c][planar_offset_ + index], &phase_filter_[0],
+                     taps_));
+    }
+    ++output_frames;
+    position_ += in_rate;
+  }
+
+  // Mark input that no future output sample will reference as consumed.
+  // |Deinterleave()| reclaims the space.
+  const int32 consumed =
+      static_cast<int32>(std::min<int64>(position_ / out_rate, available));
+  planar_offset_ += consumed;
+  position_ -= consumed * out_rate;
+  return output_frames;
+}
+
+void AudioConverter::Interleave(int32 num_frames) {
+  const int32 out_channels = output_config_.channels;
+  interleaved_.assign(num_frames * out_channels, 0.0f);
+  for (int32 i = 0; i < num_frames; ++i) {
+    float* const ptr_frame = &interleaved_[i * out_channels];
+    if (work_channels_ == 1 && out_channels > 1) {
+      // Mono goes to both front channels.
+      ptr_frame[kFrontLeft] = resampled_[0][i];
+      ptr_frame[kFrontRight] = resampled_[0][i];
+    } else {
+      for (int32 c = 0; c < work_channels_; ++c) {
+        ptr_frame[c] = resampled_[c][i];
+      }
+    }
+  }
+}
+
+void AudioConverter::InitDownmix() {
+  const int32 in_channels = input_config_.channels;
+  downmix_.assign(work_channels_ * in_channels, 0.0f);
+  if (work_channels_ <= 2 && in_channels > work_channels_) {
+    std::vector<float> stereo(2 * in_channels, 0.0f);
+    float* const left = &stereo[0];
+    float* const right = &stereo[in_channels];
+    left[kFrontLeft] = 1.0f;
+    right[kFrontRight] = 1.0f;
+    if (in_channels > kFrontCenter) {
+      left[kFrontCenter] = kMinus3dB;
+      right[kFrontCenter] = kMinus3dB;
+    }
+    if (in_channels > kBackRight) {
+      left[kBackLeft] = kMinus3dB;
+      right[kBackRight] = kMinus3dB;
+    }
+    if (in_channels > kSideRight) {
+      left[kSideLeft] = kMinus3dB;
+      right[kSideRight] = kMinus3dB;
+    }
+    if (work_channels_ == 2) {
+      downmix_.swap(stereo);
+    } else {
+      // Mono is the stereo downmix summed at -6 dB.
+      for (int32 c = 0; c < in_channels; ++c) {
+        downmix_[c] = 0.5f * (left[c] + right[c]);
+      }
+    }
+  } else {
+    // Same channel count, or a reduction not covered above: keep the first
+    // |work_channels_| channels.
+    for (int32 w = 0; w < work_channels_; ++w) {
+      downmix_[w * in_channels + w] = 1.0f;
+    }
+  }
+}
+
+// Phase |p| of the filter bank interpolates the input at fractional offset
+// p / |kNumPhases| past tap |taps_| / 2 - 1.
+void AudioConverter::InitFilterBank() {
+  filter_bank_.assign((kNumPhases + 1) * taps_, 0.0f);
+  const double in_rate = input_config_.sample_rate;
+  const double out_rate = output_config_.sample_rate;
+  const double rolloff = quality_ == kResamplerQualityHigh ? 0.95 : 0.9;
+  const double cutoff = std::min(1.0, out_rate / in_rate) * rolloff;
+  const double half_taps = taps_ / 2;
+  for (int p = 0; p <= kNumPhases; ++p) {
+    const double fraction = static_cast<double>(p) / kNumPhases;
+    float* const ptr_phase = &filter_bank_[p * taps_];
+    double sum = 0;
+    for (int k = 0; k < taps_; ++k) {
+      const double t = k - (half_taps - 1) - fraction;
+      double coefficient = 0;
+      if (quality_ == kResamplerQualityLinear) {
+        coefficient = std::max(0.0, 1.0 - fabs(t));
+      } else {
+        coefficient = cutoff * Sinc(cutoff * t) * BlackmanWindow(t / half_taps);
+      }
+      ptr_phase[k] = static_cast<float>(coefficient);
+      sum += coefficient;
+    }
+    if (sum != 0) {
+      for (int k = 0; k < taps_; ++k) {
+        ptr_phase[k] = static_cast<float>(ptr_phase[k] / sum);
+      }
+    }
+  }
+}
+
+}  // namespace webmlive
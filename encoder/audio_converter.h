@@ -0,0 +1,170 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AUDIO_CONVERTER_H_
+#define WEBMLIVE_ENCODER_AUDIO_CONVERTER_H_
+
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+enum ResamplerQuality {
+  // Two tap linear interpolation. Cheapest, but aliases when downsampling.
+  kResamplerQualityLinear = 0,
+
+  // 16 tap windowed sinc polyphase filter.
+  kResamplerQualityMedium = 1,
+
+  // 32 tap windowed sinc polyphase filter.
+  kResamplerQualityHigh = 2,
+};
+
+// Audio conversion control structure. Values set to 0 mean keep the capture
+// setting.
+struct AudioConverterConfig {
+  AudioConverterConfig()
+      : sample_rate(0),
+        channels(0),
+        quality(kResamplerQualityMedium) {}
+
+  // Output sample rate.
+  uint32 sample_rate;
+
+  // Output channel count.
+  uint16 channels;
+
+  // Resampling filter preset.
+  ResamplerQuality quality;
+};
+
+// Converts uncompressed capture audio to the sample rate and channel count
+// expected by the audio encoder. Output is always interleaved 32 bit IEEE
+// float.
+//
+// Notes:
+// - Downmixing happens before resampling, and upmixing after, so the filter
+//   always runs on the smaller channel count.
+// - Channels are assumed to be in WAVE order: FL, FR, FC, LFE, BL, BR, SL, SR.
+//   Downmix to stereo uses the ITU-R BS.775 coefficients: fronts at unity,
+//   center and surrounds folded in at -3 dB, LFE discarded. Downmix to mono
+//   sums the stereo downmix at -6 dB. The matrix is not normalized; instead
+//   a peak limiter lowers the gain only when a mixed sample would clip, and
+//   releases it back to unity over |kLimiterReleaseMs|.
+// - Resampling uses a fixed set of |kNumPhases| filter phases; the filter for
+//   each output sample is linearly interpolated between the two phases
+//   around its exact position, which is tracked without drift.
+// - The inner filter loop uses SSE when available.
+class AudioConverter {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+
+    // |Convert()| consumed the input but has no output yet.
+    kNoSamples = 1,
+  };
+
+  // Number of filter phases per input sample interval.
+  static const int kNumPhases = 128;
+
+  // Time the downmix limiter takes to return from full attenuation to unity
+  // gain.
+  static const int kLimiterReleaseMs = 500;
+
+  AudioConverter();
+  ~AudioConverter();
+
+  // Returns true when |input_config| differs from the output described by
+  // |converter_config| and a conversion stage is required.
+  static bool ConversionRequired(const AudioConfig& input_config,
+                                 const AudioConverterConfig& converter_config);
+
+  // Prepares filters and mixing for conversion of audio described by
+  // |input_config|. Returns |kSuccess| when successful. Returns |kInvalidArg|
+  // when the input is not 16 bit PCM or 32 bit float, or when the
+  // configuration is invalid.
+  int Init(const AudioConfig& input_config,
+           const AudioConverterConfig& converter_config);
+
+  // Converts |input_buffer| and stores the result in |ptr_output_buffer|.
+  // Returns |kNoSamples| when the filter needs more input before producing
+  // output.
+  int Convert(const AudioBuffer& input_buffer, AudioBuffer* ptr_output_buffer);
+
+  // Returns the number of input frames needed to produce about |num_frames| of
+  // output.
+  int32 InputFramesFor(int32 num_frames) const;
+
+  // Accessors.
+  const AudioConfig& output_config() const { return output_config_; }
+
+ private:
+  // Deinterleaves |num_frames| of |ptr_data| into |planar_|, applying
+  // |downmix_| and the clipping limiter. Compacts |planar_| first when more
+  // than half of it has been consumed.
+  void Deinterleave(const uint8* ptr_data, int32 num_frames);
+
+  // Resamples |planar_| into |resampled_|. Returns the number of output
+  // frames produced.
+  int32 Resample();
+
+  // Interleaves |num_frames| of |resampled_| into |interleaved_|, upmixing to
+  // the output channel count.
+  void Interleave(int32 num_frames);
+
+  // Builds the downmix matrix and filter bank.
+  void InitDownmix();
+  void InitFilterBank();
+
+  AudioConfig input_config_;
+  AudioConfig output_config_;
+  ResamplerQuality quality_;
+  int32 work_channels_;
+  int32 taps_;
+
+  // Downmix coefficients, |work_channels_| rows of input channel count
+  // columns.
+  std::vector<float> downmix_;
+
+  // |kNumPhases| + 1 rows of |taps_| coefficients.
+  std::vector<float> filter_bank_;
+
+  // Planar working storage: filter history followed by new input. Frames
+  // before |planar_offset_| have been consumed and are discarded lazily.
+  std::vector<std::vector<float> > planar_;
+  int32 planar_frames_;
+  int32 planar_offset_;
+
+  // Filter for the current output sample, interpolated from two adjacent
+  // phases of |filter_bank_|.
+  std::vector<float> phase_filter_;
+
+  // Downmix limiter gain, and the amount it recovers per input frame.
+  float limiter_gain_;
+  float limiter_release_;
+
+  // Planar resampler output and interleaved converter output.
+  std::vector<std::vector<float> > resampled_;
+  std::vector<float> interleaved_;
+
+  // Position of the next output sample relative to |planar_offset_|,
+  // in units of 1/|output_config_.sample_rate| input samples.
+  int64 position_;
+
+  int64 first_input_timestamp_;
+  int64 frames_output_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioConverter);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AUDIO_CONVERTER_H_
@@ -0,0 +1,155 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/audio_converter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+AudioConfig FloatConfig(uint16 channels, uint32 sample_rate) {
+  AudioConfig config;
+  config.format_tag = kAudioFormatIeeeFloat;
+  config.bits_per_sample = 32;
+  config.channels = channels;
+  config.sample_rate = sample_rate;
+  return config;
+}
+
+// Converts |num_blocks| blocks of 10 milliseconds of a 1 kHz sine at
+// |amplitude| on input channel |channel|, all other channels silent. Returns
+// the peak level of each output channel, and the output frame count in
+// |ptr_frames|.
+std::vector<float> ConvertSine(AudioConverter* ptr_converter,
+                               const AudioConfig& config,
+                               int channel,
+                               float amplitude,
+                               int num_blocks,
+                               int64* ptr_frames) {
+  const int out_channels = ptr_converter->output_config().channels;
+  std::vector<float> peaks(out_channels, 0.0f);
+  const int32 block_frames = config.sample_rate / 100;
+  int64 frame = 0;
+  *ptr_frames = 0;
+  for (int block = 0; block < num_blocks; ++block) {
+    std::vector<float> input(block_frames * config.channels, 0.0f);
+    for (int32 i = 0; i < block_frames; ++i, ++frame) {
+      input[i * config.channels + channel] = static_cast<float>(
+          amplitude * sin(2 * kPi * 1000 * frame / config.sample_rate));
+    }
+    AudioBuffer input_buffer;
+    EXPECT_EQ(AudioBuffer::kSuccess,
+              input_buffer.Init(config, block * 10, 10,
+                                reinterpret_cast<const uint8*>(&input[0]),
+                                static_cast<int32>(input.size() *
+                                                   sizeof(input[0]))));
+    AudioBuffer output_buffer;
+    const int status = ptr_converter->Convert(input_buffer, &output_buffer);
+    if (status == AudioConverter::kNoSamples) {
+      continue;
+    }
+    EXPECT_EQ(AudioConverter::kSuccess, status);
+    const float* const ptr_output =
+        reinterpret_cast<const float*>(output_buffer.buffer());
+    const int32 output_frames =
+        output_buffer.buffer_length() / (out_channels * sizeof(*ptr_output));
+    for (int32 i = 0; i < output_frames; ++i) {
+      for (int c = 0; c < out_channels; ++c) {
+        peaks[c] = std::max(peaks[c],
+                            static_cast<float>(fabs(
+                                ptr_output[i * out_channels + c])));
+      }
+    }
+    *ptr_frames += output_frames;
+  }
+  return peaks;
+}
+
+TEST(AudioConverterTest, RejectsUnsupportedInput) {
+  AudioConfig config;
+  config.bits_per_sample = 8;
+  AudioConverter converter;
+  EXPECT_EQ(AudioConverter::kInvalidArg,
+            converter.Init(config, AudioConverterConfig()));
+}
+
+// Fronts pass through a 7.1 to stereo downmix at unity gain, and center at
+// -3 dB on both sides.
+TEST(AudioConverterTest, DownmixLevels) {
+  const AudioConfig config = FloatConfig(8, 48000);
+  AudioConverterConfig converter_config;
+  converter_config.channels = 2;
+  int64 frames = 0;
+
+  AudioConverter front;
+  ASSERT_EQ(AudioConverter::kSuccess, front.Init(config, converter_config));
+  std::vector<float> peaks = ConvertSine(&front, config, 0, 0.5f, 10,
+                                         &frames);
+  EXPECT_NEAR(0.5f, peaks[0], 0.01f);
+  EXPECT_NEAR(0.0f, peaks[1], 0.01f);
+
+  AudioConverter center;
+  ASSERT_EQ(AudioConverter::kSuccess, center.Init(config, converter_config));
+  peaks = ConvertSine(&center, config, 2, 0.5f, 10, &frames);
+  EXPECT_NEAR(0.354f, peaks[0], 0.01f);
+  EXPECT_NEAR(0.354f, peaks[1], 0.01f);
+}
+
+// Full scale on every channel does not clip after the downmix.
+TEST(AudioConverterTest, DownmixDoesNotClip) {
+  const AudioConfig config = FloatConfig(6, 48000);
+  AudioConverterConfig converter_config;
+  converter_config.channels = 2;
+  AudioConverter converter;
+  ASSERT_EQ(AudioConverter::kSuccess,
+            converter.Init(config, converter_config));
+  std::vector<float> input(480 * 6, 1.0f);
+  AudioBuffer input_buffer;
+  ASSERT_EQ(AudioBuffer::kSuccess,
+            input_buffer.Init(config, 0, 10,
+                              reinterpret_cast<const uint8*>(&input[0]),
+                              static_cast<int32>(input.size() *
+                                                 sizeof(input[0]))));
+  AudioBuffer output_buffer;
+  ASSERT_EQ(AudioConverter::kSuccess,
+            converter.Convert(input_buffer, &output_buffer));
+  const float* const ptr_output =
+      reinterpret_cast<const float*>(output_buffer.buffer());
+  const int32 num_samples = output_buffer.buffer_length() / sizeof(*ptr_output);
+  for (int32 i = 0; i < num_samples; ++i) {
+    ASSERT_LE(fabs(ptr_output[i]), 1.0f);
+  }
+}
+
+// Resampling keeps the level of an in band tone, and produces the expected
+// number of frames over many calls.
+TEST(AudioConverterTest, Resample) {
+  const AudioConfig config = FloatConfig(1, 48000);
+  AudioConverterConfig converter_config;
+  converter_config.sample_rate = 44100;
+  AudioConverter converter;
+  ASSERT_EQ(AudioConverter::kSuccess,
+            converter.Init(config, converter_config));
+  int64 frames = 0;
+  const std::vector<float> peaks =
+      ConvertSine(&converter, config, 0, 0.5f, 100, &frames);
+  EXPECT_NEAR(0.5f, peaks[0], 0.01f);
+
+  // One second of input; the filter holds back less than its length.
+  EXPECT_LE(frames, 44100);
+  EXPECT_GE(frames, 44100 - 32);
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -9,6 +9,8 @@
 
 #include <new>
 
+#include "encoder/opus_encoder.h"
+#include "encoder/vorbis_encoder.h"
 #include "glog/logging.h"
 
 namespace webmlive {
@@ -77,7 +79,7 @@ void AudioBuffer::Swap(AudioBuffer* ptr_buffer) {
 
   temp_time = timestamp_;
   timestamp_ = ptr_buffer->timestamp_;
-  ptr_buffer->duration_ = temp_time;
+  ptr_buffer->timestamp_ = temp_time;
 
   int32 temp_size = buffer_length_;
   buffer_length_ = ptr_buffer->buffer_length_;
@@ -90,4 +92,84 @@ void AudioBuffer::Swap(AudioBuffer* ptr_buffer) {
   buffer_.swap(ptr_buffer->buffer_);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// AudioEncoder
+//
+
+AudioEncoder::AudioEncoder() : codec_(kAudioFormatVorbis) {
+}
+
+AudioEncoder::~AudioEncoder() {
+}
+
+int AudioEncoder::Init(AudioFormat codec,
+                       const AudioConfig& audio_config,
+                       const OpusConfig& opus_config,
+                       const VorbisConfig& vorbis_config) {
+  codec_ = codec;
+  if (codec_ == kAudioFormatOpus) {
+    ptr_opus_encoder_.reset(new (std::nothrow) OpusAudioEncoder());  // NOLINT
+    if (!ptr_opus_encoder_) {
+      return kNoMemory;
+    }
+    return ptr_opus_encoder_->Init(audio_config, opus_config);
+  } else if (codec_ == kAudioFormatVorbis) {
+    ptr_vorbis_encoder_.reset(new (std::nothrow) VorbisEncoder());  // NOLINT
+    if (!ptr_vorbis_encoder_) {
+      return kNoMemory;
+    }
+    return ptr_vorbis_encoder_->Init(audio_config, vorbis_config);
+  }
+  LOG(ERROR) << "unsupported audio codec: " << codec_;
+  return kUnsupportedFormat;
+}
+
+int AudioEncoder::Encode(const AudioBuffer& uncompressed_buffer) {
+  if (ptr_opus_encoder_) {
+    return ptr_opus_encoder_->Encode(uncompressed_buffer);
+  } else if (ptr_vorbis_encoder_) {
+    return ptr_vorbis_encoder_->Encode(uncompressed_buffer);
+  }
+  LOG(ERROR) << "AudioEncoder has NULL encoder, not Init'd";
+  return kEncoderError;
+}
+
+int AudioEncoder::ReadCompressedAudio(AudioBuffer* ptr_buffer) {
+  if (ptr_opus_encoder_) {
+    return ptr_opus_encoder_->ReadCompressedAudio(ptr_buffer);
+  } else if (ptr_vorbis_encoder_) {
+    return ptr_vorbis_encoder_->ReadCompressedAudio(ptr_buffer);
+  }
+  LOG(ERROR) << "AudioEncoder has NULL encoder, not Init'd";
+  return kEncoderError;
+}
+
+int64 AudioEncoder::audio_delay() const {
+  if (ptr_opus_encoder_) {
+    return ptr_opus_encoder_->audio_delay();
+  }
+  return ptr_vorbis_encoder_ ? ptr_vorbis_encoder_->audio_delay() : 0;
+}
+
+int64 AudioEncoder::last_timestamp() const {
+  if (ptr_opus_encoder_) {
+    return ptr_opus_encoder_->last_timestamp();
+  }
+  return ptr_vorbis_encoder_ ? ptr_vorbis_encoder_->last_timestamp() : 0;
+}
+
+int64 AudioEncoder::time_encoded() const {
+  if (ptr_opus_encoder_) {
+    return ptr_opus_encoder_->time_encoded();
+  }
+  return ptr_vorbis_encoder_ ? ptr_vorbis_encoder_->time_encoded() : 0;
+}
+
+int32 AudioEncoder::preferred_block_size() const {
+  if (ptr_opus_encoder_) {
+    return ptr_opus_encoder_->frame_size();
+  }
+  return VorbisEncoder::kPreferredBlockSize;
+}
+
 }  // namespace webmlive
@@ -19,6 +19,7 @@ enum AudioFormat {
   kAudioFormatPcm = 1,
   kAudioFormatVorbis = 2,
   kAudioFormatIeeeFloat = 3,
+  kAudioFormatOpus = 4,
 };
 
 // Audio configuration control structure. Values set to 0 mean use default.
@@ -149,6 +150,95 @@ struct VorbisConfig {
   double lowpass_frequency;
 };
 
+struct OpusConfig {
+  // Special value that means use the default value for the current option.
+  static const int kUseDefault = -200;
+  OpusConfig()
+      : bitrate(64),
+        frame_duration(20.0),
+        complexity(kUseDefault) {}
+
+  // Average bitrate in kilobits.
+  int bitrate;
+
+  // Duration of each Opus frame in milliseconds. Valid values are 2.5, 5, 10,
+  // 20, 40, and 60. Shorter frames reduce latency at the cost of compression
+  // efficiency.
+  double frame_duration;
+
+  // Encoder complexity. Valid range is 0 to 10.
+  int complexity;
+};
+
+// Forward declarations of the codec specific audio encoders wrapped by
+// |AudioEncoder|.
+class OpusAudioEncoder;
+class VorbisEncoder;
+
+// Audio encoder that hides the codec specific encoder selected by |codec|
+// from |WebmEncoder|.
+class AudioEncoder {
+ public:
+  enum {
+    // The codec library returned an error.
+    kCodecError = -202,
+
+    // Internal error within the codec specific encoder.
+    kEncoderError = -201,
+
+    // Input audio or encoder configuration is not supported.
+    kUnsupportedFormat = -200,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+
+    // |ReadCompressedAudio()| has no samples available.
+    kNoSamples = 1,
+  };
+
+  AudioEncoder();
+  ~AudioEncoder();
+
+  // Constructs and initializes the encoder for |codec|, which must be
+  // |kAudioFormatOpus| or |kAudioFormatVorbis|. |audio_config| describes the
+  // uncompressed input. Only the settings of the selected codec are used.
+  // Returns |kSuccess| when successful.
+  int Init(AudioFormat codec,
+           const AudioConfig& audio_config,
+           const OpusConfig& opus_config,
+           const VorbisConfig& vorbis_config);
+
+  // Passes |uncompressed_buffer| to the codec. Returns |kSuccess| after
+  // successful handoff of samples to the encoder.
+  int Encode(const AudioBuffer& uncompressed_buffer);
+
+  // Returns compressed audio via |ptr_buffer|. Returns |kNoSamples| when the
+  // encoder has no data ready.
+  int ReadCompressedAudio(AudioBuffer* ptr_buffer);
+
+  // Accessors.
+  AudioFormat codec() const { return codec_; }
+  const OpusAudioEncoder* opus_encoder() const {
+    return ptr_opus_encoder_.get();
+  }
+  const VorbisEncoder* vorbis_encoder() const {
+    return ptr_vorbis_encoder_.get();
+  }
+  int64 audio_delay() const;
+  int64 last_timestamp() const;
+  int64 time_encoded() const;
+
+  // Returns the number of uncompressed sample frames the codec prefers to
+  // receive per |Encode()| call.
+  int32 preferred_block_size() const;
+
+ private:
+  AudioFormat codec_;
+  std::unique_ptr<OpusAudioEncoder> ptr_opus_encoder_;
+  std::unique_ptr<VorbisEncoder> ptr_vorbis_encoder_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioEncoder);
+};
+
 }  // namespace webmlive
 
 #endif  // WEBMLIVE_ENCODER_AUDIO_ENCODER_H_
@@ -0,0 +1,234 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/audio_queue.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+AudioQueue::AudioQueue()
+    : bytes_per_frame_(0),
+      capacity_frames_(0),
+      read_frame_(0),
+      num_frames_(0),
+      head_frame_(0),
+      tail_frame_(0),
+      dropped_frames_(0) {
+}
+
+AudioQueue::~AudioQueue() {
+}
+
+int AudioQueue::Init(const AudioConfig& config,
+                     int capacity_milliseconds,
+                     int32 block_frames) {
+  const int32 bytes_per_frame = config.channels * config.bits_per_sample / 8;
+  if (bytes_per_frame <= 0 || config.sample_rate == 0) {
+    LOG(ERROR) << "AudioQueue cannot Init with invalid audio format.";
+    return kInvalidArg;
+  }
+  const int64 capacity_frames =
+      static_cast<int64>(config.sample_rate) * capacity_milliseconds / 1000;
+  if (block_frames < 1 || capacity_frames < block_frames) {
+    LOG(ERROR) << "AudioQueue capacity of " << capacity_milliseconds
+               << " ms cannot hold blocks of " << block_frames << " frames.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_frames_ = static_cast<int32>(capacity_frames);
+  bytes_per_frame_ = bytes_per_frame;
+  config_ = config;
+  config_.block_align = static_cast<uint16>(bytes_per_frame);
+  ring_.resize(capacity_frames_ * bytes_per_frame_);
+  read_frame_ = 0;
+  num_frames_ = 0;
+  head_frame_ = 0;
+  tail_frame_ = 0;
+  anchors_.clear();
+  dropped_frames_ = 0;
+  LOG(INFO) << "AudioQueue capacity_frames_=" << capacity_frames_;
+  return kSuccess;
+}
+
+int AudioQueue::Write(const AudioBuffer& buffer) {
+  if (!buffer.buffer() || buffer.buffer_length() <= 0) {
+    LOG(ERROR) << "AudioQueue cannot Write empty buffer.";
+    return kInvalidArg;
+  }
+  if (bytes_per_frame_ == 0) {
+    LOG(ERROR) << "AudioQueue cannot Write before Init.";
+    return kInvalidArg;
+  }
+  if (buffer.buffer_length() % bytes_per_frame_ != 0) {
+    LOG(ERROR) << "AudioQueue cannot Write partial sample frames.";
+    return kInvalidArg;
+  }
+  const int32 frames_to_write = buffer.buffer_length() / bytes_per_frame_;
+  if (frames_to_write > capacity_frames_) {
+    LOG(ERROR) << "AudioQueue cannot Write " << frames_to_write
+               << " frames, capacity is " << capacity_frames_ << " frames.";
+    return kBufferTooLarge;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int32 free_frames = capacity_frames_ - num_frames_;
+  if (frames_to_write > free_frames) {
+    const int32 overflow_frames = frames_to_write - free_frames;
+    DropFrames(overflow_frames);
+    dropped_frames_ += overflow_frames;
+    LOG(WARNING) << "AudioQueue full, dropped " << overflow_frames
+                 << " frames (total=" << dropped_frames_ << ").";
+  }
+
+  // Time the new samples from the capture timestamp when the queue is empty,
+  // or when the derived time is too far off.
+  const int64 timestamp = buffer.timestamp();
+  if (num_frames_ == 0) {
+    anchors_.clear();
+  }
+  if (anchors_.empty()) {
+    const Anchor anchor = {tail_frame_, timestamp};
+    anchors_.push_back(anchor);
+  } else {
+    const int64 derived_timestamp = FrameTimestamp(tail_frame_);
+    const int64 error = timestamp - derived_timestamp;
+    if (error > kResyncThreshold || error < -kResyncThreshold) {
+      LOG(INFO) << "AudioQueue resynced to capture time, off by " << error
+                << " ms.";
+      const Anchor anchor = {tail_frame_, timestamp};
+      anchors_.push_back(anchor);
+    }
+  }
+
+  // Copy in up to two pieces: to the end of |ring_|, then from its start.
+  const uint8* const ptr_data = buffer.buffer();
+  const int32 write_frame = (read_frame_ + num_frames_) % capacity_frames_;
+  const int32 first_frames =
+      std::min(frames_to_write, capacity_frames_ - write_frame);
+  memcpy(&ring_[write_frame * bytes_per_frame_], ptr_data,
+         first_frames * bytes_per_frame_);
+  if (first_frames < frames_to_write) {
+    memcpy(&ring_[0], ptr_data + first_frames * bytes_per_frame_,
+           (frames_to_write - first_frames) * bytes_per_frame_);
+  }
+  num_frames_ += frames_to_write;
+  tail_frame_ += frames_to_write;
+  return kSuccess;
+}
+
+int AudioQueue::Read(int32 num_frames, AudioBuffer* ptr_buffer) {
+  if (!ptr_buffer || num_frames <= 0) {
+    LOG(ERROR) << "AudioQueue cannot Read with NULL buffer or no frames.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (num_frames > num_frames_) {
+    return kEmpty;
+  }
+  return ReadFrames(num_frames, num_frames, ptr_buffer);
+}
+
+int AudioQueue::ReadPadded(int32 num_frames, AudioBuffer* ptr_buffer) {
+  if (!ptr_buffer || num_frames <= 0) {
+    LOG(ERROR) << "AudioQueue cannot Read with NULL buffer or no frames.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (num_frames_ == 0) {
+    return kEmpty;
+  }
+  return ReadFrames(std::min(num_frames, num_frames_), num_frames, ptr_buffer);
+}
+
+int AudioQueue::HeadTimestamp(int64* ptr_timestamp) {
+  if (!ptr_timestamp) {
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (num_frames_ == 0) {
+    return kEmpty;
+  }
+  *ptr_timestamp = FrameTimestamp(head_frame_);
+  return kSuccess;
+}
+
+bool AudioQueue::IsEmpty() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_frames_ == 0;
+}
+
+int64 AudioQueue::dropped_frames() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_frames_;
+}
+
+int AudioQueue::ReadFrames(int32 num_frames,
+                           int32 out_frames,
+                           AudioBuffer* ptr_buffer) {
+  const int32 read_length = num_frames * bytes_per_frame_;
+  const int32 out_length = out_frames * bytes_per_frame_;
+  const int32 first_frames =
+      std::min(num_frames, capacity_frames_ - read_frame_);
+  const uint8* ptr_data = &ring_[read_frame_ * bytes_per_frame_];
+  if (first_frames < num_frames || out_frames > num_frames) {
+    // The frames wrap around the end of |ring_|, or are padded; stage them
+    // contiguously. Unsigned 8 bit PCM is silent at 0x80, all other formats
+    // at 0.
+    read_buffer_.resize(out_length);
+    const int32 first_length = first_frames * bytes_per_frame_;
+    memcpy(&read_buffer_[0], ptr_data, first_length);
+    memcpy(&read_buffer_[first_length], &ring_[0],
+           read_length - first_length);
+    const uint8 silence = config_.bits_per_sample == 8 ? 0x80 : 0;
+    memset(&read_buffer_[read_length], silence, out_length - read_length);
+    ptr_data = &read_buffer_[0];
+  }
+
+  // Durations are derived from the same anchor as the timestamp, so that a
+  // block spanning a resync keeps its length.
+  const int64 timestamp = FrameTimestamp(head_frame_);
+  const int64 duration = FramesToMilliseconds(head_frame_ + out_frames) -
+      FramesToMilliseconds(head_frame_);
+  const int status =
+      ptr_buffer->Init(config_, timestamp, duration, ptr_data, out_length);
+  if (status) {
+    LOG(ERROR) << "AudioBuffer Init failed: " << status;
+    return kNoMemory;
+  }
+  DropFrames(num_frames);
+  return kSuccess;
+}
+
+int64 AudioQueue::FramesToMilliseconds(int64 num_frames) const {
+  return num_frames * 1000 / config_.sample_rate;
+}
+
+int64 AudioQueue::FrameTimestamp(int64 frame) const {
+  std::deque<Anchor>::const_reverse_iterator anchor = anchors_.rbegin();
+  while (anchor + 1 != anchors_.rend() && anchor->frame > frame) {
+    ++anchor;
+  }
+  return anchor->timestamp +
+      FramesToMilliseconds(frame) - FramesToMilliseconds(anchor->frame);
+}
+
+void AudioQueue::DropFrames(int32 num_frames) {
+  num_frames = std::min(num_frames, num_frames_);
+  read_frame_ = (read_frame_ + num_frames) % capacity_frames_;
+  num_frames_ -= num_frames;
+  head_frame_ += num_frames;
+
+  // Anchors superseded by a later anchor at or before the head are done.
+  while (anchors_.size() > 1 && anchors_[1].frame <= head_frame_) {
+    anchors_.pop_front();
+  }
+}
+
+}  // namespace webmlive
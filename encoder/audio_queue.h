@@ -0,0 +1,148 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AUDIO_QUEUE_H_
+#define WEBMLIVE_ENCODER_AUDIO_QUEUE_H_
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+// Fixed capacity ring of interleaved uncompressed audio used to pass samples
+// from the capture thread to the encoder thread. Capture buffers of any size
+// are appended with |Write()|, and the encoder reads blocks of the size it
+// prefers with |Read()|.
+//
+// Notes:
+// - Memory use never exceeds the capacity passed to |Init()|. When a write
+//   would overflow the ring the oldest samples are dropped, the timestamp of
+//   the queue head is advanced to match, and the drop is counted in
+//   |dropped_frames()|.
+// - Output timestamps are derived from the sample count, so that small
+//   capture jitter does not reach the encoder. When the timestamp of a
+//   capture buffer differs from the time derived for it by more than
+//   |kResyncThreshold| milliseconds (a capture gap, or accumulated clock
+//   drift), the samples from that buffer on are timed from its timestamp.
+// - All public methods are thread safe.
+class AudioQueue {
+ public:
+  enum {
+    // The buffer passed to |Write()| holds more samples than the ring.
+    kBufferTooLarge = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+
+    // Fewer samples than requested are queued.
+    kEmpty = 1,
+  };
+
+  // Largest difference, in milliseconds, between the timestamp of a capture
+  // buffer and the time derived from the sample count that is smoothed over.
+  static const int64 kResyncThreshold = 40;
+
+  AudioQueue();
+  ~AudioQueue();
+
+  // Allocates storage for |capacity_milliseconds| of audio in the format
+  // described by |config|, and returns |kSuccess|. |block_frames| is the
+  // largest number of sample frames the reader passes to |Read()|. Returns
+  // |kInvalidArg| when |config| describes a format with no sample size or
+  // rate, or when the ring cannot hold |block_frames|.
+  int Init(const AudioConfig& config,
+           int capacity_milliseconds,
+           int32 block_frames);
+
+  // Appends the samples in |buffer| to the ring. Returns |kSuccess| when the
+  // samples are queued, including when older samples had to be dropped to make
+  // room for them. Returns |kInvalidArg| when |buffer| is empty or its length
+  // is not a whole number of sample frames, and |kBufferTooLarge| when
+  // |buffer| alone holds more samples than the ring; no samples are queued in
+  // either case.
+  int Write(const AudioBuffer& buffer);
+
+  // Removes |num_frames| sample frames from the ring and stores them in
+  // |ptr_buffer|. Returns |kEmpty| when fewer than |num_frames| are queued.
+  // |ptr_buffer| storage is reused when large enough.
+  int Read(int32 num_frames, AudioBuffer* ptr_buffer);
+
+  // Same as |Read()|, but when fewer than |num_frames| are queued removes the
+  // frames queued, and pads them with silence to |num_frames|. Used to flush
+  // the last partial block when stopping. Returns |kEmpty| only when no
+  // frames are queued.
+  int ReadPadded(int32 num_frames, AudioBuffer* ptr_buffer);
+
+  // Writes the timestamp of the first queued sample to |ptr_timestamp| and
+  // returns |kSuccess|. Returns |kEmpty| when the queue is empty.
+  int HeadTimestamp(int64* ptr_timestamp);
+
+  // Returns true when no samples are queued.
+  bool IsEmpty();
+
+  // Returns the number of sample frames dropped because the ring was full.
+  int64 dropped_frames();
+
+  // Returns the number of sample frames the ring can hold.
+  int32 capacity_frames() const { return capacity_frames_; }
+
+ private:
+  // Capture timestamp of the frame numbered |frame|. Frames are numbered in
+  // the order they are written, from 0.
+  struct Anchor {
+    int64 frame;
+    int64 timestamp;
+  };
+
+  // Removes |num_frames| from the ring, padded with silence to |out_frames|,
+  // and stores them in |ptr_buffer|. |mutex_| must be held.
+  int ReadFrames(int32 num_frames, int32 out_frames, AudioBuffer* ptr_buffer);
+
+  // Converts |num_frames| to milliseconds.
+  int64 FramesToMilliseconds(int64 num_frames) const;
+
+  // Returns the timestamp of frame number |frame|, derived from the newest
+  // anchor at or before it. |mutex_| must be held, and |anchors_| must not be
+  // empty.
+  int64 FrameTimestamp(int64 frame) const;
+
+  // Drops |num_frames| from the head of the ring. |mutex_| must be held.
+  void DropFrames(int32 num_frames);
+
+  AudioConfig config_;
+  int32 bytes_per_frame_;
+  int32 capacity_frames_;
+
+  // Ring storage, and read position and fill level in frames.
+  std::vector<uint8> ring_;
+  int32 read_frame_;
+  int32 num_frames_;
+
+  // Number of the frame at |read_frame_|, and of the next frame written.
+  int64 head_frame_;
+  int64 tail_frame_;
+
+  // Timestamps of the queued frames, oldest first. The first anchor is at or
+  // before |head_frame_|.
+  std::deque<Anchor> anchors_;
+  int64 dropped_frames_;
+
+  // Staging storage used by |Read()| when the requested frames wrap around
+  // the end of |ring_|, or are padded.
+  std::vector<uint8> read_buffer_;
+  std::mutex mutex_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioQueue);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AUDIO_QUEUE_H_
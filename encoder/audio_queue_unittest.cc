@@ -0,0 +1,109 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/audio_queue.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+// Mono 16 bit audio at 1000 Hz, so that one frame lasts one millisecond.
+class AudioQueueTest : public ::testing::Test {
+ protected:
+  AudioQueueTest() {
+    config_.format_tag = kAudioFormatPcm;
+    config_.channels = 1;
+    config_.bits_per_sample = 16;
+    config_.sample_rate = 1000;
+  }
+
+  // Writes |num_frames| frames with value |value| captured at |timestamp|.
+  int Write(int64 timestamp, int32 num_frames, uint8 value) {
+    std::vector<uint8> data(num_frames * 2, value);
+    AudioBuffer buffer;
+    EXPECT_EQ(AudioBuffer::kSuccess,
+              buffer.Init(config_, timestamp, num_frames, &data[0],
+                          static_cast<int32>(data.size())));
+    return queue_.Write(buffer);
+  }
+
+  AudioConfig config_;
+  AudioQueue queue_;
+};
+
+TEST_F(AudioQueueTest, InitRejectsCapacityBelowOneBlock) {
+  EXPECT_EQ(AudioQueue::kInvalidArg, queue_.Init(config_, 10, 20));
+  EXPECT_EQ(AudioQueue::kInvalidArg, queue_.Init(config_, 100, 0));
+  EXPECT_EQ(AudioQueue::kSuccess, queue_.Init(config_, 100, 20));
+  EXPECT_EQ(100, queue_.capacity_frames());
+}
+
+TEST_F(AudioQueueTest, RejectsOversizedBuffer) {
+  ASSERT_EQ(AudioQueue::kSuccess, queue_.Init(config_, 100, 20));
+  EXPECT_EQ(AudioQueue::kBufferTooLarge, Write(0, 101, 1));
+  EXPECT_TRUE(queue_.IsEmpty());
+  EXPECT_EQ(0, queue_.dropped_frames());
+}
+
+// Small capture jitter is smoothed over; a jump past |kResyncThreshold|
+// re-anchors the output timestamps.
+TEST_F(AudioQueueTest, Timestamps) {
+  ASSERT_EQ(AudioQueue::kSuccess, queue_.Init(config_, 100, 20));
+  ASSERT_EQ(AudioQueue::kSuccess, Write(0, 30, 1));
+  ASSERT_EQ(AudioQueue::kSuccess, Write(35, 30, 1));
+  ASSERT_EQ(AudioQueue::kSuccess, Write(500, 30, 1));
+  const int64 kExpected[] = {0, 20, 40, 500};
+  AudioBuffer buffer;
+  for (size_t i = 0; i < sizeof(kExpected) / sizeof(kExpected[0]); ++i) {
+    ASSERT_EQ(AudioQueue::kSuccess, queue_.Read(20, &buffer));
+    EXPECT_EQ(kExpected[i], buffer.timestamp());
+    EXPECT_EQ(20, buffer.duration());
+    EXPECT_EQ(40, buffer.buffer_length());
+  }
+  EXPECT_EQ(AudioQueue::kEmpty, queue_.Read(20, &buffer));
+}
+
+// The last partial block is padded with silence.
+TEST_F(AudioQueueTest, ReadPadded) {
+  ASSERT_EQ(AudioQueue::kSuccess, queue_.Init(config_, 100, 20));
+  ASSERT_EQ(AudioQueue::kSuccess, Write(0, 30, 1));
+  AudioBuffer buffer;
+  ASSERT_EQ(AudioQueue::kSuccess, queue_.Read(20, &buffer));
+  EXPECT_EQ(AudioQueue::kEmpty, queue_.Read(20, &buffer));
+  ASSERT_EQ(AudioQueue::kSuccess, queue_.ReadPadded(20, &buffer));
+  EXPECT_EQ(20, buffer.timestamp());
+  ASSERT_EQ(40, buffer.buffer_length());
+  EXPECT_EQ(1, buffer.buffer()[19]);
+  EXPECT_EQ(0, buffer.buffer()[20]);
+  EXPECT_EQ(0, buffer.buffer()[39]);
+  EXPECT_EQ(AudioQueue::kEmpty, queue_.ReadPadded(20, &buffer));
+}
+
+// A full ring drops its oldest frames, and advances the head timestamp to
+// match.
+TEST_F(AudioQueueTest, DropsOldestWhenFull) {
+  ASSERT_EQ(AudioQueue::kSuccess, queue_.Init(config_, 50, 30));
+  ASSERT_EQ(AudioQueue::kSuccess, Write(0, 40, 1));
+  ASSERT_EQ(AudioQueue::kSuccess, Write(40, 30, 2));
+  EXPECT_EQ(20, queue_.dropped_frames());
+  int64 timestamp = -1;
+  ASSERT_EQ(AudioQueue::kSuccess, queue_.HeadTimestamp(&timestamp));
+  EXPECT_EQ(20, timestamp);
+
+  // Reads across the end of the ring.
+  AudioBuffer buffer;
+  ASSERT_EQ(AudioQueue::kSuccess, queue_.Read(30, &buffer));
+  EXPECT_EQ(20, buffer.timestamp());
+  EXPECT_EQ(1, buffer.buffer()[39]);
+  EXPECT_EQ(2, buffer.buffer()[40]);
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -0,0 +1,271 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/chunk_spill_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "glog/logging.h"
+
+namespace {
+
+// Numbers segment files across all spill files of the process.
+std::atomic<int> g_next_segment_number(0);
+
+int ProcessId() {
+#ifdef _WIN32
+  return static_cast<int>(GetCurrentProcessId());
+#else
+  return static_cast<int>(getpid());
+#endif
+}
+
+}  // namespace
+
+namespace webmlive {
+
+// Temporary file mapped read/write into memory. The file is deleted when it
+// is closed.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Creates |path| with a size of |size| bytes and maps it. Returns true when
+  // successful.
+  bool Open(const std::string& path, int32 size);
+
+  uint8* data() const { return ptr_data_; }
+  int32 size() const { return size_; }
+
+ private:
+  uint8* ptr_data_;
+  int32 size_;
+#ifdef _WIN32
+  HANDLE file_;
+  HANDLE mapping_;
+#endif
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+#ifdef _WIN32
+MappedFile::MappedFile()
+    : ptr_data_(NULL), size_(0), file_(INVALID_HANDLE_VALUE), mapping_(NULL) {
+}
+
+MappedFile::~MappedFile() {
+  if (ptr_data_) {
+    UnmapViewOfFile(ptr_data_);
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+  }
+  if (file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_);
+  }
+}
+
+bool MappedFile::Open(const std::string& path, int32 size) {
+  file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                      CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                      NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    LOG(ERROR) << "cannot create " << path << ": " << GetLastError();
+    return false;
+  }
+  mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE, 0, size, NULL);
+  if (!mapping_) {
+    LOG(ERROR) << "cannot map " << path << ": " << GetLastError();
+    return false;
+  }
+  ptr_data_ = reinterpret_cast<uint8*>(
+      MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size));
+  if (!ptr_data_) {
+    LOG(ERROR) << "cannot map view of " << path << ": " << GetLastError();
+    return false;
+  }
+  size_ = size;
+  return true;
+}
+#else
+MappedFile::MappedFile() : ptr_data_(NULL), size_(0) {
+}
+
+MappedFile::~MappedFile() {
+  if (ptr_data_) {
+    munmap(ptr_data_, size_);
+  }
+}
+
+// The file is unlinked as soon as it is mapped; the mapping keeps its data.
+bool MappedFile::Open(const std::string& path, int32 size) {
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    LOG(ERROR) << "cannot create " << path;
+    return false;
+  }
+  void* ptr_map = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    ptr_map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  unlink(path.c_str());
+  if (ptr_map == MAP_FAILED) {
+    LOG(ERROR) << "cannot map " << path;
+    return false;
+  }
+  ptr_data_ = reinterpret_cast<uint8*>(ptr_map);
+  size_ = size;
+  return true;
+}
+#endif  // _WIN32
+
+struct ChunkSpillFile::Segment {
+  Segment() : write_offset(0), num_entries(0) {}
+  MappedFile file;
+
+  // Offset at which the next chunk is appended.
+  int32 write_offset;
+
+  // Chunks in the segment not yet popped.
+  int num_entries;
+};
+
+ChunkSpillFile::ChunkSpillFile()
+    : segment_size_(kDefaultSegmentSize), stored_bytes_(0) {
+}
+
+ChunkSpillFile::~ChunkSpillFile() {
+}
+
+int ChunkSpillFile::Init(const std::string& directory, int32 segment_size) {
+  if (directory.empty() || segment_size <= 0) {
+    LOG(ERROR) << "invalid spill file settings.";
+    return kInvalidArg;
+  }
+  directory_ = directory;
+  segment_size_ = segment_size;
+  return kSuccess;
+}
+
+int ChunkSpillFile::Append(const ChunkInfo& info,
+                           const uint8* ptr_data,
+                           int32 data_length) {
+  if (!ptr_data || data_length <= 0) {
+    LOG(ERROR) << "ChunkSpillFile cannot Append empty chunk.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (segments_.empty() ||
+      segments_.back()->file.size() - segments_.back()->write_offset <
+          data_length) {
+    const int status = AddSegment(data_length);
+    if (status) {
+      return status;
+    }
+  }
+  Segment* const ptr_segment = segments_.back().get();
+  memcpy(ptr_segment->file.data() + ptr_segment->write_offset, ptr_data,
+         data_length);
+
+  Entry entry;
+  entry.info = info;
+  entry.ptr_segment = ptr_segment;
+  entry.offset = ptr_segment->write_offset;
+  entry.length = data_length;
+  entries_.push_back(entry);
+  ptr_segment->write_offset += data_length;
+  ++ptr_segment->num_entries;
+  stored_bytes_ += data_length;
+  return kSuccess;
+}
+
+int ChunkSpillFile::Front(ChunkInfo* ptr_info,
+                          const uint8** ptr_data,
+                          int32* ptr_length) {
+  if (!ptr_info || !ptr_data || !ptr_length) {
+    LOG(ERROR) << "NULL Front argument.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.empty()) {
+    return kEmpty;
+  }
+  const Entry& entry = entries_.front();
+  *ptr_info = entry.info;
+  *ptr_data = entry.ptr_segment->file.data() + entry.offset;
+  *ptr_length = entry.length;
+  return kSuccess;
+}
+
+void ChunkSpillFile::Pop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.empty()) {
+    return;
+  }
+  const Entry entry = entries_.front();
+  entries_.pop_front();
+  stored_bytes_ -= entry.length;
+  Segment* const ptr_segment = entry.ptr_segment;
+  if (--ptr_segment->num_entries > 0) {
+    return;
+  }
+  if (ptr_segment == segments_.back().get()) {
+    // Keep the newest segment mapped, and append from its start again.
+    ptr_segment->write_offset = 0;
+    return;
+  }
+  // Chunks are popped in order, so the empty segment is the oldest.
+  segments_.pop_front();
+  VLOG(1) << "spill segment closed, " << segments_.size() << " remain.";
+}
+
+bool ChunkSpillFile::empty() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.empty();
+}
+
+int64 ChunkSpillFile::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stored_bytes_;
+}
+
+int ChunkSpillFile::AddSegment(int32 min_size) {
+  if (!segments_.empty() && segments_.back()->num_entries == 0) {
+    // The newest segment is empty, and too small for the chunk.
+    segments_.pop_back();
+  }
+  std::unique_ptr<Segment> segment(new (std::nothrow) Segment());  // NOLINT
+  if (!segment) {
+    LOG(ERROR) << "cannot construct spill segment.";
+    return kNoMemory;
+  }
+  std::ostringstream path;
+  path << directory_ << "/webmlive_spill_" << ProcessId() << "_"
+       << g_next_segment_number++ << ".tmp";
+  if (!segment->file.Open(path.str(), std::max(min_size, segment_size_))) {
+    return kFileError;
+  }
+  LOG(INFO) << "spill segment mapped: " << path.str() << " ("
+            << segment->file.size() << " bytes)";
+  segments_.push_back(std::move(segment));
+  return kSuccess;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,102 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_CHUNK_SPILL_FILE_H_
+#define WEBMLIVE_ENCODER_CHUNK_SPILL_FILE_H_
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+// First in, first out chunk queue kept in memory-mapped, append-only segment
+// files. Used by |DataSinkStage| to hold chunks on disk while the data sink
+// falls behind.
+//
+// Notes:
+// - |Append()| must only be called from one thread, and |Front()| and |Pop()|
+//   from one other thread.
+// - Chunk data is copied once, into the mapping. |Front()| returns a pointer
+//   into the mapping, so reading a chunk back costs no copy.
+// - Only chunk data goes to disk; the |ChunkInfo| of each chunk stays in
+//   memory.
+// - Segment files are temporary: the system deletes them when they are
+//   closed, or when the process exits.
+class ChunkSpillFile {
+ public:
+  enum {
+    kFileError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+
+    // No chunk stored.
+    kEmpty = 1,
+  };
+
+  // Default size of a segment file. Larger chunks get a segment of their own.
+  static const int32 kDefaultSegmentSize = 64 * 1024 * 1024;
+
+  ChunkSpillFile();
+  ~ChunkSpillFile();
+
+  // Stores |directory|, in which segment files are created, and
+  // |segment_size|. Returns |kSuccess| when successful.
+  int Init(const std::string& directory, int32 segment_size);
+
+  // Copies |data_length| bytes from |ptr_data| to the end of the newest
+  // segment, mapping a new segment when it is full.
+  int Append(const ChunkInfo& info, const uint8* ptr_data, int32 data_length);
+
+  // Copies the description of the oldest chunk to |ptr_info|, and stores its
+  // address and length in |ptr_data| and |ptr_length|. The data stays valid
+  // until |Pop()|. Returns |kEmpty| when no chunk is stored.
+  int Front(ChunkInfo* ptr_info, const uint8** ptr_data, int32* ptr_length);
+
+  // Removes the oldest chunk. Closes its segment once every chunk in it has
+  // been removed, unless more chunks are to be appended to it.
+  void Pop();
+
+  bool empty() const;
+
+  // Returns the number of bytes of chunk data stored.
+  int64 size() const;
+
+ private:
+  struct Segment;
+  struct Entry {
+    ChunkInfo info;
+    Segment* ptr_segment;
+    int32 offset;
+    int32 length;
+  };
+
+  // Maps a segment of at least |min_size| bytes, and appends it to
+  // |segments_|. Requires |mutex_|.
+  int AddSegment(int32 min_size);
+
+  std::string directory_;
+  int32 segment_size_;
+
+  // All protected by |mutex_|. |segments_| is ordered oldest first; chunks
+  // are appended to the last segment.
+  std::deque<std::unique_ptr<Segment>> segments_;
+  std::deque<Entry> entries_;
+  int64 stored_bytes_;
+  mutable std::mutex mutex_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(ChunkSpillFile);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_CHUNK_SPILL_FILE_H_
@@ -0,0 +1,116 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/chunk_spill_file.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const int32 kSegmentSize = 4096;
+
+class ChunkSpillFileTest : public ::testing::Test {
+ protected:
+  void InitSpillFile() {
+    ASSERT_EQ(ChunkSpillFile::kSuccess, spill_.Init(".", kSegmentSize));
+  }
+
+  // Appends |length| bytes of |value| as chunk |number|.
+  void Append(int64 number, int32 length, uint8 value) {
+    ChunkInfo info;
+    info.number = number;
+    const std::vector<uint8> data(length, value);
+    ASSERT_EQ(ChunkSpillFile::kSuccess,
+              spill_.Append(info, &data[0], length));
+  }
+
+  // Expects the oldest chunk to be chunk |number|, of |length| bytes of
+  // |value|, and pops it.
+  void ExpectFrontAndPop(int64 number, int32 length, uint8 value) {
+    ChunkInfo info;
+    const uint8* ptr_data = NULL;
+    int32 data_length = 0;
+    ASSERT_EQ(ChunkSpillFile::kSuccess,
+              spill_.Front(&info, &ptr_data, &data_length));
+    EXPECT_EQ(number, info.number);
+    ASSERT_EQ(length, data_length);
+    EXPECT_EQ(std::vector<uint8>(length, value),
+              std::vector<uint8>(ptr_data, ptr_data + data_length));
+    spill_.Pop();
+  }
+
+  ChunkSpillFile spill_;
+};
+
+TEST_F(ChunkSpillFileTest, InvalidArgs) {
+  EXPECT_EQ(ChunkSpillFile::kInvalidArg, spill_.Init("", kSegmentSize));
+  EXPECT_EQ(ChunkSpillFile::kInvalidArg, spill_.Init(".", 0));
+  InitSpillFile();
+  ChunkInfo info;
+  const uint8 data = 0;
+  EXPECT_EQ(ChunkSpillFile::kInvalidArg, spill_.Append(info, NULL, 1));
+  EXPECT_EQ(ChunkSpillFile::kInvalidArg, spill_.Append(info, &data, 0));
+}
+
+TEST_F(ChunkSpillFileTest, Empty) {
+  InitSpillFile();
+  EXPECT_TRUE(spill_.empty());
+  EXPECT_EQ(0, spill_.size());
+  ChunkInfo info;
+  const uint8* ptr_data = NULL;
+  int32 length = 0;
+  EXPECT_EQ(ChunkSpillFile::kEmpty, spill_.Front(&info, &ptr_data, &length));
+}
+
+// Chunks come back in order across segments, including a chunk larger than a
+// segment, and |size()| follows the bytes stored.
+TEST_F(ChunkSpillFileTest, FirstInFirstOut) {
+  InitSpillFile();
+  const int kNumChunks = 10;
+  const int32 kChunkLength = kSegmentSize / 3;
+  int64 size = 0;
+  for (int i = 0; i < kNumChunks; ++i) {
+    Append(i, kChunkLength, static_cast<uint8>(i));
+    size += kChunkLength;
+  }
+  Append(kNumChunks, 3 * kSegmentSize, 0xFF);
+  size += 3 * kSegmentSize;
+  EXPECT_FALSE(spill_.empty());
+  EXPECT_EQ(size, spill_.size());
+
+  for (int i = 0; i < kNumChunks; ++i) {
+    ExpectFrontAndPop(i, kChunkLength, static_cast<uint8>(i));
+    size -= kChunkLength;
+    EXPECT_EQ(size, spill_.size());
+  }
+  ExpectFrontAndPop(kNumChunks, 3 * kSegmentSize, 0xFF);
+  EXPECT_TRUE(spill_.empty());
+  EXPECT_EQ(0, spill_.size());
+}
+
+// Appends interleaved with pops reuse the newest segment once it is empty,
+// without overwriting chunks not yet read.
+TEST_F(ChunkSpillFileTest, InterleavedAppendAndPop) {
+  InitSpillFile();
+  const int kNumChunks = 50;
+  const int32 kChunkLength = kSegmentSize / 4;
+  Append(0, kChunkLength, 0);
+  for (int i = 1; i < kNumChunks; ++i) {
+    Append(i, kChunkLength, static_cast<uint8>(i));
+    ExpectFrontAndPop(i - 1, kChunkLength, static_cast<uint8>(i - 1));
+  }
+  ExpectFrontAndPop(kNumChunks - 1, kChunkLength,
+                    static_cast<uint8>(kNumChunks - 1));
+  EXPECT_TRUE(spill_.empty());
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -7,6 +7,9 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/dash_writer.h"
 
+#include <algorithm>
+#include <cmath>
+#include <ctime>
 #include <ios>
 #include <sstream>
 
@@ -22,6 +25,8 @@ const char kDefaultSchema[] = "urn:mpeg:dash:schema:mpd:2011";
 const int kDefaultMinBufferTime = 1;
 const int kDefaultMediaPresentationDuration = 36000;  // 10 hours.
 const char kDefaultType[] = "static";
+const char kDynamicType[] = "dynamic";
+const char kDateTimeFormat[] = "%Y-%m-%dT%H:%M:%SZ";
 const char kDefaultProfiles[] = "urn:mpeg:dash:profile:isoff-live:2011";
 const int kDefaultStartTime = 0;
 const int kDefaultMaxWidth = 1920;
@@ -31,6 +36,8 @@ const int kDefaultContentComponentId = 1;
 const char kContentComponentTypeAudio[] = "audio";
 const char kContentComponentTypeVideo[] = "video";
 const int kDefaultPeriodDuration = kDefaultMediaPresentationDuration;
+const int kDefaultMinimumUpdatePeriod = 5;
+const int kDefaultTimeShiftBufferDepth = 0;  // Unlimited.
 const int kDefaultTimescale = 1000;  // milliseconds.
 const int kDefaultChunkDuration = 5000;  // milliseconds.
 const int kDefaultStartNumber = 1;
@@ -43,6 +50,7 @@ const int kDefaultAudioChannels = 2;
 const char kAudioMimeType[] = "audio/webm";
 const char kVideoMimeType[] = "video/webm";
 const char kAudioCodecs[] = "vorbis";
+const char kAudioCodecsOpus[] = "opus";
 const char kVideoCodecs[] = "vp9";
 const char kAudioId[] = "1";
 const char kVideoId[] = "2";
@@ -54,6 +62,58 @@ const char kInitializationPattern[] = "_$RepresentationID$.hdr";
 const char kAudioSchemeUri[] =
   "urn:mpeg:dash:23003:3:audio_channel_configuration:2011";
 
+const char kManifestExtension[] = ".mpd";
+const char kRepresentationIdIdentifier[] = "$RepresentationID$";
+const char kNumberIdentifier[] = "$Number$";
+
+namespace {
+
+// Returns |name| followed by the track ID, or just |name| for muxed output.
+std::string TrackPrefix(const std::string& name, ChunkInfo::Track track) {
+  std::ostringstream prefix;
+  prefix << name;
+  if (track != ChunkInfo::kAllTracks) {
+    prefix << "_" << track;
+  }
+  return prefix.str();
+}
+
+// Returns |time| as a UTC xs:dateTime string.
+std::string FormatDateTime(time_t time) {
+  struct tm utc_time = {0};
+#ifdef _WIN32
+  gmtime_s(&utc_time, &time);
+#else
+  gmtime_r(&time, &utc_time);
+#endif
+  char date_time[32] = {0};
+  strftime(date_time, sizeof(date_time), kDateTimeFormat, &utc_time);
+  return date_time;
+}
+
+// Returns the startWithSAP attribute of |adaptation_set| followed by a space,
+// or nothing when |start_with_sap| is 0.
+std::string StartWithSap(const AdaptationSet& adaptation_set) {
+  if (adaptation_set.start_with_sap == 0) {
+    return "";
+  }
+  std::ostringstream attribute;
+  attribute << "startWithSAP=\"" << adaptation_set.start_with_sap << "\" ";
+  return attribute.str();
+}
+
+// Replaces the first occurrence of |identifier| in |pattern| with |value|.
+void ReplaceIdentifier(const std::string& identifier,
+                       const std::string& value,
+                       std::string* pattern) {
+  const std::string::size_type pos = pattern->find(identifier);
+  if (pos != std::string::npos) {
+    pattern->replace(pos, identifier.length(), value);
+  }
+}
+
+}  // namespace
+
 //
 // AdaptationSet
 //
@@ -78,6 +138,7 @@ AudioAdaptationSet::AudioAdaptationSet()
       scheme_id_uri(kAudioSchemeUri),
       value(kDefaultAudioChannels) {
   media_type = kAudio;
+  cc_id = kAudioId;
   content_type = kContentComponentTypeAudio;
   mimetype = kAudioMimeType;
   codecs = kAudioCodecs;
@@ -94,7 +155,7 @@ VideoAdaptationSet::VideoAdaptationSet()
       height(kDefaultMaxHeight),
       frame_rate(kDefaultFrameRate) {
   media_type = kVideo;
-  cc_id = kAudioId;
+  cc_id = kVideoId;
   mimetype = kVideoMimeType;
   codecs = kVideoCodecs;
 }
@@ -106,6 +167,8 @@ DashConfig::DashConfig()
       : type(kDefaultType),
         min_buffer_time(kDefaultMinBufferTime),
         media_presentation_duration(kDefaultMediaPresentationDuration),
+        minimum_update_period(kDefaultMinimumUpdatePeriod),
+        time_shift_buffer_depth(kDefaultTimeShiftBufferDepth),
         start_time(kDefaultStartTime),
         period_duration(kDefaultPeriodDuration) {}
 
@@ -124,15 +187,20 @@ bool DashWriter::Init(std::string name, std::string id,
 
   if (!webm_config.disable_audio) {
     config_.audio_as.enabled = true;
-    config_.audio_as.bandwidth =
-        webm_config.vorbis_config.average_bitrate * 1000;
+    if (webm_config.audio_codec == kAudioFormatOpus) {
+      config_.audio_as.codecs = kAudioCodecsOpus;
+      config_.audio_as.bandwidth = webm_config.opus_config.bitrate * 1000;
+    } else {
+      config_.audio_as.bandwidth =
+          webm_config.vorbis_config.average_bitrate * 1000;
+    }
     config_.audio_as.media = name + "_" + kAudioId + kChunkPattern;
     config_.audio_as.initialization =
         name + "_" + kAudioId + kInitializationPattern;
     config_.audio_as.rep_id = id;
     config_.audio_as.audio_sampling_rate =
-        webm_config.actual_audio_config.sample_rate;
-    config_.audio_as.value = webm_config.actual_audio_config.channels;
+        webm_config.encoded_audio_config.sample_rate;
+    config_.audio_as.value = webm_config.encoded_audio_config.channels;
   }
   if (!webm_config.disable_video) {
     config_.video_as.enabled = true;
@@ -161,6 +229,31 @@ bool DashWriter::Init(std::string name, std::string id,
   config_.audio_as.chunk_duration = webm_config.vpx_config.keyframe_interval;
   config_.video_as.chunk_duration = webm_config.vpx_config.keyframe_interval;
 
+  // Size based cluster splits can start a video segment with a delta frame;
+  // startWithSAP is then left out rather than claim every segment starts
+  // with a keyframe. Muxed segments carry the video too.
+  const bool delta_segments = !webm_config.disable_video &&
+      webm_config.max_cluster_size > 0 &&
+      webm_config.cluster_split_policy !=
+          WebmEncoderConfig::kSplitAtKeyframeOnly;
+  if (delta_segments) {
+    config_.video_as.start_with_sap = 0;
+    if (!webm_config.per_track_output) {
+      config_.audio_as.start_with_sap = 0;
+    }
+  }
+
+  if (webm_config.dash_live_manifest) {
+    config_.type = kDynamicType;
+    config_.availability_start_time = FormatDateTime(time(NULL));
+
+    // Clients refresh the manifest about once per segment.
+    config_.minimum_update_period = std::max(1, static_cast<int>(
+        std::ceil(webm_config.vpx_config.keyframe_interval / 1000.0)));
+    config_.time_shift_buffer_depth =
+        webm_config.dash_time_shift_buffer_depth;
+  }
+
   *dash_config = config_;
   initialized_ = true;
   return true;
@@ -173,6 +266,9 @@ bool DashWriter::WriteManifest(const DashConfig& config,
     LOG(ERROR) << "DashWriter not initialized before call to WriteManifest()";
     return false;
   }
+  config_ = config;
+  dynamic_ = (config.type == kDynamicType);
+  ResetIndent();
 
   std::ostringstream manifest;
 
@@ -182,47 +278,138 @@ bool DashWriter::WriteManifest(const DashConfig& config,
   manifest << "<MPD "
            << "xmlns=\"" << kDefaultSchema << "\" "
            << "type=\"" << config.type << "\" "
-           << "minBufferTime=\"PT" << config.min_buffer_time << "S\" "
-           << "mediaPresentationDuration=\"PT"
-           << config.media_presentation_duration << "\" "
-           << "profiles=\"" << kDefaultProfiles << "\">"
+           << "minBufferTime=\"PT" << config.min_buffer_time << "S\" ";
+  if (dynamic_) {
+    manifest << "availabilityStartTime=\"" << config.availability_start_time
+             << "\" "
+             << "minimumUpdatePeriod=\"PT" << config.minimum_update_period
+             << "S\" ";
+    if (config.time_shift_buffer_depth > 0) {
+      manifest << "timeShiftBufferDepth=\"PT"
+               << config.time_shift_buffer_depth << "S\" ";
+    }
+  } else {
+    manifest << "mediaPresentationDuration=\"PT"
+             << config.media_presentation_duration << "\" ";
+  }
+  manifest << "profiles=\"" << kDefaultProfiles << "\">"
            << "\n";
   IncreaseIndent();
 
-  // Open the Period element.
+  // Open the Period element. The Period of a dynamic manifest lasts until
+  // the stream ends.
   manifest << indent_
            << "<Period "
-           << "start=\"PT" << config.start_time << "S\" "
-           << "duration=\"PT" << config.period_duration << "\">"
-           << "\n";
+           << "start=\"PT" << config.start_time << "S\"";
+  if (!dynamic_) {
+    manifest << " duration=\"PT" << config.period_duration << "\"";
+  }
+  manifest << ">\n";
   IncreaseIndent();
+  manifest_head_ = manifest.str();
 
+  adaptation_sets_.clear();
   if (config.audio_as.enabled) {
-    std::string audio_as;
+    CachedAdaptationSet audio_as;
+    audio_as.track = ChunkInfo::kAudioTrack;
     WriteAudioAdaptationSet(&audio_as);
-    manifest << audio_as;
+    adaptation_sets_.push_back(audio_as);
   }
 
   if (config.video_as.enabled) {
-    std::string video_as;
+    CachedAdaptationSet video_as;
+    video_as.track = ChunkInfo::kVideoTrack;
     WriteVideoAdaptationSet(&video_as);
-    manifest << video_as;
+    adaptation_sets_.push_back(video_as);
   }
 
   // Close open elements.
+  manifest.str("");
   DecreaseIndent();
   manifest << indent_ << "</Period>\n";
   DecreaseIndent();
   manifest << indent_ << "</MPD>\n";
+  manifest_tail_ = manifest.str();
 
-  LOG(INFO) << "\nmanifest:\n" << manifest.str();
-  *out_manifest = manifest.str();
-  config_ = config;
+  JoinManifest(out_manifest);
+  LOG(INFO) << "\nmanifest:\n" << *out_manifest;
+  return true;
+}
 
+bool DashWriter::AppendSegment(ChunkInfo::Track track,
+                               int64 number,
+                               int64 start_time,
+                               int64 duration) {
+  if (!dynamic_) {
+    LOG(ERROR) << "AppendSegment requires a dynamic manifest.";
+    return false;
+  }
+  for (size_t i = 0; i < adaptation_sets_.size(); ++i) {
+    CachedAdaptationSet& as = adaptation_sets_[i];
+    if (track != ChunkInfo::kAllTracks && track != as.track) {
+      continue;
+    }
+    std::ostringstream element;
+    element << as.indent << kIndentStep << kIndentStep
+            << "<S t=\"" << start_time << "\" d=\"" << duration << "\"/>\n";
+    TimelineSegment segment;
+    segment.number = number;
+    segment.start_time = start_time;
+    segment.duration = duration;
+    segment.element = element.str();
+    as.timeline.push_back(segment);
+
+    // Drop segments that ended before the time shift buffer.
+    if (config_.time_shift_buffer_depth > 0) {
+      const int64 buffer_start = start_time + duration -
+          config_.time_shift_buffer_depth * kDefaultTimescale;
+      while (as.timeline.size() > 1 &&
+             as.timeline.front().start_time + as.timeline.front().duration <=
+                 buffer_start) {
+        as.timeline.pop_front();
+      }
+    }
+  }
   return true;
 }
 
-void DashWriter::WriteAudioAdaptationSet(std::string* adaptation_set) {
+bool DashWriter::UpdateManifest(std::string* out_manifest) const {
+  CHECK_NOTNULL(out_manifest);
+  if (!dynamic_ || manifest_head_.empty()) {
+    LOG(ERROR) << "UpdateManifest requires a dynamic manifest written by "
+               << "WriteManifest().";
+    return false;
+  }
+  JoinManifest(out_manifest);
+  return true;
+}
+
+std::string DashWriter::ManifestName(const std::string& name) {
+  return name + kManifestExtension;
+}
+
+std::string DashWriter::InitializationName(const std::string& name,
+                                           const std::string& id,
+                                           ChunkInfo::Track track) {
+  std::string file_name = TrackPrefix(name, track) + kInitializationPattern;
+  ReplaceIdentifier(kRepresentationIdIdentifier, id, &file_name);
+  return file_name;
+}
+
+std::string DashWriter::ChunkName(const std::string& name,
+                                  const std::string& id,
+                                  ChunkInfo::Track track,
+                                  int64 number) {
+  std::ostringstream number_string;
+  number_string << number;
+  std::string file_name = TrackPrefix(name, track) + kChunkPattern;
+  ReplaceIdentifier(kRepresentationIdIdentifier, id, &file_name);
+  ReplaceIdentifier(kNumberIdentifier, number_string.str(), &file_name);
+  return file_name;
+}
+
+void DashWriter::WriteAudioAdaptationSet(
+    CachedAdaptationSet* adaptation_set) {
   CHECK_NOTNULL(adaptation_set);
   std::ostringstream a_stream;
   const AudioAdaptationSet& audio_as = config_.audio_as;
@@ -253,14 +440,7 @@ void DashWriter::WriteAudioAdaptationSet(std::string* adaptation_set) {
            << "\n";
 
   // Write SegmentTemplate element.
-  a_stream << indent_
-           << "<SegmentTemplate "
-           << "timescale=\"" << audio_as.timescale << "\" "
-           << "duration=\"" << audio_as.chunk_duration << "\" "
-           << "media=\"" << audio_as.media << "\" "
-           << "startNumber=\"" << audio_as.start_number << "\" "
-           << "initialization=\"" << audio_as.initialization << "\"/>"
-           << "\n";
+  WriteSegmentTemplate(audio_as, &a_stream, adaptation_set);
 
   // Write the Representation element.
   a_stream << indent_
@@ -268,7 +448,7 @@ void DashWriter::WriteAudioAdaptationSet(std::string* adaptation_set) {
            << "id=\"" << audio_as.rep_id << "\" "
            << "mimeType=\"" << audio_as.mimetype << "\" "
            << "codecs=\"" << audio_as.codecs << "\" "
-           << "startWithSAP=\"" << audio_as.start_with_sap << "\" "
+           << StartWithSap(audio_as)
            << "bandwidth=\"" << audio_as.bandwidth << "\" "
            << "></Representation>"
            << "\n";
@@ -276,10 +456,11 @@ void DashWriter::WriteAudioAdaptationSet(std::string* adaptation_set) {
   // Close open the AdaptationSet element.
   DecreaseIndent();
   a_stream << indent_ << "</AdaptationSet>\n";
-  *adaptation_set = a_stream.str();
+  adaptation_set->tail = a_stream.str();
 }
 
-void DashWriter::WriteVideoAdaptationSet(std::string* adaptation_set) {
+void DashWriter::WriteVideoAdaptationSet(
+    CachedAdaptationSet* adaptation_set) {
   CHECK_NOTNULL(adaptation_set);
   std::ostringstream v_stream;
   const VideoAdaptationSet& video_as = config_.video_as;
@@ -304,14 +485,7 @@ void DashWriter::WriteVideoAdaptationSet(std::string* adaptation_set) {
            << "\n";
 
   // Write SegmentTemplate element.
-  v_stream << indent_
-           << "<SegmentTemplate "
-           << "timescale=\"" << video_as.timescale << "\" "
-           << "duration=\"" << video_as.chunk_duration << "\" "
-           << "media=\"" << video_as.media << "\" "
-           << "startNumber=\"" << video_as.start_number << "\" "
-           << "initialization=\"" << video_as.initialization << "\"/>"
-           << "\n";
+  WriteSegmentTemplate(video_as, &v_stream, adaptation_set);
 
   // Write the Representation element.
   v_stream << indent_
@@ -321,7 +495,7 @@ void DashWriter::WriteVideoAdaptationSet(std::string* adaptation_set) {
            << "codecs=\"" << video_as.codecs << "\" "
            << "width=\"" << video_as.width << "\" "
            << "height=\"" << video_as.height << "\" "
-           << "startWithSAP=\"" << video_as.start_with_sap << "\" "
+           << StartWithSap(video_as)
            << "bandwidth=\"" << video_as.bandwidth << "\" "
            << "framerate=\"" << video_as.frame_rate << "\" "
            << "></Representation>"
@@ -330,7 +504,60 @@ void DashWriter::WriteVideoAdaptationSet(std::string* adaptation_set) {
   // Close open the AdaptationSet element.
   DecreaseIndent();
   v_stream << indent_ << "</AdaptationSet>\n";
-  *adaptation_set = v_stream.str();
+  adaptation_set->tail = v_stream.str();
+}
+
+// Static manifests describe segments with the SegmentTemplate duration
+// attribute; dynamic manifests list them in a SegmentTimeline instead.
+void DashWriter::WriteSegmentTemplate(const AdaptationSet& as,
+                                      std::ostringstream* stream,
+                                      CachedAdaptationSet* adaptation_set) {
+  *stream << indent_
+          << "<SegmentTemplate "
+          << "timescale=\"" << as.timescale << "\" ";
+  if (!dynamic_) {
+    *stream << "duration=\"" << as.chunk_duration << "\" ";
+  }
+  *stream << "media=\"" << as.media << "\" "
+          << "startNumber=\"";
+  adaptation_set->head = stream->str();
+  adaptation_set->start_number = as.start_number;
+  adaptation_set->indent = indent_;
+
+  std::ostringstream attributes;
+  attributes << "\" "
+             << "initialization=\"" << as.initialization << "\"";
+  adaptation_set->template_attributes = attributes.str();
+  stream->str("");
+}
+
+void DashWriter::JoinManifest(std::string* manifest) const {
+  const std::string kTimelineOpen = "<SegmentTimeline>\n";
+  const std::string kTimelineClose = "</SegmentTimeline>\n";
+  const std::string kTemplateClose = "</SegmentTemplate>\n";
+  manifest->assign(manifest_head_);
+  for (size_t i = 0; i < adaptation_sets_.size(); ++i) {
+    const CachedAdaptationSet& as = adaptation_sets_[i];
+    std::ostringstream start_number;
+    start_number << (as.timeline.empty() ?
+        as.start_number : as.timeline.front().number);
+    manifest->append(as.head);
+    manifest->append(start_number.str());
+    manifest->append(as.template_attributes);
+    if (!dynamic_) {
+      manifest->append("/>\n");
+    } else {
+      manifest->append(">\n");
+      manifest->append(as.indent + kIndentStep + kTimelineOpen);
+      for (size_t s = 0; s < as.timeline.size(); ++s) {
+        manifest->append(as.timeline[s].element);
+      }
+      manifest->append(as.indent + kIndentStep + kTimelineClose);
+      manifest->append(as.indent + kTemplateClose);
+    }
+    manifest->append(as.tail);
+  }
+  manifest->append(manifest_tail_);
 }
 
 void DashWriter::IncreaseIndent() {
@@ -8,12 +8,21 @@
 #ifndef WEBMLIVE_ENCODER_DASH_WRITER_H_
 #define WEBMLIVE_ENCODER_DASH_WRITER_H_
 
+#include <deque>
+#include <sstream>
 #include <string>
+#include <vector>
 
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
 #include "encoder/webm_encoder.h"
 
 namespace webmlive {
 
+// Name and representation ID of the stream written by |WebmEncoder|.
+const char kDefaultDashName[] = "webmlive";
+const char kDefaultDashId[] = "webmlive";
+
 class AdaptationSet {
 public:
  enum MediaType {
@@ -46,6 +55,7 @@ public:
  std::string rep_id;
  std::string mimetype;
  std::string codecs;
+ // 0 leaves the startWithSAP attribute out.
  int start_with_sap;
  int bandwidth;
 };
@@ -82,10 +92,17 @@ class VideoAdaptationSet : public AdaptationSet {
 struct DashConfig {
   DashConfig();
 
-  // MPD properties.
+  // MPD properties. |media_presentation_duration| applies only to static
+  // manifests; the remaining time values apply only to dynamic manifests.
+  // |availability_start_time| is a UTC xs:dateTime string, and a
+  // |time_shift_buffer_depth| of 0 leaves the attribute out and keeps every
+  // segment in the SegmentTimeline.
   std::string type;
   int min_buffer_time;
   int media_presentation_duration;
+  std::string availability_start_time;
+  int minimum_update_period;
+  int time_shift_buffer_depth;
 
   // Period properties.
   int start_time;
@@ -99,26 +116,99 @@ struct DashConfig {
 
 class DashWriter {
  public:
-  DashWriter() : initialized_(false){}
+  DashWriter() : initialized_(false), dynamic_(false) {}
   ~DashWriter() {}
 
   DashConfig config() const { return config_; }
   void config(DashConfig& config) { config_ = config; }
 
   // Builds the SegmentTemplate media and initialization strings and then stores
-  // them in |config|. Must be called before |WriteManifest()|. Returns true
-  // when successful.
+  // them in |config|. Must be called before |WriteManifest()|. Sets up a
+  // dynamic manifest that starts now when |webm_config.dash_live_manifest| is
+  // true. Returns true when successful.
   bool Init(std::string name, std::string id,
             const WebmEncoderConfig& webm_config, DashConfig* config);
 
   // Writes the DASH manifest built from |config| to |manifest|. Returns true
-  // when successful.
+  // when successful. Dynamic manifests use a SegmentTemplate with a
+  // SegmentTimeline; the manifest text around each timeline is cached for
+  // |UpdateManifest()|.
   bool WriteManifest(const DashConfig& config,
                      std::string* manifest);
 
+  // Appends media segment |number| of |track|, spanning |duration|
+  // milliseconds from |start_time|, to the SegmentTimeline of the matching
+  // AdaptationSet, or of every AdaptationSet for |ChunkInfo::kAllTracks|.
+  // Segments older than the time shift buffer are dropped. Requires a
+  // dynamic manifest. Returns true when successful.
+  bool AppendSegment(ChunkInfo::Track track,
+                     int64 number,
+                     int64 start_time,
+                     int64 duration);
+
+  // Writes the dynamic manifest, including all segments appended since
+  // |WriteManifest()|, to |manifest| from the cached manifest text. Returns
+  // true when successful.
+  bool UpdateManifest(std::string* manifest) const;
+
+  bool dynamic() const { return dynamic_; }
+
+  // File names of the manifest, initialization segment, and media segment
+  // |number| for stream |name| with representation |id|. Segment names are
+  // built from the SegmentTemplate patterns |Init()| writes; muxed output
+  // (|ChunkInfo::kAllTracks|) leaves the track ID out.
+  static std::string ManifestName(const std::string& name);
+  static std::string InitializationName(const std::string& name,
+                                        const std::string& id,
+                                        ChunkInfo::Track track);
+  static std::string ChunkName(const std::string& name,
+                               const std::string& id,
+                               ChunkInfo::Track track,
+                               int64 number);
+
  private:
-  void WriteAudioAdaptationSet(std::string* adaptation_set);
-  void WriteVideoAdaptationSet(std::string* adaptation_set);
+  // S element of a SegmentTimeline.
+  struct TimelineSegment {
+    int64 number;
+    int64 start_time;
+    int64 duration;
+    std::string element;
+  };
+
+  // Manifest text of one AdaptationSet, split around the SegmentTemplate
+  // startNumber value and the SegmentTimeline, and the timeline segments.
+  struct CachedAdaptationSet {
+    CachedAdaptationSet() : track(ChunkInfo::kAllTracks), start_number(0) {}
+    ChunkInfo::Track track;
+    int start_number;
+
+    // Text up to the startNumber value, text from the startNumber value to
+    // the end of the SegmentTemplate attributes, and text following the
+    // SegmentTemplate element.
+    std::string head;
+    std::string template_attributes;
+    std::string tail;
+
+    // Indent of the SegmentTemplate element.
+    std::string indent;
+
+    std::deque<TimelineSegment> timeline;
+  };
+
+  // Write the AdaptationSet elements to |adaptation_set|.
+  void WriteAudioAdaptationSet(CachedAdaptationSet* adaptation_set);
+  void WriteVideoAdaptationSet(CachedAdaptationSet* adaptation_set);
+
+  // Writes the SegmentTemplate element for |as| to |adaptation_set|, and
+  // stores the text written so far in |adaptation_set->head|. The
+  // SegmentTemplate attributes following startNumber go to
+  // |adaptation_set->template_attributes|.
+  void WriteSegmentTemplate(const AdaptationSet& as,
+                            std::ostringstream* stream,
+                            CachedAdaptationSet* adaptation_set);
+
+  // Joins the cached manifest text and the timelines into |manifest|.
+  void JoinManifest(std::string* manifest) const;
 
   void IncreaseIndent();
   void DecreaseIndent();
@@ -127,6 +217,15 @@ class DashWriter {
   bool initialized_;
   DashConfig config_;
   std::string indent_;
+
+  // True when |config_| describes a dynamic manifest.
+  bool dynamic_;
+
+  // Manifest text before and after the AdaptationSet elements, and the
+  // AdaptationSets, cached by |WriteManifest()|.
+  std::string manifest_head_;
+  std::string manifest_tail_;
+  std::vector<CachedAdaptationSet> adaptation_sets_;
 };
 
 }  // namespace webmlive
@@ -0,0 +1,132 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/dash_writer.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const int64 kSegmentDuration = 2000;
+
+// Returns the number of times |text| occurs in |manifest|.
+int Count(const std::string& manifest, const std::string& text) {
+  int count = 0;
+  for (size_t pos = manifest.find(text); pos != std::string::npos;
+       pos = manifest.find(text, pos + text.size())) {
+    ++count;
+  }
+  return count;
+}
+
+class DashWriterTest : public ::testing::Test {
+ protected:
+  // Initializes |writer_| and writes the first manifest to |manifest_|.
+  void WriteManifest() {
+    DashConfig dash_config;
+    ASSERT_TRUE(writer_.Init(kDefaultDashName, kDefaultDashId, webm_config_,
+                             &dash_config));
+    ASSERT_TRUE(writer_.WriteManifest(dash_config, &manifest_));
+  }
+
+  // Appends segments |first| to |last| of |track|, each |kSegmentDuration|
+  // long, and updates |manifest_|.
+  void AppendSegments(ChunkInfo::Track track, int64 first, int64 last) {
+    for (int64 number = first; number <= last; ++number) {
+      ASSERT_TRUE(writer_.AppendSegment(track, number,
+                                        (number - 1) * kSegmentDuration,
+                                        kSegmentDuration));
+    }
+    ASSERT_TRUE(writer_.UpdateManifest(&manifest_));
+  }
+
+  WebmEncoderConfig webm_config_;
+  DashWriter writer_;
+  std::string manifest_;
+};
+
+// Static manifests keep the SegmentTemplate duration, and cannot be updated.
+TEST_F(DashWriterTest, StaticManifest) {
+  WriteManifest();
+  EXPECT_FALSE(writer_.dynamic());
+  EXPECT_EQ(1, Count(manifest_, "type=\"static\""));
+  EXPECT_EQ(1, Count(manifest_, "mediaPresentationDuration="));
+  EXPECT_EQ(2, Count(manifest_, "<SegmentTemplate timescale=\"1000\" "
+                                "duration=\""));
+  EXPECT_EQ(0, Count(manifest_, "<SegmentTimeline>"));
+  EXPECT_EQ(0, Count(manifest_, "</SegmentTemplate>"));
+  EXPECT_FALSE(writer_.AppendSegment(ChunkInfo::kAllTracks, 1, 0,
+                                     kSegmentDuration));
+  std::string manifest;
+  EXPECT_FALSE(writer_.UpdateManifest(&manifest));
+}
+
+TEST_F(DashWriterTest, DynamicManifest) {
+  webm_config_.dash_live_manifest = true;
+  WriteManifest();
+  EXPECT_TRUE(writer_.dynamic());
+  EXPECT_EQ(1, Count(manifest_, "type=\"dynamic\""));
+  EXPECT_EQ(1, Count(manifest_, "availabilityStartTime=\""));
+  EXPECT_EQ(1, Count(manifest_, "minimumUpdatePeriod=\"PT"));
+  EXPECT_EQ(0, Count(manifest_, "timeShiftBufferDepth="));
+  EXPECT_EQ(0, Count(manifest_, "mediaPresentationDuration="));
+  EXPECT_EQ(2, Count(manifest_, "<SegmentTimeline>\n"));
+  EXPECT_EQ(0, Count(manifest_, "<S "));
+
+  // An update with no new segments matches the manifest first written.
+  std::string manifest;
+  ASSERT_TRUE(writer_.UpdateManifest(&manifest));
+  EXPECT_EQ(manifest_, manifest);
+}
+
+// Muxed segments are appended to every AdaptationSet, and per-track segments
+// only to their own.
+TEST_F(DashWriterTest, UpdatesAppendSegments) {
+  webm_config_.dash_live_manifest = true;
+  WriteManifest();
+  AppendSegments(ChunkInfo::kAllTracks, 1, 2);
+  EXPECT_EQ(2, Count(manifest_, "<S t=\"0\" d=\"2000\"/>"));
+  EXPECT_EQ(2, Count(manifest_, "<S t=\"2000\" d=\"2000\"/>"));
+  EXPECT_EQ(2, Count(manifest_, "startNumber=\"1\""));
+
+  AppendSegments(ChunkInfo::kVideoTrack, 3, 3);
+  EXPECT_EQ(1, Count(manifest_, "<S t=\"4000\" d=\"2000\"/>"));
+
+  // The video AdaptationSet, which follows the audio one, holds it.
+  EXPECT_GT(manifest_.find("<S t=\"4000\""),
+            manifest_.find("contentType=\"video\""));
+}
+
+// Segments that end before the time shift buffer are dropped, and
+// startNumber follows the oldest segment kept.
+TEST_F(DashWriterTest, TimeShiftBuffer) {
+  webm_config_.dash_live_manifest = true;
+  webm_config_.dash_time_shift_buffer_depth = 4;
+  WriteManifest();
+  EXPECT_EQ(1, Count(manifest_, "timeShiftBufferDepth=\"PT4S\""));
+  AppendSegments(ChunkInfo::kAllTracks, 1, 5);
+  EXPECT_EQ(0, Count(manifest_, "<S t=\"4000\""));
+  EXPECT_EQ(2, Count(manifest_, "<S t=\"6000\""));
+  EXPECT_EQ(2, Count(manifest_, "<S t=\"8000\""));
+  EXPECT_EQ(2, Count(manifest_, "startNumber=\"4\""));
+}
+
+TEST_F(DashWriterTest, FileNames) {
+  EXPECT_EQ("webmlive.mpd", DashWriter::ManifestName("webmlive"));
+  EXPECT_EQ("webmlive_webmlive.hdr",
+            DashWriter::InitializationName("webmlive", "webmlive",
+                                           ChunkInfo::kAllTracks));
+  EXPECT_EQ("webmlive_2_id_12.chk",
+            DashWriter::ChunkName("webmlive", "id", ChunkInfo::kVideoTrack,
+                                  12));
+}
+
+}  // namespace
+}  // namespace webmlive
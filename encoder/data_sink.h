@@ -8,10 +8,77 @@
 #ifndef WEBMLIVE_ENCODER_DATA_SINK_H_
 #define WEBMLIVE_ENCODER_DATA_SINK_H_
 
+#include <string>
+
 #include "encoder/basictypes.h"
 
 namespace webmlive {
 
+// Describes the data passed to |DataSinkInterface::WriteChunk()|.
+struct ChunkInfo {
+  enum ChunkType {
+    // DASH manifest.
+    kManifest = 0,
+
+    // EBML header, segment info, and segment tracks.
+    kMetadata = 1,
+
+    // Cluster data.
+    kMedia = 2,
+  };
+
+  // Tracks carried by the chunk. The values match the AdaptationSet IDs
+  // written by |DashWriter|.
+  enum Track {
+    kAllTracks = 0,
+    kAudioTrack = 1,
+    kVideoTrack = 2,
+  };
+
+  ChunkInfo()
+      : type(kMedia),
+        complete(true),
+        keyframe(false),
+        track(kAllTracks),
+        number(0),
+        start_time(0),
+        duration(0) {}
+
+  ChunkType type;
+
+  // True when the chunk ends where a new cluster starts, or where the stream
+  // ends. Partial chunks are only produced in low latency mode, and the chunk
+  // following a complete chunk always starts a cluster.
+  bool complete;
+
+  // True when the cluster the chunk belongs to starts with a video keyframe,
+  // or carries no video, so that decoding can start with it. Always false for
+  // manifest and metadata chunks.
+  bool keyframe;
+
+  // |kAllTracks| for muxed output; otherwise the only track in the chunk.
+  Track track;
+
+  // Media chunk number within |track|, counting clusters from 1. Partial
+  // chunks carry the number of the cluster they belong to. Always 0 for
+  // manifest and metadata chunks.
+  int64 number;
+
+  // Media time span of the cluster the chunk belongs to, in milliseconds.
+  // |duration| is 0 until the chunk is complete.
+  int64 start_time;
+  int64 duration;
+
+  // Index of the blocks in a media chunk, as single line JSON:
+  //   {"timecode":T,"blocks":N,"tracks":[{"track":K,"first":F,"last":L}],
+  //    "keyframes":[O]}
+  // |T| is the cluster timecode, |F| and |L| the first and last block
+  // timestamps of track number |K|, and |O| the byte offset of a keyframe
+  // SimpleBlock within the chunk. Times are in milliseconds. Empty for
+  // manifest and metadata chunks.
+  std::string index;
+};
+
 class DataSinkInterface {
  public:
   virtual ~DataSinkInterface() {}
@@ -22,6 +89,15 @@ class DataSinkInterface {
 
   // Writes data to the sink and returns true when successful.
   virtual bool WriteData(const uint8* ptr_data, int32 data_length) = 0;
+
+  // Writes data described by |info| to the sink and returns true when
+  // successful. Sinks that need to know chunk boundaries override this; the
+  // default ignores |info|.
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length) {
+    return WriteData(ptr_data, data_length);
+  }
 };
 
 }  // namespace webmlive
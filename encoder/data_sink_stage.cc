@@ -0,0 +1,202 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/data_sink_stage.h"
+
+#include <chrono>
+#include <new>
+#include <thread>
+
+#include "encoder/chunk_spill_file.h"
+#include "encoder/spsc_queue-inl.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+DataSinkStage::DataSinkStage()
+    : ptr_sink_(NULL),
+      ptr_space_callback_(NULL),
+      max_queued_bytes_(0),
+      queued_bytes_(0),
+      spilling_(false),
+      spill_failed_(false),
+      spill_failed_size_(0) {
+}
+
+DataSinkStage::~DataSinkStage() {
+}
+
+int DataSinkStage::Init(DataSinkInterface* ptr_sink, int queue_length) {
+  if (!ptr_sink) {
+    LOG(ERROR) << "DataSinkStage cannot Init with NULL sink.";
+    return kInvalidArg;
+  }
+  const int status = queue_.Init(queue_length);
+  if (status) {
+    LOG(ERROR) << "DataSinkStage queue Init failed: " << status;
+    return status == SpscQueue<QueuedChunk>::kNoMemory ?
+        kNoMemory : kInvalidArg;
+  }
+  ptr_sink_ = ptr_sink;
+  return kSuccess;
+}
+
+int DataSinkStage::EnableSpill(const std::string& directory,
+                               int64 max_queued_bytes) {
+  if (!ptr_sink_ || max_queued_bytes <= 0) {
+    LOG(ERROR) << "DataSinkStage cannot EnableSpill.";
+    return kInvalidArg;
+  }
+  ptr_spill_.reset(new (std::nothrow) ChunkSpillFile());  // NOLINT
+  if (!ptr_spill_) {
+    LOG(ERROR) << "cannot construct ChunkSpillFile.";
+    return kNoMemory;
+  }
+  const int status =
+      ptr_spill_->Init(directory, ChunkSpillFile::kDefaultSegmentSize);
+  if (status) {
+    LOG(ERROR) << "spill file Init failed: " << status;
+    ptr_spill_.reset();
+    return kInvalidArg;
+  }
+  max_queued_bytes_ = max_queued_bytes;
+  return kSuccess;
+}
+
+int DataSinkStage::Write(const ChunkInfo& info,
+                         const uint8* ptr_data,
+                         int32 data_length) {
+  if (!ptr_data || data_length <= 0) {
+    LOG(ERROR) << "DataSinkStage cannot Write empty chunk.";
+    return kInvalidArg;
+  }
+  if (ptr_spill_) {
+    // Leave spill mode only once the sink has read every spilled chunk, so
+    // that queued chunks never overtake spilled ones.
+    if (spilling_ && ptr_spill_->empty()) {
+      LOG(INFO) << "DataSinkStage spill file drained.";
+      spilling_ = false;
+    }
+    if (!spilling_ &&
+        (queue_.full() || queued_bytes_ + data_length > max_queued_bytes_)) {
+      LOG(WARNING) << "DataSinkStage spilling chunks to disk.";
+      spilling_ = true;
+    }
+    if (spilling_) {
+      if (ptr_spill_->Append(info, ptr_data, data_length) ==
+          ChunkSpillFile::kSuccess) {
+        spill_failed_ = false;
+        VLOG(4) << "DataSinkStage spilled " << data_length << " bytes, "
+                << ptr_spill_->size() << " bytes on disk.";
+        return kSuccess;
+      }
+      LOG(WARNING) << "DataSinkStage cannot spill chunk.";
+      spill_failed_ = true;
+      spill_failed_size_ = ptr_spill_->size();
+      if (!ptr_spill_->empty()) {
+        return kFull;
+      }
+      // Nothing spilled; queued chunks cannot overtake anything.
+      spilling_ = false;
+    }
+  }
+  if (queue_.full()) {
+    return kFull;
+  }
+  write_chunk_.info = info;
+  write_chunk_.data.assign(ptr_data, ptr_data + data_length);
+  if (queue_.TryPush(&write_chunk_)) {
+    return kFull;
+  }
+  queued_bytes_ += data_length;
+  VLOG(4) << "DataSinkStage queued " << data_length << " bytes.";
+  return kSuccess;
+}
+
+bool DataSinkStage::full() const {
+  if (!ptr_spill_) {
+    return queue_.full();
+  }
+  if (!spill_failed_) {
+    return false;
+  }
+  // Retry the spill file once the sink has read some of it back.
+  if (!ptr_spill_->empty()) {
+    return ptr_spill_->size() >= spill_failed_size_;
+  }
+  return queue_.full();
+}
+
+// Queued chunks are always older than spilled chunks.
+int DataSinkStage::Process(bool* ptr_did_work) {
+  *ptr_did_work = false;
+  if (!ptr_sink_->Ready()) {
+    return kSuccess;
+  }
+  int status = kSuccess;
+  if (queue_.TryPop(&sink_chunk_) == kSuccess) {
+    *ptr_did_work = true;
+    status = WriteChunk();
+  } else if (ptr_spill_ && !ptr_spill_->empty()) {
+    *ptr_did_work = true;
+    status = WriteSpilledChunk();
+  }
+  if (*ptr_did_work && ptr_space_callback_) {
+    ptr_space_callback_->OnSinkSpaceAvailable();
+  }
+  return status;
+}
+
+int DataSinkStage::Drain() {
+  while (queue_.TryPop(&sink_chunk_) == kSuccess) {
+    while (!ptr_sink_->Ready()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const int status = WriteChunk();
+    if (status) {
+      return status;
+    }
+  }
+  while (ptr_spill_ && !ptr_spill_->empty()) {
+    while (!ptr_sink_->Ready()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const int status = WriteSpilledChunk();
+    if (status) {
+      return status;
+    }
+  }
+  return kSuccess;
+}
+
+int DataSinkStage::WriteChunk() {
+  const int32 length = static_cast<int32>(sink_chunk_.data.size());
+  queued_bytes_ -= length;
+  if (!ptr_sink_->WriteChunk(sink_chunk_.info, &sink_chunk_.data[0], length)) {
+    LOG(ERROR) << "data sink write failed!";
+    return kSinkError;
+  }
+  return kSuccess;
+}
+
+// The sink reads the chunk straight from the spill file mapping.
+int DataSinkStage::WriteSpilledChunk() {
+  ChunkInfo info;
+  const uint8* ptr_data = NULL;
+  int32 length = 0;
+  if (ptr_spill_->Front(&info, &ptr_data, &length)) {
+    return kSuccess;
+  }
+  if (!ptr_sink_->WriteChunk(info, ptr_data, length)) {
+    LOG(ERROR) << "data sink write failed!";
+    return kSinkError;
+  }
+  ptr_spill_->Pop();
+  return kSuccess;
+}
+
+}  // namespace webmlive
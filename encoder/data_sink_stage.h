@@ -0,0 +1,131 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_DATA_SINK_STAGE_H_
+#define WEBMLIVE_ENCODER_DATA_SINK_STAGE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/encoder_base.h"
+#include "encoder/pipeline_stage.h"
+#include "encoder/spsc_queue.h"
+
+namespace webmlive {
+
+class ChunkSpillFile;
+
+// Interface called by |DataSinkStage| on the sink stage thread each time it
+// passes a chunk to the sink, which makes room for another |Write()|.
+class SinkSpaceCallbackInterface {
+ public:
+  virtual ~SinkSpaceCallbackInterface() {}
+  virtual void OnSinkSpaceAvailable() = 0;
+};
+
+// Pipeline stage that owns all writes to a |DataSinkInterface|. The mux stage
+// hands chunks to |Write()|, and the sink stage thread passes them to the sink
+// whenever it reports ready, so a slow upload no longer stalls muxing.
+//
+// Notes:
+// - |Write()| must only be called from one thread.
+// - Chunks are copied once into queue storage that is reused across writes.
+// - After |EnableSpill()|, chunks that do not fit in the queue are appended
+//   to a memory-mapped spill file instead. Chunks keep their order: once a
+//   chunk is spilled, every following chunk is spilled too until the sink has
+//   read the spill file back to its end.
+// - When the spill file cannot take a chunk the stage falls back to the
+//   queue if nothing is spilled, and otherwise reports full until the sink
+//   has read some of the spill file back.
+class DataSinkStage : public PipelineStageInterface {
+ public:
+  enum {
+    kSinkError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+
+    // No queue or spill file space for another chunk. Not an error: retry
+    // the |Write()| once the sink has caught up.
+    kFull = 2,
+  };
+
+  // Default number of chunks queued ahead of the sink.
+  static const int kDefaultQueueLength = 8;
+
+  DataSinkStage();
+  virtual ~DataSinkStage();
+
+  // Stores |ptr_sink| and allocates a queue of |queue_length| chunks. Returns
+  // |kSuccess| when successful.
+  int Init(DataSinkInterface* ptr_sink, int queue_length);
+
+  // Spills chunks to segment files in |directory| once the queue is full, or
+  // once it holds |max_queued_bytes| bytes. Must be called after |Init()|,
+  // and before the first |Write()|.
+  int EnableSpill(const std::string& directory, int64 max_queued_bytes);
+
+  // Queues a copy of |data_length| bytes from |ptr_data|, described by |info|,
+  // for the sink. Returns |kFull| when |queue_length| chunks are already
+  // waiting and spilling is disabled, or when the spill file cannot grow and
+  // already holds chunks.
+  int Write(const ChunkInfo& info, const uint8* ptr_data, int32 data_length);
+
+  // Returns true when |Write()| would return |kFull|.
+  bool full() const;
+
+  // Sets the callback notified after each chunk |Process()| passes to the
+  // sink. Must be called before the stage starts.
+  void set_space_callback(SinkSpaceCallbackInterface* ptr_callback) {
+    ptr_space_callback_ = ptr_callback;
+  }
+
+  // |PipelineStageInterface| methods. |Process()| writes one chunk when the
+  // sink is ready. |Drain()| waits for the sink and writes all queued chunks.
+  virtual int Process(bool* ptr_did_work);
+  virtual int Drain();
+
+ private:
+  struct QueuedChunk {
+    ChunkInfo info;
+    std::vector<uint8> data;
+  };
+
+  // Passes |sink_chunk_| to |ptr_sink_|.
+  int WriteChunk();
+
+  // Passes the oldest spilled chunk to |ptr_sink_|, and removes it from
+  // |ptr_spill_| when the sink accepts it.
+  int WriteSpilledChunk();
+
+  DataSinkInterface* ptr_sink_;
+  SinkSpaceCallbackInterface* ptr_space_callback_;
+  SpscQueue<QueuedChunk> queue_;
+
+  // Producer and consumer side chunk storage, swapped with queue slots.
+  QueuedChunk write_chunk_;
+  QueuedChunk sink_chunk_;
+
+  // Spill state. |spilling_|, |spill_failed_| and |spill_failed_size_| are
+  // only used by the writing thread. |spill_failed_size_| is the spill file
+  // size when an append last failed.
+  std::unique_ptr<ChunkSpillFile> ptr_spill_;
+  int64 max_queued_bytes_;
+  std::atomic<int64> queued_bytes_;
+  bool spilling_;
+  bool spill_failed_;
+  int64 spill_failed_size_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(DataSinkStage);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_DATA_SINK_STAGE_H_
@@ -0,0 +1,156 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/data_sink_stage.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const int kQueueLength = 2;
+const int32 kChunkLength = 100;
+
+// Records the number and first byte of each chunk written while |ready| is
+// set.
+class FakeSink : public DataSinkInterface {
+ public:
+  FakeSink() : ready(false) {}
+  virtual bool Ready() const { return ready; }
+  virtual bool WriteData(const uint8*, int32) { return false; }
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length) {
+    if (!ready || data_length != kChunkLength ||
+        ptr_data[0] != static_cast<uint8>(info.number)) {
+      return false;
+    }
+    numbers.push_back(info.number);
+    return true;
+  }
+
+  bool ready;
+  std::vector<int64> numbers;
+};
+
+class CountingCallback : public SinkSpaceCallbackInterface {
+ public:
+  CountingCallback() : calls(0) {}
+  virtual void OnSinkSpaceAvailable() { ++calls; }
+  int calls;
+};
+
+class DataSinkStageTest : public ::testing::Test {
+ protected:
+  DataSinkStageTest() : next_number_(0) {}
+
+  void InitStage() {
+    ASSERT_EQ(DataSinkStage::kSuccess, stage_.Init(&sink_, kQueueLength));
+    stage_.set_space_callback(&callback_);
+  }
+
+  // Writes the next chunk, filled with its number, and returns the status.
+  int WriteNext() {
+    ChunkInfo info;
+    info.number = next_number_;
+    const std::vector<uint8> data(kChunkLength,
+                                  static_cast<uint8>(next_number_));
+    const int status = stage_.Write(info, &data[0], kChunkLength);
+    if (status == DataSinkStage::kSuccess) {
+      ++next_number_;
+    }
+    return status;
+  }
+
+  // Runs |Process()| |count| times, expecting each call to write a chunk.
+  void Process(int count) {
+    for (int i = 0; i < count; ++i) {
+      bool did_work = false;
+      ASSERT_EQ(DataSinkStage::kSuccess, stage_.Process(&did_work));
+      EXPECT_TRUE(did_work);
+    }
+  }
+
+  // Expects the sink to have received chunks 0 to |next_number_| in order.
+  void ExpectChunksInOrder() {
+    ASSERT_EQ(static_cast<size_t>(next_number_), sink_.numbers.size());
+    for (int64 i = 0; i < next_number_; ++i) {
+      EXPECT_EQ(i, sink_.numbers[static_cast<size_t>(i)]);
+    }
+  }
+
+  FakeSink sink_;
+  CountingCallback callback_;
+  DataSinkStage stage_;
+  int64 next_number_;
+};
+
+TEST_F(DataSinkStageTest, InvalidArgs) {
+  EXPECT_EQ(DataSinkStage::kInvalidArg, stage_.Init(NULL, kQueueLength));
+  EXPECT_EQ(DataSinkStage::kInvalidArg, stage_.EnableSpill(".", 1));
+  InitStage();
+  EXPECT_EQ(DataSinkStage::kInvalidArg, stage_.EnableSpill(".", 0));
+  EXPECT_EQ(DataSinkStage::kInvalidArg, stage_.EnableSpill("", 1));
+  ChunkInfo info;
+  EXPECT_EQ(DataSinkStage::kInvalidArg, stage_.Write(info, NULL, 1));
+}
+
+// Without a spill file, writes fail with |kFull| until the sink takes a
+// chunk, and each chunk passed to the sink notifies the space callback.
+TEST_F(DataSinkStageTest, QueueFull) {
+  InitStage();
+  for (int i = 0; i < kQueueLength; ++i) {
+    EXPECT_EQ(DataSinkStage::kSuccess, WriteNext());
+  }
+  EXPECT_TRUE(stage_.full());
+  EXPECT_EQ(DataSinkStage::kFull, WriteNext());
+
+  bool did_work = true;
+  ASSERT_EQ(DataSinkStage::kSuccess, stage_.Process(&did_work));
+  EXPECT_FALSE(did_work);
+  EXPECT_EQ(0, callback_.calls);
+
+  sink_.ready = true;
+  Process(1);
+  EXPECT_EQ(1, callback_.calls);
+  EXPECT_FALSE(stage_.full());
+  EXPECT_EQ(DataSinkStage::kSuccess, WriteNext());
+  ASSERT_EQ(DataSinkStage::kSuccess, stage_.Drain());
+  ExpectChunksInOrder();
+}
+
+// Chunks that do not fit in the queue are spilled, and reach the sink after
+// the queued ones, even when more chunks are written while the spill file is
+// read back.
+TEST_F(DataSinkStageTest, SpillKeepsOrder) {
+  InitStage();
+  ASSERT_EQ(DataSinkStage::kSuccess, stage_.EnableSpill(".", 1024 * 1024));
+  const int kNumChunks = 10;
+  for (int i = 0; i < kNumChunks; ++i) {
+    EXPECT_EQ(DataSinkStage::kSuccess, WriteNext());
+    EXPECT_FALSE(stage_.full());
+  }
+
+  sink_.ready = true;
+  Process(kNumChunks / 2);
+  EXPECT_EQ(kNumChunks / 2, callback_.calls);
+  for (int i = 0; i < kNumChunks; ++i) {
+    EXPECT_EQ(DataSinkStage::kSuccess, WriteNext());
+  }
+  ASSERT_EQ(DataSinkStage::kSuccess, stage_.Drain());
+  ExpectChunksInOrder();
+
+  // Once the spill file is drained, chunks are queued again.
+  EXPECT_EQ(DataSinkStage::kSuccess, WriteNext());
+  Process(1);
+  ExpectChunksInOrder();
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -0,0 +1,294 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/dvr_ring.h"
+
+#include <algorithm>
+#include <new>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+DvrRing::DvrRing() : next_sequence_(0), last_evicted_sequence_(-1) {
+  std::fill(metadata_sequence_, metadata_sequence_ + kNumTracks, -1);
+  std::fill(keyframe_sequence_, keyframe_sequence_ + kNumTracks, -1);
+  std::fill(in_cluster_, in_cluster_ + kNumTracks, false);
+  std::fill(last_number_, last_number_ + kNumTracks, 0);
+}
+
+DvrRing::~DvrRing() {
+}
+
+int DvrRing::Init(const DvrConfig& config) {
+  if (config.duration <= 0 || config.max_size <= 0) {
+    LOG(ERROR) << "invalid DVR limits: duration=" << config.duration
+               << " max_size=" << config.max_size;
+    return kInvalidArg;
+  }
+  config_ = config;
+  return kSuccess;
+}
+
+int DvrRing::ReadLiveStart(ChunkInfo::Track track,
+                           DvrChunkList* ptr_chunks,
+                           int64* ptr_next_sequence) const {
+  if (!ptr_chunks || !ptr_next_sequence || track < 0 || track >= kNumTracks) {
+    LOG(ERROR) << "invalid ReadLiveStart argument.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (keyframe_sequence_[track] < 0 || !metadata_[track]) {
+    return kNoKeyframe;
+  }
+  ReadFromIndex(track, IndexOf(keyframe_sequence_[track]), ptr_chunks,
+                ptr_next_sequence);
+  return kSuccess;
+}
+
+int DvrRing::ReadFrom(ChunkInfo::Track track,
+                      int64 time,
+                      DvrChunkList* ptr_chunks,
+                      int64* ptr_next_sequence) const {
+  if (!ptr_chunks || !ptr_next_sequence || track < 0 || track >= kNumTracks) {
+    LOG(ERROR) << "invalid ReadFrom argument.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!metadata_[track]) {
+    return kNoKeyframe;
+  }
+
+  // Only clusters written after the track's metadata chunk can follow it.
+  bool found = false;
+  size_t start_index = 0;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const Entry& entry = entries_[i];
+    if (!entry.keyframe_start || entry.chunk->info.track != track ||
+        entry.sequence < metadata_sequence_[track]) {
+      continue;
+    }
+    if (found && entry.chunk->info.start_time > time) {
+      break;
+    }
+    found = true;
+    start_index = i;
+  }
+  if (!found) {
+    return kNoKeyframe;
+  }
+  ReadFromIndex(track, start_index, ptr_chunks, ptr_next_sequence);
+  return kSuccess;
+}
+
+int DvrRing::ReadNewChunks(ChunkInfo::Track track,
+                           int64* ptr_sequence,
+                           DvrChunkList* ptr_chunks) const {
+  if (!ptr_sequence || !ptr_chunks || track < 0 || track >= kNumTracks) {
+    LOG(ERROR) << "invalid ReadNewChunks argument.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int64 sequence = *ptr_sequence;
+  if (sequence <= last_evicted_sequence_) {
+    return kOverrun;
+  }
+  if (metadata_[track] && metadata_sequence_[track] >= sequence) {
+    ptr_chunks->push_back(metadata_[track]);
+  }
+  for (size_t i = IndexOf(sequence); i < entries_.size(); ++i) {
+    if (entries_[i].chunk->info.track == track) {
+      ptr_chunks->push_back(entries_[i].chunk);
+    }
+  }
+  *ptr_sequence = next_sequence_;
+  return kSuccess;
+}
+
+int DvrRing::ReadSegment(ChunkInfo::Track track,
+                         int64 number,
+                         DvrChunkList* ptr_chunks,
+                         int64* ptr_next_sequence) const {
+  if (!ptr_chunks || !ptr_next_sequence || track < 0 || track >= kNumTracks) {
+    LOG(ERROR) << "invalid ReadSegment argument.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  *ptr_next_sequence = next_sequence_;
+  if (number == last_number_[track] + 1 && !in_cluster_[track]) {
+    return kPending;
+  }
+
+  // Chunk numbers increase within a track, so the search runs from the
+  // newest chunk back to the first chunk of the segment.
+  size_t index = entries_.size();
+  for (size_t i = entries_.size(); i > 0; --i) {
+    const ChunkInfo& info = entries_[i - 1].chunk->info;
+    if (info.track != track) {
+      continue;
+    }
+    if (info.number < number) {
+      break;
+    }
+    if (info.number == number) {
+      index = i - 1;
+    }
+  }
+  if (index == entries_.size() || !entries_[index].cluster_start) {
+    return kNotFound;
+  }
+  for (size_t i = index; i < entries_.size(); ++i) {
+    const DvrChunkPtr& chunk = entries_[i].chunk;
+    if (chunk->info.track != track) {
+      continue;
+    }
+    if (chunk->info.number != number) {
+      break;
+    }
+    ptr_chunks->push_back(chunk);
+  }
+  return kSuccess;
+}
+
+DvrChunkPtr DvrRing::manifest() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return manifest_;
+}
+
+DvrChunkPtr DvrRing::metadata(ChunkInfo::Track track) const {
+  if (track < 0 || track >= kNumTracks) {
+    return DvrChunkPtr();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  return metadata_[track];
+}
+
+void DvrRing::GetStats(DvrStats* ptr_stats) const {
+  if (ptr_stats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *ptr_stats = stats_;
+  }
+}
+
+bool DvrRing::WriteData(const uint8* ptr_data, int32 data_length) {
+  ChunkInfo info;
+  return WriteChunk(info, ptr_data, data_length);
+}
+
+bool DvrRing::WriteChunk(const ChunkInfo& info,
+                         const uint8* ptr_data,
+                         int32 data_length) {
+  if (!ptr_data || data_length <= 0 || info.track < 0 ||
+      info.track >= kNumTracks) {
+    LOG(ERROR) << "DvrRing cannot write invalid chunk.";
+    return false;
+  }
+
+  // Copy the chunk before taking the lock, so that readers do not wait for
+  // the copy.
+  std::shared_ptr<DvrChunk> chunk(new (std::nothrow) DvrChunk());  // NOLINT
+  if (!chunk) {
+    LOG(ERROR) << "cannot allocate DVR chunk.";
+    return false;
+  }
+  chunk->info = info;
+  chunk->data.assign(ptr_data, ptr_data + data_length);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int64 sequence = next_sequence_++;
+  const ChunkInfo::Track track = info.track;
+  if (info.type == ChunkInfo::kManifest) {
+    manifest_ = chunk;
+    return true;
+  }
+  if (info.type == ChunkInfo::kMetadata) {
+    metadata_[track] = chunk;
+    metadata_sequence_[track] = sequence;
+    keyframe_sequence_[track] = -1;
+    in_cluster_[track] = false;
+    return true;
+  }
+
+  Entry entry;
+  entry.sequence = sequence;
+  entry.chunk = chunk;
+  entry.cluster_start = !in_cluster_[track];
+  entry.keyframe_start = entry.cluster_start && info.keyframe;
+  entries_.push_back(entry);
+  in_cluster_[track] = !info.complete;
+  last_number_[track] = info.number;
+  if (entry.keyframe_start) {
+    keyframe_sequence_[track] = sequence;
+  }
+
+  if (stats_.chunks == 0) {
+    stats_.start_time = info.start_time;
+  }
+  ++stats_.chunks;
+  stats_.bytes += data_length;
+  stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.bytes);
+  stats_.end_time =
+      std::max(stats_.end_time, info.start_time + info.duration);
+  Evict();
+  return true;
+}
+
+void DvrRing::Evict() {
+  int64 keep_sequence = next_sequence_;
+  for (int i = 0; i < kNumTracks; ++i) {
+    if (keyframe_sequence_[i] >= 0) {
+      keep_sequence = std::min(keep_sequence, keyframe_sequence_[i]);
+    }
+  }
+  while (!entries_.empty()) {
+    const Entry& entry = entries_.front();
+    const int64 time_span = stats_.end_time - entry.chunk->info.start_time;
+    if (entry.sequence >= keep_sequence ||
+        (time_span <= config_.duration && stats_.bytes <= config_.max_size)) {
+      break;
+    }
+    stats_.bytes -= static_cast<int64>(entry.chunk->data.size());
+    --stats_.chunks;
+    ++stats_.chunks_evicted;
+    last_evicted_sequence_ = entry.sequence;
+    entries_.pop_front();
+  }
+  if (!entries_.empty()) {
+    stats_.start_time = entries_.front().chunk->info.start_time;
+  }
+}
+
+void DvrRing::ReadFromIndex(ChunkInfo::Track track,
+                            size_t index,
+                            DvrChunkList* ptr_chunks,
+                            int64* ptr_next_sequence) const {
+  ptr_chunks->push_back(metadata_[track]);
+  for (size_t i = index; i < entries_.size(); ++i) {
+    if (entries_[i].chunk->info.track == track) {
+      ptr_chunks->push_back(entries_[i].chunk);
+    }
+  }
+  *ptr_next_sequence = next_sequence_;
+}
+
+// Sequence numbers increase along |entries_|, but skip the numbers of
+// manifest and metadata chunks.
+size_t DvrRing::IndexOf(int64 sequence) const {
+  size_t low = 0;
+  size_t high = entries_.size();
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    if (entries_[middle].sequence < sequence) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+}  // namespace webmlive
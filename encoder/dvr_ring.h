@@ -0,0 +1,230 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_DVR_RING_H_
+#define WEBMLIVE_ENCODER_DVR_RING_H_
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+struct DvrConfig {
+  // Default media time retained, in milliseconds.
+  static const int64 kDefaultDuration = 60000;
+
+  // Default bound on the chunk data retained, in bytes.
+  static const int64 kDefaultMaxSize = 64 * 1024 * 1024;
+
+  DvrConfig() : duration(kDefaultDuration), max_size(kDefaultMaxSize) {}
+
+  // Media time, in milliseconds, that chunks are retained. Older chunks are
+  // evicted.
+  int64 duration;
+
+  // Chunk data, in bytes, retained. Oldest chunks are evicted first.
+  int64 max_size;
+};
+
+// Chunk held by |DvrRing|. Readers share chunks with the ring, so chunks are
+// never copied out of it, and a chunk a reader holds outlives its eviction.
+struct DvrChunk {
+  ChunkInfo info;
+  std::vector<uint8> data;
+};
+typedef std::shared_ptr<const DvrChunk> DvrChunkPtr;
+typedef std::vector<DvrChunkPtr> DvrChunkList;
+
+struct DvrStats {
+  DvrStats()
+      : chunks(0),
+        bytes(0),
+        peak_bytes(0),
+        start_time(0),
+        end_time(0),
+        chunks_evicted(0) {}
+
+  // Media chunks and bytes retained, and the most bytes ever retained.
+  // Metadata and manifest chunks are not counted.
+  int64 chunks;
+  int64 bytes;
+  int64 peak_bytes;
+
+  // Media time span retained, in milliseconds.
+  int64 start_time;
+  int64 end_time;
+
+  int64 chunks_evicted;
+};
+
+// Data sink that retains the last |DvrConfig::duration| milliseconds of the
+// stream in memory, so that local consumers that join mid-stream start with
+// a decodable cluster instead of waiting for the next keyframe, and so that
+// they can rewind.
+//
+// Notes:
+// - Chunks are numbered in the order they are written. Readers read a start
+//   position, then follow the stream by sequence number with
+//   |ReadNewChunks()|.
+// - The latest metadata chunk of each track and the latest manifest are
+//   always kept. So are the chunks of the newest cluster of each track that
+//   starts with a keyframe (see |ChunkInfo::keyframe|), and the chunks after
+//   it, even when they take the ring past its limits.
+// - Reads return the chunks of one track; streams muxed into one WebM stream
+//   are read as |ChunkInfo::kAllTracks|.
+// - All methods are thread safe, and share one mutex. Readers hold it while
+//   they append the chunk pointers of their read to the caller's list, and
+//   writers while they link in a chunk copied beforehand, so a writer waits
+//   at most for one list of pointers, never for chunk data to be copied.
+class DvrRing : public DataSinkInterface {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+
+    // No cluster that starts with a keyframe is retained for the track.
+    kNoKeyframe = 1,
+
+    // Chunks after the sequence number passed to |ReadNewChunks()| have been
+    // evicted.
+    kOverrun = 2,
+
+    // No chunk of the media segment requested is retained.
+    kNotFound = 3,
+
+    // The media segment requested is the next one of its track, and has not
+    // been started.
+    kPending = 4,
+  };
+
+  DvrRing();
+  virtual ~DvrRing();
+
+  // Stores |config|. Returns |kSuccess| when successful.
+  int Init(const DvrConfig& config);
+
+  // Writes the metadata chunk of |track|, followed by the retained media
+  // chunks of |track| from the newest cluster that starts with a keyframe, to
+  // |ptr_chunks|. Sets |ptr_next_sequence| to the sequence number to pass to
+  // |ReadNewChunks()|. Returns |kNoKeyframe| when there is no such cluster.
+  int ReadLiveStart(ChunkInfo::Track track,
+                    DvrChunkList* ptr_chunks,
+                    int64* ptr_next_sequence) const;
+
+  // Same as |ReadLiveStart()|, but starts with the newest cluster that starts
+  // with a keyframe at or before |time| milliseconds, or with the oldest one
+  // retained when all start after |time|.
+  int ReadFrom(ChunkInfo::Track track,
+               int64 time,
+               DvrChunkList* ptr_chunks,
+               int64* ptr_next_sequence) const;
+
+  // Appends the chunks of |track| written since |*ptr_sequence| to
+  // |ptr_chunks|, and advances |*ptr_sequence| past them. Metadata chunks
+  // written since are included. Returns |kOverrun| when some of those chunks
+  // have been evicted; the reader must start again.
+  int ReadNewChunks(ChunkInfo::Track track,
+                    int64* ptr_sequence,
+                    DvrChunkList* ptr_chunks) const;
+
+  // Writes the retained chunks of media segment |number| of |track| to
+  // |ptr_chunks|, and sets |ptr_next_sequence| to the sequence number to pass
+  // to |ReadNewChunks()| for the rest of the segment. The segment is complete
+  // when its last chunk is. Returns |kNotFound| when the start of the segment
+  // is not retained, and |kPending| when the segment is the next one of
+  // |track|; |ptr_next_sequence| is set in both cases.
+  int ReadSegment(ChunkInfo::Track track,
+                  int64 number,
+                  DvrChunkList* ptr_chunks,
+                  int64* ptr_next_sequence) const;
+
+  // Returns the latest manifest chunk, or NULL when there is none.
+  DvrChunkPtr manifest() const;
+
+  // Returns the latest metadata chunk of |track|, or NULL when there is none.
+  DvrChunkPtr metadata(ChunkInfo::Track track) const;
+
+  // Copies the current memory use and time span to |ptr_stats|.
+  void GetStats(DvrStats* ptr_stats) const;
+
+  // DataSinkInterface methods. |WriteData()| treats data as a complete
+  // media chunk of muxed output.
+  virtual bool Ready() const { return true; }
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length);
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length);
+
+ private:
+  static const int kNumTracks = ChunkInfo::kVideoTrack + 1;
+
+  struct Entry {
+    int64 sequence;
+    DvrChunkPtr chunk;
+
+    // True for the first chunk of a cluster, and for the first chunk of a
+    // cluster that starts with a keyframe.
+    bool cluster_start;
+    bool keyframe_start;
+  };
+
+  // Evicts media chunks from the front of |entries_| while the ring is past
+  // its limits, stopping at the chunks that must be kept.
+  void Evict();
+
+  // Writes the chunks of |track| in |entries_| from |index| on to
+  // |ptr_chunks|, preceded by the track's metadata chunk, and sets
+  // |ptr_next_sequence|. |mutex_| must be held.
+  void ReadFromIndex(ChunkInfo::Track track,
+                     size_t index,
+                     DvrChunkList* ptr_chunks,
+                     int64* ptr_next_sequence) const;
+
+  // Returns the index in |entries_| of |sequence|. |mutex_| must be held.
+  size_t IndexOf(int64 sequence) const;
+
+  DvrConfig config_;
+  mutable std::mutex mutex_;
+
+  // Retained media chunks, oldest first.
+  std::deque<Entry> entries_;
+
+  // Sequence number of the next chunk written, and of the last chunk
+  // evicted.
+  int64 next_sequence_;
+  int64 last_evicted_sequence_;
+
+  // Latest metadata chunk of each track, and the sequence number it was
+  // written with.
+  DvrChunkPtr metadata_[kNumTracks];
+  int64 metadata_sequence_[kNumTracks];
+  DvrChunkPtr manifest_;
+
+  // Sequence number of the first chunk of the newest cluster of each track
+  // that starts with a keyframe, or -1.
+  int64 keyframe_sequence_[kNumTracks];
+
+  // True while a cluster of the track is partly written.
+  bool in_cluster_[kNumTracks];
+
+  // Number of the newest media chunk of each track, or 0.
+  int64 last_number_[kNumTracks];
+
+  DvrStats stats_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(DvrRing);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_DVR_RING_H_
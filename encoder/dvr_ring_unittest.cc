@@ -0,0 +1,158 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/dvr_ring.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const int32 kChunkLength = 100;
+
+class DvrRingTest : public ::testing::Test {
+ protected:
+  DvrRingTest() : data_(kChunkLength, 0xAB), number_(0) {}
+
+  void WriteMetadata() {
+    ChunkInfo info;
+    info.type = ChunkInfo::kMetadata;
+    ASSERT_TRUE(ring_.WriteChunk(info, &data_[0], kChunkLength));
+  }
+
+  // Writes the next cluster, 1000 milliseconds long, as one complete chunk.
+  void WriteCluster(bool keyframe) {
+    ChunkInfo info;
+    info.keyframe = keyframe;
+    info.number = ++number_;
+    info.start_time = (number_ - 1) * 1000;
+    info.duration = 1000;
+    ASSERT_TRUE(ring_.WriteChunk(info, &data_[0], kChunkLength));
+  }
+
+  DvrRing ring_;
+  std::vector<uint8> data_;
+  int64 number_;
+};
+
+TEST_F(DvrRingTest, NoKeyframe) {
+  ASSERT_EQ(DvrRing::kSuccess, ring_.Init(DvrConfig()));
+  DvrChunkList chunks;
+  int64 sequence = 0;
+  EXPECT_EQ(DvrRing::kNoKeyframe,
+            ring_.ReadLiveStart(ChunkInfo::kAllTracks, &chunks, &sequence));
+  WriteMetadata();
+  WriteCluster(false);
+  EXPECT_EQ(DvrRing::kNoKeyframe,
+            ring_.ReadLiveStart(ChunkInfo::kAllTracks, &chunks, &sequence));
+  EXPECT_TRUE(chunks.empty());
+}
+
+// A live start begins with the metadata, then the newest cluster that starts
+// with a keyframe and everything after it.
+TEST_F(DvrRingTest, LiveStartsAtNewestKeyframe) {
+  ASSERT_EQ(DvrRing::kSuccess, ring_.Init(DvrConfig()));
+  WriteMetadata();
+  WriteCluster(true);
+  WriteCluster(false);
+  WriteCluster(true);
+  WriteCluster(false);
+  WriteCluster(false);
+
+  DvrChunkList chunks;
+  int64 sequence = 0;
+  ASSERT_EQ(DvrRing::kSuccess,
+            ring_.ReadLiveStart(ChunkInfo::kAllTracks, &chunks, &sequence));
+  ASSERT_EQ(4u, chunks.size());
+  EXPECT_EQ(ChunkInfo::kMetadata, chunks[0]->info.type);
+  EXPECT_EQ(3, chunks[1]->info.number);
+  EXPECT_EQ(5, chunks[3]->info.number);
+
+  // The reader follows the stream from where the live start ended.
+  chunks.clear();
+  WriteCluster(false);
+  ASSERT_EQ(DvrRing::kSuccess,
+            ring_.ReadNewChunks(ChunkInfo::kAllTracks, &sequence, &chunks));
+  ASSERT_EQ(1u, chunks.size());
+  EXPECT_EQ(6, chunks[0]->info.number);
+  chunks.clear();
+  ASSERT_EQ(DvrRing::kSuccess,
+            ring_.ReadNewChunks(ChunkInfo::kAllTracks, &sequence, &chunks));
+  EXPECT_TRUE(chunks.empty());
+}
+
+// A reader that falls behind eviction is told to start again, and can.
+TEST_F(DvrRingTest, Overrun) {
+  DvrConfig config;
+  config.max_size = 3 * kChunkLength;
+  ASSERT_EQ(DvrRing::kSuccess, ring_.Init(config));
+  WriteMetadata();
+  WriteCluster(true);
+
+  DvrChunkList chunks;
+  int64 sequence = 0;
+  ASSERT_EQ(DvrRing::kSuccess,
+            ring_.ReadLiveStart(ChunkInfo::kAllTracks, &chunks, &sequence));
+  for (int i = 0; i < 5; ++i) {
+    WriteCluster(true);
+  }
+  DvrStats stats;
+  ring_.GetStats(&stats);
+  EXPECT_LE(stats.bytes, config.max_size);
+  EXPECT_GT(stats.chunks_evicted, 0);
+
+  chunks.clear();
+  EXPECT_EQ(DvrRing::kOverrun,
+            ring_.ReadNewChunks(ChunkInfo::kAllTracks, &sequence, &chunks));
+  EXPECT_TRUE(chunks.empty());
+  ASSERT_EQ(DvrRing::kSuccess,
+            ring_.ReadLiveStart(ChunkInfo::kAllTracks, &chunks, &sequence));
+  ASSERT_EQ(2u, chunks.size());
+  EXPECT_EQ(6, chunks[1]->info.number);
+}
+
+// The newest keyframe cluster and the chunks after it are kept even when
+// they exceed the limits.
+TEST_F(DvrRingTest, KeepsNewestKeyframeCluster) {
+  DvrConfig config;
+  config.max_size = kChunkLength;
+  ASSERT_EQ(DvrRing::kSuccess, ring_.Init(config));
+  WriteMetadata();
+  WriteCluster(true);
+  WriteCluster(false);
+  WriteCluster(false);
+
+  DvrChunkList chunks;
+  int64 sequence = 0;
+  ASSERT_EQ(DvrRing::kSuccess,
+            ring_.ReadLiveStart(ChunkInfo::kAllTracks, &chunks, &sequence));
+  ASSERT_EQ(4u, chunks.size());
+  EXPECT_EQ(1, chunks[1]->info.number);
+}
+
+// Chunks a reader holds outlive their eviction.
+TEST_F(DvrRingTest, ReaderKeepsEvictedChunks) {
+  DvrConfig config;
+  config.max_size = kChunkLength;
+  ASSERT_EQ(DvrRing::kSuccess, ring_.Init(config));
+  WriteMetadata();
+  WriteCluster(true);
+  DvrChunkList chunks;
+  int64 sequence = 0;
+  ASSERT_EQ(DvrRing::kSuccess,
+            ring_.ReadLiveStart(ChunkInfo::kAllTracks, &chunks, &sequence));
+  WriteCluster(true);
+  WriteCluster(true);
+  ASSERT_EQ(2u, chunks.size());
+  EXPECT_EQ(1, chunks[1]->info.number);
+  EXPECT_EQ(static_cast<size_t>(kChunkLength), chunks[1]->data.size());
+}
+
+}  // namespace
+}  // namespace webmlive
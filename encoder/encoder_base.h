@@ -10,8 +10,11 @@
 
 #if _WIN32
 
+// Windows Vista or later is required: |LocalHttpServer| uses WSAPoll, and
+// |RecordingSink| uses SetFileInformationByHandle. Windows XP is no longer
+// supported.
 #ifndef _WIN32_WINNT
-#  define _WIN32_WINNT 0x0501  // WinXP
+#  define _WIN32_WINNT 0x0600
 #endif
 
 // Disable the max macro defined in the windows headers.
@@ -11,13 +11,22 @@
 #include <stdio.h>
 #include <tchar.h>
 
+#include <cctype>
+#include <fstream>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "encoder/buffer_util.h"
+#include "encoder/dvr_ring.h"
+#include "encoder/http_upload_engine.h"
 #include "encoder/http_uploader.h"
+#include "encoder/local_http_server.h"
+#include "encoder/recording_sink.h"
+#include "encoder/segment_directory_sink.h"
+#include "encoder/tee_sink.h"
 #include "encoder/webm_encoder.h"
+#include "encoder/worker_pool.h"
 #include "glog/logging.h"
 
 namespace {
@@ -33,17 +42,72 @@ const std::string kMetadataQueryFragment = "&metadata=1";
 const std::string kWebmItagQueryFragment = "&itag=43";
 const std::string kCodecVp8 = "vp8";
 const std::string kCodecVp9 = "vp9";
+const std::string kCodecOpus = "opus";
+const std::string kCodecVorbis = "vorbis";
+const std::string kResampleLinear = "linear";
+const std::string kResampleMedium = "medium";
+const std::string kResampleHigh = "high";
+const std::string kSyncNone = "none";
+const std::string kSyncSegments = "segments";
+const std::string kSyncAll = "all";
+const std::string kSplitKeyframe = "keyframe";
+const std::string kSplitAny = "any";
+const std::string kPriorityLow = "low";
+const std::string kPriorityNormal = "normal";
+const std::string kPriorityHigh = "high";
 typedef std::vector<std::string> StringVector;
 
 struct WebmEncoderClientConfig {
   // Target for HTTP POSTs.
   std::string target_url;
 
+  // Optional second target. Chunks are uploaded to both targets; the backup
+  // upload drops clusters when it falls behind, and never holds the encoder.
+  std::string backup_url;
+
   // Uploader settings.
   webmlive::HttpUploaderSettings uploader_settings;
 
+  // Run uploads through an |HttpUploadEngine| limited to |upload_connections|
+  // connections instead of on the uploader thread.
+  bool use_upload_engine;
+  int upload_connections;
+
+  // Segment directory settings. Chunks are written to files instead of
+  // uploaded when |segment_config.directory| is non-empty.
+  webmlive::SegmentDirectoryConfig segment_config;
+
+  // Local recording settings. Uploaded chunks are also recorded to files
+  // when |recording_config.directory| is non-empty.
+  webmlive::RecordingConfig recording_config;
+
+  // In-memory DVR settings. The last |dvr_config.duration| milliseconds of
+  // the stream are retained in memory when |use_dvr| is true.
+  bool use_dvr;
+  webmlive::DvrConfig dvr_config;
+
+  // Embedded HTTP server settings. The stream the DVR ring retains is served
+  // to local clients when |use_http_server| is true. Chunks are only served,
+  // not uploaded, when |target_url| is empty.
+  bool use_http_server;
+  webmlive::LocalHttpServerConfig server_config;
+
+  // Stream host settings. Each line of |host_file| holds the options of one
+  // stream; all streams run in this process, on |num_workers| shared worker
+  // threads, or one per core when |num_workers| is 0.
+  std::string host_file;
+  int num_workers;
+
   // WebM encoder settings.
   webmlive::WebmEncoderConfig enc_config;
+
+  WebmEncoderClientConfig()
+      : use_upload_engine(false),
+        upload_connections(
+            webmlive::HttpUploadEngine::kDefaultMaxConnections),
+        use_dvr(false),
+        use_http_server(false),
+        num_workers(0) {}
 };
 
 }  // anonymous namespace
@@ -63,21 +127,124 @@ void usage(const char** argv) {
   printf("                                   used.\n");
   printf("    --form_post                    Send WebM chunks as file data\n");
   printf("                                   in a form (a la RFC 1867).\n");
+  printf("    --stream_post                  Send the stream in one chunked\n");
+  printf("                                   HTTP POST.\n");
+  printf("    --stream_put                   Send the stream in one chunked\n");
+  printf("                                   HTTP PUT.\n");
   printf("    --stream_id <stream ID>        Stream ID to include in POST\n");
   printf("                                   query string.\n");
   printf("    --stream_name <stream name>    Stream name to include in POST\n");
   printf("                                   query string.\n");
   printf("    --url <target URL>             Target for HTTP Posts.\n");
+  printf("    --backup_url <target URL>      Also upload to this target.\n");
+  printf("                                   Clusters are dropped for it\n");
+  printf("                                   when it falls behind.\n");
+  printf("    --upload_engine                Run uploads on a shared\n");
+  printf("                                   connection pool. Not for\n");
+  printf("                                   --stream_post/--stream_put.\n");
+  printf("    --upload_connections <count>   Connection limit for\n");
+  printf("                                   --upload_engine. The default\n");
+  printf("                                   is 16.\n");
+  printf("    --upload_attempts <count>      Attempts per chunk before it\n");
+  printf("                                   is dropped. The default is 5.\n");
+  printf("    --upload_resume                Resume partially sent chunks\n");
+  printf("                                   with a Content-Range header.\n");
+  printf("    --spill_dir <directory>        Keep chunks waiting for upload\n");
+  printf("                                   in files in this directory\n");
+  printf("                                   when the upload falls behind.\n");
+  printf("    --spill_threshold <MB>         Chunk data held in memory\n");
+  printf("                                   before spilling. The default\n");
+  printf("                                   is 16.\n");
+  printf("    --output_dir <directory>       Write the manifest and DASH\n");
+  printf("                                   segments to files in this\n");
+  printf("                                   directory instead of\n");
+  printf("                                   uploading them.\n");
+  printf("    --segment_window <segments>    Segments kept per track in\n");
+  printf("                                   --output_dir. The default, 0,\n");
+  printf("                                   keeps all segments.\n");
+  printf("    --fsync <policy>               Flush files to disk before\n");
+  printf("                                   publishing them: none,\n");
+  printf("                                   segments, or all. The\n");
+  printf("                                   default is none.\n");
+  printf("    --record_dir <directory>       Also record the stream to\n");
+  printf("                                   WebM files in this directory.\n");
+  printf("    --record_duration <sec>        Start a new recording file\n");
+  printf("                                   after this many seconds.\n");
+  printf("    --record_size <MB>             Start a new recording file\n");
+  printf("                                   after this many megabytes.\n");
+  printf("    --record_sync <ms>             Time between flushes of\n");
+  printf("                                   recording files to disk. The\n");
+  printf("                                   default, 0, flushes files\n");
+  printf("                                   when they are closed.\n");
+  printf("    --record_finalize              Rewrite each closed recording\n");
+  printf("                                   as a seekable WebM file with\n");
+  printf("                                   Cues.\n");
+  printf("    --dvr <sec>                    Keep this many seconds of the\n");
+  printf("                                   stream in memory.\n");
+  printf("    --dvr_size <MB>                Memory limit of --dvr. The\n");
+  printf("                                   default is 64.\n");
+  printf("    --http_port <port>             Serve the stream from memory\n");
+  printf("                                   over HTTP on this port. The\n");
+  printf("                                   URL is optional with this\n");
+  printf("                                   option.\n");
+  printf("    --http_address <address>       Address the HTTP server\n");
+  printf("                                   listens on. The default is\n");
+  printf("                                   127.0.0.1.\n");
+  printf("    --host <file>                  Run the streams listed in this\n");
+  printf("                                   file, one line of options per\n");
+  printf("                                   stream, in one process.\n");
+  printf("    --workers <count>              Worker threads shared by the\n");
+  printf("                                   --host streams. The default,\n");
+  printf("                                   0, runs one per core.\n");
+  printf("    --priority <priority>          Worker priority of a --host\n");
+  printf("                                   stream: low, normal, or high.\n");
+  printf("                                   The default is normal.\n");
   printf("    --vdev <video source name>     Video capture device name.\n");
   printf("    --vdevidx <source index>       Select video capture device by\n");
   printf("                                   index. Ignored when --vdev is\n");
   printf("                                   used.\n");
+  printf("    --low_latency                  Send partial clusters as soon\n");
+  printf("                                   as blocks are muxed.\n");
+  printf("    --native_clusters              Write clusters without\n");
+  printf("                                   libwebm. See mux_benchmark.\n");
+  printf("    --max_cluster_size <kB>        Split clusters that reach\n");
+  printf("                                   this size before the keyframe\n");
+  printf("                                   interval ends.\n");
+  printf("    --cluster_split <policy>       How full video clusters are\n");
+  printf("                                   split: keyframe, to request a\n");
+  printf("                                   keyframe, or any, to split at\n");
+  printf("                                   the next frame. The default\n");
+  printf("                                   is keyframe. With segment or\n");
+  printf("                                   recording output clusters\n");
+  printf("                                   only split at keyframes.\n");
+  printf("    --mux_reorder_window <ms>      Time packets wait for the\n");
+  printf("                                   other track before muxing.\n");
+  printf("                                   The default is 500.\n");
+  printf("    --per_track_output             Send audio and video as\n");
+  printf("                                   separate DASH streams.\n");
+  printf("    --dash_live                    Write a dynamic DASH manifest\n");
+  printf("                                   and update it after each\n");
+  printf("                                   segment.\n");
+  printf("    --dash_time_shift_depth <sec>  Time segments stay listed in\n");
+  printf("                                   the dynamic manifest. The\n");
+  printf("                                   default 0 lists all segments.\n");
   printf("  Audio source configuration options:\n");
   printf("    --adisable                     Disable audio capture.\n");
   printf("    --amanual                      Attempt manual configuration.\n");
   printf("    --achannels <channels>         Number of audio channels.\n");
   printf("    --arate <sample rate>          Audio sample rate.\n");
   printf("    --asize <sample size>          Audio bits per sample.\n");
+  printf("    --audio_codec <codec>          Audio codec, vorbis or opus.\n");
+  printf("                                   The default codec is vorbis.\n");
+  printf("                                   Opus defaults to 48000 Hz\n");
+  printf("                                   when --arate is not used.\n");
+  printf("  Audio conversion options:\n");
+  printf("    --aout_rate <sample rate>          Resample to this rate.\n");
+  printf("    --aout_channels <channels>         Mix to this channel count.\n");
+  printf("                                       Defaults to 2 when the\n");
+  printf("                                       source has more channels.\n");
+  printf("    --aresample_quality <quality>      linear, medium, or high.\n");
+  printf("                                       The default is medium.\n");
   printf("  Vorbis Encoder options:\n");
   printf("    --vorbis_bitrate <kbps>            Average bitrate.\n");
   printf("    --vorbis_minimum_bitrate <kbps>    Minimum bitrate.\n");
@@ -87,6 +254,11 @@ void usage(const char** argv) {
   printf("                                       bitrate.\n");
   printf("    --vorbis_iblock_bias <-15.0-0.0>   Impulse block bias.\n");
   printf("    --vorbis_lowpass_frequency <2-99>  Hard-low pass frequency.\n");
+  printf("  Opus Encoder options:\n");
+  printf("    --opus_bitrate <kbps>              Average bitrate.\n");
+  printf("    --opus_frame_duration <ms>         Frame duration: 2.5, 5,\n");
+  printf("                                       10, 20, 40, or 60.\n");
+  printf("    --opus_complexity <0-10>           Encoder complexity.\n");
   printf("  Video source configuration options:\n");
   printf("    --vdisable                         Disable video capture.");
   printf("    --vmanual                          Attempt manual\n");
@@ -186,6 +358,7 @@ void parse_command_line(int argc, const char** argv,
   webmlive::HttpUploaderSettings& uploader_settings = config.uploader_settings;
   webmlive::WebmEncoderConfig& enc_config = config.enc_config;
   config.uploader_settings.post_mode = webmlive::HTTP_POST;
+  bool user_sample_rate = false;
   for (int i = 1; i < argc; ++i) {
     if (!strcmp("-h", argv[i]) || !strcmp("-?", argv[i]) ||
         !strcmp("--help", argv[i])) {
@@ -193,6 +366,92 @@ void parse_command_line(int argc, const char** argv,
       exit(EXIT_SUCCESS);
     } else if (!strcmp("--url", argv[i]) && arg_has_value(i, argc, argv)) {
       config.target_url = argv[++i];
+    } else if (!strcmp("--backup_url", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.backup_url = argv[++i];
+    } else if (!strcmp("--upload_engine", argv[i])) {
+      config.use_upload_engine = true;
+    } else if (!strcmp("--upload_connections", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.upload_connections = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--upload_attempts", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.max_upload_attempts = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--upload_resume", argv[i])) {
+      uploader_settings.resume_uploads = true;
+    } else if (!strcmp("--spill_dir", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.spill_directory = argv[++i];
+    } else if (!strcmp("--spill_threshold", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.spill_threshold =
+          strtol(argv[++i], NULL, 10) * 1024LL * 1024LL;
+    } else if (!strcmp("--output_dir", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.segment_config.directory = argv[++i];
+    } else if (!strcmp("--segment_window", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.segment_config.segment_window = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--fsync", argv[i]) && arg_has_value(i, argc, argv)) {
+      const std::string policy = argv[++i];
+      if (policy == kSyncNone) {
+        config.segment_config.sync_policy =
+            webmlive::SegmentDirectoryConfig::kSyncNone;
+      } else if (policy == kSyncSegments) {
+        config.segment_config.sync_policy =
+            webmlive::SegmentDirectoryConfig::kSyncSegments;
+      } else if (policy == kSyncAll) {
+        config.segment_config.sync_policy =
+            webmlive::SegmentDirectoryConfig::kSyncAll;
+      } else {
+        LOG(WARNING) << "unknown fsync policy: " << policy;
+      }
+    } else if (!strcmp("--record_dir", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.recording_config.directory = argv[++i];
+    } else if (!strcmp("--record_duration", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.recording_config.max_file_duration =
+          strtol(argv[++i], NULL, 10) * 1000LL;
+    } else if (!strcmp("--record_size", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.recording_config.max_file_size =
+          strtol(argv[++i], NULL, 10) * 1024LL * 1024LL;
+    } else if (!strcmp("--record_sync", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.recording_config.sync_interval = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--record_finalize", argv[i])) {
+      config.recording_config.finalize = true;
+    } else if (!strcmp("--dvr", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.use_dvr = true;
+      config.dvr_config.duration = strtol(argv[++i], NULL, 10) * 1000LL;
+    } else if (!strcmp("--dvr_size", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.dvr_config.max_size =
+          strtol(argv[++i], NULL, 10) * 1024LL * 1024LL;
+    } else if (!strcmp("--http_port", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.use_http_server = true;
+      config.server_config.port = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--http_address", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.server_config.address = argv[++i];
+    } else if (!strcmp("--host", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.host_file = argv[++i];
+    } else if (!strcmp("--workers", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.num_workers = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--priority", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const std::string priority = argv[++i];
+      if (priority == kPriorityLow) {
+        enc_config.worker_priority = webmlive::WorkerPool::kLowPriority;
+      } else if (priority == kPriorityNormal) {
+        enc_config.worker_priority = webmlive::WorkerPool::kNormalPriority;
+      } else if (priority == kPriorityHigh) {
+        enc_config.worker_priority = webmlive::WorkerPool::kHighPriority;
+      } else {
+        LOG(WARNING) << "unknown priority: " << priority;
+      }
     } else if (!strcmp("--header", argv[i]) && arg_has_value(i, argc, argv)) {
       unparsed_headers.push_back(argv[++i]);
     } else if (!strcmp("--var", argv[i]) && arg_has_value(i, argc, argv)) {
@@ -212,9 +471,37 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--arate", argv[i]) && arg_has_value(i, argc, argv)) {
       enc_config.requested_audio_config.sample_rate =
           strtol(argv[++i], NULL, 10);
+      user_sample_rate = true;
     } else if (!strcmp("--asize", argv[i]) && arg_has_value(i, argc, argv)) {
       enc_config.requested_audio_config.bits_per_sample =
           static_cast<uint16>(strtol(argv[++i], NULL, 10));
+    } else if (!strcmp("--aout_rate", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.audio_conversion.sample_rate = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--aout_channels", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.audio_conversion.channels =
+          static_cast<uint16>(strtol(argv[++i], NULL, 10));
+    } else if (!strcmp("--aresample_quality", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      std::string quality_value = argv[++i];
+      if (quality_value == kResampleLinear)
+        enc_config.audio_conversion.quality = webmlive::kResamplerQualityLinear;
+      else if (quality_value == kResampleMedium)
+        enc_config.audio_conversion.quality = webmlive::kResamplerQualityMedium;
+      else if (quality_value == kResampleHigh)
+        enc_config.audio_conversion.quality = webmlive::kResamplerQualityHigh;
+      else
+        LOG(ERROR) << "Invalid --aresample_quality value: " << quality_value;
+    } else if (!strcmp("--audio_codec", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      std::string audio_codec_value = argv[++i];
+      if (audio_codec_value == kCodecVorbis)
+        enc_config.audio_codec = webmlive::kAudioFormatVorbis;
+      else if (audio_codec_value == kCodecOpus)
+        enc_config.audio_codec = webmlive::kAudioFormatOpus;
+      else
+        LOG(ERROR) << "Invalid --audio_codec value: " << audio_codec_value;
     } else if (!strcmp("--stream_name", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       uploader_settings.stream_name = argv[++i];
@@ -224,6 +511,36 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--form_post", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       uploader_settings.post_mode = webmlive::HTTP_FORM_POST;
+    } else if (!strcmp("--stream_post", argv[i])) {
+      uploader_settings.post_mode = webmlive::HTTP_STREAM_POST;
+    } else if (!strcmp("--stream_put", argv[i])) {
+      uploader_settings.post_mode = webmlive::HTTP_STREAM_PUT;
+    } else if (!strcmp("--low_latency", argv[i])) {
+      enc_config.low_latency = true;
+    } else if (!strcmp("--native_clusters", argv[i])) {
+      enc_config.native_clusters = true;
+    } else if (!strcmp("--max_cluster_size", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.max_cluster_size = strtol(argv[++i], NULL, 10) * 1024LL;
+    } else if (!strcmp("--cluster_split", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const std::string policy = argv[++i];
+      if (policy == kSplitKeyframe) {
+        enc_config.cluster_split_policy =
+            webmlive::WebmEncoderConfig::kSplitAtKeyframe;
+      } else if (policy == kSplitAny) {
+        enc_config.cluster_split_policy =
+            webmlive::WebmEncoderConfig::kSplitAtAnyFrame;
+      } else {
+        LOG(WARNING) << "unknown cluster split policy: " << policy;
+      }
+    } else if (!strcmp("--per_track_output", argv[i])) {
+      enc_config.per_track_output = true;
+    } else if (!strcmp("--dash_live", argv[i])) {
+      enc_config.dash_live_manifest = true;
+    } else if (!strcmp("--dash_time_shift_depth", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.dash_time_shift_buffer_depth = strtol(argv[++i], NULL, 10);
     } else if (!strcmp("--vdisable", argv[i])) {
       enc_config.disable_video = true;
     } else if (!strcmp("--vdev", argv[i]) && arg_has_value(i, argc, argv)) {
@@ -256,6 +573,18 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--vorbis_lowpass_frequency", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       enc_config.vorbis_config.lowpass_frequency = strtod(argv[++i], NULL);
+    } else if (!strcmp("--opus_bitrate", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.opus_config.bitrate = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--opus_frame_duration", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.opus_config.frame_duration = strtod(argv[++i], NULL);
+    } else if (!strcmp("--opus_complexity", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.opus_config.complexity = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--mux_reorder_window", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.mux_reorder_window = strtol(argv[++i], NULL, 10);
     } else if (!strcmp("--vpx_keyframe_interval", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       enc_config.vpx_config.keyframe_interval = strtol(argv[++i], NULL, 10);
@@ -336,6 +665,26 @@ void parse_command_line(int argc, const char** argv,
     }
   }
 
+  // Segment files and recordings must start with a keyframe, so clusters
+  // never split before one when either is written.
+  if (!config.segment_config.directory.empty() ||
+      !config.recording_config.directory.empty()) {
+    if (enc_config.cluster_split_policy ==
+        webmlive::WebmEncoderConfig::kSplitAtAnyFrame) {
+      LOG(WARNING) << "--cluster_split any ignored with segment or recording "
+                   << "output.";
+    }
+    enc_config.cluster_split_policy =
+        webmlive::WebmEncoderConfig::kSplitAtKeyframeOnly;
+  }
+
+  // 44100 Hz is not supported by libopus; request 48000 Hz unless the user
+  // asked for a specific rate.
+  if (enc_config.audio_codec == webmlive::kAudioFormatOpus &&
+      !user_sample_rate) {
+    enc_config.requested_audio_config.sample_rate = 48000;
+  }
+
   // Store user HTTP headers.
   store_string_map_entries(unparsed_headers, uploader_settings.headers);
 
@@ -344,8 +693,9 @@ void parse_command_line(int argc, const char** argv,
 }
 
 // Calls |Init| and |Run| on |uploader| to start the uploader thread, which
-// uploads buffers when |UploadBuffer| is called on the uploader.
+// uploads buffers to |url| when |UploadBuffer| is called on the uploader.
 int start_uploader(WebmEncoderClientConfig* ptr_config,
+                   const std::string& url,
                    webmlive::HttpUploader* ptr_uploader) {
   int status = ptr_uploader->Init(ptr_config->uploader_settings);
   if (status) {
@@ -353,28 +703,42 @@ int start_uploader(WebmEncoderClientConfig* ptr_config,
     return status;
   }
 
-  if (ptr_config->target_url.find('?') == std::string::npos) {
+  std::string target_url = url;
+  if (target_url.find('?') == std::string::npos) {
     // When the URL lacks a query string the URL must be reconstructed.
-    std::ostringstream url;
+    std::ostringstream query_url;
 
     // Rebuild it with query params included.
-    url << ptr_config->target_url
-        << "?ns=" << ptr_config->uploader_settings.stream_name
-        << "&id=" << ptr_config->uploader_settings.stream_id
-        << kAgentQueryFragment
-        << kWebmItagQueryFragment;
+    query_url << target_url
+              << "?ns=" << ptr_config->uploader_settings.stream_name
+              << "&id=" << ptr_config->uploader_settings.stream_id
+              << kAgentQueryFragment
+              << kWebmItagQueryFragment;
 
-    ptr_config->target_url = url.str();
+    target_url = query_url.str();
   }
 
   // Queue the target URLs.
   // Store the target for all but the first upload in |base_url|.
-  const std::string base_url = ptr_config->target_url;
+  const std::string base_url = target_url;
+
+  const webmlive::UploadMode post_mode =
+      ptr_config->uploader_settings.post_mode;
+  if (post_mode == webmlive::HTTP_STREAM_POST ||
+      post_mode == webmlive::HTTP_STREAM_PUT) {
+    // Metadata and clusters travel in the same request when streaming.
+    ptr_uploader->EnqueueTargetUrl(base_url);
+    status = ptr_uploader->Run();
+    if (status) {
+      LOG(ERROR) << "uploader Run failed, status=" << status;
+    }
+    return status;
+  }
 
   // Update the target URL to notify the server that the chunk in the first
   // upload is metadata.
-  ptr_config->target_url.append(kMetadataQueryFragment);
-  ptr_uploader->EnqueueTargetUrl(ptr_config->target_url);
+  target_url.append(kMetadataQueryFragment);
+  ptr_uploader->EnqueueTargetUrl(target_url);
 
   // Now add the URL that's used for all subsequent uploads.
   ptr_uploader->EnqueueTargetUrl(base_url);
@@ -387,78 +751,580 @@ int start_uploader(WebmEncoderClientConfig* ptr_config,
   return status;
 }
 
-int encoder_main(WebmEncoderClientConfig* ptr_config) {
-  webmlive::WebmEncoderConfig& enc_config = ptr_config->enc_config;
-  webmlive::HttpUploader uploader;
+// Logs the memory use of |dvr_ring|, and the connection counts of
+// |http_server| when |use_http_server| is true.
+void log_dvr_stats(const webmlive::DvrRing& dvr_ring,
+                   const webmlive::LocalHttpServer& http_server,
+                   bool use_http_server) {
+  webmlive::DvrStats dvr_stats;
+  dvr_ring.GetStats(&dvr_stats);
+  LOG(INFO) << "DVR: " << dvr_stats.chunks << " chunks, "
+            << dvr_stats.bytes << " bytes ("
+            << dvr_stats.peak_bytes << " peak), "
+            << dvr_stats.start_time << "-" << dvr_stats.end_time
+            << " ms, " << dvr_stats.chunks_evicted << " evicted";
+  if (use_http_server) {
+    webmlive::LocalHttpServerStats server_stats;
+    http_server.GetStats(&server_stats);
+    LOG(INFO) << "HTTP server: " << server_stats.requests << " requests, "
+              << server_stats.bytes_sent << " bytes sent, "
+              << server_stats.peak_connections << " peak connections, "
+              << server_stats.connections_dropped << " dropped";
+  }
+}
+
+// Initializes |ptr_dvr_ring|, and |ptr_http_server| when enabled. Stores the
+// sink that feeds them in |ptr_sink|.
+int init_dvr(WebmEncoderClientConfig* ptr_config,
+             webmlive::DvrRing* ptr_dvr_ring,
+             webmlive::LocalHttpServer* ptr_http_server,
+             webmlive::DataSinkInterface** ptr_sink) {
+  int status = ptr_dvr_ring->Init(ptr_config->dvr_config);
+  if (status) {
+    LOG(ERROR) << "DvrRing Init failed, status=" << status;
+    return status;
+  }
+  *ptr_sink = ptr_dvr_ring;
+  if (ptr_config->use_http_server) {
+    status = ptr_http_server->Init(ptr_config->server_config, ptr_dvr_ring);
+    if (status) {
+      LOG(ERROR) << "LocalHttpServer Init failed, status=" << status;
+      return status;
+    }
+    *ptr_sink = ptr_http_server;
+  }
+  return webmlive::DvrRing::kSuccess;
+}
+
+// Returns true when the upload settings in |config| can be used together.
+bool validate_upload_config(const WebmEncoderClientConfig& config) {
+  // Confirm |stream_id| and |stream_name| are present when no query string
+  // is present in |target_url|.
+  if ((config.uploader_settings.stream_id.empty() ||
+      config.uploader_settings.stream_name.empty()) &&
+      config.target_url.find('?') == std::string::npos) {
+    LOG(ERROR) << "stream_id and stream_name are required when the target "
+               << "URL lacks a query string!\n";
+    return false;
+  }
+
+  // Streaming modes send one WebM stream over one request.
+  const webmlive::UploadMode post_mode = config.uploader_settings.post_mode;
+  if (config.enc_config.per_track_output &&
+      (post_mode == webmlive::HTTP_STREAM_POST ||
+       post_mode == webmlive::HTTP_STREAM_PUT)) {
+    LOG(ERROR) << "per_track_output cannot be used with stream_post or "
+               << "stream_put!\n";
+    return false;
+  }
+  if (config.use_upload_engine &&
+      (post_mode == webmlive::HTTP_STREAM_POST ||
+       post_mode == webmlive::HTTP_STREAM_PUT)) {
+    LOG(ERROR) << "upload_engine cannot be used with stream_post or "
+               << "stream_put!\n";
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+// One stream: a |WebmEncoder| and the sinks it writes to. Chunks are written
+// to a |SegmentDirectorySink| when |segment_config.directory| is set, served
+// by a |LocalHttpServer| when only |use_http_server| is set, and uploaded
+// otherwise.
+class StreamSession {
+ public:
+  StreamSession();
+  ~StreamSession();
+
+  // Starts the sinks and the encoder. Starts an |HttpUploadEngine| for the
+  // stream when |use_upload_engine| is set and |uploader_settings.engine| is
+  // NULL. Returns |kSuccess| when successful.
+  int Start(const WebmEncoderClientConfig& config);
+
+  // Stops the encoder and the sinks started.
+  void Stop();
+
+  // Prints the encoded duration and the sink progress, without a newline.
+  void PrintStatus();
+
+  int64 encoded_duration() const { return encoder_.encoded_duration(); }
+
+ private:
+  // Sink setup for each output mode.
+  int InitDirectory();
+  int InitServer();
+  int InitUpload();
+
+  // Starts the sink threads.
+  int RunUpload();
+
+  WebmEncoderClientConfig config_;
+  bool started_;
+  bool use_directory_;
+  bool use_server_;
+  bool use_backup_;
+  bool use_recording_;
+  bool use_dvr_;
+  bool use_tee_;
+  webmlive::DataSinkInterface* ptr_sink_;
+
+  webmlive::HttpUploadEngine upload_engine_;
+  webmlive::HttpUploader uploader_;
+  webmlive::HttpUploader backup_uploader_;
+  webmlive::SegmentDirectorySink directory_sink_;
+  webmlive::RecordingSink recording_sink_;
+  webmlive::DvrRing dvr_ring_;
+  webmlive::LocalHttpServer http_server_;
+  webmlive::TeeSink tee_sink_;
+  webmlive::WebmEncoder encoder_;
+
+  // Components whose |Stop()| requires a successful |Run()|.
+  bool uploader_running_;
+  bool backup_running_;
+  bool encoder_running_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(StreamSession);
+};
+
+StreamSession::StreamSession()
+    : started_(false),
+      use_directory_(false),
+      use_server_(false),
+      use_backup_(false),
+      use_recording_(false),
+      use_dvr_(false),
+      use_tee_(false),
+      ptr_sink_(NULL),
+      uploader_running_(false),
+      backup_running_(false),
+      encoder_running_(false) {
+}
+
+StreamSession::~StreamSession() {
+  Stop();
+}
+
+int StreamSession::Start(const WebmEncoderClientConfig& config) {
+  config_ = config;
+  use_directory_ = !config_.segment_config.directory.empty();
+  use_server_ =
+      !use_directory_ && config_.target_url.empty() && config_.use_http_server;
+  started_ = true;
+
+  int status = kSuccess;
+  if (use_directory_) {
+    LOG(INFO) << "output directory: " << config_.segment_config.directory;
+    status = InitDirectory();
+  } else if (use_server_) {
+    status = InitServer();
+  } else {
+    LOG(INFO) << "url: " << config_.target_url.c_str();
+    status = InitUpload();
+  }
+  if (status) {
+    Stop();
+    return status;
+  }
 
   // Init the WebM encoder.
-  webmlive::WebmEncoder encoder;
-  int status = encoder.Init(enc_config, &uploader);
+  status = encoder_.Init(config_.enc_config, ptr_sink_);
   if (status) {
-    LOG(ERROR) << "WebmEncoder Run failed, status=" << status;
-    return EXIT_FAILURE;
+    LOG(ERROR) << "WebmEncoder Init failed, status=" << status;
+    Stop();
+    return status;
   }
 
-  // Start the uploader thread.
-  status = start_uploader(ptr_config, &uploader);
+  // Start the sink threads.
+  if (use_directory_) {
+    status = directory_sink_.Run();
+    if (status) {
+      LOG(ERROR) << "SegmentDirectorySink Run failed, status=" << status;
+    }
+  } else if (use_server_) {
+    status = http_server_.Run();
+    if (status) {
+      LOG(ERROR) << "LocalHttpServer Run failed, status=" << status;
+    }
+  } else {
+    status = RunUpload();
+  }
   if (status) {
-    LOG(ERROR) << "start_uploader failed, status=" << status;
-    return EXIT_FAILURE;
+    Stop();
+    return status;
   }
 
   // Start the WebM encoder.
-  status = encoder.Run();
+  status = encoder_.Run();
   if (status) {
     LOG(ERROR) << "start_encoder failed, status=" << status;
-    uploader.Stop();
-    return EXIT_FAILURE;
+    Stop();
+    return status;
+  }
+  encoder_running_ = true;
+  return kSuccess;
+}
+
+void StreamSession::Stop() {
+  if (!started_) {
+    return;
+  }
+  started_ = false;
+  if (encoder_running_) {
+    LOG(INFO) << "stopping encoder...";
+    encoder_.Stop();
+    encoder_running_ = false;
+  }
+  if (use_directory_) {
+    LOG(INFO) << "stopping segment writer...";
+    directory_sink_.Stop();
+    return;
+  }
+  tee_sink_.Stop();
+  recording_sink_.Stop();
+  if (use_server_) {
+    LOG(INFO) << "stopping HTTP server...";
+  }
+  http_server_.Stop();
+  if (uploader_running_) {
+    LOG(INFO) << "stopping uploader...";
+    uploader_.Stop();
+    uploader_running_ = false;
   }
+  if (backup_running_) {
+    backup_uploader_.Stop();
+    backup_running_ = false;
+  }
+  upload_engine_.Stop();
+  if (use_dvr_) {
+    log_dvr_stats(dvr_ring_, http_server_, config_.use_http_server);
+  }
+}
 
+void StreamSession::PrintStatus() {
+  const double duration = encoder_.encoded_duration() / 1000.0;
+  if (use_server_) {
+    webmlive::LocalHttpServerStats stats;
+    http_server_.GetStats(&stats);
+    printf("\rencoded duration: %04f seconds, connections: %I64d",
+           duration, stats.connections);
+    return;
+  }
   webmlive::HttpUploaderStats stats;
-  printf("\nPress the any key to quit...\n");
+  if (!use_directory_ &&
+      uploader_.GetStats(&stats) == webmlive::HttpUploader::kSuccess) {
+    printf("\rencoded duration: %04f seconds, uploaded: %I64d @ %d kBps, "
+           "lost chunks: %I64d",
+           duration,
+           stats.bytes_sent_current + stats.total_bytes_uploaded,
+           static_cast<int>(stats.bytes_per_second / 1000),
+           stats.chunks_lost);
+    return;
+  }
+  printf("\rencoded duration: %04f seconds", duration);
+}
 
-  while (!_kbhit()) {
-    // Output current duration and upload progress
-    if (uploader.GetStats(&stats) == webmlive::HttpUploader::kSuccess) {
-      printf("\rencoded duration: %04f seconds, uploaded: %I64d @ %d kBps",
-             (encoder.encoded_duration() / 1000.0),
-             stats.bytes_sent_current + stats.total_bytes_uploaded,
-             static_cast<int>(stats.bytes_per_second / 1000));
+int StreamSession::InitDirectory() {
+  const int status = directory_sink_.Init(config_.segment_config);
+  if (status) {
+    LOG(ERROR) << "SegmentDirectorySink Init failed, status=" << status;
+    return status;
+  }
+  ptr_sink_ = &directory_sink_;
+  return kSuccess;
+}
+
+int StreamSession::InitServer() {
+  use_dvr_ = true;
+  return init_dvr(&config_, &dvr_ring_, &http_server_, &ptr_sink_);
+}
+
+int StreamSession::InitUpload() {
+  use_backup_ = !config_.backup_url.empty();
+  use_recording_ = !config_.recording_config.directory.empty();
+  use_dvr_ = config_.use_dvr || config_.use_http_server;
+  use_tee_ = use_backup_ || use_recording_ || use_dvr_;
+  ptr_sink_ = &uploader_;
+  int status = kSuccess;
+
+  if (config_.use_upload_engine && !config_.uploader_settings.engine) {
+    status = upload_engine_.Init(config_.upload_connections);
+    if (status == webmlive::HttpUploadEngine::kSuccess) {
+      status = upload_engine_.Run();
     }
-    Sleep(100);
+    if (status) {
+      LOG(ERROR) << "upload engine start failed, status=" << status;
+      return status;
+    }
+    config_.uploader_settings.engine = &upload_engine_;
   }
 
-  LOG(INFO) << "stopping encoder...";
-  encoder.Stop();
-  LOG(INFO) << "stopping uploader...";
-  uploader.Stop();
+  if (!use_tee_) {
+    return kSuccess;
+  }
 
+  // The encoder waits for the primary target only.
+  status = tee_sink_.AddSink("primary", &uploader_,
+                             webmlive::TeeSink::kBackpressure,
+                             webmlive::TeeSink::kDefaultQueueLength);
+  if (status == webmlive::TeeSink::kSuccess && use_backup_) {
+    status = tee_sink_.AddSink("backup", &backup_uploader_,
+                               webmlive::TeeSink::kDrop,
+                               webmlive::TeeSink::kDefaultQueueLength);
+  }
+  if (status == webmlive::TeeSink::kSuccess && use_recording_) {
+    status = recording_sink_.Init(config_.recording_config);
+    if (status == webmlive::RecordingSink::kSuccess) {
+      status = tee_sink_.AddSink("recording", &recording_sink_,
+                                 webmlive::TeeSink::kDrop,
+                                 webmlive::TeeSink::kDefaultQueueLength);
+    }
+  }
+  if (status == webmlive::TeeSink::kSuccess && use_dvr_) {
+    webmlive::DataSinkInterface* ptr_dvr_sink = NULL;
+    status = init_dvr(&config_, &dvr_ring_, &http_server_, &ptr_dvr_sink);
+    if (status == webmlive::DvrRing::kSuccess) {
+      status = tee_sink_.AddSink("dvr", ptr_dvr_sink,
+                                 webmlive::TeeSink::kDrop,
+                                 webmlive::TeeSink::kDefaultQueueLength);
+    }
+  }
+  if (status) {
+    LOG(ERROR) << "TeeSink AddSink failed, status=" << status;
+    return status;
+  }
+  ptr_sink_ = &tee_sink_;
+  return kSuccess;
+}
+
+int StreamSession::RunUpload() {
+  // Start the uploader threads.
+  int status = start_uploader(&config_, config_.target_url, &uploader_);
+  uploader_running_ = status == webmlive::HttpUploader::kSuccess;
+  if (status == webmlive::HttpUploader::kSuccess && use_backup_) {
+    status = start_uploader(&config_, config_.backup_url, &backup_uploader_);
+    backup_running_ = status == webmlive::HttpUploader::kSuccess;
+  }
+  if (status == webmlive::HttpUploader::kSuccess && use_recording_) {
+    status = recording_sink_.Run();
+  }
+  if (status == webmlive::HttpUploader::kSuccess && config_.use_http_server) {
+    status = http_server_.Run();
+  }
+  if (status == webmlive::HttpUploader::kSuccess && use_tee_) {
+    status = tee_sink_.Run();
+  }
+  if (status) {
+    LOG(ERROR) << "start_uploader failed, status=" << status;
+  }
+  return status;
+}
+
+}  // anonymous namespace
+
+// Runs one stream until a key is pressed.
+int encoder_main(WebmEncoderClientConfig* ptr_config) {
+  StreamSession session;
+  if (session.Start(*ptr_config)) {
+    return EXIT_FAILURE;
+  }
+
+  printf("\nPress the any key to quit...\n");
+  while (!_kbhit()) {
+    session.PrintStatus();
+    Sleep(100);
+  }
+  session.Stop();
   return EXIT_SUCCESS;
 }
 
+// Splits |line| into arguments at whitespace. Double quotes group words into
+// one argument.
+StringVector split_host_line(const std::string& line) {
+  StringVector args;
+  std::string arg;
+  bool in_arg = false;
+  bool quoted = false;
+  for (size_t i = 0; i < line.size(); ++i) {
+    const char c = line[i];
+    if (c == '"') {
+      quoted = !quoted;
+      in_arg = true;
+    } else if (!quoted && isspace(static_cast<unsigned char>(c))) {
+      if (in_arg) {
+        args.push_back(arg);
+        arg.clear();
+        in_arg = false;
+      }
+    } else {
+      arg += c;
+      in_arg = true;
+    }
+  }
+  if (in_arg) {
+    args.push_back(arg);
+  }
+  return args;
+}
+
+// Reads the stream host file |file_name|, and stores one configuration per
+// stream in |ptr_configs|. Each line holds the command line options of one
+// stream. Blank lines and lines starting with # are skipped.
+int read_host_file(const std::string& file_name, const char* program_name,
+                   std::vector<WebmEncoderClientConfig>* ptr_configs) {
+  std::ifstream file(file_name.c_str());
+  if (!file) {
+    LOG(ERROR) << "cannot open stream host file: " << file_name;
+    return kInvalidArg;
+  }
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line)) {
+    ++line_number;
+    const StringVector args = split_host_line(line);
+    if (args.empty() || args[0][0] == '#') {
+      continue;
+    }
+    std::vector<const char*> argv;
+    argv.push_back(program_name);
+    for (size_t i = 0; i < args.size(); ++i) {
+      argv.push_back(args[i].c_str());
+    }
+    WebmEncoderClientConfig config;
+    parse_command_line(static_cast<int>(argv.size()), &argv[0], config);
+    if (config.segment_config.directory.empty() && config.target_url.empty() &&
+        !config.use_http_server) {
+      LOG(ERROR) << file_name << ":" << line_number
+                 << ": stream has no output.";
+      return kInvalidArg;
+    }
+    if (config.segment_config.directory.empty() &&
+        !config.target_url.empty() && !validate_upload_config(config)) {
+      LOG(ERROR) << file_name << ":" << line_number << ": invalid stream.";
+      return kInvalidArg;
+    }
+    ptr_configs->push_back(config);
+  }
+  if (ptr_configs->empty()) {
+    LOG(ERROR) << "no streams in stream host file: " << file_name;
+    return kInvalidArg;
+  }
+  return kSuccess;
+}
+
+// Runs the streams listed in |ptr_config->host_file| in one process. The
+// convert, encode, and sink stages of all streams share one |WorkerPool|, and
+// streams that use an upload engine share one |HttpUploadEngine|.
+int host_main(WebmEncoderClientConfig* ptr_config, const char* program_name) {
+  std::vector<WebmEncoderClientConfig> stream_configs;
+  int status = read_host_file(ptr_config->host_file, program_name,
+                              &stream_configs);
+  if (status) {
+    return EXIT_FAILURE;
+  }
+
+  webmlive::WorkerPool worker_pool;
+  status = worker_pool.Init(ptr_config->num_workers);
+  if (status == webmlive::WorkerPool::kSuccess) {
+    status = worker_pool.Run();
+  }
+  if (status) {
+    LOG(ERROR) << "worker pool start failed, status=" << status;
+    return EXIT_FAILURE;
+  }
+
+  bool use_upload_engine = false;
+  for (size_t i = 0; i < stream_configs.size(); ++i) {
+    use_upload_engine |= stream_configs[i].use_upload_engine;
+  }
+  webmlive::HttpUploadEngine upload_engine;
+  if (use_upload_engine) {
+    status = upload_engine.Init(ptr_config->upload_connections);
+    if (status == webmlive::HttpUploadEngine::kSuccess) {
+      status = upload_engine.Run();
+    }
+  }
+  if (status) {
+    LOG(ERROR) << "upload engine start failed, status=" << status;
+    worker_pool.Stop();
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::unique_ptr<StreamSession>> sessions;
+  for (size_t i = 0; i < stream_configs.size(); ++i) {
+    WebmEncoderClientConfig& config = stream_configs[i];
+    config.enc_config.worker_pool = &worker_pool;
+    if (config.use_upload_engine) {
+      config.uploader_settings.engine = &upload_engine;
+    }
+    std::unique_ptr<StreamSession> session(
+        new (std::nothrow) StreamSession());  // NOLINT
+    if (!session) {
+      LOG(ERROR) << "cannot construct stream session.";
+      status = kNoMemory;
+      break;
+    }
+    status = session->Start(config);
+    if (status) {
+      LOG(ERROR) << "stream " << i << " start failed, status=" << status;
+      break;
+    }
+    sessions.push_back(std::move(session));
+  }
+
+  if (!status) {
+    LOG(INFO) << "hosting " << sessions.size() << " streams on "
+              << worker_pool.num_workers() << " workers.";
+    printf("\nPress the any key to quit...\n");
+    while (!_kbhit()) {
+      printf("\rencoded duration:");
+      for (size_t i = 0; i < sessions.size(); ++i) {
+        printf(" %.1f", sessions[i]->encoded_duration() / 1000.0);
+      }
+      printf(" seconds");
+      Sleep(100);
+    }
+  }
+
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    sessions[i]->Stop();
+  }
+  upload_engine.Stop();
+  worker_pool.Stop();
+
+  webmlive::WorkerPoolStats pool_stats;
+  worker_pool.GetStats(&pool_stats);
+  LOG(INFO) << "worker pool: " << pool_stats.passes << " passes, "
+            << pool_stats.idle_passes << " idle, "
+            << pool_stats.steals << " steals";
+
+  return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, const char** argv) {
   google::InitGoogleLogging(argv[0]);
   WebmEncoderClientConfig config;
   parse_command_line(argc, argv, config);
 
-  // validate params
-  if (config.target_url.empty()) {
-    LOG(ERROR) << "The URL parameter is required!";
-    usage(argv);
-    return EXIT_FAILURE;
+  if (!config.host_file.empty()) {
+    const int exit_code = host_main(&config, argv[0]);
+    google::ShutdownGoogleLogging();
+    return exit_code;
   }
 
-  // Confirm |stream_id| and |stream_name| are present when no query string
-  // is present in |target_url|.
-  if ((config.uploader_settings.stream_id.empty() ||
-      config.uploader_settings.stream_name.empty()) &&
-      config.target_url.find('?') == std::string::npos) {
-    LOG(ERROR) << "stream_id and stream_name are required when the target "
-               << "URL lacks a query string!\n";
-    return EXIT_FAILURE;
+  // validate params
+  if (config.segment_config.directory.empty() &&
+      !(config.target_url.empty() && config.use_http_server)) {
+    if (config.target_url.empty()) {
+      LOG(ERROR) << "The URL parameter is required!";
+      usage(argv);
+      return EXIT_FAILURE;
+    }
+    if (!validate_upload_config(config)) {
+      return EXIT_FAILURE;
+    }
   }
 
-  LOG(INFO) << "url: " << config.target_url.c_str();
   int exit_code = encoder_main(&config);
   google::ShutdownGoogleLogging();
   return exit_code;
@@ -0,0 +1,466 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/http_upload_engine.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "curl/curl.h"
+#include "curl/multi.h"
+#include "glog/logging.h"
+
+#define LOG_CURLM_ERR(CURLM_ERR, MSG_STR) \
+  LOG(ERROR) << MSG_STR << " err=" << CURLM_ERR << ":" \
+             << curl_multi_strerror(CURLM_ERR)
+
+namespace webmlive {
+
+// Time |curl_multi_wait| waits for socket activity while transfers run.
+// Bounds the delay before transfers queued meanwhile are started.
+static const int kMultiWaitMilliseconds = 5;
+
+class HttpUploadEngineImpl {
+ public:
+  typedef HttpUploadEngine::Transfer Transfer;
+  enum {
+    kLibCurlError = HttpUploadEngine::kLibCurlError,
+    kInvalidStream = HttpUploadEngine::kInvalidStream,
+    kNoMemory = HttpUploadEngine::kNoMemory,
+    kInvalidArg = HttpUploadEngine::kInvalidArg,
+    kSuccess = HttpUploadEngine::kSuccess,
+  };
+
+  HttpUploadEngineImpl();
+  ~HttpUploadEngineImpl();
+
+  int Init(int max_connections);
+  int Run();
+  void Stop();
+  int AddStream(int* ptr_stream_id);
+  void RemoveStream(int stream_id);
+  int QueueTransfer(int stream_id, Transfer* ptr_transfer,
+                    int delay_milliseconds);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+  struct QueuedTransfer {
+    Transfer* ptr_transfer;
+
+    // Time before which the transfer must not start.
+    Clock::time_point start_time;
+  };
+  struct Stream {
+    Stream() : ptr_active(NULL) {}
+    std::deque<QueuedTransfer> transfers;
+
+    // Transfer added to |ptr_multi_|, or NULL.
+    Transfer* ptr_active;
+  };
+  typedef std::map<int, Stream> StreamMap;
+
+  // Returns true when a stream has transfers waiting. Requires |mutex_|.
+  bool TransfersQueued() const;
+
+  // Stores the earliest start time of the transfers waiting in idle streams
+  // in |ptr_start_time|. Returns false when no stream is waiting. Requires
+  // |mutex_|.
+  bool NextStartTime(Clock::time_point* ptr_start_time) const;
+
+  // Adds the next due transfer of each idle stream to |ptr_multi_| while fewer
+  // than |max_connections_| transfers run. Streams are visited in turn
+  // starting after |last_started_stream_|, so that no stream can starve the
+  // others. Transfers libcurl refuses go to |ptr_failed|. Requires |mutex_|.
+  void StartTransfers(std::vector<Transfer*>* ptr_failed);
+
+  // Removes finished transfers from |ptr_multi_| and reports them to their
+  // owners.
+  void FinishTransfers();
+
+  // Ends the active transfer of |stream_id| with |curl_code|.
+  void EndTransfer(int stream_id, Transfer* ptr_transfer, int curl_code);
+
+  // Engine thread function. Drives |ptr_multi_| until |Stop| is called and
+  // all queued transfers are done.
+  void EngineThread();
+
+  CURLM* ptr_multi_;
+  int max_connections_;
+
+  // State shared with the engine thread. All protected by |mutex_|.
+  StreamMap streams_;
+  int next_stream_id_;
+  int last_started_stream_;
+  int num_running_;
+  bool running_;
+  bool stop_;
+  std::mutex mutex_;
+
+  // Wakes the idle engine thread when transfers are queued or stop is
+  // requested.
+  std::condition_variable work_ready_;
+
+  // Signaled each time a transfer ends.
+  std::condition_variable transfer_done_;
+
+  std::shared_ptr<std::thread> engine_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(HttpUploadEngineImpl);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// HttpUploadEngine
+//
+
+HttpUploadEngine::HttpUploadEngine() {
+}
+
+HttpUploadEngine::~HttpUploadEngine() {
+}
+
+int HttpUploadEngine::Init(int max_connections) {
+  ptr_engine_.reset(new (std::nothrow) HttpUploadEngineImpl());  // NOLINT
+  if (!ptr_engine_) {
+    LOG(ERROR) << "can't construct HttpUploadEngineImpl.";
+    return kNoMemory;
+  }
+  return ptr_engine_->Init(max_connections);
+}
+
+int HttpUploadEngine::Run() {
+  return ptr_engine_->Run();
+}
+
+void HttpUploadEngine::Stop() {
+  if (ptr_engine_) {
+    ptr_engine_->Stop();
+  }
+}
+
+int HttpUploadEngine::AddStream(int* ptr_stream_id) {
+  return ptr_engine_->AddStream(ptr_stream_id);
+}
+
+void HttpUploadEngine::RemoveStream(int stream_id) {
+  ptr_engine_->RemoveStream(stream_id);
+}
+
+int HttpUploadEngine::QueueTransfer(int stream_id, Transfer* ptr_transfer,
+                                    int delay_milliseconds) {
+  return ptr_engine_->QueueTransfer(stream_id, ptr_transfer,
+                                    delay_milliseconds);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HttpUploadEngineImpl
+//
+
+HttpUploadEngineImpl::HttpUploadEngineImpl()
+    : ptr_multi_(NULL),
+      max_connections_(HttpUploadEngine::kDefaultMaxConnections),
+      next_stream_id_(1),
+      last_started_stream_(0),
+      num_running_(0),
+      running_(false),
+      stop_(false) {
+}
+
+HttpUploadEngineImpl::~HttpUploadEngineImpl() {
+  Stop();
+  if (ptr_multi_) {
+    curl_multi_cleanup(ptr_multi_);
+    ptr_multi_ = NULL;
+  }
+}
+
+int HttpUploadEngineImpl::Init(int max_connections) {
+  if (max_connections < 1) {
+    LOG(ERROR) << "invalid max connections: " << max_connections;
+    return kInvalidArg;
+  }
+  max_connections_ = max_connections;
+  ptr_multi_ = curl_multi_init();
+  if (!ptr_multi_) {
+    LOG(ERROR) << "curl_multi_init failed!";
+    return kLibCurlError;
+  }
+
+  // Limit open connections, and keep as many in the connection cache so that
+  // every stream finds its connection still open for its next upload.
+  CURLMcode err = curl_multi_setopt(ptr_multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                                    static_cast<long>(max_connections));  // NOLINT
+  if (err != CURLM_OK) {
+    LOG_CURLM_ERR(err, "setopt CURLMOPT_MAX_TOTAL_CONNECTIONS failed.");
+    return kLibCurlError;
+  }
+  err = curl_multi_setopt(ptr_multi_, CURLMOPT_MAXCONNECTS,
+                          static_cast<long>(max_connections));  // NOLINT
+  if (err != CURLM_OK) {
+    LOG_CURLM_ERR(err, "setopt CURLMOPT_MAXCONNECTS failed.");
+    return kLibCurlError;
+  }
+  return kSuccess;
+}
+
+int HttpUploadEngineImpl::Run() {
+  if (!ptr_multi_) {
+    LOG(ERROR) << "HttpUploadEngine cannot Run, Init required.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) {
+    return kSuccess;
+  }
+  using std::bind;
+  using std::nothrow;
+  using std::shared_ptr;
+  using std::thread;
+  engine_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&HttpUploadEngineImpl::EngineThread,  // NOLINT
+                                this)));
+  if (!engine_thread_) {
+    LOG(ERROR) << "cannot construct engine thread.";
+    return kNoMemory;
+  }
+  running_ = true;
+  stop_ = false;
+  return kSuccess;
+}
+
+void HttpUploadEngineImpl::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    stop_ = true;
+  }
+  work_ready_.notify_one();
+  engine_thread_->join();
+  engine_thread_.reset();
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_ = false;
+}
+
+int HttpUploadEngineImpl::AddStream(int* ptr_stream_id) {
+  if (!ptr_stream_id) {
+    LOG(ERROR) << "NULL stream ID pointer.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  *ptr_stream_id = next_stream_id_++;
+  streams_[*ptr_stream_id] = Stream();
+  return kSuccess;
+}
+
+void HttpUploadEngineImpl::RemoveStream(int stream_id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  StreamMap::iterator stream_iter = streams_.find(stream_id);
+  if (stream_iter == streams_.end()) {
+    return;
+  }
+  // Transfers only finish while the engine thread runs.
+  const Stream& stream = stream_iter->second;
+  transfer_done_.wait(lock, [this, &stream] {
+    return !running_ || (!stream.ptr_active && stream.transfers.empty());
+  });
+  streams_.erase(stream_id);
+}
+
+int HttpUploadEngineImpl::QueueTransfer(int stream_id,
+                                        Transfer* ptr_transfer,
+                                        int delay_milliseconds) {
+  if (!ptr_transfer || !ptr_transfer->curl_handle() ||
+      delay_milliseconds < 0) {
+    LOG(ERROR) << "invalid transfer.";
+    return kInvalidArg;
+  }
+  QueuedTransfer queued;
+  queued.ptr_transfer = ptr_transfer;
+  queued.start_time =
+      Clock::now() + std::chrono::milliseconds(delay_milliseconds);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StreamMap::iterator stream_iter = streams_.find(stream_id);
+    if (stream_iter == streams_.end()) {
+      LOG(ERROR) << "unknown stream: " << stream_id;
+      return kInvalidStream;
+    }
+    if (!running_ || stop_) {
+      LOG(ERROR) << "HttpUploadEngine not running.";
+      return kInvalidArg;
+    }
+    stream_iter->second.transfers.push_back(queued);
+  }
+  work_ready_.notify_one();
+  return kSuccess;
+}
+
+bool HttpUploadEngineImpl::TransfersQueued() const {
+  for (StreamMap::const_iterator stream_iter = streams_.begin();
+       stream_iter != streams_.end(); ++stream_iter) {
+    if (!stream_iter->second.transfers.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HttpUploadEngineImpl::NextStartTime(
+    Clock::time_point* ptr_start_time) const {
+  bool waiting = false;
+  for (StreamMap::const_iterator stream_iter = streams_.begin();
+       stream_iter != streams_.end(); ++stream_iter) {
+    const Stream& stream = stream_iter->second;
+    if (stream.ptr_active || stream.transfers.empty()) {
+      continue;
+    }
+    const Clock::time_point start_time = stream.transfers.front().start_time;
+    if (!waiting || start_time < *ptr_start_time) {
+      *ptr_start_time = start_time;
+      waiting = true;
+    }
+  }
+  return waiting;
+}
+
+void HttpUploadEngineImpl::StartTransfers(std::vector<Transfer*>* ptr_failed) {
+  if (streams_.empty()) {
+    return;
+  }
+  const Clock::time_point now = Clock::now();
+  StreamMap::iterator stream_iter = streams_.upper_bound(last_started_stream_);
+  for (size_t i = 0;
+       i < streams_.size() && num_running_ < max_connections_;
+       ++i, ++stream_iter) {
+    if (stream_iter == streams_.end()) {
+      stream_iter = streams_.begin();
+    }
+    Stream& stream = stream_iter->second;
+    if (stream.ptr_active || stream.transfers.empty() ||
+        stream.transfers.front().start_time > now) {
+      continue;
+    }
+    Transfer* const ptr_transfer = stream.transfers.front().ptr_transfer;
+    stream.transfers.pop_front();
+
+    // The stream ID travels with the easy handle to |FinishTransfers|.
+    CURL* const ptr_curl = ptr_transfer->curl_handle();
+    curl_easy_setopt(ptr_curl, CURLOPT_PRIVATE,
+                     reinterpret_cast<void*>(
+                         static_cast<intptr_t>(stream_iter->first)));
+    const CURLMcode err = curl_multi_add_handle(ptr_multi_, ptr_curl);
+    if (err != CURLM_OK) {
+      LOG_CURLM_ERR(err, "curl_multi_add_handle failed.");
+      ptr_failed->push_back(ptr_transfer);
+      continue;
+    }
+    stream.ptr_active = ptr_transfer;
+    last_started_stream_ = stream_iter->first;
+    ++num_running_;
+  }
+}
+
+void HttpUploadEngineImpl::FinishTransfers() {
+  int messages_left = 0;
+  CURLMsg* ptr_message = NULL;
+  while ((ptr_message = curl_multi_info_read(ptr_multi_, &messages_left))) {
+    if (ptr_message->msg != CURLMSG_DONE) {
+      continue;
+    }
+    CURL* const ptr_curl = ptr_message->easy_handle;
+    const CURLcode result = ptr_message->data.result;
+    char* ptr_private = NULL;
+    curl_easy_getinfo(ptr_curl, CURLINFO_PRIVATE, &ptr_private);
+    curl_multi_remove_handle(ptr_multi_, ptr_curl);
+    const int stream_id =
+        static_cast<int>(reinterpret_cast<intptr_t>(ptr_private));
+
+    Transfer* ptr_transfer = NULL;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      StreamMap::iterator stream_iter = streams_.find(stream_id);
+      if (stream_iter != streams_.end()) {
+        ptr_transfer = stream_iter->second.ptr_active;
+      }
+    }
+    if (!ptr_transfer) {
+      LOG(ERROR) << "finished transfer has no stream: " << stream_id;
+      continue;
+    }
+    EndTransfer(stream_id, ptr_transfer, result);
+  }
+}
+
+// |TransferDone| runs before the stream is marked idle: the stream cannot be
+// removed, or start its next transfer, until its owner has seen the result.
+void HttpUploadEngineImpl::EndTransfer(int stream_id,
+                                       Transfer* ptr_transfer,
+                                       int curl_code) {
+  ptr_transfer->TransferDone(curl_code);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StreamMap::iterator stream_iter = streams_.find(stream_id);
+    if (stream_iter != streams_.end() &&
+        stream_iter->second.ptr_active == ptr_transfer) {
+      stream_iter->second.ptr_active = NULL;
+      --num_running_;
+    }
+  }
+  transfer_done_.notify_all();
+}
+
+void HttpUploadEngineImpl::EngineThread() {
+  LOG(INFO) << "upload engine running...";
+  for (;;) {
+    std::vector<Transfer*> failed;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      StartTransfers(&failed);
+      if (num_running_ == 0 && failed.empty()) {
+        // Idle streams started their due transfers above; what remains
+        // waits for its start time.
+        Clock::time_point start_time;
+        if (NextStartTime(&start_time)) {
+          work_ready_.wait_until(lock, start_time);
+          continue;
+        }
+        if (stop_) {
+          break;
+        }
+        work_ready_.wait(lock, [this] {
+          return stop_ || TransfersQueued();
+        });
+        continue;
+      }
+    }
+    for (size_t i = 0; i < failed.size(); ++i) {
+      failed[i]->TransferDone(CURLE_FAILED_INIT);
+      transfer_done_.notify_all();
+    }
+
+    int running_handles = 0;
+    const CURLMcode err = curl_multi_perform(ptr_multi_, &running_handles);
+    if (err != CURLM_OK) {
+      LOG_CURLM_ERR(err, "curl_multi_perform failed.");
+    }
+    FinishTransfers();
+    if (running_handles > 0) {
+      curl_multi_wait(ptr_multi_, NULL, 0, kMultiWaitMilliseconds, NULL);
+    }
+  }
+  LOG(INFO) << "upload engine done";
+}
+
+}  // namespace webmlive
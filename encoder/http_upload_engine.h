@@ -0,0 +1,96 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_HTTP_UPLOAD_ENGINE_H_
+#define WEBMLIVE_ENCODER_HTTP_UPLOAD_ENGINE_H_
+
+#include <memory>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+class HttpUploadEngineImpl;
+
+// Runs the HTTP uploads of any number of streams on one thread with the
+// libcurl multi interface, so that uploaders do not each block a thread in
+// |curl_easy_perform|. Connections are cached by the engine and reused, with
+// TCP keep-alive, by every stream uploading to the same host.
+//
+// Notes:
+// - Each stream has its own queue of transfers. Transfers of one stream run
+//   one at a time and in order; streams take turns starting transfers while
+//   fewer than |max_connections| are running.
+// - |HttpUploader| registers itself as a stream when
+//   |HttpUploaderSettings::engine| is set.
+// - |Init| must be called before any other method, and |Run| before
+//   transfers are queued.
+class HttpUploadEngine {
+ public:
+  enum {
+    // Libcurl reported an unexpected error.
+    kLibCurlError = -4,
+
+    // Unknown stream ID.
+    kInvalidStream = -3,
+
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static const int kDefaultMaxConnections = 16;
+
+  // An HTTP request run by the engine.
+  class Transfer {
+   public:
+    virtual ~Transfer() {}
+
+    // Returns the libcurl easy handle configured for the request.
+    virtual void* curl_handle() = 0;
+
+    // Called on the engine thread when the request ends. |curl_code| is the
+    // libcurl CURLcode result.
+    virtual void TransferDone(int curl_code) = 0;
+  };
+
+  HttpUploadEngine();
+  ~HttpUploadEngine();
+
+  // Creates the libcurl multi handle, allowing up to |max_connections|
+  // connections. Returns |kSuccess| when successful.
+  int Init(int max_connections);
+
+  // Starts the engine thread.
+  int Run();
+
+  // Finishes all queued transfers and stops the engine thread.
+  void Stop();
+
+  // Registers a stream and stores its ID in |ptr_stream_id|.
+  int AddStream(int* ptr_stream_id);
+
+  // Waits until the transfers of |stream_id| are done, and removes the
+  // stream.
+  void RemoveStream(int stream_id);
+
+  // Queues |ptr_transfer| behind the other transfers of |stream_id|, to start
+  // no sooner than |delay_milliseconds| from now. The transfer must stay
+  // valid until its |TransferDone()| call, which may queue it again to retry
+  // the request.
+  int QueueTransfer(int stream_id, Transfer* ptr_transfer,
+                    int delay_milliseconds);
+
+ private:
+  std::unique_ptr<HttpUploadEngineImpl> ptr_engine_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(HttpUploadEngine);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_HTTP_UPLOAD_ENGINE_H_
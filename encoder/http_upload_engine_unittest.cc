@@ -0,0 +1,199 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/http_upload_engine.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "curl/curl.h"
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const char kTestFile[] = "http_upload_engine_unittest.txt";
+const int kNumStreams = 3;
+const int kTransfersPerStream = 5;
+
+// Delay that lets every test transfer be queued before the first one starts.
+const int kStartDelay = 100;
+
+// Records the order in which transfers end.
+class TransferLog {
+ public:
+  void Add(int stream, int transfer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_back(Entry(stream, transfer));
+  }
+  typedef std::pair<int, int> Entry;
+  std::vector<Entry> entries() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<Entry> entries_;
+};
+
+// Reads a local file, so the engine is exercised without a server.
+class FileTransfer : public HttpUploadEngine::Transfer {
+ public:
+  FileTransfer(const std::string& url, int stream, int transfer,
+               TransferLog* ptr_log)
+      : ptr_curl_(curl_easy_init()),
+        stream_(stream),
+        transfer_(transfer),
+        curl_code_(-1),
+        ptr_log_(ptr_log) {
+    curl_easy_setopt(ptr_curl_, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(ptr_curl_, CURLOPT_WRITEFUNCTION, Discard);
+  }
+  virtual ~FileTransfer() { curl_easy_cleanup(ptr_curl_); }
+
+  virtual void* curl_handle() { return ptr_curl_; }
+  virtual void TransferDone(int curl_code) {
+    curl_code_ = curl_code;
+    ptr_log_->Add(stream_, transfer_);
+  }
+  int curl_code() const { return curl_code_; }
+
+ private:
+  static size_t Discard(char*, size_t size, size_t count, void*) {
+    return size * count;
+  }
+
+  CURL* ptr_curl_;
+  int stream_;
+  int transfer_;
+  int curl_code_;
+  TransferLog* ptr_log_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(FileTransfer);
+};
+
+class HttpUploadEngineTest : public ::testing::Test {
+ protected:
+  HttpUploadEngineTest() {
+    FILE* const ptr_file = fopen(kTestFile, "wb");
+    if (ptr_file) {
+      fputs("chunk", ptr_file);
+      fclose(ptr_file);
+    }
+#ifdef _WIN32
+    char* const ptr_path = _fullpath(NULL, kTestFile, 0);
+    const char kFileScheme[] = "file:///";
+#else
+    char* const ptr_path = realpath(kTestFile, NULL);
+    const char kFileScheme[] = "file://";
+#endif
+    if (ptr_path) {
+      url_ = std::string(kFileScheme) + ptr_path;
+      free(ptr_path);
+    }
+  }
+
+  virtual ~HttpUploadEngineTest() {
+    engine_.Stop();
+    for (size_t i = 0; i < transfers_.size(); ++i) {
+      delete transfers_[i];
+    }
+    remove(kTestFile);
+  }
+
+  void StartEngine(int max_connections) {
+    ASSERT_FALSE(url_.empty());
+    ASSERT_EQ(HttpUploadEngine::kSuccess, engine_.Init(max_connections));
+    ASSERT_EQ(HttpUploadEngine::kSuccess, engine_.Run());
+  }
+
+  // Adds |kNumStreams| streams, and queues |kTransfersPerStream| transfers
+  // for each, stream by stream, to start after |kStartDelay|.
+  void QueueTransfers() {
+    for (int stream = 0; stream < kNumStreams; ++stream) {
+      ASSERT_EQ(HttpUploadEngine::kSuccess,
+                engine_.AddStream(&stream_ids_[stream]));
+    }
+    for (int stream = 0; stream < kNumStreams; ++stream) {
+      for (int transfer = 0; transfer < kTransfersPerStream; ++transfer) {
+        FileTransfer* const ptr_transfer =
+            new FileTransfer(url_, stream, transfer, &log_);
+        transfers_.push_back(ptr_transfer);
+        ASSERT_EQ(HttpUploadEngine::kSuccess,
+                  engine_.QueueTransfer(stream_ids_[stream], ptr_transfer,
+                                        kStartDelay));
+      }
+    }
+  }
+
+  void RemoveStreams() {
+    for (int stream = 0; stream < kNumStreams; ++stream) {
+      engine_.RemoveStream(stream_ids_[stream]);
+    }
+  }
+
+  HttpUploadEngine engine_;
+  std::string url_;
+  int stream_ids_[kNumStreams];
+  std::vector<FileTransfer*> transfers_;
+  TransferLog log_;
+};
+
+TEST_F(HttpUploadEngineTest, InvalidArgs) {
+  EXPECT_EQ(HttpUploadEngine::kInvalidArg, engine_.Init(0));
+  StartEngine(1);
+  EXPECT_EQ(HttpUploadEngine::kInvalidArg, engine_.AddStream(NULL));
+  int stream_id = 0;
+  ASSERT_EQ(HttpUploadEngine::kSuccess, engine_.AddStream(&stream_id));
+  EXPECT_EQ(HttpUploadEngine::kInvalidArg,
+            engine_.QueueTransfer(stream_id, NULL, 0));
+  FileTransfer transfer(url_, 0, 0, &log_);
+  EXPECT_EQ(HttpUploadEngine::kInvalidStream,
+            engine_.QueueTransfer(stream_id + 1, &transfer, 0));
+}
+
+// With one connection, streams that all have transfers waiting take turns:
+// no stream starts a second transfer before every other stream started one.
+TEST_F(HttpUploadEngineTest, StreamsTakeTurns) {
+  StartEngine(1);
+  QueueTransfers();
+  RemoveStreams();
+
+  const std::vector<TransferLog::Entry> entries = log_.entries();
+  ASSERT_EQ(static_cast<size_t>(kNumStreams * kTransfersPerStream),
+            entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    EXPECT_EQ(static_cast<int>(i) % kNumStreams, entries[i].first) << i;
+    EXPECT_EQ(static_cast<int>(i) / kNumStreams, entries[i].second) << i;
+  }
+  for (size_t i = 0; i < transfers_.size(); ++i) {
+    EXPECT_EQ(CURLE_OK, transfers_[i]->curl_code());
+  }
+}
+
+// With more connections than streams, transfers of each stream still end in
+// the order they were queued.
+TEST_F(HttpUploadEngineTest, StreamTransfersInOrder) {
+  StartEngine(kNumStreams * kTransfersPerStream);
+  QueueTransfers();
+  RemoveStreams();
+
+  const std::vector<TransferLog::Entry> entries = log_.entries();
+  ASSERT_EQ(static_cast<size_t>(kNumStreams * kTransfersPerStream),
+            entries.size());
+  int next_transfer[kNumStreams] = {0};
+  for (size_t i = 0; i < entries.size(); ++i) {
+    EXPECT_EQ(next_transfer[entries[i].first]++, entries[i].second) << i;
+  }
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -7,18 +7,26 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/http_uploader.h"
 
+#include <algorithm>
 #include <cassert>
-#include <ctime>
+#include <cctype>
+#include <chrono>
 #include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "encoder/buffer_util.h"
+#include "encoder/http_upload_engine.h"
+#include "encoder/throughput_estimator.h"
+#include "encoder/upload_retry_state.h"
 #include "curl/curl.h"
 #include "curl/easy.h"
 #include "glog/logging.h"
@@ -37,9 +45,34 @@ static const char* kContentTypeHeader = "Content-Type: video/webm";
 static const char* kFormName = "webm_file";
 static const char* kWebmMimeType = "video/webm";
 static const int kUnknownFileSize = -1;
-static const int kBytesRequiredForResume = 32*1024;
-
-class HttpUploaderImpl {
+static const char* kChunkedTransferHeader = "Transfer-Encoding: chunked";
+static const char* kChunkIndexHeader = "X-WebM-Chunk-Index: ";
+static const char* kChunkSequenceHeader = "X-WebM-Chunk-Sequence: ";
+static const char* kContentRangeHeader = "Content-Range: bytes ";
+static const char* kChunkReceivedHeader = "X-WebM-Chunk-Received:";
+
+// Streaming mode limits: unsent bytes queued before |UploadComplete| reports
+// busy, and the wait between reconnect attempts.
+static const size_t kMaxStreamBufferBytes = 8 * 1024 * 1024;
+static const int kStreamReconnectDelayMilliseconds = 1000;
+
+// Time the libcurl read callback waits for data before checking for stop.
+static const int kStreamReadWaitMilliseconds = 100;
+
+// Streams slower than |kStreamLowSpeedBytesPerSecond| for
+// |kStreamLowSpeedSeconds| are aborted by libcurl. Catches a server that
+// stops reading, which would otherwise block |Stop| forever.
+static const long kStreamLowSpeedBytesPerSecond = 1;  // NOLINT
+static const long kStreamLowSpeedSeconds = 30;  // NOLINT
+
+// Sampling interval of the throughput estimate in the streaming modes, and
+// the weight of a new round trip sample, which is the one TCP uses.
+static const int kStreamSampleMilliseconds = 1000;
+static const double kRttAverageWeight = 0.125;
+
+typedef ThroughputEstimator::Clock Clock;
+
+class HttpUploaderImpl : public HttpUploadEngine::Transfer {
  public:
   typedef std::queue<std::string> UrlQueue;
   enum {
@@ -59,10 +92,13 @@ class HttpUploaderImpl {
     // unlocked |upload_buffer_|, which means |Stop| is waiting for
     // |UploadThread| to exit.
     kStopping = 2,
+
+    // Returned by |FinishRequest| when the upload is not retried.
+    kNoRetry = -1,
   };
 
   HttpUploaderImpl();
-  ~HttpUploaderImpl();
+  virtual ~HttpUploaderImpl();
 
   // Returns true when the uploader is ready to start an upload. Always returns
   // true when no uploads have been attempted.
@@ -80,6 +116,17 @@ class HttpUploaderImpl {
   // Uploads user data.
   int UploadBuffer(const uint8* ptr_buffer, int32 length);
 
+  // Uploads user data to the target URL with |url_query| appended. A
+  // non-empty |chunk_index| is sent in the X-WebM-Chunk-Index header.
+  int UploadBuffer(const uint8* ptr_buffer, int32 length,
+                   const std::string& url_query,
+                   const std::string& chunk_index);
+
+  // Passes data to |UploadBuffer|, or to |StreamChunk| in the streaming
+  // modes.
+  int UploadChunk(const ChunkInfo& info, const uint8* ptr_buffer,
+                  int32 length);
+
   // Stops the uploader.
   int Stop();
 
@@ -87,10 +134,22 @@ class HttpUploaderImpl {
   // URL is popped off the queue and assigned to |target_url_|
   void EnqueueTargetUrl(const std::string& target_url);
 
+  // HttpUploadEngine::Transfer methods. Used when |settings_.engine| is
+  // non-NULL: the engine runs the request set up by |StartRequest|.
+  virtual void* curl_handle() { return ptr_curl_; }
+  virtual void TransferDone(int curl_code);
+
  private:
   // Used by |UploadThread|. Returns true if user has called |Stop|.
   bool StopRequested();
 
+  // Returns true when |settings_.post_mode| is a streaming mode.
+  bool Streaming() const;
+
+  // Returns true when all queued stream data has been passed to libcurl.
+  // Caller must hold |mutex_|.
+  bool StreamDrained() const;
+
   // Pass our callbacks, |ProgressCallback| and |WriteCallback|, to libcurl.
   CURLcode SetCurlCallbacks();
 
@@ -107,6 +166,65 @@ class HttpUploaderImpl {
   // Upload user data with libcurl.
   int Upload();
 
+  // Configures |ptr_curl_| to upload |upload_buffer_| to the target URL, or
+  // to ask the server for the resume offset when
+  // |retry_state_.resume_query_pending()|.
+  int StartRequest();
+
+  // Configures |ptr_curl_| for the HEAD request that asks the server how
+  // much of the current chunk it received.
+  int StartResumeQuery();
+
+  // Passes the response to the resume query to |retry_state_|.
+  void FinishResumeQuery(CURLcode err);
+
+  // Appends the user headers, and the chunk sequence, range, and index
+  // headers to |ptr_chunk_headers_|, and passes it to libcurl.
+  void SetChunkHeaders(int32 chunk_length);
+
+  // Restores the user headers, pops the target URL after a successful
+  // request, and updates the stats. |err| is the result of the request.
+  // Returns the time to wait before retrying the request, or |kNoRetry| when
+  // the chunk was sent, or dropped.
+  int FinishRequest(CURLcode err);
+
+  // Waits |delay_milliseconds| before a retry. Returns false when |Stop| is
+  // called meanwhile.
+  bool WaitForRetry(int delay_milliseconds);
+
+  // Restores the user headers on |ptr_curl_| and frees |ptr_chunk_headers_|.
+  void FreeChunkHeaders();
+
+  // Marks the upload done and unlocks |upload_buffer_|.
+  void CompleteUpload();
+
+  // Adds the bytes libcurl reports uploaded by the last request to |stats_|,
+  // and updates the throughput and timing stats from its libcurl timing.
+  void UpdateUploadTotal();
+
+  // Streaming mode methods.
+  // Appends |ptr_buffer| to |stream_header_| or |stream_buffer_| and wakes
+  // |ReadCallback|.
+  int StreamChunk(const ChunkInfo& info, const uint8* ptr_buffer,
+                  int32 length);
+
+  // Opens a streaming request and runs it until |ReadCallback| ends the
+  // stream or libcurl reports an error.
+  int StreamUpload();
+
+  // Runs |StreamUpload| until stopped, reconnecting after failures.
+  void StreamLoop();
+
+  // Copies up to |max_length| bytes of stream data into |ptr_buffer|: first
+  // the metadata for the current request, then queued cluster data. Waits
+  // for data when none is queued. Returns 0 to end the request when stop has
+  // been requested and no data remains.
+  size_t ReadStreamData(char* ptr_buffer, size_t max_length);
+
+  // Libcurl read callback. Calls |ReadStreamData|.
+  static size_t ReadCallback(char* buffer, size_t size, size_t nitems,
+                             void* ptr_this);
+
   // Wakes up |UploadThread| when users pass data through |UploadBuffer|.
   int WaitForUserData();
 
@@ -120,7 +238,13 @@ class HttpUploaderImpl {
   static size_t WriteCallback(char* buffer, size_t size, size_t nitems,
                               void* ptr_this);
 
-  // Acquires |mutex_|, resets |stats_| and sets |start_ticks_|.
+  // Libcurl header callback. Stores the X-WebM-Chunk-Received value in
+  // |received_offset_|.
+  static size_t HeaderCallback(char* buffer, size_t size, size_t nitems,
+                               void* ptr_this);
+
+  // Acquires |mutex_|, resets |stats_| and |throughput_|, and sets
+  // |start_time_|.
   void ResetStats();
 
   // Thread function. Wakes when |WaitForUserData| is notified by
@@ -149,7 +273,13 @@ class HttpUploaderImpl {
   std::shared_ptr<std::thread> upload_thread_;
 
   // Uploader start time.  Reset when via |ResetStatts| when |Init| is called.
-  clock_t start_ticks_;
+  Clock::time_point start_time_;
+
+  // Throughput samples, and in the streaming modes the start of the sample
+  // in progress. Protected by |mutex_|.
+  ThroughputEstimator throughput_;
+  Clock::time_point sample_start_time_;
+  int64 sample_start_bytes_;
 
   // Libcurl pointer.
   CURL* ptr_curl_;
@@ -184,9 +314,58 @@ class HttpUploaderImpl {
   // empty.
   std::string target_url_;
 
+  // Query parameters appended to |target_url_| for the current upload.
+  std::string url_query_;
+
+  // |ChunkInfo::index| of the current upload, and the header list, user
+  // headers included, that sends it.
+  std::string chunk_index_;
+  curl_slist* ptr_chunk_headers_;
+
+  // Stream ID assigned by |settings_.engine|.
+  int engine_stream_id_;
+
+  // X-WebM-Chunk-Sequence value of the current chunk, and its retry state.
+  int64 chunk_sequence_;
+  UploadRetryState retry_state_;
+
+  // Set while the HEAD request asking the server how much of the chunk it
+  // holds runs. |received_offset_| is the X-WebM-Chunk-Received value of its
+  // response, or -1.
+  bool resume_query_;
+  int64 received_offset_;
+
   // Queue of target URLs.
   UrlQueue url_queue_;
 
+  // Streaming mode state. All protected by |mutex_|.
+  //
+  // WebM metadata, sent at the start of every streaming request, and the
+  // number of its bytes sent on the current request.
+  std::vector<uint8> stream_header_;
+  bool stream_header_complete_;
+  size_t header_send_offset_;
+
+  // Cluster data. |stream_buffer_[stream_read_offset_]| is the next byte to
+  // send, and |stream_base_position_| is the stream position of
+  // |stream_buffer_[0]|.
+  std::vector<uint8> stream_buffer_;
+  size_t stream_read_offset_;
+  int64 stream_base_position_;
+
+  // Stream positions at which clusters start.
+  std::deque<int64> cluster_starts_;
+
+  // True when the next chunk queued starts a cluster.
+  bool next_chunk_starts_cluster_;
+
+  // Set at the start of each request; |ReadStreamData| skips data until the
+  // next cluster start before sending anything after the metadata.
+  bool stream_resync_;
+
+  // Wakes |ReadStreamData| when data is queued or stop is requested.
+  std::condition_variable stream_data_ready_;
+
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(HttpUploaderImpl);
 };
 
@@ -240,6 +419,12 @@ int HttpUploader::UploadBuffer(const uint8* ptr_buffer, int32 length) {
   return ptr_uploader_->UploadBuffer(ptr_buffer, length);
 }
 
+// Return result of |UploadChunk| on |ptr_uploader_|.
+int HttpUploader::UploadChunk(const ChunkInfo& info, const uint8* ptr_buffer,
+                              int32 length) {
+  return ptr_uploader_->UploadChunk(info, ptr_buffer, length);
+}
+
 void HttpUploader::EnqueueTargetUrl(const std::string& target_url) {
   ptr_uploader_->EnqueueTargetUrl(target_url);
 }
@@ -249,12 +434,24 @@ void HttpUploader::EnqueueTargetUrl(const std::string& target_url) {
 //
 
 HttpUploaderImpl::HttpUploaderImpl()
-    : ptr_curl_(NULL),
+    : stop_(false),
+      upload_complete_(true),
+      sample_start_bytes_(0),
+      ptr_curl_(NULL),
       ptr_form_(NULL),
       ptr_form_end_(NULL),
       ptr_headers_(NULL),
-      stop_(false),
-      upload_complete_(true) {
+      ptr_chunk_headers_(NULL),
+      engine_stream_id_(0),
+      chunk_sequence_(0),
+      resume_query_(false),
+      received_offset_(-1),
+      stream_header_complete_(false),
+      header_send_offset_(0),
+      stream_read_offset_(0),
+      stream_base_position_(0),
+      next_chunk_starts_cluster_(false),
+      stream_resync_(false) {
 }
 
 HttpUploaderImpl::~HttpUploaderImpl() {
@@ -271,14 +468,24 @@ HttpUploaderImpl::~HttpUploaderImpl() {
     curl_slist_free_all(ptr_headers_);
     ptr_headers_ = NULL;
   }
+  if (ptr_chunk_headers_) {
+    curl_slist_free_all(ptr_chunk_headers_);
+    ptr_chunk_headers_ = NULL;
+  }
 }
 
-// Obtain lock on |mutex_| and return value of |upload_complete_|.
+// Obtain lock on |mutex_| and return value of |upload_complete_|. In the
+// streaming modes returns true while |stream_buffer_| has room.
 bool HttpUploaderImpl::UploadComplete() const {
   bool complete = false;
   std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
   if (lock.owns_lock()) {
-    complete = upload_complete_;
+    if (Streaming()) {
+      const size_t unsent = stream_buffer_.size() - stream_read_offset_;
+      complete = unsent < kMaxStreamBufferBytes;
+    } else {
+      complete = upload_complete_;
+    }
   }
   return complete;
 }
@@ -290,6 +497,19 @@ bool HttpUploaderImpl::UploadComplete() const {
 int HttpUploaderImpl::Init(const HttpUploaderSettings& settings) {
   // copy user settings
   settings_ = settings;
+  if (settings_.engine && Streaming()) {
+    LOG(ERROR) << "the upload engine does not support streaming modes.";
+    return HttpUploader::kInvalidArg;
+  }
+  if (settings_.max_upload_attempts < 1 ||
+      settings_.retry_delay_milliseconds < 0 ||
+      settings_.max_retry_delay_milliseconds <
+          settings_.retry_delay_milliseconds) {
+    LOG(ERROR) << "invalid upload retry settings.";
+    return HttpUploader::kInvalidArg;
+  }
+  retry_state_.Init(settings_, static_cast<unsigned int>(
+      Clock::now().time_since_epoch().count()));
 
   // Init libcurl.
   ptr_curl_ = curl_easy_init();
@@ -319,6 +539,33 @@ int HttpUploaderImpl::Init(const HttpUploaderSettings& settings) {
     return HttpUploader::kHeaderError;
   }
 
+  if (Streaming()) {
+    curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_LOW_SPEED_LIMIT,
+                                kStreamLowSpeedBytesPerSecond);
+    if (curl_ret == CURLE_OK) {
+      curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_LOW_SPEED_TIME,
+                                  kStreamLowSpeedSeconds);
+    }
+    if (curl_ret != CURLE_OK) {
+      LOG_CURL_ERR(curl_ret, "setopt CURLOPT_LOW_SPEED_* failed.");
+      return kLibCurlError;
+    }
+  }
+
+  if (settings_.engine) {
+    // Keep idle connections open between uploads.
+    curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_TCP_KEEPALIVE, 1L);
+    if (curl_ret != CURLE_OK) {
+      LOG_CURL_ERR(curl_ret, "setopt CURLOPT_TCP_KEEPALIVE failed.");
+      return kLibCurlError;
+    }
+    const int status = settings_.engine->AddStream(&engine_stream_id_);
+    if (status) {
+      LOG(ERROR) << "engine AddStream failed, status=" << status;
+      return HttpUploader::kInitFailed;
+    }
+  }
+
   local_file_name_ = settings_.local_file;
   ResetStats();
   return kSuccess;
@@ -332,14 +579,17 @@ int HttpUploaderImpl::GetStats(HttpUploaderStats* ptr_stats) {
     return HttpUploader::kInvalidArg;
   }
   std::lock_guard<std::mutex> lock(mutex_);
-  ptr_stats->bytes_per_second = stats_.bytes_per_second;
-  ptr_stats->bytes_sent_current = stats_.bytes_sent_current;
-  ptr_stats->total_bytes_uploaded = stats_.total_bytes_uploaded;
+  *ptr_stats = stats_;
+  ptr_stats->max_bytes_per_second = throughput_.WindowMax(Clock::now());
   return kSuccess;
 }
 
-// Run |UploadThread| using |boost::thread|.
+// Run |UploadThread| using |boost::thread|. Uploads run on the engine thread
+// when |settings_.engine| is non-NULL.
 int HttpUploaderImpl::Run() {
+  if (settings_.engine) {
+    return kSuccess;
+  }
   assert(!upload_thread_);
   using std::bind;
   using std::shared_ptr;
@@ -357,6 +607,12 @@ int HttpUploaderImpl::Run() {
 // thread through call to |notify_one| on the |buffer_ready_| condition
 // variable.
 int HttpUploaderImpl::UploadBuffer(const uint8* ptr_buf, int32 length) {
+  return UploadBuffer(ptr_buf, length, "", "");
+}
+
+int HttpUploaderImpl::UploadBuffer(const uint8* ptr_buf, int32 length,
+                                   const std::string& url_query,
+                                   const std::string& chunk_index) {
   int status = HttpUploader::kUploadInProgress;
   std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
   if (lock.owns_lock() && !upload_buffer_.IsLocked()) {
@@ -367,6 +623,10 @@ int HttpUploaderImpl::UploadBuffer(const uint8* ptr_buf, int32 length) {
       LOG(ERROR) << "No target URL!";
       return HttpUploader::kUrlConfigError;
     }
+    url_query_ = url_query;
+    chunk_index_ = chunk_index;
+    ++chunk_sequence_;
+    retry_state_.StartChunk(length);
 
     // Lock obtained; (re)initialize |upload_buffer_| with the user data...
     status = upload_buffer_.Init(ptr_buf, length);
@@ -384,6 +644,21 @@ int HttpUploaderImpl::UploadBuffer(const uint8* ptr_buf, int32 length) {
     }
     upload_complete_ = false;
 
+    if (settings_.engine) {
+      status = StartRequest();
+      if (status == kSuccess) {
+        status = settings_.engine->QueueTransfer(engine_stream_id_, this, 0);
+      }
+      if (status) {
+        LOG(ERROR) << "cannot queue upload, status=" << status;
+        FreeChunkHeaders();
+        upload_buffer_.Unlock();
+        upload_complete_ = true;
+        return HttpUploader::kRunFailed;
+      }
+      return kSuccess;
+    }
+
     // Wake |UploadThread|.
     LOG(INFO) << "waking uploader with " << length << " bytes";
     buffer_ready_.notify_one();
@@ -391,6 +666,24 @@ int HttpUploaderImpl::UploadBuffer(const uint8* ptr_buf, int32 length) {
   return status;
 }
 
+int HttpUploaderImpl::UploadChunk(const ChunkInfo& info,
+                                  const uint8* ptr_buffer,
+                                  int32 length) {
+  if (Streaming()) {
+    return StreamChunk(info, ptr_buffer, length);
+  }
+  std::ostringstream url_query;
+  if (info.track != ChunkInfo::kAllTracks) {
+    url_query << "&track=" << info.track;
+    if (info.type == ChunkInfo::kMetadata) {
+      url_query << "&metadata=1";
+    } else {
+      url_query << "&chunk=" << info.number;
+    }
+  }
+  return UploadBuffer(ptr_buffer, length, url_query.str(), info.index);
+}
+
 // Stops |UploadThread|. First it wakes the thread by calling |notify_one| on
 // the |buffer_ready_| condition variable without locking |upload_buffer_|,
 // which causes |Upload| to return |kStopping| to |UploadThread|, breaking the
@@ -400,6 +693,15 @@ int HttpUploaderImpl::UploadBuffer(const uint8* ptr_buf, int32 length) {
 // ensure a running upload stops when |StopRequested| is called within the
 // libcurl callbacks.
 int HttpUploaderImpl::Stop() {
+  if (settings_.engine) {
+    // Stop the upload in progress, if any, and wait for the engine to drop
+    // the transfer.
+    mutex_.lock();
+    stop_ = true;
+    mutex_.unlock();
+    settings_.engine->RemoveStream(engine_stream_id_);
+    return kSuccess;
+  }
   assert(upload_thread_);
   if (UploadComplete()) {
     // Wake up the upload thread
@@ -408,6 +710,10 @@ int HttpUploaderImpl::Stop() {
   mutex_.lock();
   stop_ = true;
   mutex_.unlock();
+  stream_data_ready_.notify_one();
+
+  // Ends a wait in |WaitForRetry|.
+  buffer_ready_.notify_one();
   upload_thread_->join();
   return kSuccess;
 }
@@ -428,6 +734,25 @@ bool HttpUploaderImpl::StopRequested() {
   return stop_requested;
 }
 
+bool HttpUploaderImpl::StreamDrained() const {
+  if (!stream_header_complete_) {
+    return true;
+  }
+  if (header_send_offset_ < stream_header_.size()) {
+    return false;
+  }
+  // While resyncing only data from the next cluster start on is sent.
+  if (stream_resync_ && cluster_starts_.empty()) {
+    return true;
+  }
+  return stream_read_offset_ >= stream_buffer_.size();
+}
+
+bool HttpUploaderImpl::Streaming() const {
+  return settings_.post_mode == webmlive::HTTP_STREAM_POST ||
+      settings_.post_mode == webmlive::HTTP_STREAM_PUT;
+}
+
 // Pass callback function pointers (|ProgressCallback| and |WriteCallback|),
 // and data, |this|, to libcurl.
 CURLcode HttpUploaderImpl::SetCurlCallbacks() {
@@ -458,6 +783,31 @@ CURLcode HttpUploaderImpl::SetCurlCallbacks() {
     LOG_CURL_ERR(err, "curl write callback data setup failed.");
     return err;
   }
+  // set header callback function pointer and data pointer
+  err = curl_easy_setopt(ptr_curl_, CURLOPT_HEADERFUNCTION, HeaderCallback);
+  if (err == CURLE_OK) {
+    err = curl_easy_setopt(ptr_curl_, CURLOPT_HEADERDATA,
+                           reinterpret_cast<void*>(this));
+  }
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "curl header callback setup failed.");
+    return err;
+  }
+  if (Streaming()) {
+    // set read callback function pointer
+    err = curl_easy_setopt(ptr_curl_, CURLOPT_READFUNCTION, ReadCallback);
+    if (err != CURLE_OK) {
+      LOG_CURL_ERR(err, "curl read callback setup failed.");
+      return err;
+    }
+    // set read callback data pointer
+    err = curl_easy_setopt(ptr_curl_, CURLOPT_READDATA,
+                           reinterpret_cast<void*>(this));
+    if (err != CURLE_OK) {
+      LOG_CURL_ERR(err, "curl read callback data setup failed.");
+      return err;
+    }
+  }
   return err;
 }
 
@@ -466,11 +816,15 @@ CURLcode HttpUploaderImpl::SetCurlCallbacks() {
 CURLcode HttpUploaderImpl::SetHeaders() {
   // Tell libcurl to omit "Expect: 100-continue" from requests
   ptr_headers_ = curl_slist_append(ptr_headers_, kExpectHeader);
-  if (settings_.post_mode == webmlive::HTTP_POST) {
+  if (settings_.post_mode != webmlive::HTTP_FORM_POST) {
     // In form posts the video/webm mime-type is included in the form itself,
     // but in plain old HTTP posts the Content-Type must be video/webm.
     ptr_headers_ = curl_slist_append(ptr_headers_, kContentTypeHeader);
   }
+  if (Streaming()) {
+    // The stream length is unknown.
+    ptr_headers_ = curl_slist_append(ptr_headers_, kChunkedTransferHeader);
+  }
   typedef std::map<std::string, std::string> StringMap;
   StringMap::const_iterator header_iter = settings_.headers.begin();
   // add user headers
@@ -555,13 +909,27 @@ int HttpUploaderImpl::SetupPost(const uint8* const ptr_buffer, int32 length) {
   return kSuccess;
 }
 
-// Upload data using libcurl.
+// Upload data using libcurl. Retries the upload until it succeeds, or until
+// |FinishRequest| gives up on it.
 int HttpUploaderImpl::Upload() {
   if (!upload_buffer_.IsLocked()) {
     LOG(INFO) << "woke with unlocked buffer, stopping.";
     return kStopping;
   }
+  for (;;) {
+    const int status = StartRequest();
+    if (status) {
+      return status;
+    }
+    const int retry_delay = FinishRequest(curl_easy_perform(ptr_curl_));
+    if (retry_delay == kNoRetry || !WaitForRetry(retry_delay)) {
+      break;
+    }
+  }
+  return kSuccess;
+}
 
+int HttpUploaderImpl::StartRequest() {
   uint8* ptr_data = NULL;
   int32 length = 0;
   int status = upload_buffer_.GetBuffer(&ptr_data, &length);
@@ -569,10 +937,25 @@ int HttpUploaderImpl::Upload() {
     LOG(ERROR) << "error, could not get buffer pointer, status=" << status;
     return HttpUploader::kRunFailed;
   }
+  if (retry_state_.resume_query_pending()) {
+    return StartResumeQuery();
+  }
+  retry_state_.StartAttempt();
+
+  // Send the part of the chunk the failed request did not.
+  const int32 chunk_length = length;
+  const int32 resume_offset = retry_state_.resume_offset();
+  if (resume_offset > 0) {
+    LOG(INFO) << "resuming chunk " << chunk_sequence_ << " at offset "
+              << resume_offset;
+    ptr_data += resume_offset;
+    length -= resume_offset;
+  }
 
-  LOG(INFO) << "upload buffer size=" << length;
-  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_URL,
-                                  target_url_.c_str());
+  LOG(INFO) << "upload buffer size=" << length << " attempt="
+            << retry_state_.attempts();
+  const std::string url = target_url_ + url_query_;
+  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_URL, url.c_str());
   if (err != CURLE_OK) {
     LOG_CURL_ERR(err, "could not pass URL to curl.");
     return HttpUploader::kUrlConfigError;
@@ -590,34 +973,400 @@ int HttpUploaderImpl::Upload() {
     }
   }
 
-  err = curl_easy_perform(ptr_curl_);
+  SetChunkHeaders(chunk_length);
+  return kSuccess;
+}
+
+int HttpUploaderImpl::StartResumeQuery() {
+  LOG(INFO) << "asking server for the resume offset of chunk "
+            << chunk_sequence_;
+  resume_query_ = true;
+  received_offset_ = -1;
+  const std::string url = target_url_ + url_query_;
+  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_URL, url.c_str());
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "could not pass URL to curl.");
+    return HttpUploader::kUrlConfigError;
+  }
+  err = curl_easy_setopt(ptr_curl_, CURLOPT_NOBODY, 1L);
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "setopt CURLOPT_NOBODY failed.");
+    return HttpUploader::kRunFailed;
+  }
+  SetChunkHeaders(0);
+  return kSuccess;
+}
+
+void HttpUploaderImpl::FinishResumeQuery(CURLcode err) {
+  FreeChunkHeaders();
+  curl_easy_setopt(ptr_curl_, CURLOPT_NOBODY, 0L);
+  resume_query_ = false;
+
+  long resp_code = 0;  // NOLINT
+  if (err == CURLE_OK) {
+    curl_easy_getinfo(ptr_curl_, CURLINFO_RESPONSE_CODE, &resp_code);
+  } else {
+    LOG_CURL_ERR(err, "resume query failed.");
+  }
+  retry_state_.ResumeQueryDone(static_cast<int>(resp_code), received_offset_);
+  if (retry_state_.resume_offset() == 0) {
+    LOG(INFO) << "no resume offset confirmed, resending chunk "
+              << chunk_sequence_ << " whole.";
+  }
+}
+
+void HttpUploaderImpl::SetChunkHeaders(int32 chunk_length) {
+  // Send the chunk sequence number, range, and index along with the user
+  // headers.
+  for (curl_slist* ptr_header = ptr_headers_; ptr_header;
+       ptr_header = ptr_header->next) {
+    ptr_chunk_headers_ = curl_slist_append(ptr_chunk_headers_,
+                                           ptr_header->data);
+  }
+  std::ostringstream chunk_header;
+  chunk_header << kChunkSequenceHeader << chunk_sequence_;
+  ptr_chunk_headers_ = curl_slist_append(ptr_chunk_headers_,
+                                         chunk_header.str().c_str());
+  const int32 resume_offset = retry_state_.resume_offset();
+  if (resume_offset > 0 && chunk_length > 0) {
+    chunk_header.str("");
+    chunk_header << kContentRangeHeader << resume_offset << "-"
+                 << chunk_length - 1 << "/" << chunk_length;
+    ptr_chunk_headers_ = curl_slist_append(ptr_chunk_headers_,
+                                           chunk_header.str().c_str());
+  }
+  if (!chunk_index_.empty()) {
+    const std::string index_header = kChunkIndexHeader + chunk_index_;
+    ptr_chunk_headers_ = curl_slist_append(ptr_chunk_headers_,
+                                           index_header.c_str());
+  }
+  const CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_HTTPHEADER,
+                                        ptr_chunk_headers_);
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "setopt CURLOPT_HTTPHEADER failed err=");
+  }
+}
+
+int HttpUploaderImpl::FinishRequest(CURLcode err) {
+  if (resume_query_) {
+    FinishResumeQuery(err);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stop_ ? kNoRetry : 0;
+  }
+  FreeChunkHeaders();
+  long resp_code = 0;  // NOLINT
+  double bytes_sent = 0;
   if (err != CURLE_OK) {
     LOG_CURL_ERR(err, "curl_easy_perform failed.");
+    curl_easy_getinfo(ptr_curl_, CURLINFO_SIZE_UPLOAD, &bytes_sent);
   } else {
-    int resp_code = 0;
     curl_easy_getinfo(ptr_curl_, CURLINFO_RESPONSE_CODE, &resp_code);
     LOG(INFO) << "server response code: " << resp_code;
+  }
+  UpdateUploadTotal();
 
+  int retry_delay = kNoRetry;
+  const UploadRetryState::Result result = retry_state_.RequestDone(
+      static_cast<int>(resp_code), bytes_sent, &retry_delay);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (result == UploadRetryState::kChunkSent) {
     // Upload was successful, pop the target url off of the queue.
     if (!url_queue_.empty()) {
       url_queue_.pop();
     }
+    return kNoRetry;
+  }
+  if (stop_) {
+    LOG(INFO) << "stop requested, chunk " << chunk_sequence_ << " not sent.";
+    return kNoRetry;
+  }
+  if (result == UploadRetryState::kChunkLost) {
+    LOG(ERROR) << "chunk " << chunk_sequence_ << " lost after "
+               << retry_state_.attempts() << " attempt(s).";
+    ++stats_.chunks_lost;
+    return kNoRetry;
+  }
+  ++stats_.upload_retries;
+  return retry_delay;
+}
+
+bool HttpUploaderImpl::WaitForRetry(int delay_milliseconds) {
+  LOG(INFO) << "retrying chunk " << chunk_sequence_ << " in "
+            << delay_milliseconds << " ms";
+  std::unique_lock<std::mutex> lock(mutex_);
+  return !buffer_ready_.wait_for(
+      lock, std::chrono::milliseconds(delay_milliseconds),
+      [this] { return stop_; });
+}
+
+void HttpUploaderImpl::FreeChunkHeaders() {
+  if (ptr_chunk_headers_) {
+    curl_easy_setopt(ptr_curl_, CURLOPT_HTTPHEADER, ptr_headers_);
+    curl_slist_free_all(ptr_chunk_headers_);
+    ptr_chunk_headers_ = NULL;
+  }
+}
+
+void HttpUploaderImpl::CompleteUpload() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  LOG(INFO) << "unlocking upload buffer...";
+  const int status = upload_buffer_.Unlock();
+  if (status) {
+    LOG(ERROR) << "unable to unlock buffer, status=" << status;
+  }
+  upload_complete_ = true;
+}
+
+// Runs on the engine thread. Retries are queued on the engine with the
+// backoff delay instead of waiting here.
+void HttpUploaderImpl::TransferDone(int curl_code) {
+  const int retry_delay = FinishRequest(static_cast<CURLcode>(curl_code));
+  if (retry_delay != kNoRetry) {
+    LOG(INFO) << "retrying chunk " << chunk_sequence_ << " in "
+              << retry_delay << " ms";
+    int status = StartRequest();
+    if (status == kSuccess) {
+      status = settings_.engine->QueueTransfer(engine_stream_id_, this,
+                                               retry_delay);
+    }
+    if (status == kSuccess) {
+      return;
+    }
+    LOG(ERROR) << "cannot queue retry, status=" << status;
+    FreeChunkHeaders();
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.chunks_lost;
   }
+  CompleteUpload();
+}
 
-  // Update total bytes uploaded.
+// libcurl times are in seconds from the start of the request. Request rates
+// are measured from the end of connection setup, so that reconnects do not
+// count against the link.
+void HttpUploaderImpl::UpdateUploadTotal() {
   double bytes_uploaded = 0;
-  err = curl_easy_getinfo(ptr_curl_, CURLINFO_SIZE_UPLOAD, &bytes_uploaded);
+  CURLcode err =
+      curl_easy_getinfo(ptr_curl_, CURLINFO_SIZE_UPLOAD, &bytes_uploaded);
   if (err != CURLE_OK) {
     LOG_CURL_ERR(err, "curl_easy_getinfo CURLINFO_SIZE_UPLOAD failed.");
-  } else {
+    return;
+  }
+  double name_lookup_time = 0;
+  double connect_time = 0;
+  double tls_time = 0;
+  double pretransfer_time = 0;
+  double first_byte_time = 0;
+  double total_time = 0;
+  long num_connects = 0;  // NOLINT
+  curl_easy_getinfo(ptr_curl_, CURLINFO_NAMELOOKUP_TIME, &name_lookup_time);
+  curl_easy_getinfo(ptr_curl_, CURLINFO_CONNECT_TIME, &connect_time);
+  curl_easy_getinfo(ptr_curl_, CURLINFO_APPCONNECT_TIME, &tls_time);
+  curl_easy_getinfo(ptr_curl_, CURLINFO_PRETRANSFER_TIME, &pretransfer_time);
+  curl_easy_getinfo(ptr_curl_, CURLINFO_STARTTRANSFER_TIME, &first_byte_time);
+  curl_easy_getinfo(ptr_curl_, CURLINFO_TOTAL_TIME, &total_time);
+  curl_easy_getinfo(ptr_curl_, CURLINFO_NUM_CONNECTS, &num_connects);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.bytes_sent_current = 0;
+  stats_.total_bytes_uploaded += static_cast<int64>(bytes_uploaded);
+  stats_.connect_milliseconds = connect_time * 1000;
+  stats_.tls_milliseconds = tls_time * 1000;
+  stats_.first_byte_milliseconds = first_byte_time * 1000;
+  stats_.total_milliseconds = total_time * 1000;
+
+  // A TCP connect takes one round trip.
+  const double connect_rtt = (connect_time - name_lookup_time) * 1000;
+  if (num_connects > 0 && connect_rtt > 0) {
+    stats_.rtt_milliseconds = stats_.rtt_milliseconds == 0 ?
+        connect_rtt :
+        stats_.rtt_milliseconds +
+            kRttAverageWeight * (connect_rtt - stats_.rtt_milliseconds);
+  }
+
+  // The streaming modes sample the stream in |ProgressCallback|.
+  if (!Streaming()) {
+    throughput_.AddSample(Clock::now(), bytes_uploaded,
+                          total_time - pretransfer_time);
+    stats_.average_bytes_per_second = throughput_.average();
+  }
+  VLOG(1) << "request: " << static_cast<int64>(bytes_uploaded) << " bytes"
+          << " connect=" << stats_.connect_milliseconds << "ms"
+          << " tls=" << stats_.tls_milliseconds << "ms"
+          << " first_byte=" << stats_.first_byte_milliseconds << "ms"
+          << " total=" << stats_.total_milliseconds << "ms";
+}
+
+// Metadata chunks are stored in |stream_header_|; everything else is appended
+// to |stream_buffer_|. A complete chunk means the next chunk starts a cluster,
+// so its position is recorded in |cluster_starts_| for reconnects.
+int HttpUploaderImpl::StreamChunk(const ChunkInfo& info,
+                                  const uint8* ptr_buffer,
+                                  int32 length) {
+  if (!ptr_buffer || length <= 0) {
+    LOG(ERROR) << "cannot stream empty chunk.";
+    return HttpUploader::kInvalidArg;
+  }
+  if (info.type == ChunkInfo::kManifest) {
+    VLOG(1) << "streaming mode, not sending manifest.";
+    return kSuccess;
+  }
+  {
     std::lock_guard<std::mutex> lock(mutex_);
-    stats_.bytes_sent_current = 0;
-    stats_.total_bytes_uploaded += static_cast<int64>(bytes_uploaded);
+    if (info.type == ChunkInfo::kMetadata) {
+      if (stream_header_complete_) {
+        LOG(ERROR) << "metadata received after stream start.";
+        return HttpUploader::kInvalidArg;
+      }
+      stream_header_.insert(stream_header_.end(), ptr_buffer,
+                            ptr_buffer + length);
+      stream_header_complete_ = info.complete;
+      next_chunk_starts_cluster_ = info.complete;
+    } else {
+      // Reclaim sent data once it is at least half of |stream_buffer_|.
+      if (stream_read_offset_ > 0 &&
+          stream_read_offset_ >= stream_buffer_.size() / 2) {
+        stream_buffer_.erase(stream_buffer_.begin(),
+                             stream_buffer_.begin() + stream_read_offset_);
+        stream_base_position_ += stream_read_offset_;
+        stream_read_offset_ = 0;
+      }
+      if (next_chunk_starts_cluster_) {
+        cluster_starts_.push_back(stream_base_position_ +
+                                  stream_buffer_.size());
+      }
+      stream_buffer_.insert(stream_buffer_.end(), ptr_buffer,
+                            ptr_buffer + length);
+      next_chunk_starts_cluster_ = info.complete;
+    }
   }
+  stream_data_ready_.notify_one();
+  return kSuccess;
+}
 
+int HttpUploaderImpl::StreamUpload() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!url_queue_.empty()) {
+      target_url_ = url_queue_.front();
+    }
+    header_send_offset_ = 0;
+    stream_resync_ = true;
+  }
+  if (target_url_.empty()) {
+    LOG(ERROR) << "No target URL!";
+    return HttpUploader::kUrlConfigError;
+  }
+  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_URL,
+                                  target_url_.c_str());
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "could not pass URL to curl.");
+    return HttpUploader::kUrlConfigError;
+  }
+  if (settings_.post_mode == webmlive::HTTP_STREAM_PUT) {
+    err = curl_easy_setopt(ptr_curl_, CURLOPT_UPLOAD, 1L);
+  } else {
+    err = curl_easy_setopt(ptr_curl_, CURLOPT_POST, 1L);
+  }
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "setopt CURLOPT_UPLOAD/CURLOPT_POST failed.");
+    return HttpUploader::kRunFailed;
+  }
+
+  LOG(INFO) << "opening stream to " << target_url_;
+  err = curl_easy_perform(ptr_curl_);
+  UpdateUploadTotal();
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "streaming curl_easy_perform failed.");
+    return kLibCurlError;
+  }
+  int resp_code = 0;
+  curl_easy_getinfo(ptr_curl_, CURLINFO_RESPONSE_CODE, &resp_code);
+  LOG(INFO) << "stream closed, server response code: " << resp_code;
   return kSuccess;
 }
 
+void HttpUploaderImpl::StreamLoop() {
+  for (;;) {
+    const int status = StreamUpload();
+    if (status == kSuccess) {
+      // |ReadStreamData| ended the request because of |Stop|.
+      break;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stop_) {
+      break;
+    }
+    LOG(ERROR) << "stream upload failed, status=" << status
+               << ", reconnecting in " << kStreamReconnectDelayMilliseconds
+               << " ms.";
+    // Wait out the delay unless stopped; new data does not cut it short.
+    if (stream_data_ready_.wait_for(
+            lock, std::chrono::milliseconds(kStreamReconnectDelayMilliseconds),
+            [this] { return stop_; })) {
+      break;
+    }
+  }
+}
+
+size_t HttpUploaderImpl::ReadStreamData(char* ptr_buffer, size_t max_length) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    // Send the metadata first.
+    if (stream_header_complete_ &&
+        header_send_offset_ < stream_header_.size()) {
+      const size_t length =
+          std::min(max_length, stream_header_.size() - header_send_offset_);
+      memcpy(ptr_buffer, &stream_header_[header_send_offset_], length);
+      header_send_offset_ += length;
+      return length;
+    }
+
+    // Drop cluster starts already passed, and when resyncing skip everything
+    // before the next cluster.
+    const int64 read_position = stream_base_position_ + stream_read_offset_;
+    while (!cluster_starts_.empty() &&
+           cluster_starts_.front() < read_position) {
+      cluster_starts_.pop_front();
+    }
+    if (stream_header_complete_ && stream_resync_) {
+      if (!cluster_starts_.empty()) {
+        const int64 skipped = cluster_starts_.front() - read_position;
+        if (skipped > 0) {
+          LOG(WARNING) << "stream resync skipped " << skipped << " bytes.";
+        }
+        stream_read_offset_ =
+            static_cast<size_t>(cluster_starts_.front() -
+                                stream_base_position_);
+        stream_resync_ = false;
+      } else {
+        stream_read_offset_ = stream_buffer_.size();
+      }
+    }
+
+    if (stream_header_complete_ && !stream_resync_ &&
+        stream_read_offset_ < stream_buffer_.size()) {
+      const size_t length =
+          std::min(max_length, stream_buffer_.size() - stream_read_offset_);
+      memcpy(ptr_buffer, &stream_buffer_[stream_read_offset_], length);
+      stream_read_offset_ += length;
+      return length;
+    }
+    if (stop_) {
+      LOG(INFO) << "stop requested, ending stream.";
+      return 0;
+    }
+    stream_data_ready_.wait_for(
+        lock, std::chrono::milliseconds(kStreamReadWaitMilliseconds));
+  }
+}
+
+size_t HttpUploaderImpl::ReadCallback(char* buffer, size_t size,
+                                      size_t nitems, void* ptr_this) {
+  HttpUploaderImpl* ptr_uploader_ =
+    reinterpret_cast<HttpUploaderImpl*>(ptr_this);
+  return ptr_uploader_->ReadStreamData(buffer, size * nitems);
+}
+
 // Idle the upload thread while awaiting user data.
 int HttpUploaderImpl::WaitForUserData() {
   std::unique_lock<std::mutex> lock(mutex_);
@@ -637,18 +1386,43 @@ int HttpUploaderImpl::ProgressCallback(void* ptr_this,
   download_current;
   HttpUploaderImpl* ptr_uploader_ =
     reinterpret_cast<HttpUploaderImpl*>(ptr_this);
-  if (ptr_uploader_->StopRequested()) {
+
+  if (!ptr_uploader_->Streaming() && ptr_uploader_->StopRequested()) {
     LOG(ERROR) << "stop requested.";
     return kProgressCallbackStopRequest;
   }
   std::lock_guard<std::mutex> lock(ptr_uploader_->mutex_);
+
+  // Streams are allowed to send everything queued before the stop request;
+  // once that has been handed to libcurl nothing is left to wait for.
+  if (ptr_uploader_->Streaming() && ptr_uploader_->stop_ &&
+      ptr_uploader_->StreamDrained()) {
+    LOG(INFO) << "stop requested, stream drained.";
+    return kProgressCallbackStopRequest;
+  }
   HttpUploaderStats& stats = ptr_uploader_->stats_;
   stats.bytes_sent_current = static_cast<int64>(upload_current);
-  double ticks_elapsed = clock() - ptr_uploader_->start_ticks_;
-  double ticks_per_sec = CLOCKS_PER_SEC;
-  stats.bytes_per_second =
-      (upload_current + stats.total_bytes_uploaded) /
-      (ticks_elapsed / ticks_per_sec);
+  const Clock::time_point now = Clock::now();
+  const int64 bytes_sent =
+      stats.bytes_sent_current + stats.total_bytes_uploaded;
+  const double seconds_elapsed =
+      std::chrono::duration<double>(now - ptr_uploader_->start_time_).count();
+  if (seconds_elapsed > 0) {
+    stats.bytes_per_second = bytes_sent / seconds_elapsed;
+  }
+  if (ptr_uploader_->Streaming()) {
+    const double sample_seconds = std::chrono::duration<double>(
+        now - ptr_uploader_->sample_start_time_).count();
+    if (sample_seconds * 1000 >= kStreamSampleMilliseconds) {
+      const int64 sample_bytes =
+          bytes_sent - ptr_uploader_->sample_start_bytes_;
+      ptr_uploader_->throughput_.AddSample(
+          now, static_cast<double>(sample_bytes), sample_seconds);
+      stats.average_bytes_per_second = ptr_uploader_->throughput_.average();
+      ptr_uploader_->sample_start_time_ = now;
+      ptr_uploader_->sample_start_bytes_ = bytes_sent;
+    }
+  }
   VLOG(4) << "total=" << static_cast<int>(upload_total) << " bytes_per_sec="
           << static_cast<int>(stats.bytes_per_second);
   return 0;
@@ -665,6 +1439,8 @@ size_t HttpUploaderImpl::WriteCallback(char* buffer, size_t size,
   LOG(INFO) << "from server:\n" << tmp.c_str();
   HttpUploaderImpl* ptr_uploader_ =
     reinterpret_cast<HttpUploaderImpl*>(ptr_this);
+  // A streaming server only responds once the upload is over, so stopping
+  // here loses nothing in any mode.
   if (ptr_uploader_->StopRequested()) {
     LOG(INFO) << "stop requested.";
     return kWriteCallbackStopRequest;
@@ -672,19 +1448,63 @@ size_t HttpUploaderImpl::WriteCallback(char* buffer, size_t size,
   return size*nitems;
 }
 
+// Handle HTTP response headers.
+size_t HttpUploaderImpl::HeaderCallback(char* buffer, size_t size,
+                                        size_t nitems,
+                                        void* ptr_this) {
+  HttpUploaderImpl* ptr_uploader_ =
+    reinterpret_cast<HttpUploaderImpl*>(ptr_this);
+  const size_t length = size * nitems;
+  std::string header(buffer, length);
+  const size_t name_length = strlen(kChunkReceivedHeader);
+  if (header.size() <= name_length) {
+    return length;
+  }
+  // Header names are case insensitive.
+  std::transform(header.begin(), header.begin() + name_length,
+                 header.begin(), ::tolower);
+  std::string name(kChunkReceivedHeader);
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  if (header.compare(0, name_length, name) == 0) {
+    std::istringstream value(header.substr(name_length));
+    int64 received_offset = -1;
+    if (value >> received_offset) {
+      ptr_uploader_->received_offset_ = received_offset;
+    }
+  }
+  return length;
+}
+
 // Reset uploaded byte count, and store upload start time.
 void HttpUploaderImpl::ResetStats() {
   std::lock_guard<std::mutex> lock(mutex_);
   stats_.bytes_per_second = 0;
+  stats_.average_bytes_per_second = 0;
+  stats_.max_bytes_per_second = 0;
+  stats_.connect_milliseconds = 0;
+  stats_.tls_milliseconds = 0;
+  stats_.first_byte_milliseconds = 0;
+  stats_.total_milliseconds = 0;
+  stats_.rtt_milliseconds = 0;
   stats_.bytes_sent_current = 0;
   stats_.total_bytes_uploaded = 0;
-  start_ticks_ = clock();
+  stats_.upload_retries = 0;
+  stats_.chunks_lost = 0;
+  throughput_.Reset();
+  start_time_ = Clock::now();
+  sample_start_time_ = start_time_;
+  sample_start_bytes_ = 0;
 }
 
 // Upload thread.  Wakes when user provides a buffer via call to
 // |UploadBuffer|.
 void HttpUploaderImpl::UploadThread() {
   LOG(INFO) << "upload thread running...";
+  if (Streaming()) {
+    StreamLoop();
+    LOG(INFO) << "thread done";
+    return;
+  }
   while (!StopRequested()) {
     LOG(INFO) << "upload thread waiting for buffer...";
     WaitForUserData();
@@ -695,18 +1515,13 @@ void HttpUploaderImpl::UploadThread() {
     }
     if (status) {
       LOG(ERROR) << "buffer upload failed, status=" << status;
-      // TODO(tomfinegan): Report upload failure, and provide access to
-      //                   response code and data.
-    } else {
-      std::lock_guard<std::mutex> lock(mutex_);
-      LOG(INFO) << "unlocking upload buffer...";
-      status = upload_buffer_.Unlock();
-      if (status) {
-        LOG(ERROR) << "unable to unlock buffer, status=" << status;
-        // keep spinning, for now...
-      }
-      upload_complete_ = true;
+      // TODO(tomfinegan): Provide access to response code and data.
+      FreeChunkHeaders();
+      mutex_.lock();
+      ++stats_.chunks_lost;
+      mutex_.unlock();
     }
+    CompleteUpload();
   }
   LOG(INFO) << "thread done";
 }
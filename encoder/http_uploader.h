@@ -19,9 +19,16 @@
 
 namespace webmlive {
 
+class HttpUploadEngine;
+
 enum UploadMode {
   HTTP_POST = 0,
   HTTP_FORM_POST = 1,
+
+  // The whole stream is sent in one long running request using chunked
+  // transfer encoding.
+  HTTP_STREAM_POST = 2,
+  HTTP_STREAM_PUT = 3,
 };
 
 struct HttpUploaderSettings {
@@ -29,6 +36,20 @@ struct HttpUploaderSettings {
   // map<std::string,std::string>.
   typedef std::map<std::string, std::string> StringMap;
 
+  // Default retry policy: up to 5 attempts per chunk, waiting 250 ms before
+  // the first retry and doubling the wait up to 4 seconds.
+  static const int kDefaultMaxUploadAttempts = 5;
+  static const int kDefaultRetryDelayMilliseconds = 250;
+  static const int kDefaultMaxRetryDelayMilliseconds = 4000;
+
+  HttpUploaderSettings()
+      : post_mode(HTTP_POST),
+        engine(NULL),
+        max_upload_attempts(kDefaultMaxUploadAttempts),
+        retry_delay_milliseconds(kDefaultRetryDelayMilliseconds),
+        max_retry_delay_milliseconds(kDefaultMaxRetryDelayMilliseconds),
+        resume_uploads(false) {}
+
   // |local_file| is what the HTTP server sees as the local file name.
   // Assigning a path to a local file and passing the settings struct to
   // |HttpUploader::Init| will not upload an existing file.
@@ -48,17 +69,63 @@ struct HttpUploaderSettings {
 
   // Post mode
   UploadMode post_mode;
+
+  // Shared engine that runs the uploads, or NULL to upload from a thread
+  // owned by the uploader. The engine must be running before |Run| is
+  // called, and must outlive the uploader. Not supported in the streaming
+  // modes.
+  HttpUploadEngine* engine;
+
+  // Retry budget of each chunk, counting the first attempt. 1 disables
+  // retries. Not used in the streaming modes, which reconnect instead.
+  int max_upload_attempts;
+
+  // Wait before the first retry of a chunk. The wait doubles with each retry
+  // up to |max_retry_delay_milliseconds|, and is randomly shortened by up to
+  // half so that uploaders sharing a server do not retry in lockstep.
+  int retry_delay_milliseconds;
+  int max_retry_delay_milliseconds;
+
+  // Resume partially sent chunks instead of resending them whole. The server
+  // must accept a Content-Range header on POST requests. Ignored with
+  // |HTTP_FORM_POST|.
+  bool resume_uploads;
 };
 
 struct HttpUploaderStats {
-  // Upload average bytes per second.
+  // Upload throughput, in bytes per second, measured on the wall clock.
+  // |bytes_per_second| averages everything sent since |Init|.
+  // |average_bytes_per_second| is a moving average of recent requests, or of
+  // one second intervals of the stream in the streaming modes.
+  // |max_bytes_per_second| is the highest of those rates in the last 10
+  // seconds.
   double bytes_per_second;
+  double average_bytes_per_second;
+  double max_bytes_per_second;
+
+  // libcurl timing of the last request, in milliseconds from its start:
+  // connection open, TLS handshake done, first response byte received, and
+  // request done. The connection times are near 0 when the request reused an
+  // open connection.
+  double connect_milliseconds;
+  double tls_milliseconds;
+  double first_byte_milliseconds;
+  double total_milliseconds;
+
+  // Smoothed round trip time to the server, in milliseconds, estimated from
+  // the TCP connect time of new connections. 0 until a connection is opened.
+  double rtt_milliseconds;
 
   // Bytes sent for current upload.
   int64 bytes_sent_current;
 
   // Total number of bytes uploaded.
   int64 total_bytes_uploaded;
+
+  // Number of requests retried, and number of chunks dropped after a
+  // rejection or after using up their retry budget.
+  int64 upload_retries;
+  int64 chunks_lost;
 };
 
 class HttpUploaderImpl;
@@ -71,6 +138,26 @@ class HttpUploaderImpl;
 // - |EnqueueTargetUrl| must be used to control target for HTTP requests. URLs
 //   enqueued are used in sequence, and only removed from the queue after
 //   successful uploads.
+// - In the streaming modes, |HTTP_STREAM_POST| and |HTTP_STREAM_PUT|, data
+//   passed to |UploadChunk| is appended to a byte queue that libcurl reads
+//   from while a single request stays open. When the request fails the
+//   uploader reconnects, resends the WebM metadata, and resumes at the next
+//   cluster boundary. DASH manifest chunks are not sent in these modes.
+// - With |HttpUploaderSettings::engine| set the uploader has no thread of its
+//   own; each upload is queued as a transfer on the engine.
+// - Every chunk carries an X-WebM-Chunk-Sequence header numbering the chunks
+//   passed to the uploader. Retries of a chunk send the same number, so the
+//   server can drop a chunk it already received.
+// - Chunks are retried after transport errors, and after HTTP 408, 429 and
+//   5xx responses. Other 4xx responses drop the chunk. Either way
+//   |UploadComplete| reports true only once the chunk is sent or dropped.
+// - With |HttpUploaderSettings::resume_uploads| a retry following a request
+//   that sent at least 32 kB is preceded by a HEAD request carrying the
+//   chunk's X-WebM-Chunk-Sequence header. When the server answers with an
+//   X-WebM-Chunk-Received header of at least 32 kB, the retry sends only the
+//   rest of the chunk from that offset, with a Content-Range header.
+//   Otherwise, or when the server answers the resumed request with 416, the
+//   uploader resends the whole chunk.
 class HttpUploader : public DataSinkInterface {
  public:
   enum {
@@ -123,6 +210,13 @@ class HttpUploader : public DataSinkInterface {
   // |EnqueueTargetUrl| to set target URLs.
   int UploadBuffer(const uint8* ptr_buffer, int32 length);
 
+  // Same as |UploadBuffer| in the non-streaming modes, except that chunks
+  // from per-track output are sent with "&track=<track>" and "&metadata=1" or
+  // "&chunk=<number>" added to the URL. In the streaming modes queues the
+  // chunk described by |info| for the open request.
+  int UploadChunk(const ChunkInfo& info, const uint8* ptr_buffer,
+                  int32 length);
+
   // Calls |HttpUploaderImpl::EnqueueTargetUrl| to enqueue |target_url|.
   void EnqueueTargetUrl(const std::string& target_url);
 
@@ -131,6 +225,10 @@ class HttpUploader : public DataSinkInterface {
   virtual bool WriteData(const uint8* ptr_buffer, int32 length) {
     return (UploadBuffer(ptr_buffer, length) == kSuccess);
   }
+  virtual bool WriteChunk(const ChunkInfo& info, const uint8* ptr_buffer,
+                          int32 length) {
+    return (UploadChunk(info, ptr_buffer, length) == kSuccess);
+  }
 
  private:
   // Pointer to uploader implementation.
@@ -0,0 +1,1320 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/local_http_server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <new>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "encoder/dash_writer.h"
+#include "encoder/dvr_ring.h"
+#include "glog/logging.h"
+
+namespace {
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+const Socket kInvalidSocket = INVALID_SOCKET;
+const int kSendFlags = 0;
+
+void CloseSocket(Socket socket) {
+  closesocket(socket);
+}
+
+bool SetNonBlocking(Socket socket) {
+  u_long non_blocking = 1;
+  return ioctlsocket(socket, FIONBIO, &non_blocking) == 0;
+}
+
+// Returns true when the last socket call failed only because it would
+// block.
+bool WouldBlock() {
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+#else
+typedef int Socket;
+const Socket kInvalidSocket = -1;
+const int kSendFlags = MSG_NOSIGNAL;
+
+void CloseSocket(Socket socket) {
+  close(socket);
+}
+
+bool SetNonBlocking(Socket socket) {
+  const int flags = fcntl(socket, F_GETFL, 0);
+  return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+bool WouldBlock() {
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+#endif
+
+// Requests whose headers do not fit are refused.
+const size_t kMaxRequestSize = 8192;
+
+const char kHeaderEnd[] = "\r\n\r\n";
+const char kLastChunk[] = "0\r\n\r\n";
+const char kLiveStreamExtension[] = ".webm";
+
+const char kManifestType[] = "application/dash+xml";
+const char kAudioType[] = "audio/webm";
+const char kVideoType[] = "video/webm";
+const char kTextType[] = "text/plain";
+
+// Returns |text| in lower case.
+std::string ToLower(const std::string& text) {
+  std::string lower(text);
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  return lower;
+}
+
+// Waits for socket events with epoll, or with WSAPoll on Windows. Sockets are
+// always watched for reads, and for writes on request.
+class SocketPoller {
+ public:
+  struct Event {
+    Socket socket;
+    bool readable;
+    bool writable;
+  };
+
+  SocketPoller();
+  ~SocketPoller();
+
+  bool Init();
+  bool Add(Socket socket, bool write);
+  bool Modify(Socket socket, bool write);
+  void Remove(Socket socket);
+
+  // Waits up to |timeout| milliseconds for events, or indefinitely when
+  // |timeout| is negative, and replaces the contents of |ptr_events| with the
+  // events. Returns false on failure.
+  bool Wait(int timeout, std::vector<Event>* ptr_events);
+
+ private:
+#ifdef _WIN32
+  std::vector<WSAPOLLFD> sockets_;
+
+  // Index of each socket in |sockets_|.
+  std::map<Socket, size_t> indexes_;
+#else
+  int epoll_fd_;
+  std::vector<epoll_event> events_;
+#endif
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SocketPoller);
+};
+
+#ifdef _WIN32
+SocketPoller::SocketPoller() {
+}
+
+SocketPoller::~SocketPoller() {
+}
+
+bool SocketPoller::Init() {
+  return true;
+}
+
+bool SocketPoller::Add(Socket socket, bool write) {
+  WSAPOLLFD poll_fd = {0};
+  poll_fd.fd = socket;
+  poll_fd.events = POLLRDNORM | (write ? POLLWRNORM : 0);
+  indexes_[socket] = sockets_.size();
+  sockets_.push_back(poll_fd);
+  return true;
+}
+
+bool SocketPoller::Modify(Socket socket, bool write) {
+  const std::map<Socket, size_t>::const_iterator it = indexes_.find(socket);
+  if (it == indexes_.end()) {
+    return false;
+  }
+  sockets_[it->second].events = POLLRDNORM | (write ? POLLWRNORM : 0);
+  return true;
+}
+
+void SocketPoller::Remove(Socket socket) {
+  const std::map<Socket, size_t>::iterator it = indexes_.find(socket);
+  if (it == indexes_.end()) {
+    return;
+  }
+  const size_t index = it->second;
+  indexes_.erase(it);
+  if (index + 1 < sockets_.size()) {
+    sockets_[index] = sockets_.back();
+    indexes_[sockets_[index].fd] = index;
+  }
+  sockets_.pop_back();
+}
+
+bool SocketPoller::Wait(int timeout, std::vector<Event>* ptr_events) {
+  ptr_events->clear();
+  const int num_ready =
+      WSAPoll(&sockets_[0], static_cast<ULONG>(sockets_.size()), timeout);
+  if (num_ready == SOCKET_ERROR) {
+    LOG(ERROR) << "WSAPoll failed, error=" << WSAGetLastError();
+    return false;
+  }
+  for (size_t i = 0; i < sockets_.size() && num_ready > 0; ++i) {
+    const SHORT revents = sockets_[i].revents;
+    if (revents == 0) {
+      continue;
+    }
+    // Errors and hang ups are reported as reads, which then fail.
+    Event event;
+    event.socket = sockets_[i].fd;
+    event.readable = (revents & (POLLRDNORM | POLLHUP | POLLERR)) != 0;
+    event.writable = (revents & POLLWRNORM) != 0;
+    ptr_events->push_back(event);
+  }
+  return true;
+}
+#else
+SocketPoller::SocketPoller() : epoll_fd_(-1) {
+}
+
+SocketPoller::~SocketPoller() {
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+bool SocketPoller::Init() {
+  epoll_fd_ = epoll_create1(0);
+  if (epoll_fd_ < 0) {
+    LOG(ERROR) << "epoll_create1 failed, errno=" << errno;
+    return false;
+  }
+  return true;
+}
+
+bool SocketPoller::Add(Socket socket, bool write) {
+  epoll_event event = {0};
+  event.events = EPOLLIN | (write ? EPOLLOUT : 0);
+  event.data.fd = socket;
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, socket, &event) == 0;
+}
+
+bool SocketPoller::Modify(Socket socket, bool write) {
+  epoll_event event = {0};
+  event.events = EPOLLIN | (write ? EPOLLOUT : 0);
+  event.data.fd = socket;
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, socket, &event) == 0;
+}
+
+void SocketPoller::Remove(Socket socket) {
+  epoll_event event = {0};
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, socket, &event);
+}
+
+bool SocketPoller::Wait(int timeout, std::vector<Event>* ptr_events) {
+  ptr_events->clear();
+  const size_t kMaxEvents = 256;
+  events_.resize(kMaxEvents);
+  const int num_ready =
+      epoll_wait(epoll_fd_, &events_[0], kMaxEvents, timeout);
+  if (num_ready < 0) {
+    if (errno == EINTR) {
+      return true;
+    }
+    LOG(ERROR) << "epoll_wait failed, errno=" << errno;
+    return false;
+  }
+  for (int i = 0; i < num_ready; ++i) {
+    // Errors and hang ups are reported as reads, which then fail.
+    Event event;
+    event.socket = events_[i].data.fd;
+    event.readable =
+        (events_[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+    event.writable = (events_[i].events & EPOLLOUT) != 0;
+    ptr_events->push_back(event);
+  }
+  return true;
+}
+#endif
+
+}  // namespace
+
+namespace webmlive {
+
+LocalHttpServerConfig::LocalHttpServerConfig()
+    : address("127.0.0.1"),
+      port(kDefaultPort),
+      name(kDefaultDashName),
+      id(kDefaultDashId),
+      max_connections(kDefaultMaxConnections),
+      long_poll_timeout(kDefaultLongPollTimeout),
+      max_pending_size(kDefaultMaxPendingSize) {
+}
+
+class LocalHttpServerImpl {
+ public:
+  enum {
+    kSocketError = LocalHttpServer::kSocketError,
+    kRunFailed = LocalHttpServer::kRunFailed,
+    kNoMemory = LocalHttpServer::kNoMemory,
+    kInvalidArg = LocalHttpServer::kInvalidArg,
+    kSuccess = LocalHttpServer::kSuccess,
+  };
+
+  LocalHttpServerImpl();
+  ~LocalHttpServerImpl();
+
+  int Init(const LocalHttpServerConfig& config, DvrRing* ptr_ring);
+  int Run();
+  void Stop();
+  void GetStats(LocalHttpServerStats* ptr_stats) const;
+  bool WriteChunk(const ChunkInfo& info,
+                  const uint8* ptr_data,
+                  int32 data_length);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+  static const int kNumTracks = ChunkInfo::kVideoTrack + 1;
+
+  // Response data queued for a connection: |text| when |chunk| is NULL.
+  struct OutputBuffer {
+    std::string text;
+    DvrChunkPtr chunk;
+  };
+
+  struct Connection {
+    enum State {
+      // Reading a request.
+      kReading,
+
+      // Sending a response that is fully queued.
+      kSending,
+
+      // Waiting for the first chunk of media segment |number| of |track|.
+      kWaitingSegment,
+
+      // Sending media segment |number| of |track| as its chunks arrive.
+      kStreamingSegment,
+
+      // Sending the live stream of |track|. |sequence| is -1 until the
+      // stream starts.
+      kStreamingLive,
+    };
+
+    Connection()
+        : socket(kInvalidSocket),
+          id(0),
+          state(kReading),
+          keep_alive(true),
+          chunked(true),
+          write_interest(false),
+          output_offset(0),
+          pending_size(0),
+          track(ChunkInfo::kAllTracks),
+          number(0),
+          sequence(-1) {}
+
+    Socket socket;
+    uint64 id;
+    State state;
+
+    // Request data not yet handled.
+    std::string input;
+
+    // True when the connection stays open after the response, and when
+    // streamed responses use chunked transfer encoding. Both are false for
+    // HTTP/1.0 requests.
+    bool keep_alive;
+    bool chunked;
+
+    // True while the poller watches the socket for writes.
+    bool write_interest;
+
+    // Response data not yet sent, the bytes of |output.front()| already
+    // sent, and the bytes queued in |output|.
+    std::deque<OutputBuffer> output;
+    size_t output_offset;
+    int64 pending_size;
+
+    ChunkInfo::Track track;
+    int64 number;
+
+    // Sequence number of the next |DvrRing| chunk to read.
+    int64 sequence;
+  };
+  typedef std::map<Socket, std::unique_ptr<Connection>> ConnectionMap;
+
+  // Request waiting for a media segment, and the time at which it fails.
+  struct SegmentWait {
+    Socket socket;
+    uint64 id;
+    Clock::time_point deadline;
+  };
+
+  // Server thread function. Runs the event loop until |Stop()| is called.
+  void ServerThread();
+
+  // Wakes the server thread.
+  void Wake();
+
+  // Accepts pending connections.
+  void AcceptConnections();
+
+  // Closes |socket| and forgets its connection.
+  void CloseConnection(Socket socket);
+
+  // Reads from the connection, and handles the request read. Returns false
+  // when the connection must be closed.
+  bool ReadInput(Connection* ptr_connection);
+
+  // Handles the first request in |ptr_connection->input| when it is
+  // complete. Returns false when the connection must be closed.
+  bool HandleInput(Connection* ptr_connection);
+
+  // Queues the response to |method| |path|, or starts waiting for it.
+  // Returns false when the connection must be closed.
+  bool HandleRequest(Connection* ptr_connection,
+                     const std::string& method,
+                     const std::string& path);
+
+  // Responds with media segment |number| of |track|, or waits for it.
+  void ServeSegment(Connection* ptr_connection,
+                    ChunkInfo::Track track,
+                    int64 number);
+
+  // Adds |ptr_connection| to the streams of its track, which are updated
+  // when the track is written.
+  void WatchStream(Connection* ptr_connection);
+
+  // Updates the streams of the tracks set in |dirty_tracks|, one bit per
+  // track, and forgets connections that stopped streaming.
+  void UpdateStreams(int dirty_tracks);
+
+  // Reads the chunks written since the last read for a connection that
+  // waits for or streams media, and queues them. Returns false when the
+  // connection must be closed.
+  bool ReadStream(Connection* ptr_connection);
+
+  // Sends queued output, starting the next request when a response is done,
+  // and updates the events watched. Returns false when the connection must
+  // be closed.
+  bool Flush(Connection* ptr_connection);
+
+  // Sends queued output until the socket would block. Returns false on
+  // failure.
+  bool SendOutput(Connection* ptr_connection);
+
+  // Queues response headers. |content_length| is negative for streamed
+  // responses.
+  void QueueHeader(Connection* ptr_connection,
+                   int status_code,
+                   const char* reason,
+                   const char* content_type,
+                   int64 content_length,
+                   bool cacheable);
+
+  // Queues a complete response made of |chunks|.
+  void QueueChunks(Connection* ptr_connection,
+                   const char* content_type,
+                   const DvrChunkList& chunks,
+                   bool cacheable);
+
+  // Queues one chunk of a streamed response.
+  void QueueStreamChunk(Connection* ptr_connection, const DvrChunkPtr& chunk);
+
+  // Queues the end of a streamed response, and marks the response fully
+  // queued.
+  void QueueStreamEnd(Connection* ptr_connection);
+
+  // Queues an error response.
+  void QueueError(Connection* ptr_connection,
+                  int status_code,
+                  const char* reason);
+
+  void QueueText(Connection* ptr_connection, const std::string& text);
+
+  // Fails requests that waited too long for their segment.
+  void ExpireWaits();
+
+  // Returns the milliseconds until the next wait expires, or -1.
+  int NextTimeout() const;
+
+  // Parses |path| as the name of a media segment of |track|. Returns true
+  // and sets |ptr_number| when it is one.
+  bool ParseSegmentPath(const std::string& path,
+                        ChunkInfo::Track track,
+                        int64* ptr_number) const;
+
+  static const char* ContentType(ChunkInfo::Track track);
+
+  LocalHttpServerConfig config_;
+  DvrRing* ptr_ring_;
+  bool winsock_started_;
+  Socket listen_socket_;
+
+  // Datagram socket connected to itself. |Wake()| sends it a byte.
+  Socket wake_socket_;
+  std::atomic<bool> wake_pending_;
+
+  // Tracks written since the server thread last updated their streams, one
+  // bit per track.
+  std::atomic<int> dirty_tracks_;
+  std::atomic<bool> stop_;
+  std::shared_ptr<std::thread> server_thread_;
+
+  // Server thread state.
+  SocketPoller poller_;
+  ConnectionMap connections_;
+  std::deque<SegmentWait> segment_waits_;
+  uint64 next_connection_id_;
+
+  // Sockets of the connections that wait for or stream media, per track.
+  // Entries of connections that moved on are removed by |UpdateStreams()|.
+  std::set<Socket> stream_sockets_[kNumTracks];
+
+  // Resource paths.
+  std::string manifest_path_;
+  std::string initialization_paths_[kNumTracks];
+  std::string live_paths_[kNumTracks];
+  std::string segment_prefixes_[kNumTracks];
+  std::string segment_suffixes_[kNumTracks];
+
+  mutable std::mutex stats_mutex_;
+  LocalHttpServerStats stats_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LocalHttpServerImpl);
+};
+
+LocalHttpServerImpl::LocalHttpServerImpl()
+    : ptr_ring_(NULL),
+      winsock_started_(false),
+      listen_socket_(kInvalidSocket),
+      wake_socket_(kInvalidSocket),
+      wake_pending_(false),
+      dirty_tracks_(0),
+      stop_(false),
+      next_connection_id_(1) {
+}
+
+LocalHttpServerImpl::~LocalHttpServerImpl() {
+  Stop();
+  if (listen_socket_ != kInvalidSocket) {
+    CloseSocket(listen_socket_);
+  }
+  if (wake_socket_ != kInvalidSocket) {
+    CloseSocket(wake_socket_);
+  }
+#ifdef _WIN32
+  if (winsock_started_) {
+    WSACleanup();
+  }
+#endif
+}
+
+int LocalHttpServerImpl::Init(const LocalHttpServerConfig& config,
+                              DvrRing* ptr_ring) {
+  if (!ptr_ring || config.port <= 0 || config.port > 65535 ||
+      config.max_connections <= 0 || config.long_poll_timeout < 0 ||
+      config.max_pending_size <= 0) {
+    LOG(ERROR) << "invalid LocalHttpServer config.";
+    return kInvalidArg;
+  }
+  config_ = config;
+  ptr_ring_ = ptr_ring;
+
+  manifest_path_ = "/" + DashWriter::ManifestName(config_.name);
+  for (int i = 0; i < kNumTracks; ++i) {
+    const ChunkInfo::Track track = static_cast<ChunkInfo::Track>(i);
+    initialization_paths_[i] =
+        "/" + DashWriter::InitializationName(config_.name, config_.id, track);
+    std::ostringstream live_path;
+    live_path << "/" << config_.name;
+    if (track != ChunkInfo::kAllTracks) {
+      live_path << "_" << track;
+    }
+    live_path << kLiveStreamExtension;
+    live_paths_[i] = live_path.str();
+
+    // Segment names differ only in their numbers.
+    const std::string name_0 =
+        DashWriter::ChunkName(config_.name, config_.id, track, 0);
+    const std::string name_1 =
+        DashWriter::ChunkName(config_.name, config_.id, track, 1);
+    size_t prefix_length = 0;
+    while (name_0[prefix_length] == name_1[prefix_length]) {
+      ++prefix_length;
+    }
+    segment_prefixes_[i] = "/" + name_0.substr(0, prefix_length);
+    segment_suffixes_[i] = name_0.substr(prefix_length + 1);
+  }
+
+#ifdef _WIN32
+  WSADATA wsa_data = {0};
+  if (WSAStartup(MAKEWORD(2, 2), &wsa_data)) {
+    LOG(ERROR) << "WSAStartup failed.";
+    return kSocketError;
+  }
+  winsock_started_ = true;
+#endif
+
+  if (!poller_.Init()) {
+    return kSocketError;
+  }
+
+  sockaddr_in address = {0};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16>(config_.port));
+  if (inet_pton(AF_INET, config_.address.c_str(), &address.sin_addr) != 1) {
+    LOG(ERROR) << "invalid server address: " << config_.address;
+    return kInvalidArg;
+  }
+  listen_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (listen_socket_ == kInvalidSocket) {
+    LOG(ERROR) << "cannot create server socket.";
+    return kSocketError;
+  }
+#ifndef _WIN32
+  // Allows restarting the encoder while old connections linger.
+  const int reuse_address = 1;
+  setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, &reuse_address,
+             sizeof(reuse_address));
+#endif
+  if (bind(listen_socket_, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) ||
+      listen(listen_socket_, SOMAXCONN) ||
+      !SetNonBlocking(listen_socket_)) {
+    LOG(ERROR) << "cannot listen on " << config_.address << ":"
+               << config_.port;
+    return kSocketError;
+  }
+
+  // The wake socket sends to itself over loopback.
+  sockaddr_in wake_address = {0};
+  wake_address.sin_family = AF_INET;
+  wake_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t wake_address_length = sizeof(wake_address);
+  wake_socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (wake_socket_ == kInvalidSocket ||
+      bind(wake_socket_, reinterpret_cast<sockaddr*>(&wake_address),
+           sizeof(wake_address)) ||
+      getsockname(wake_socket_, reinterpret_cast<sockaddr*>(&wake_address),
+                  &wake_address_length) ||
+      connect(wake_socket_, reinterpret_cast<sockaddr*>(&wake_address),
+              sizeof(wake_address)) ||
+      !SetNonBlocking(wake_socket_)) {
+    LOG(ERROR) << "cannot create wake socket.";
+    return kSocketError;
+  }
+
+  if (!poller_.Add(listen_socket_, false) ||
+      !poller_.Add(wake_socket_, false)) {
+    LOG(ERROR) << "cannot poll server sockets.";
+    return kSocketError;
+  }
+  LOG(INFO) << "serving " << manifest_path_ << " on " << config_.address
+            << ":" << config_.port;
+  return kSuccess;
+}
+
+int LocalHttpServerImpl::Run() {
+  if (listen_socket_ == kInvalidSocket) {
+    LOG(ERROR) << "LocalHttpServer cannot Run, Init required.";
+    return kRunFailed;
+  }
+  if (server_thread_) {
+    return kSuccess;
+  }
+  using std::bind;
+  using std::nothrow;
+  using std::shared_ptr;
+  using std::thread;
+  stop_ = false;
+  server_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&LocalHttpServerImpl::ServerThread,  // NOLINT
+                                this)));
+  if (!server_thread_) {
+    LOG(ERROR) << "cannot construct server thread.";
+    return kRunFailed;
+  }
+  return kSuccess;
+}
+
+void LocalHttpServerImpl::Stop() {
+  if (!server_thread_) {
+    return;
+  }
+  stop_ = true;
+  Wake();
+  server_thread_->join();
+  server_thread_.reset();
+  while (!connections_.empty()) {
+    CloseConnection(connections_.begin()->first);
+  }
+  segment_waits_.clear();
+  for (int i = 0; i < kNumTracks; ++i) {
+    stream_sockets_[i].clear();
+  }
+}
+
+void LocalHttpServerImpl::GetStats(LocalHttpServerStats* ptr_stats) const {
+  if (ptr_stats) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    *ptr_stats = stats_;
+  }
+}
+
+bool LocalHttpServerImpl::WriteChunk(const ChunkInfo& info,
+                                     const uint8* ptr_data,
+                                     int32 data_length) {
+  if (!ptr_ring_ || !ptr_ring_->WriteChunk(info, ptr_data, data_length)) {
+    return false;
+  }
+  dirty_tracks_ |= 1 << info.track;
+  Wake();
+  return true;
+}
+
+void LocalHttpServerImpl::ServerThread() {
+  std::vector<SocketPoller::Event> events;
+  while (!stop_) {
+    if (!poller_.Wait(NextTimeout(), &events)) {
+      break;
+    }
+    for (size_t i = 0; i < events.size(); ++i) {
+      const SocketPoller::Event& event = events[i];
+      if (event.socket == listen_socket_) {
+        AcceptConnections();
+        continue;
+      }
+      if (event.socket == wake_socket_) {
+        // Clear the flag first, so that chunks written while the streams are
+        // updated wake the thread again.
+        wake_pending_ = false;
+        char buffer[64];
+        while (recv(wake_socket_, buffer, sizeof(buffer), 0) > 0) {}
+        UpdateStreams(dirty_tracks_.exchange(0));
+        continue;
+      }
+      const ConnectionMap::iterator it = connections_.find(event.socket);
+      if (it == connections_.end()) {
+        continue;
+      }
+      Connection* const ptr_connection = it->second.get();
+      if ((event.readable && !ReadInput(ptr_connection)) ||
+          !Flush(ptr_connection)) {
+        CloseConnection(event.socket);
+      }
+    }
+    ExpireWaits();
+  }
+  VLOG(1) << "server thread done.";
+}
+
+void LocalHttpServerImpl::Wake() {
+  if (!wake_pending_.exchange(true)) {
+    const char kWakeByte = 1;
+    send(wake_socket_, &kWakeByte, 1, 0);
+  }
+}
+
+void LocalHttpServerImpl::AcceptConnections() {
+  for (;;) {
+    const Socket socket = accept(listen_socket_, NULL, NULL);
+    if (socket == kInvalidSocket) {
+      if (!WouldBlock()) {
+        LOG(WARNING) << "accept failed.";
+      }
+      return;
+    }
+    if (connections_.size() >=
+            static_cast<size_t>(config_.max_connections) ||
+        !SetNonBlocking(socket)) {
+      CloseSocket(socket);
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      ++stats_.connections_dropped;
+      continue;
+    }
+
+    // Partial clusters are sent as soon as they are written.
+    const int no_delay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY,
+               reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+
+    std::unique_ptr<Connection> connection(
+        new (std::nothrow) Connection());  // NOLINT
+    if (!connection || !poller_.Add(socket, false)) {
+      LOG(ERROR) << "cannot add connection.";
+      CloseSocket(socket);
+      continue;
+    }
+    connection->socket = socket;
+    connection->id = next_connection_id_++;
+    connections_[socket] = std::move(connection);
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ++stats_.connections;
+    stats_.peak_connections =
+        std::max(stats_.peak_connections, stats_.connections);
+  }
+}
+
+void LocalHttpServerImpl::CloseConnection(Socket socket) {
+  const ConnectionMap::iterator it = connections_.find(socket);
+  if (it == connections_.end()) {
+    return;
+  }
+  poller_.Remove(socket);
+  CloseSocket(socket);
+  connections_.erase(it);
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  --stats_.connections;
+}
+
+void LocalHttpServerImpl::WatchStream(Connection* ptr_connection) {
+  stream_sockets_[ptr_connection->track].insert(ptr_connection->socket);
+}
+
+void LocalHttpServerImpl::UpdateStreams(int dirty_tracks) {
+  std::vector<Socket> closed;
+  for (int i = 0; i < kNumTracks; ++i) {
+    if (!(dirty_tracks & (1 << i))) {
+      continue;
+    }
+    std::set<Socket>& sockets = stream_sockets_[i];
+    std::set<Socket>::iterator it = sockets.begin();
+    while (it != sockets.end()) {
+      const ConnectionMap::iterator connection = connections_.find(*it);
+      if (connection == connections_.end() ||
+          connection->second->track != i ||
+          (connection->second->state != Connection::kWaitingSegment &&
+           connection->second->state != Connection::kStreamingSegment &&
+           connection->second->state != Connection::kStreamingLive)) {
+        it = sockets.erase(it);
+        continue;
+      }
+      if (!ReadStream(connection->second.get()) ||
+          !Flush(connection->second.get())) {
+        closed.push_back(*it);
+      }
+      ++it;
+    }
+  }
+  for (size_t i = 0; i < closed.size(); ++i) {
+    CloseConnection(closed[i]);
+  }
+}
+
+bool LocalHttpServerImpl::ReadInput(Connection* ptr_connection) {
+  char buffer[4096];
+  while (ptr_connection->input.size() <= kMaxRequestSize) {
+    const int bytes_read =
+        recv(ptr_connection->socket, buffer, sizeof(buffer), 0);
+    if (bytes_read > 0) {
+      ptr_connection->input.append(buffer, bytes_read);
+      continue;
+    }
+    if (bytes_read < 0 && WouldBlock()) {
+      break;
+    }
+
+    // The client closed the connection, or it failed.
+    return false;
+  }
+  if (ptr_connection->state == Connection::kReading) {
+    return HandleInput(ptr_connection);
+  }
+
+  // Requests that follow a streamed response are handled once it ends.
+  return ptr_connection->input.size() <= kMaxRequestSize;
+}
+
+bool LocalHttpServerImpl::HandleInput(Connection* ptr_connection) {
+  std::string& input = ptr_connection->input;
+  const size_t header_end = input.find(kHeaderEnd);
+  if (header_end == std::string::npos) {
+    if (input.size() > kMaxRequestSize) {
+      ptr_connection->keep_alive = false;
+      QueueError(ptr_connection, 431, "Request Header Fields Too Large");
+    }
+    return true;
+  }
+  std::istringstream request(input.substr(0, header_end));
+  input.erase(0, header_end + sizeof(kHeaderEnd) - 1);
+
+  std::string method;
+  std::string path;
+  std::string version;
+  std::string line;
+  if (!std::getline(request, line)) {
+    return false;
+  }
+  std::istringstream request_line(line);
+  if (!(request_line >> method >> path >> version) ||
+      version.compare(0, 5, "HTTP/")) {
+    ptr_connection->keep_alive = false;
+    QueueError(ptr_connection, 400, "Bad Request");
+    return true;
+  }
+  const bool http_1_0 = version == "HTTP/1.0";
+  ptr_connection->keep_alive = !http_1_0;
+  ptr_connection->chunked = !http_1_0;
+  while (std::getline(request, line)) {
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos ||
+        ToLower(line.substr(0, colon)) != "connection") {
+      continue;
+    }
+    const std::string value = ToLower(line.substr(colon + 1));
+    if (value.find("close") != std::string::npos) {
+      ptr_connection->keep_alive = false;
+    } else if (value.find("keep-alive") != std::string::npos) {
+      ptr_connection->keep_alive = true;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ++stats_.requests;
+  }
+  VLOG(2) << method << " " << path;
+  return HandleRequest(ptr_connection, method, path);
+}
+
+bool LocalHttpServerImpl::HandleRequest(Connection* ptr_connection,
+                                        const std::string& method,
+                                        const std::string& target) {
+  if (method != "GET") {
+    QueueError(ptr_connection, 405, "Method Not Allowed");
+    return true;
+  }
+  const std::string path = target.substr(0, target.find('?'));
+  if (path == manifest_path_) {
+    const DvrChunkPtr manifest = ptr_ring_->manifest();
+    if (!manifest) {
+      QueueError(ptr_connection, 404, "Not Found");
+      return true;
+    }
+    QueueChunks(ptr_connection, kManifestType, DvrChunkList(1, manifest),
+                false);
+    return true;
+  }
+  for (int i = 0; i < kNumTracks; ++i) {
+    const ChunkInfo::Track track = static_cast<ChunkInfo::Track>(i);
+    int64 number = 0;
+    if (path == initialization_paths_[i]) {
+      const DvrChunkPtr metadata = ptr_ring_->metadata(track);
+      if (!metadata) {
+        QueueError(ptr_connection, 404, "Not Found");
+        return true;
+      }
+      QueueChunks(ptr_connection, ContentType(track),
+                  DvrChunkList(1, metadata), false);
+      return true;
+    } else if (path == live_paths_[i]) {
+      ptr_connection->track = track;
+      ptr_connection->sequence = -1;
+      ptr_connection->state = Connection::kStreamingLive;
+      WatchStream(ptr_connection);
+      QueueHeader(ptr_connection, 200, "OK", ContentType(track), -1, false);
+      return ReadStream(ptr_connection);
+    } else if (ParseSegmentPath(path, track, &number)) {
+      ServeSegment(ptr_connection, track, number);
+      return true;
+    }
+  }
+  QueueError(ptr_connection, 404, "Not Found");
+  return true;
+}
+
+void LocalHttpServerImpl::ServeSegment(Connection* ptr_connection,
+                                       ChunkInfo::Track track,
+                                       int64 number) {
+  DvrChunkList chunks;
+  int64 sequence = 0;
+  const int status =
+      ptr_ring_->ReadSegment(track, number, &chunks, &sequence);
+  ptr_connection->track = track;
+  ptr_connection->number = number;
+  ptr_connection->sequence = sequence;
+  if (status == DvrRing::kPending) {
+    ptr_connection->state = Connection::kWaitingSegment;
+    WatchStream(ptr_connection);
+    SegmentWait wait;
+    wait.socket = ptr_connection->socket;
+    wait.id = ptr_connection->id;
+    wait.deadline = Clock::now() +
+        std::chrono::milliseconds(config_.long_poll_timeout);
+    segment_waits_.push_back(wait);
+    return;
+  }
+  if (status != DvrRing::kSuccess) {
+    QueueError(ptr_connection, 404, "Not Found");
+    return;
+  }
+  if (chunks.back()->info.complete) {
+    QueueChunks(ptr_connection, ContentType(track), chunks, true);
+    return;
+  }
+  ptr_connection->state = Connection::kStreamingSegment;
+  WatchStream(ptr_connection);
+  QueueHeader(ptr_connection, 200, "OK", ContentType(track), -1, false);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    QueueStreamChunk(ptr_connection, chunks[i]);
+  }
+}
+
+bool LocalHttpServerImpl::ReadStream(Connection* ptr_connection) {
+  const Connection::State state = ptr_connection->state;
+  if (state != Connection::kWaitingSegment &&
+      state != Connection::kStreamingSegment &&
+      state != Connection::kStreamingLive) {
+    return true;
+  }
+  DvrChunkList chunks;
+  int status = DvrRing::kSuccess;
+  if (state == Connection::kStreamingLive && ptr_connection->sequence < 0) {
+    status = ptr_ring_->ReadLiveStart(ptr_connection->track, &chunks,
+                                      &ptr_connection->sequence);
+    if (status == DvrRing::kNoKeyframe) {
+      return true;
+    }
+  } else {
+    status = ptr_ring_->ReadNewChunks(ptr_connection->track,
+                                      &ptr_connection->sequence, &chunks);
+  }
+  if (status == DvrRing::kOverrun && state == Connection::kWaitingSegment) {
+    QueueError(ptr_connection, 404, "Not Found");
+    return true;
+  }
+  if (status != DvrRing::kSuccess) {
+    LOG(WARNING) << "connection " << ptr_connection->id
+                 << " fell behind the stream, status=" << status;
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ++stats_.connections_dropped;
+    return false;
+  }
+
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    const DvrChunkPtr& chunk = chunks[i];
+    if (state == Connection::kStreamingLive) {
+      QueueStreamChunk(ptr_connection, chunk);
+      continue;
+    }
+    if (chunk->info.type != ChunkInfo::kMedia ||
+        chunk->info.number < ptr_connection->number) {
+      continue;
+    }
+    if (chunk->info.number > ptr_connection->number) {
+      // The segment ended without a complete chunk; the stream restarted.
+      if (ptr_connection->state == Connection::kWaitingSegment) {
+        QueueError(ptr_connection, 404, "Not Found");
+      } else {
+        QueueStreamEnd(ptr_connection);
+      }
+      break;
+    }
+    if (ptr_connection->state == Connection::kWaitingSegment) {
+      ptr_connection->state = Connection::kStreamingSegment;
+      QueueHeader(ptr_connection, 200, "OK",
+                  ContentType(ptr_connection->track), -1, false);
+    }
+    QueueStreamChunk(ptr_connection, chunk);
+    if (chunk->info.complete) {
+      QueueStreamEnd(ptr_connection);
+      break;
+    }
+  }
+  if (ptr_connection->pending_size > config_.max_pending_size) {
+    LOG(WARNING) << "connection " << ptr_connection->id
+                 << " fell behind the stream, " << ptr_connection->pending_size
+                 << " bytes pending.";
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    ++stats_.connections_dropped;
+    return false;
+  }
+  return true;
+}
+
+bool LocalHttpServerImpl::Flush(Connection* ptr_connection) {
+  for (;;) {
+    if (!SendOutput(ptr_connection)) {
+      return false;
+    }
+    if (!ptr_connection->output.empty() ||
+        ptr_connection->state != Connection::kSending) {
+      break;
+    }
+
+    // The response is sent; handle the next request.
+    if (!ptr_connection->keep_alive) {
+      return false;
+    }
+    ptr_connection->state = Connection::kReading;
+    if (!HandleInput(ptr_connection)) {
+      return false;
+    }
+    if (ptr_connection->state == Connection::kReading) {
+      break;
+    }
+  }
+  const bool write_interest = !ptr_connection->output.empty();
+  if (write_interest != ptr_connection->write_interest) {
+    if (!poller_.Modify(ptr_connection->socket, write_interest)) {
+      LOG(ERROR) << "cannot poll connection " << ptr_connection->id;
+      return false;
+    }
+    ptr_connection->write_interest = write_interest;
+  }
+  return true;
+}
+
+bool LocalHttpServerImpl::SendOutput(Connection* ptr_connection) {
+  std::deque<OutputBuffer>& output = ptr_connection->output;
+  int64 bytes_sent = 0;
+  bool ok = true;
+  while (!output.empty()) {
+    const OutputBuffer& buffer = output.front();
+    const char* ptr_data = buffer.text.data();
+    size_t length = buffer.text.size();
+    if (buffer.chunk) {
+      ptr_data = reinterpret_cast<const char*>(&buffer.chunk->data[0]);
+      length = buffer.chunk->data.size();
+    }
+    const size_t remaining = length - ptr_connection->output_offset;
+    const int sent = send(ptr_connection->socket,
+                          ptr_data + ptr_connection->output_offset,
+                          static_cast<int>(remaining), kSendFlags);
+    if (sent < 0) {
+      ok = WouldBlock();
+      break;
+    }
+    bytes_sent += sent;
+    ptr_connection->pending_size -= sent;
+    if (static_cast<size_t>(sent) < remaining) {
+      ptr_connection->output_offset += sent;
+      continue;
+    }
+    output.pop_front();
+    ptr_connection->output_offset = 0;
+  }
+  if (bytes_sent > 0) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.bytes_sent += bytes_sent;
+  }
+  return ok;
+}
+
+void LocalHttpServerImpl::QueueHeader(Connection* ptr_connection,
+                                      int status_code,
+                                      const char* reason,
+                                      const char* content_type,
+                                      int64 content_length,
+                                      bool cacheable) {
+  std::ostringstream header;
+  header << "HTTP/1.1 " << status_code << " " << reason << "\r\n"
+         << "Server: " << kClientName << "\r\n"
+         << "Content-Type: " << content_type << "\r\n"
+         << "Access-Control-Allow-Origin: *\r\n";
+  if (!cacheable) {
+    header << "Cache-Control: no-cache\r\n";
+  }
+  if (content_length >= 0) {
+    header << "Content-Length: " << content_length << "\r\n";
+  } else if (ptr_connection->chunked) {
+    header << "Transfer-Encoding: chunked\r\n";
+  } else {
+    // HTTP/1.0 streams end when the connection closes.
+    ptr_connection->keep_alive = false;
+  }
+  if (!ptr_connection->keep_alive) {
+    header << "Connection: close\r\n";
+  }
+  header << "\r\n";
+  QueueText(ptr_connection, header.str());
+}
+
+void LocalHttpServerImpl::QueueChunks(Connection* ptr_connection,
+                                      const char* content_type,
+                                      const DvrChunkList& chunks,
+                                      bool cacheable) {
+  int64 content_length = 0;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    content_length += chunks[i]->data.size();
+  }
+  QueueHeader(ptr_connection, 200, "OK", content_type, content_length,
+              cacheable);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    OutputBuffer buffer;
+    buffer.chunk = chunks[i];
+    ptr_connection->output.push_back(buffer);
+    ptr_connection->pending_size += chunks[i]->data.size();
+  }
+  ptr_connection->state = Connection::kSending;
+}
+
+void LocalHttpServerImpl::QueueStreamChunk(Connection* ptr_connection,
+                                           const DvrChunkPtr& chunk) {
+  if (ptr_connection->chunked) {
+    std::ostringstream chunk_size;
+    chunk_size << std::hex << chunk->data.size() << "\r\n";
+    QueueText(ptr_connection, chunk_size.str());
+  }
+  OutputBuffer buffer;
+  buffer.chunk = chunk;
+  ptr_connection->output.push_back(buffer);
+  ptr_connection->pending_size += chunk->data.size();
+  if (ptr_connection->chunked) {
+    QueueText(ptr_connection, "\r\n");
+  }
+}
+
+void LocalHttpServerImpl::QueueStreamEnd(Connection* ptr_connection) {
+  if (ptr_connection->chunked) {
+    QueueText(ptr_connection, kLastChunk);
+  }
+  ptr_connection->state = Connection::kSending;
+}
+
+void LocalHttpServerImpl::QueueError(Connection* ptr_connection,
+                                     int status_code,
+                                     const char* reason) {
+  std::ostringstream body;
+  body << status_code << " " << reason << "\n";
+  QueueHeader(ptr_connection, status_code, reason, kTextType,
+              body.str().size(), false);
+  QueueText(ptr_connection, body.str());
+  ptr_connection->state = Connection::kSending;
+}
+
+void LocalHttpServerImpl::QueueText(Connection* ptr_connection,
+                                    const std::string& text) {
+  OutputBuffer buffer;
+  buffer.text = text;
+  ptr_connection->output.push_back(buffer);
+  ptr_connection->pending_size += text.size();
+}
+
+void LocalHttpServerImpl::ExpireWaits() {
+  // Every wait lasts |long_poll_timeout|, so |segment_waits_| is in deadline
+  // order. Waits of connections that moved on are skipped.
+  const Clock::time_point now = Clock::now();
+  while (!segment_waits_.empty() && segment_waits_.front().deadline <= now) {
+    const SegmentWait wait = segment_waits_.front();
+    segment_waits_.pop_front();
+    const ConnectionMap::iterator it = connections_.find(wait.socket);
+    if (it == connections_.end() || it->second->id != wait.id ||
+        it->second->state != Connection::kWaitingSegment) {
+      continue;
+    }
+    QueueError(it->second.get(), 404, "Not Found");
+    if (!Flush(it->second.get())) {
+      CloseConnection(wait.socket);
+    }
+  }
+}
+
+int LocalHttpServerImpl::NextTimeout() const {
+  if (segment_waits_.empty()) {
+    return -1;
+  }
+  const int64 timeout =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          segment_waits_.front().deadline - Clock::now()).count();
+  return static_cast<int>(std::max<int64>(timeout + 1, 0));
+}
+
+bool LocalHttpServerImpl::ParseSegmentPath(const std::string& path,
+                                           ChunkInfo::Track track,
+                                           int64* ptr_number) const {
+  const std::string& prefix = segment_prefixes_[track];
+  const std::string& suffix = segment_suffixes_[track];
+  const size_t kMaxDigits = 18;
+  if (path.size() <= prefix.size() + suffix.size() ||
+      path.size() > prefix.size() + suffix.size() + kMaxDigits ||
+      path.compare(0, prefix.size(), prefix) ||
+      path.compare(path.size() - suffix.size(), suffix.size(), suffix)) {
+    return false;
+  }
+  int64 number = 0;
+  for (size_t i = prefix.size(); i < path.size() - suffix.size(); ++i) {
+    if (!isdigit(static_cast<unsigned char>(path[i]))) {
+      return false;
+    }
+    number = number * 10 + (path[i] - '0');
+  }
+  *ptr_number = number;
+  return true;
+}
+
+const char* LocalHttpServerImpl::ContentType(ChunkInfo::Track track) {
+  return track == ChunkInfo::kAudioTrack ? kAudioType : kVideoType;
+}
+
+LocalHttpServer::LocalHttpServer() {
+}
+
+LocalHttpServer::~LocalHttpServer() {
+}
+
+int LocalHttpServer::Init(const LocalHttpServerConfig& config,
+                          DvrRing* ptr_ring) {
+  ptr_server_.reset(new (std::nothrow) LocalHttpServerImpl());  // NOLINT
+  if (!ptr_server_) {
+    LOG(ERROR) << "cannot construct LocalHttpServerImpl.";
+    return kNoMemory;
+  }
+  return ptr_server_->Init(config, ptr_ring);
+}
+
+int LocalHttpServer::Run() {
+  return ptr_server_ ? ptr_server_->Run() : kRunFailed;
+}
+
+void LocalHttpServer::Stop() {
+  if (ptr_server_) {
+    ptr_server_->Stop();
+  }
+}
+
+void LocalHttpServer::GetStats(LocalHttpServerStats* ptr_stats) const {
+  if (ptr_server_) {
+    ptr_server_->GetStats(ptr_stats);
+  }
+}
+
+bool LocalHttpServer::WriteData(const uint8* ptr_data, int32 data_length) {
+  ChunkInfo info;
+  return WriteChunk(info, ptr_data, data_length);
+}
+
+bool LocalHttpServer::WriteChunk(const ChunkInfo& info,
+                                 const uint8* ptr_data,
+                                 int32 data_length) {
+  return ptr_server_ && ptr_server_->WriteChunk(info, ptr_data, data_length);
+}
+
+}  // namespace webmlive
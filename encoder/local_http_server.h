@@ -0,0 +1,143 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LOCAL_HTTP_SERVER_H_
+#define WEBMLIVE_ENCODER_LOCAL_HTTP_SERVER_H_
+
+#include <memory>
+#include <string>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+class DvrRing;
+
+struct LocalHttpServerConfig {
+  static const int kDefaultPort = 8080;
+  static const int kDefaultMaxConnections = 4096;
+
+  // Default time a request for the next media segment waits for the
+  // segment, in milliseconds.
+  static const int kDefaultLongPollTimeout = 10000;
+
+  // Default bound on the response data queued per connection, in bytes.
+  static const int64 kDefaultMaxPendingSize = 16 * 1024 * 1024;
+
+  LocalHttpServerConfig();
+
+  // IPv4 address and port the server listens on. The default address,
+  // 127.0.0.1, accepts local connections only.
+  std::string address;
+  int port;
+
+  // Stream name and representation ID used to build resource names. Must
+  // match the values passed to |DashWriter::Init()|.
+  std::string name;
+  std::string id;
+
+  // Connections accepted past |max_connections| are closed at once.
+  int max_connections;
+
+  int long_poll_timeout;
+
+  // Connections that fall |max_pending_size| bytes behind the live stream
+  // are closed.
+  int64 max_pending_size;
+};
+
+struct LocalHttpServerStats {
+  LocalHttpServerStats()
+      : connections(0),
+        peak_connections(0),
+        requests(0),
+        bytes_sent(0),
+        connections_dropped(0) {}
+
+  // Open connections, and the most ever open at once.
+  int64 connections;
+  int64 peak_connections;
+
+  int64 requests;
+  int64 bytes_sent;
+
+  // Connections closed because they fell behind, or because
+  // |LocalHttpServerConfig::max_connections| were open.
+  int64 connections_dropped;
+};
+
+// Forward declaration of the class that runs the server.
+class LocalHttpServerImpl;
+
+// Embedded HTTP/1.1 server that serves the stream retained by a |DvrRing|
+// straight from memory, so that relays on the same host pull from the
+// encoder instead of the encoder uploading every chunk.
+//
+// Resources, with <name> and <id> from |LocalHttpServerConfig|, and <track>
+// left out, with its underscore, for muxed output:
+//   /<name>.mpd                       The DASH manifest.
+//   /<name>_<track>_<id>.hdr          The initialization segment of <track>.
+//   /<name>_<track>_<id>_<N>.chk      Media segment <N> of <track>.
+//   /<name>_<track>.webm              The live stream of <track>.
+// <track> is a |ChunkInfo::Track| value, as in the |DashWriter| segment
+// names.
+//
+// Notes:
+// - All sockets are served by one thread with epoll, or WSAPoll on Windows.
+// - Responses are sent from the chunks the ring holds, without copies.
+// - A request for the next media segment waits for the segment, up to
+//   |LocalHttpServerConfig::long_poll_timeout|. Segments still being written
+//   are sent with chunked transfer encoding as their chunks arrive.
+// - A live stream starts with the initialization segment and the newest
+//   cluster that starts with a keyframe, and follows the stream until the
+//   client disconnects.
+// - Chunks written to the server are written to its ring, and wake the
+//   server thread, which updates only the connections that wait for or
+//   stream the track written.
+class LocalHttpServer : public DataSinkInterface {
+ public:
+  enum {
+    kSocketError = -4,
+    kRunFailed = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  LocalHttpServer();
+  virtual ~LocalHttpServer();
+
+  // Stores |config|, and opens the listening socket. |ptr_ring| must outlive
+  // the server. Returns |kSuccess| when successful.
+  int Init(const LocalHttpServerConfig& config, DvrRing* ptr_ring);
+
+  // Starts the server thread.
+  int Run();
+
+  // Closes all connections and stops the server thread.
+  void Stop();
+
+  // Copies the connection and request counts to |ptr_stats|.
+  void GetStats(LocalHttpServerStats* ptr_stats) const;
+
+  // DataSinkInterface methods.
+  virtual bool Ready() const { return true; }
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length);
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length);
+
+ private:
+  std::unique_ptr<LocalHttpServerImpl> ptr_server_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LocalHttpServer);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LOCAL_HTTP_SERVER_H_
@@ -0,0 +1,275 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/local_http_server.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "encoder/dash_writer.h"
+#include "encoder/dvr_ring.h"
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+const Socket kInvalidSocket = INVALID_SOCKET;
+
+void CloseSocket(Socket socket) {
+  closesocket(socket);
+}
+
+void SetReceiveTimeout(Socket socket, int milliseconds) {
+  const DWORD timeout = milliseconds;
+  setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO,
+             reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+}
+#else
+typedef int Socket;
+const Socket kInvalidSocket = -1;
+
+void CloseSocket(Socket socket) {
+  close(socket);
+}
+
+void SetReceiveTimeout(Socket socket, int milliseconds) {
+  timeval timeout = {0};
+  timeout.tv_sec = milliseconds / 1000;
+  timeout.tv_usec = (milliseconds % 1000) * 1000;
+  setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+#endif
+
+const int kPort = 18080;
+const int kReceiveTimeout = 5000;
+const int32 kChunkLength = 100;
+
+// Returns the body of a chunked transfer encoded |response|, or an empty
+// string when it has no complete chunk.
+std::string DecodeChunkedBody(const std::string& response) {
+  std::string body;
+  size_t offset = response.find("\r\n\r\n");
+  if (offset == std::string::npos) {
+    return body;
+  }
+  offset += 4;
+  for (;;) {
+    const size_t line_end = response.find("\r\n", offset);
+    if (line_end == std::string::npos) {
+      break;
+    }
+    const size_t chunk_size = static_cast<size_t>(
+        strtoul(response.substr(offset, line_end - offset).c_str(), NULL,
+                16));
+    offset = line_end + 2;
+    if (chunk_size == 0 || offset + chunk_size > response.size()) {
+      break;
+    }
+    body.append(response, offset, chunk_size);
+    offset += chunk_size + 2;
+  }
+  return body;
+}
+
+// Serves a |DvrRing| on loopback, and reads responses with a plain socket.
+class LocalHttpServerTest : public ::testing::Test {
+ protected:
+  LocalHttpServerTest() : client_(kInvalidSocket) {
+    config_.port = kPort;
+  }
+
+  virtual ~LocalHttpServerTest() {
+    if (client_ != kInvalidSocket) {
+      CloseSocket(client_);
+    }
+    server_.Stop();
+  }
+
+  void StartServer() {
+    ASSERT_EQ(DvrRing::kSuccess, ring_.Init(DvrConfig()));
+    ASSERT_EQ(LocalHttpServer::kSuccess, server_.Init(config_, &ring_));
+    ASSERT_EQ(LocalHttpServer::kSuccess, server_.Run());
+  }
+
+  // Connects to the server and requests |path|, and returns once the server
+  // has read the request. |receive_buffer_size| sets the client's socket
+  // receive buffer size when it is not 0.
+  void Get(const std::string& path,
+           bool keep_alive,
+           int receive_buffer_size) {
+    client_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    ASSERT_NE(kInvalidSocket, client_);
+    if (receive_buffer_size > 0) {
+      setsockopt(client_, SOL_SOCKET, SO_RCVBUF,
+                 reinterpret_cast<const char*>(&receive_buffer_size),
+                 sizeof(receive_buffer_size));
+    }
+    SetReceiveTimeout(client_, kReceiveTimeout);
+    sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(kPort);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(0, connect(client_, reinterpret_cast<sockaddr*>(&address),
+                         sizeof(address)));
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n";
+    if (!keep_alive) {
+      request += "Connection: close\r\n";
+    }
+    request += "\r\n";
+    ASSERT_EQ(static_cast<int>(request.size()),
+              send(client_, request.data(), static_cast<int>(request.size()),
+                   0));
+
+    LocalHttpServerStats stats;
+    for (int i = 0; i < kReceiveTimeout && stats.requests == 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      server_.GetStats(&stats);
+    }
+    ASSERT_EQ(1, stats.requests);
+  }
+
+  // Reads until |response_| holds |text|, or until the connection closes
+  // when |text| is empty. Returns false when neither happens in time.
+  bool ReadUntil(const std::string& text) {
+    char buffer[4096];
+    while (text.empty() || response_.find(text) == std::string::npos) {
+      const int bytes_read = recv(client_, buffer, sizeof(buffer), 0);
+      if (bytes_read <= 0) {
+        return text.empty() && bytes_read == 0;
+      }
+      response_.append(buffer, bytes_read);
+    }
+    return true;
+  }
+
+  void WriteMetadata() {
+    ChunkInfo info;
+    info.type = ChunkInfo::kMetadata;
+    WriteChunk(info, 'm');
+  }
+
+  // Writes a chunk of |kChunkLength| bytes of |value| to cluster |number|,
+  // which starts with a keyframe when the chunk starts it.
+  void WriteMedia(int64 number, bool complete, char value) {
+    ChunkInfo info;
+    info.keyframe = true;
+    info.complete = complete;
+    info.number = number;
+    WriteChunk(info, value);
+  }
+
+  void WriteChunk(const ChunkInfo& info, char value) {
+    const std::vector<uint8> data(kChunkLength, static_cast<uint8>(value));
+    ASSERT_TRUE(server_.WriteChunk(info, &data[0], kChunkLength));
+  }
+
+  LocalHttpServerConfig config_;
+  DvrRing ring_;
+  LocalHttpServer server_;
+  Socket client_;
+  std::string response_;
+};
+
+// A request for the next segment waits for it, and the segment is sent as
+// its chunks arrive.
+TEST_F(LocalHttpServerTest, SegmentLongPoll) {
+  StartServer();
+  Get("/" + DashWriter::ChunkName(config_.name, config_.id,
+                                  ChunkInfo::kAllTracks, 1),
+      false, 0);
+  WriteMetadata();
+  WriteMedia(1, false, 'a');
+  ASSERT_TRUE(ReadUntil(std::string(kChunkLength, 'a')));
+  WriteMedia(1, true, 'b');
+  ASSERT_TRUE(ReadUntil(""));
+
+  EXPECT_EQ(0u, response_.find("HTTP/1.1 200 OK\r\n"));
+  EXPECT_NE(std::string::npos,
+            response_.find("Transfer-Encoding: chunked\r\n"));
+  EXPECT_EQ(std::string(kChunkLength, 'a') + std::string(kChunkLength, 'b'),
+            DecodeChunkedBody(response_));
+}
+
+TEST_F(LocalHttpServerTest, SegmentLongPollTimeout) {
+  config_.long_poll_timeout = 50;
+  StartServer();
+  Get("/" + DashWriter::ChunkName(config_.name, config_.id,
+                                  ChunkInfo::kAllTracks, 1),
+      false, 0);
+  ASSERT_TRUE(ReadUntil(""));
+  EXPECT_EQ(0u, response_.find("HTTP/1.1 404 Not Found\r\n"));
+}
+
+// A live stream starts with the metadata and the newest keyframe cluster,
+// and then follows the stream in chunked transfer encoding.
+TEST_F(LocalHttpServerTest, ChunkedLiveStream) {
+  StartServer();
+  WriteMetadata();
+  WriteMedia(1, true, 'a');
+  WriteMedia(2, true, 'b');
+  Get("/" + config_.name + ".webm", true, 0);
+  ASSERT_TRUE(ReadUntil(std::string(kChunkLength, 'b') + "\r\n"));
+
+  // Chunks of other tracks are not sent.
+  ChunkInfo audio_info;
+  audio_info.track = ChunkInfo::kAudioTrack;
+  audio_info.number = 1;
+  WriteChunk(audio_info, 'x');
+  WriteMedia(3, false, 'c');
+  ASSERT_TRUE(ReadUntil(std::string(kChunkLength, 'c') + "\r\n"));
+
+  EXPECT_EQ(0u, response_.find("HTTP/1.1 200 OK\r\n"));
+  EXPECT_NE(std::string::npos,
+            response_.find("Transfer-Encoding: chunked\r\n"));
+  EXPECT_EQ(std::string(kChunkLength, 'm') + std::string(kChunkLength, 'b') +
+                std::string(kChunkLength, 'c'),
+            DecodeChunkedBody(response_));
+}
+
+// A client that stops reading is dropped once |max_pending_size| bytes are
+// queued for it.
+TEST_F(LocalHttpServerTest, MaxPendingSizeDrop) {
+  config_.max_pending_size = 64 * 1024;
+  StartServer();
+  WriteMetadata();
+  WriteMedia(1, false, 'a');
+  Get("/" + config_.name + ".webm", true, 4096);
+
+  // The socket buffers hold some of the stream; write until the rest
+  // exceeds the bound.
+  const int kMaxChunks = 200000;
+  LocalHttpServerStats stats;
+  for (int i = 0; i < kMaxChunks && stats.connections_dropped == 0; ++i) {
+    WriteMedia(1, false, 'a');
+    server_.GetStats(&stats);
+  }
+  for (int i = 0; i < kReceiveTimeout && stats.connections != 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    server_.GetStats(&stats);
+  }
+  EXPECT_EQ(1, stats.connections_dropped);
+  EXPECT_EQ(0, stats.connections);
+}
+
+}  // namespace
+}  // namespace webmlive
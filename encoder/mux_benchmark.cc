@@ -0,0 +1,283 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+
+// Measures the cost per frame of |LiveWebmMuxer| with libwebm clusters and
+// with native clusters. Muxes synthetic VP8 and Opus frames for several
+// streams at once, reading chunks as they complete, as |WebmEncoder| does.
+// No results are recorded here; run it on the target machine before relying
+// on either writer being faster.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_mux.h"
+#include "glog/logging.h"
+
+namespace {
+
+struct BenchmarkConfig {
+  BenchmarkConfig()
+      : streams(16),
+        seconds(60),
+        frame_rate(120),
+        video_frame_size(8000),
+        keyframe_size(60000),
+        audio_frame_duration(20),
+        audio_frame_size(160),
+        cluster_duration(1000),
+        low_latency(false) {}
+
+  // Number of streams muxed in turn on the benchmark thread.
+  int streams;
+
+  // Media time muxed per stream, in seconds.
+  int seconds;
+
+  int frame_rate;
+  int video_frame_size;
+  int keyframe_size;
+
+  // Audio frame duration in milliseconds, and size in bytes.
+  int audio_frame_duration;
+  int audio_frame_size;
+
+  // Cluster duration, and keyframe interval, in milliseconds.
+  int cluster_duration;
+  bool low_latency;
+};
+
+struct BenchmarkResult {
+  BenchmarkResult() : frames(0), chunks(0), bytes(0), seconds(0) {}
+  int64 frames;
+  int64 chunks;
+  int64 bytes;
+  double seconds;
+};
+
+// Opus identification header for 2 channels at 48 kHz.
+const uint8 kOpusHead[] = {
+  'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 2, 0x38, 0x01, 0x80, 0xBB, 0, 0,
+  0, 0, 0
+};
+
+void usage(const char** argv) {
+  printf("Usage: %s <args>\n", argv[0]);
+  printf("  --streams <count>      Streams muxed at once. Default 16.\n");
+  printf("  --seconds <sec>        Media time per stream. Default 60.\n");
+  printf("  --fps <rate>           Video frame rate. Default 120.\n");
+  printf("  --frame_size <bytes>   Video frame size. Default 8000.\n");
+  printf("  --cluster <ms>         Cluster duration. Default 1000.\n");
+  printf("  --low_latency          Read partial clusters.\n");
+}
+
+bool parse_command_line(int argc, const char** argv,
+                        BenchmarkConfig* ptr_config) {
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (!strcmp("--streams", argv[i]) && has_value) {
+      ptr_config->streams = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--seconds", argv[i]) && has_value) {
+      ptr_config->seconds = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--fps", argv[i]) && has_value) {
+      ptr_config->frame_rate = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--frame_size", argv[i]) && has_value) {
+      ptr_config->video_frame_size = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--cluster", argv[i]) && has_value) {
+      ptr_config->cluster_duration = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--low_latency", argv[i])) {
+      ptr_config->low_latency = true;
+    } else {
+      usage(argv);
+      return false;
+    }
+  }
+  if (ptr_config->streams <= 0 || ptr_config->seconds <= 0 ||
+      ptr_config->frame_rate <= 0 || ptr_config->video_frame_size <= 0 ||
+      ptr_config->cluster_duration <= 0) {
+    usage(argv);
+    return false;
+  }
+  return true;
+}
+
+// Creates a muxer with a VP8 and an Opus track.
+webmlive::LiveWebmMuxer* CreateMuxer(const BenchmarkConfig& config,
+                                     bool native_clusters) {
+  std::unique_ptr<webmlive::LiveWebmMuxer> muxer(
+      new (std::nothrow) webmlive::LiveWebmMuxer());  // NOLINT
+  if (!muxer ||
+      muxer->Init(config.cluster_duration, config.low_latency,
+                  native_clusters)) {
+    return NULL;
+  }
+  webmlive::VideoConfig video_config;
+  video_config.format = webmlive::kVideoFormatVP8;
+  video_config.width = 1280;
+  video_config.height = 720;
+  video_config.frame_rate = config.frame_rate;
+  webmlive::AudioConfig audio_config;
+  audio_config.format_tag = webmlive::kAudioFormatOpus;
+  audio_config.sample_rate = 48000;
+  audio_config.channels = 2;
+  webmlive::OpusCodecPrivate codec_private;
+  codec_private.ptr_opus_head = kOpusHead;
+  codec_private.opus_head_length = sizeof(kOpusHead);
+  if (muxer->AddTrack(video_config) ||
+      muxer->AddTrack(audio_config, codec_private)) {
+    return NULL;
+  }
+  return muxer.release();
+}
+
+// Reads every chunk ready in |ptr_muxer| into |ptr_chunk|.
+bool ReadChunks(webmlive::LiveWebmMuxer* ptr_muxer,
+                std::vector<uint8>* ptr_chunk,
+                BenchmarkResult* ptr_result) {
+  int32 chunk_length = 0;
+  while (ptr_muxer->ChunkReady(&chunk_length)) {
+    if (ptr_chunk->size() < static_cast<size_t>(chunk_length)) {
+      ptr_chunk->resize(chunk_length);
+    }
+    if (ptr_muxer->ReadChunk(chunk_length, &(*ptr_chunk)[0])) {
+      return false;
+    }
+    ++ptr_result->chunks;
+    ptr_result->bytes += chunk_length;
+  }
+  return true;
+}
+
+// Muxes |config.seconds| of audio and video for each stream, in timestamp
+// order, and returns the time taken in |ptr_result|.
+bool RunBenchmark(const BenchmarkConfig& config,
+                  bool native_clusters,
+                  BenchmarkResult* ptr_result) {
+  std::vector<std::unique_ptr<webmlive::LiveWebmMuxer>> muxers;
+  for (int i = 0; i < config.streams; ++i) {
+    muxers.push_back(std::unique_ptr<webmlive::LiveWebmMuxer>(
+        CreateMuxer(config, native_clusters)));
+    if (!muxers.back()) {
+      fprintf(stderr, "cannot create muxer.\n");
+      return false;
+    }
+  }
+
+  // Frames are built once; only their timestamps change.
+  webmlive::VideoConfig frame_config;
+  frame_config.format = webmlive::kVideoFormatVP8;
+  frame_config.width = 1280;
+  frame_config.height = 720;
+  std::vector<uint8> data(config.keyframe_size, 0x5A);
+  webmlive::VideoFrame keyframe;
+  webmlive::VideoFrame delta_frame;
+  const int64 frame_duration = 1000 / config.frame_rate;
+  webmlive::AudioConfig audio_config;
+  audio_config.format_tag = webmlive::kAudioFormatOpus;
+  webmlive::AudioBuffer audio_buffer;
+  if (keyframe.Init(frame_config, true, 0, frame_duration, &data[0],
+                    config.keyframe_size) ||
+      delta_frame.Init(frame_config, false, 0, frame_duration, &data[0],
+                       config.video_frame_size) ||
+      audio_buffer.Init(audio_config, 0, config.audio_frame_duration,
+                        &data[0], config.audio_frame_size)) {
+    fprintf(stderr, "cannot create frames.\n");
+    return false;
+  }
+
+  std::vector<uint8> chunk;
+  const int64 end_time = config.seconds * 1000LL;
+  const int64 keyframe_interval =
+      std::max<int64>(config.cluster_duration * config.frame_rate / 1000, 1);
+  int64 video_frame = 0;
+  int64 audio_time = 0;
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (;;) {
+    const int64 video_time = video_frame * 1000 / config.frame_rate;
+    if (video_time >= end_time && audio_time >= end_time) {
+      break;
+    }
+    const bool write_video = video_time <= audio_time;
+    for (size_t i = 0; i < muxers.size(); ++i) {
+      webmlive::LiveWebmMuxer* const ptr_muxer = muxers[i].get();
+      int status = webmlive::LiveWebmMuxer::kSuccess;
+      if (write_video) {
+        webmlive::VideoFrame& frame =
+            video_frame % keyframe_interval == 0 ? keyframe : delta_frame;
+        frame.set_timestamp(video_time);
+        status = ptr_muxer->WriteVideoFrame(frame);
+      } else {
+        audio_buffer.set_timestamp(audio_time);
+        status = ptr_muxer->WriteAudioBuffer(audio_buffer);
+      }
+      if (status || !ReadChunks(ptr_muxer, &chunk, ptr_result)) {
+        fprintf(stderr, "mux failed, status=%d\n", status);
+        return false;
+      }
+      ++ptr_result->frames;
+    }
+    if (write_video) {
+      ++video_frame;
+    } else {
+      audio_time += config.audio_frame_duration;
+    }
+  }
+  for (size_t i = 0; i < muxers.size(); ++i) {
+    if (muxers[i]->Finalize() ||
+        !ReadChunks(muxers[i].get(), &chunk, ptr_result)) {
+      fprintf(stderr, "Finalize failed.\n");
+      return false;
+    }
+  }
+  ptr_result->seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  return true;
+}
+
+void PrintResult(const char* name, const BenchmarkResult& result) {
+  printf("%-8s %10lld frames %8lld chunks %8.1f MB %8.3f s %10.0f frames/s "
+         "%8.0f ns/frame\n",
+         name, result.frames, result.chunks, result.bytes / 1e6,
+         result.seconds, result.frames / result.seconds,
+         result.seconds * 1e9 / result.frames);
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  BenchmarkConfig config;
+  if (!parse_command_line(argc, argv, &config)) {
+    return EXIT_FAILURE;
+  }
+  printf("%d streams, %d s, %d fps, %d byte frames, %d ms clusters%s\n",
+         config.streams, config.seconds, config.frame_rate,
+         config.video_frame_size, config.cluster_duration,
+         config.low_latency ? ", low latency" : "");
+  BenchmarkResult libwebm_result;
+  BenchmarkResult native_result;
+  if (!RunBenchmark(config, false, &libwebm_result) ||
+      !RunBenchmark(config, true, &native_result)) {
+    return EXIT_FAILURE;
+  }
+  PrintResult("libwebm", libwebm_result);
+  PrintResult("native", native_result);
+  printf("libwebm/native time: %.2f\n",
+         libwebm_result.seconds / native_result.seconds);
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,291 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/opus_encoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <new>
+
+#include "glog/logging.h"
+
+namespace {
+
+// Largest packet libopus will produce for a single frame; this is the value
+// recommended by the libopus documentation for |max_data_bytes|.
+const int kMaxOpusPacketSize = 4000;
+
+// Size of the OpusHead structure for channel mapping family 0.
+const int kOpusHeadLength = 19;
+
+// Returns true when |frame_duration| is an Opus frame duration.
+bool ValidOpusFrameDuration(double frame_duration) {
+  const double kValidDurations[] = {2.5, 5, 10, 20, 40, 60};
+  const int kNumDurations = sizeof(kValidDurations) / sizeof(double);
+  for (int i = 0; i < kNumDurations; ++i) {
+    if (frame_duration == kValidDurations[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void WriteLE16(uint16 val, uint8* ptr_out) {
+  ptr_out[0] = val & 0xff;
+  ptr_out[1] = (val >> 8) & 0xff;
+}
+
+void WriteLE32(uint32 val, uint8* ptr_out) {
+  WriteLE16(val & 0xffff, ptr_out);
+  WriteLE16((val >> 16) & 0xffff, ptr_out + 2);
+}
+
+}  // namespace
+
+namespace webmlive {
+
+OpusAudioEncoder::OpusAudioEncoder()
+    : ptr_encoder_(NULL),
+      frame_size_(0),
+      pre_skip_(0),
+      opus_head_length_(0),
+      audio_delay_(0),
+      samples_encoded_(0),
+      last_timestamp_(0),
+      first_input_timestamp_(-1),
+      pending_offset_(0) {
+}
+
+OpusAudioEncoder::~OpusAudioEncoder() {
+  if (ptr_encoder_) {
+    opus_encoder_destroy(ptr_encoder_);
+  }
+}
+
+// Bitrate values are multiplied by 1000. |WebmEncoderConfig| and its children
+// express bitrates in kilobits. Libopus bitrates are in bits.
+int OpusAudioEncoder::Init(const AudioConfig& audio_config,
+                           const OpusConfig& opus_config) {
+  if (audio_config.channels <= 0 || audio_config.channels > 2) {
+    LOG(ERROR) << "invalid/unsupported number of audio channels.";
+    return kUnsupportedFormat;
+  }
+  if (!SampleRateSupported(audio_config.sample_rate)) {
+    LOG(ERROR) << "unsupported Opus sample rate: " << audio_config.sample_rate;
+    return kUnsupportedFormat;
+  }
+  const uint16& format_tag = audio_config.format_tag;
+  if (format_tag != kAudioFormatPcm && format_tag != kAudioFormatIeeeFloat) {
+    LOG(ERROR) << "input must be uncompressed.";
+    return kUnsupportedFormat;
+  }
+  if (format_tag == kAudioFormatPcm && audio_config.bits_per_sample != 16) {
+    LOG(ERROR) << "PCM input must be 16 bits per sample.";
+    return kUnsupportedFormat;
+  }
+  const int kBitsPerIeeeFloat = sizeof(float) * 8;  // NOLINT(runtime/sizeof)
+  if (format_tag == kAudioFormatIeeeFloat &&
+      audio_config.bits_per_sample != kBitsPerIeeeFloat) {
+    LOG(ERROR) << "IEEE floating point input must be 32 bits per sample.";
+    return kUnsupportedFormat;
+  }
+  if (!ValidOpusFrameDuration(opus_config.frame_duration)) {
+    LOG(ERROR) << "invalid Opus frame duration: "
+               << opus_config.frame_duration;
+    return kUnsupportedFormat;
+  }
+  int status = OPUS_OK;
+  ptr_encoder_ = opus_encoder_create(audio_config.sample_rate,
+                                     audio_config.channels,
+                                     OPUS_APPLICATION_AUDIO,
+                                     &status);
+  if (status != OPUS_OK || !ptr_encoder_) {
+    LOG(ERROR) << "opus_encoder_create failed: " << opus_strerror(status);
+    return kCodecError;
+  }
+  if (CodecControl(OPUS_SET_BITRATE_REQUEST, opus_config.bitrate * 1000)) {
+    return kCodecError;
+  }
+  if (CodecControl(OPUS_SET_COMPLEXITY_REQUEST, opus_config.complexity)) {
+    return kCodecError;
+  }
+  opus_int32 lookahead = 0;
+  status = opus_encoder_ctl(ptr_encoder_, OPUS_GET_LOOKAHEAD(&lookahead));
+  if (status != OPUS_OK) {
+    LOG(ERROR) << "OPUS_GET_LOOKAHEAD failed: " << opus_strerror(status);
+    return kCodecError;
+  }
+  audio_config_ = audio_config;
+  opus_config_ = opus_config;
+  frame_size_ = static_cast<int32>(
+      audio_config.sample_rate * opus_config.frame_duration / 1000);
+  pre_skip_ = static_cast<int32>(
+      static_cast<int64>(lookahead) * kOpusDecodeRate /
+      audio_config.sample_rate);
+  audio_delay_ = SamplesToMilliseconds(lookahead);
+  LOG(INFO) << "OpusAudioEncoder frame_size_=" << frame_size_
+            << " pre_skip_=" << pre_skip_
+            << " audio_delay_=" << audio_delay_;
+
+  packet_buffer_.resize(kMaxOpusPacketSize);
+  status = GenerateOpusHead();
+  if (status) {
+    LOG(ERROR) << "GenerateOpusHead failed: " << status;
+    return status;
+  }
+  audio_config_.format_tag = kAudioFormatOpus;
+  return kSuccess;
+}
+
+int OpusAudioEncoder::Encode(const AudioBuffer& input_buffer) {
+  if (!input_buffer.buffer()) {
+    LOG(ERROR) << "cannot Encode empty input buffer!";
+    return kInvalidArg;
+  }
+  if (input_buffer.config().format_tag == kAudioFormatOpus) {
+    LOG(ERROR) << "cannot Encode compressed input buffer!";
+    return kInvalidArg;
+  }
+  if (first_input_timestamp_ == -1) {
+    first_input_timestamp_ = input_buffer.timestamp();
+    LOG(INFO) << "OpusAudioEncoder first_input_timestamp_="
+              << first_input_timestamp_;
+  }
+  // Drop the samples encoded since the last call before appending.
+  pending_samples_.erase(pending_samples_.begin(),
+                         pending_samples_.begin() + pending_offset_);
+  pending_offset_ = 0;
+  const uint8* const ptr_data = input_buffer.buffer();
+  std::copy(ptr_data, ptr_data + input_buffer.buffer_length(),
+            std::back_inserter(pending_samples_));
+  return kSuccess;
+}
+
+int OpusAudioEncoder::ReadCompressedAudio(AudioBuffer* ptr_buffer) {
+  if (!ptr_buffer) {
+    LOG(ERROR) << "ReadCompressedAudio requires a non-NULL ptr_buffer.";
+    return kInvalidArg;
+  }
+  const int32 bytes_per_sample = audio_config_.bits_per_sample / 8;
+  const size_t frame_bytes =
+      frame_size_ * audio_config_.channels * bytes_per_sample;
+  if (frame_bytes == 0 ||
+      pending_samples_.size() - pending_offset_ < frame_bytes) {
+    return kNoSamples;
+  }
+
+  // |audio_config_.format_tag| is |kAudioFormatOpus| after |Init()|. Input
+  // format is inferred from sample size, which |Init()| has validated.
+  int32 packet_length = 0;
+  if (bytes_per_sample == sizeof(int16)) {
+    const opus_int16* const ptr_samples =
+        reinterpret_cast<const opus_int16*>(&pending_samples_[pending_offset_]);
+    packet_length = opus_encode(ptr_encoder_, ptr_samples, frame_size_,
+                                &packet_buffer_[0], kMaxOpusPacketSize);
+  } else {
+    const float* const ptr_samples =
+        reinterpret_cast<const float*>(&pending_samples_[pending_offset_]);
+    packet_length = opus_encode_float(ptr_encoder_, ptr_samples, frame_size_,
+                                      &packet_buffer_[0], kMaxOpusPacketSize);
+  }
+  if (packet_length < 0) {
+    LOG(ERROR) << "opus_encode failed: " << opus_strerror(packet_length);
+    return kCodecError;
+  }
+  pending_offset_ += frame_bytes;
+
+  const int64 timestamp =
+      first_input_timestamp_ + SamplesToMilliseconds(samples_encoded_);
+  const int64 duration =
+      SamplesToMilliseconds(samples_encoded_ + frame_size_) -
+      SamplesToMilliseconds(samples_encoded_);
+  const int status = ptr_buffer->Init(audio_config_,
+                                      timestamp,
+                                      duration,
+                                      &packet_buffer_[0],
+                                      packet_length);
+  if (status) {
+    LOG(ERROR) << "AudioBuffer Init failed: " << status;
+    return kCodecError;
+  }
+  VLOG(4) << "OpusAudioEncoder ReadCompressedAudio timestamp=" << timestamp
+          << " duration=" << duration << " length=" << packet_length;
+  last_timestamp_ = timestamp;
+  samples_encoded_ += frame_size_;
+  return kSuccess;
+}
+
+bool OpusAudioEncoder::SampleRateSupported(uint32 sample_rate) {
+  return (sample_rate == 8000 || sample_rate == 12000 ||
+          sample_rate == 16000 || sample_rate == 24000 ||
+          sample_rate == 48000);
+}
+
+uint64 OpusAudioEncoder::codec_delay() const {
+  const uint64 kNanosecondsPerSecond = 1000000000ULL;
+  return static_cast<uint64>(pre_skip_) * kNanosecondsPerSecond /
+      kOpusDecodeRate;
+}
+
+int64 OpusAudioEncoder::time_encoded() const {
+  if (first_input_timestamp_ < 0) {
+    return 0;
+  }
+  return first_input_timestamp_ + SamplesToMilliseconds(samples_encoded_);
+}
+
+// OpusHead layout, per the Ogg Opus and WebM Opus mappings:
+//   Magic signature "OpusHead" (8 bytes)
+//   Version (1 byte)
+//   Channel count (1 byte)
+//   Pre-skip (2 bytes, little endian, 48 kHz samples)
+//   Input sample rate (4 bytes, little endian)
+//   Output gain (2 bytes, little endian)
+//   Channel mapping family (1 byte)
+int OpusAudioEncoder::GenerateOpusHead() {
+  opus_head_.reset(new (std::nothrow) uint8[kOpusHeadLength]);  // NOLINT
+  if (!opus_head_) {
+    LOG(ERROR) << "cannot GenerateOpusHead, no memory.";
+    return kNoMemory;
+  }
+  uint8* const ptr_head = opus_head_.get();
+  memcpy(ptr_head, "OpusHead", 8);
+  ptr_head[8] = 1;
+  ptr_head[9] = static_cast<uint8>(audio_config_.channels);
+  WriteLE16(static_cast<uint16>(pre_skip_), ptr_head + 10);
+  WriteLE32(audio_config_.sample_rate, ptr_head + 12);
+  WriteLE16(0, ptr_head + 16);
+  ptr_head[18] = 0;
+  opus_head_length_ = kOpusHeadLength;
+  return kSuccess;
+}
+
+// Rounds to the nearest millisecond, in integer math, so that each timestamp
+// is within half a millisecond of the exact sample time.
+int64 OpusAudioEncoder::SamplesToMilliseconds(int64 num_samples) const {
+  const int64 sample_rate = audio_config_.sample_rate;
+  if (sample_rate == 0) {
+    return 0;
+  }
+  return (num_samples * 1000 + sample_rate / 2) / sample_rate;
+}
+
+int OpusAudioEncoder::CodecControl(int control_id, int val) {
+  if (val == OpusConfig::kUseDefault) {
+    return kSuccess;
+  }
+  const int status = opus_encoder_ctl(ptr_encoder_, control_id, val);
+  if (status != OPUS_OK) {
+    LOG(ERROR) << "opus_encoder_ctl (" << control_id << ") failed: "
+               << opus_strerror(status);
+    return kCodecError;
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
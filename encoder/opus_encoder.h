@@ -0,0 +1,137 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_OPUS_ENCODER_H_
+#define WEBMLIVE_ENCODER_OPUS_ENCODER_H_
+
+#include <memory>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "libopus/opus/opus.h"
+
+namespace webmlive {
+
+// Libopus wrapper class providing a simplified interface to the Opus encoding
+// library.
+// Note: users must call |Init()| before any other method.
+class OpusAudioEncoder {
+ public:
+  enum {
+    // A libopus function returned an error.
+    kCodecError = AudioEncoder::kCodecError,
+
+    // Internal error within |OpusAudioEncoder|.
+    kEncoderError = AudioEncoder::kEncoderError,
+
+    // |audio_config| or |opus_config| format is not supported.
+    kUnsupportedFormat = AudioEncoder::kUnsupportedFormat,
+    kNoMemory = AudioEncoder::kNoMemory,
+    kInvalidArg = AudioEncoder::kInvalidArg,
+    kSuccess = AudioEncoder::kSuccess,
+
+    // |ReadCompressedAudio()| has no samples available.
+    kNoSamples = AudioEncoder::kNoSamples,
+  };
+
+  // Opus always decodes at 48 kHz; pre-skip and codec delay are expressed
+  // using this rate regardless of the input sample rate.
+  static const int kOpusDecodeRate = 48000;
+
+  // Seek pre-roll recommended by the WebM Opus mapping, in nanoseconds.
+  static const uint64 kSeekPreRoll = 80000000;
+
+  OpusAudioEncoder();
+  ~OpusAudioEncoder();
+
+  // Returns true when |sample_rate| is supported by libopus.
+  static bool SampleRateSupported(uint32 sample_rate);
+
+  // Initializes libopus using the settings stored in |audio_config| and
+  // |opus_config|. Returns |kSuccess| after successful libopus
+  // initialization. Returns |kUnsupportedFormat| when the sample rate, channel
+  // count or frame duration is not supported by libopus.
+  int Init(const AudioConfig& audio_config, const OpusConfig& opus_config);
+
+  // Stores the samples in |uncompressed_buffer| until a complete Opus frame
+  // is available. Returns |kSuccess| after successful storage of the samples.
+  int Encode(const AudioBuffer& uncompressed_buffer);
+
+  // Encodes one Opus frame and returns it via |ptr_buffer| when enough
+  // samples have been passed to |Encode()|. Returns |kNoSamples| when less
+  // than a frame of audio is buffered. Returns |kSuccess| when an Opus packet
+  // is written to |ptr_buffer|.
+  int ReadCompressedAudio(AudioBuffer* ptr_buffer);
+
+  // Accessors.
+  const uint8* opus_head() const { return opus_head_.get(); }
+  int32 opus_head_length() const { return opus_head_length_; }
+  const AudioConfig* audio_config() const { return &audio_config_; }
+  const OpusConfig* opus_config() const { return &opus_config_; }
+  int32 frame_size() const { return frame_size_; }
+
+  // Returns the encoder lookahead expressed as samples at |kOpusDecodeRate|.
+  int32 pre_skip() const { return pre_skip_; }
+
+  // Returns |pre_skip()| in nanoseconds for use as the WebM CodecDelay value.
+  uint64 codec_delay() const;
+
+  // Returns the encoder lookahead in milliseconds.
+  int64 audio_delay() const { return audio_delay_; }
+
+  // Returns the timestamp of the last encoded buffer read from
+  // |ReadCompressedAudio()|.
+  int64 last_timestamp() const { return last_timestamp_; }
+
+  // Returns the timestamp of the next output packet from |OpusAudioEncoder|.
+  int64 time_encoded() const;
+
+ private:
+  // Builds the OpusHead structure used as the WebM Opus track Codec Private
+  // element, and stores it in |opus_head_|.
+  int GenerateOpusHead();
+
+  // Converts |num_samples| to milliseconds. Timestamps are derived from the
+  // running sample count, so that the rounding of frame durations that are
+  // not whole milliseconds (2.5 ms frames) never accumulates.
+  int64 SamplesToMilliseconds(int64 num_samples) const;
+
+  // Applies libopus encoder configuration values. Does nothing and returns
+  // |kSuccess| when |val| is |OpusConfig::kUseDefault|.
+  int CodecControl(int control_id, int val);
+
+  ::OpusEncoder* ptr_encoder_;
+
+  // Samples per channel in each Opus frame.
+  int32 frame_size_;
+  int32 pre_skip_;
+  int32 opus_head_length_;
+  int64 audio_delay_;
+  int64 samples_encoded_;
+  int64 last_timestamp_;
+  int64 first_input_timestamp_;
+
+  AudioConfig audio_config_;
+  OpusConfig opus_config_;
+
+  // Interleaved input samples waiting to be encoded, in the input format.
+  // Samples before |pending_offset_| have been encoded; they are erased once
+  // per |Encode()| call instead of once per frame.
+  std::vector<uint8> pending_samples_;
+  size_t pending_offset_;
+
+  // Storage for the output of |opus_encode()|.
+  std::vector<uint8> packet_buffer_;
+
+  std::unique_ptr<uint8[]> opus_head_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(OpusAudioEncoder);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_OPUS_ENCODER_H_
@@ -0,0 +1,134 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/pipeline_stage.h"
+
+#include <chrono>
+#include <functional>
+#include <new>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+// Defined here because |std::chrono::milliseconds| binds it to a reference.
+const int PipelineStageRunner::kIdleSleepMilliseconds;
+
+PipelineStageRunner::PipelineStageRunner()
+    : ptr_stage_(NULL),
+      ptr_pool_(NULL),
+      stop_(false),
+      drain_(false),
+      status_(kSuccess) {
+}
+
+PipelineStageRunner::~PipelineStageRunner() {
+  Stop(false);
+}
+
+int PipelineStageRunner::Start(const std::string& name,
+                               PipelineStageInterface* ptr_stage) {
+  if (!ptr_stage) {
+    LOG(ERROR) << "cannot Start NULL pipeline stage.";
+    return kInvalidArg;
+  }
+  if (thread_ || ptr_pool_) {
+    LOG(ERROR) << "pipeline stage " << name_ << " already running.";
+    return kAlreadyRunning;
+  }
+  name_ = name;
+  ptr_stage_ = ptr_stage;
+  stop_ = false;
+  drain_ = false;
+  status_ = kSuccess;
+  using std::bind;
+  using std::nothrow;
+  using std::shared_ptr;
+  using std::thread;
+  thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&PipelineStageRunner::StageThread,  // NOLINT
+                                this)));
+  if (!thread_) {
+    LOG(ERROR) << "cannot construct thread for pipeline stage " << name_;
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int PipelineStageRunner::Start(const std::string& name,
+                               PipelineStageInterface* ptr_stage,
+                               WorkerPool* ptr_pool,
+                               WorkerPool::Priority priority) {
+  if (!ptr_stage || !ptr_pool) {
+    LOG(ERROR) << "cannot Start NULL pipeline stage or pool.";
+    return kInvalidArg;
+  }
+  if (thread_ || ptr_pool_) {
+    LOG(ERROR) << "pipeline stage " << name_ << " already running.";
+    return kAlreadyRunning;
+  }
+  name_ = name;
+  ptr_stage_ = ptr_stage;
+  status_ = kSuccess;
+  const int status = ptr_pool->AddStage(name, ptr_stage, priority, &status_);
+  if (status) {
+    LOG(ERROR) << "cannot add pipeline stage " << name_ << " to the pool: "
+               << status;
+    return status == WorkerPool::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  ptr_pool_ = ptr_pool;
+  return kSuccess;
+}
+
+void PipelineStageRunner::Stop(bool drain) {
+  if (ptr_pool_) {
+    ptr_pool_->RemoveStage(ptr_stage_);
+    ptr_pool_ = NULL;
+    if (drain && status_ == kSuccess) {
+      const int status = ptr_stage_->Drain();
+      if (status) {
+        LOG(ERROR) << name_ << " stage Drain failed: " << status;
+        status_ = status;
+      }
+    }
+    return;
+  }
+  if (!thread_) {
+    return;
+  }
+  drain_ = drain;
+  stop_ = true;
+  thread_->join();
+  thread_.reset();
+}
+
+void PipelineStageRunner::StageThread() {
+  LOG(INFO) << name_ << " stage started.";
+  int status = kSuccess;
+  while (!stop_) {
+    bool did_work = false;
+    status = ptr_stage_->Process(&did_work);
+    if (status) {
+      LOG(ERROR) << name_ << " stage Process failed: " << status;
+      break;
+    }
+    if (!did_work) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(kIdleSleepMilliseconds));
+    }
+  }
+  if (status == kSuccess && drain_) {
+    status = ptr_stage_->Drain();
+    if (status) {
+      LOG(ERROR) << name_ << " stage Drain failed: " << status;
+    }
+  }
+  status_ = status;
+  LOG(INFO) << name_ << " stage finished.";
+}
+
+}  // namespace webmlive
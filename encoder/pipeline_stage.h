@@ -0,0 +1,125 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_PIPELINE_STAGE_H_
+#define WEBMLIVE_ENCODER_PIPELINE_STAGE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+#include "encoder/worker_pool.h"
+
+namespace webmlive {
+
+// Interface implemented by each stage of the encoding pipeline. A stage pulls
+// work from its input queue, and pushes results to the next stage's queue.
+// Stages must not block when their output is full; they return without doing
+// work, which leaves their input queue to fill and pushes back on the stage
+// before them.
+class PipelineStageInterface {
+ public:
+  virtual ~PipelineStageInterface() {}
+
+  // Performs one unit of work and returns 0. Sets |ptr_did_work| to true when
+  // the pass made progress. Returning non-zero stops the stage.
+  virtual int Process(bool* ptr_did_work) = 0;
+
+  // Called once after the last |Process()| call when the stage is stopped
+  // with draining enabled. Finishes all queued work and returns 0.
+  virtual int Drain() = 0;
+};
+
+// Adapts a member function to |PipelineStageInterface|, for stages whose state
+// lives in a larger object. |Drain()| does nothing.
+template <class T>
+class MemberFunctionStage : public PipelineStageInterface {
+ public:
+  typedef int (T::*ProcessFunc)(bool* ptr_did_work);
+
+  MemberFunctionStage(T* ptr_object, ProcessFunc ptr_process)
+      : ptr_object_(ptr_object), ptr_process_(ptr_process) {}
+  virtual ~MemberFunctionStage() {}
+
+  virtual int Process(bool* ptr_did_work) {
+    return (ptr_object_->*ptr_process_)(ptr_did_work);
+  }
+  virtual int Drain() { return 0; }
+
+ private:
+  T* ptr_object_;
+  ProcessFunc ptr_process_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MemberFunctionStage);
+};
+
+// Runs a |PipelineStageInterface| on a dedicated thread, or on a shared
+// |WorkerPool|. The thread calls |Process()| until stopped or until
+// |Process()| fails, and sleeps for |kIdleSleepMilliseconds| after passes that
+// did no work.
+class PipelineStageRunner {
+ public:
+  enum {
+    kAlreadyRunning = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static const int kIdleSleepMilliseconds = 1;
+
+  PipelineStageRunner();
+  ~PipelineStageRunner();
+
+  // Starts a thread that runs |ptr_stage|. |name| is used in log messages.
+  // Returns |kSuccess| when the thread is running.
+  int Start(const std::string& name, PipelineStageInterface* ptr_stage);
+
+  // Runs |ptr_stage| on |ptr_pool| at |priority| instead of on a dedicated
+  // thread. |ptr_pool| must be running, and must outlive the runner.
+  int Start(const std::string& name,
+            PipelineStageInterface* ptr_stage,
+            WorkerPool* ptr_pool,
+            WorkerPool::Priority priority);
+
+  // Stops and joins the stage thread, or removes the stage from its pool.
+  // When |drain| is true the stage's |Drain()| method runs before this
+  // returns: on the stage thread, or on the calling thread for pooled
+  // stages. The caller waits for the drain either way, and |Drain()| blocks
+  // on the stage's output, so running it on a worker would only take that
+  // worker from the other encoders' stages.
+  void Stop(bool drain);
+
+  // Returns the first error reported by the stage, or |kSuccess|.
+  int status() const { return status_; }
+
+  // Returns true while the stage thread is running and has not failed.
+  bool running() const {
+    return (thread_ || ptr_pool_) && status_ == kSuccess;
+  }
+
+ private:
+  // Stage thread function.
+  void StageThread();
+
+  std::string name_;
+  PipelineStageInterface* ptr_stage_;
+  std::shared_ptr<std::thread> thread_;
+
+  // Pool running the stage, or NULL.
+  WorkerPool* ptr_pool_;
+  std::atomic<bool> stop_;
+  std::atomic<bool> drain_;
+  std::atomic<int> status_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(PipelineStageRunner);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_PIPELINE_STAGE_H_
@@ -0,0 +1,516 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/recording_sink.h"
+
+#include <chrono>
+#include <iomanip>
+#include <new>
+#include <sstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "encoder/dash_writer.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+typedef std::chrono::steady_clock Clock;
+
+RecordingConfig::RecordingConfig()
+    : directory("."),
+      name(kDefaultDashName),
+      max_file_duration(0),
+      max_file_size(0),
+      preallocation_size(kDefaultPreallocationSize),
+      sync_interval(0),
+      finalize(false),
+      queue_length(DataSinkStage::kDefaultQueueLength) {
+}
+
+// Write only file that tracks its own write offset, and reserves disk space
+// ahead of it.
+class RecordingFile {
+ public:
+  RecordingFile();
+  ~RecordingFile();
+
+  // Creates |path|, replacing any existing file. Returns true when
+  // successful.
+  bool Open(const std::string& path);
+
+  // Writes |data_length| bytes from |ptr_data| at the end of the file. Returns
+  // true when successful.
+  bool Write(const uint8* ptr_data, int32 data_length);
+
+  // Reserves disk space for the file up to |end| bytes. The file size does
+  // not change. Returns true when successful, or when the platform cannot
+  // reserve space.
+  bool Preallocate(int64 end);
+
+  // Flushes file data to disk. Returns true when successful.
+  bool Sync();
+
+  // Closes the file, flushing it to disk first when |sync| is true. Returns
+  // true when successful.
+  bool Close(bool sync);
+
+  bool is_open() const;
+  const std::string& path() const { return path_; }
+  int64 size() const { return size_; }
+
+ private:
+  std::string path_;
+  int64 size_;
+#ifdef _WIN32
+  HANDLE file_;
+#else
+  int fd_;
+#endif
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(RecordingFile);
+};
+
+#ifdef _WIN32
+RecordingFile::RecordingFile() : size_(0), file_(INVALID_HANDLE_VALUE) {
+}
+
+bool RecordingFile::Open(const std::string& path) {
+  file_ = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                      CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    LOG(ERROR) << "cannot create " << path << ": " << GetLastError();
+    return false;
+  }
+  path_ = path;
+  size_ = 0;
+  return true;
+}
+
+bool RecordingFile::Write(const uint8* ptr_data, int32 data_length) {
+  OVERLAPPED overlapped = {0};
+  overlapped.Offset = static_cast<DWORD>(size_);
+  overlapped.OffsetHigh = static_cast<DWORD>(size_ >> 32);
+  DWORD bytes_written = 0;
+  if (!WriteFile(file_, ptr_data, data_length, &bytes_written, &overlapped) ||
+      bytes_written != static_cast<DWORD>(data_length)) {
+    LOG(ERROR) << "cannot write " << path_ << ": " << GetLastError();
+    return false;
+  }
+  size_ += data_length;
+  return true;
+}
+
+// The allocation size only reserves clusters; the file size and the valid
+// data length are unchanged, and the system frees the unused space when the
+// file is closed.
+bool RecordingFile::Preallocate(int64 end) {
+  FILE_ALLOCATION_INFO allocation_info;
+  allocation_info.AllocationSize.QuadPart = end;
+  if (!SetFileInformationByHandle(file_, FileAllocationInfo, &allocation_info,
+                                  sizeof(allocation_info))) {
+    LOG(WARNING) << "cannot preallocate " << path_ << ": " << GetLastError();
+    return false;
+  }
+  return true;
+}
+
+bool RecordingFile::Sync() {
+  return FlushFileBuffers(file_) != FALSE;
+}
+
+bool RecordingFile::Close(bool sync) {
+  if (file_ == INVALID_HANDLE_VALUE) {
+    return true;
+  }
+  bool ok = !sync || Sync();
+  ok = (CloseHandle(file_) != FALSE) && ok;
+  file_ = INVALID_HANDLE_VALUE;
+  return ok;
+}
+
+bool RecordingFile::is_open() const {
+  return file_ != INVALID_HANDLE_VALUE;
+}
+#else
+RecordingFile::RecordingFile() : size_(0), fd_(-1) {
+}
+
+bool RecordingFile::Open(const std::string& path) {
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "cannot create " << path;
+    return false;
+  }
+  path_ = path;
+  size_ = 0;
+  return true;
+}
+
+bool RecordingFile::Write(const uint8* ptr_data, int32 data_length) {
+  int32 written = 0;
+  while (written < data_length) {
+    const ssize_t result = pwrite(fd_, ptr_data + written,
+                                  data_length - written, size_ + written);
+    if (result <= 0) {
+      LOG(ERROR) << "cannot write " << path_;
+      return false;
+    }
+    written += static_cast<int32>(result);
+  }
+  size_ += data_length;
+  return true;
+}
+
+// FALLOC_FL_KEEP_SIZE reserves the extents without moving the end of file, so
+// a reader never sees the unwritten space.
+bool RecordingFile::Preallocate(int64 end) {
+#ifdef __linux__
+  if (end > size_ &&
+      fallocate(fd_, FALLOC_FL_KEEP_SIZE, size_, end - size_) != 0) {
+    LOG(WARNING) << "cannot preallocate " << path_;
+    return false;
+  }
+#endif
+  return true;
+}
+
+bool RecordingFile::Sync() {
+  return fsync(fd_) == 0;
+}
+
+bool RecordingFile::Close(bool sync) {
+  if (fd_ < 0) {
+    return true;
+  }
+  // Truncating to the written size frees the space reserved past it.
+  bool ok = ftruncate(fd_, size_) == 0;
+  ok = (!sync || Sync()) && ok;
+  ok = (close(fd_) == 0) && ok;
+  fd_ = -1;
+  return ok;
+}
+
+bool RecordingFile::is_open() const {
+  return fd_ >= 0;
+}
+#endif  // _WIN32
+
+RecordingFile::~RecordingFile() {
+  Close(false);
+}
+
+// Synchronous recorder run by |RecordingSink::io_stage_| on the I/O thread.
+class RecordingFileWriter : public DataSinkInterface {
+ public:
+  // Closed files are passed to |ptr_finalizer| when it is non-NULL.
+  RecordingFileWriter(const RecordingConfig& config,
+                      WebmFinalizer* ptr_finalizer);
+  virtual ~RecordingFileWriter() {}
+
+  // Closes the open files. Returns true when successful.
+  bool Close();
+
+  // DataSinkInterface methods.
+  virtual bool Ready() const { return true; }
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length) {
+    ChunkInfo info;
+    return WriteChunk(info, ptr_data, data_length);
+  }
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length);
+
+ private:
+  static const int kNumTracks = ChunkInfo::kVideoTrack + 1;
+
+  struct TrackRecording {
+    TrackRecording()
+        : in_cluster(false), file_start_time(0), file_number(0),
+          allocated_size(0) {}
+    RecordingFile file;
+
+    // Metadata chunk of the track, written at the start of each file.
+    std::vector<uint8> header;
+
+    // True when the last media chunk written left its cluster open.
+    bool in_cluster;
+
+    // Start time of the first cluster in |file|.
+    int64 file_start_time;
+
+    // Number of the last file opened.
+    int file_number;
+
+    // File size reserved by |RecordingFile::Preallocate()|.
+    int64 allocated_size;
+    Clock::time_point last_sync;
+  };
+
+  // Closes the file of |recording|, and queues it for finalizing. Returns
+  // true when successful.
+  bool CloseFile(TrackRecording* ptr_recording);
+
+  // Returns true when the file of |recording| has reached a rotation limit
+  // and the cluster |info| starts with a keyframe, so that the next file
+  // plays from its first cluster.
+  bool RotationDue(const TrackRecording& recording,
+                   const ChunkInfo& info) const;
+
+  // Closes the file of |track|, and opens the next one with the track header.
+  bool StartFile(ChunkInfo::Track track, int64 start_time);
+
+  // Writes |data_length| bytes from |ptr_data| to the file of |recording|,
+  // reserving space and flushing as configured.
+  bool AppendToFile(TrackRecording* ptr_recording,
+                    const uint8* ptr_data,
+                    int32 data_length);
+
+  // Returns the path of file |file_number| of |track|.
+  std::string FilePath(ChunkInfo::Track track, int file_number) const;
+
+  const RecordingConfig config_;
+  WebmFinalizer* const ptr_finalizer_;
+  TrackRecording recordings_[kNumTracks];
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(RecordingFileWriter);
+};
+
+RecordingFileWriter::RecordingFileWriter(const RecordingConfig& config,
+                                         WebmFinalizer* ptr_finalizer)
+    : config_(config), ptr_finalizer_(ptr_finalizer) {
+}
+
+bool RecordingFileWriter::Close() {
+  bool ok = true;
+  for (int i = 0; i < kNumTracks; ++i) {
+    ok = CloseFile(&recordings_[i]) && ok;
+  }
+  return ok;
+}
+
+bool RecordingFileWriter::WriteChunk(const ChunkInfo& info,
+                                     const uint8* ptr_data,
+                                     int32 data_length) {
+  if (!ptr_data || data_length <= 0 ||
+      info.track < 0 || info.track >= kNumTracks) {
+    LOG(ERROR) << "RecordingFileWriter cannot write invalid chunk.";
+    return false;
+  }
+  TrackRecording& recording = recordings_[info.track];
+  switch (info.type) {
+    case ChunkInfo::kManifest:
+      return true;
+    case ChunkInfo::kMetadata:
+      recording.header.assign(ptr_data, ptr_data + data_length);
+      // A new header means a new stream; the next cluster starts a file.
+      if (!CloseFile(&recording)) {
+        return false;
+      }
+      recording.in_cluster = false;
+      return true;
+    case ChunkInfo::kMedia:
+      break;
+  }
+
+  const bool starts_cluster = !recording.in_cluster;
+  recording.in_cluster = !info.complete;
+  if (recording.header.empty()) {
+    LOG(WARNING) << "recording dropped media chunk without metadata.";
+    return true;
+  }
+  if (starts_cluster &&
+      (!recording.file.is_open() || RotationDue(recording, info))) {
+    if (!StartFile(info.track, info.start_time)) {
+      return false;
+    }
+  }
+  if (!recording.file.is_open()) {
+    // Mid cluster chunk after the file was closed by a new header.
+    return true;
+  }
+  return AppendToFile(&recording, ptr_data, data_length);
+}
+
+bool RecordingFileWriter::CloseFile(TrackRecording* ptr_recording) {
+  RecordingFile& file = ptr_recording->file;
+  if (!file.is_open()) {
+    return true;
+  }
+  if (!file.Close(true)) {
+    LOG(ERROR) << "cannot close " << file.path();
+    return false;
+  }
+  LOG(INFO) << "recording closed: " << file.path() << " (" << file.size()
+            << " bytes)";
+  if (ptr_finalizer_) {
+    ptr_finalizer_->Enqueue(file.path());
+  }
+  return true;
+}
+
+bool RecordingFileWriter::RotationDue(const TrackRecording& recording,
+                                      const ChunkInfo& info) const {
+  if (!info.keyframe) {
+    return false;
+  }
+  if (config_.max_file_size > 0 &&
+      recording.file.size() >= config_.max_file_size) {
+    return true;
+  }
+  return config_.max_file_duration > 0 &&
+      info.start_time - recording.file_start_time >=
+          config_.max_file_duration;
+}
+
+bool RecordingFileWriter::StartFile(ChunkInfo::Track track,
+                                    int64 start_time) {
+  TrackRecording& recording = recordings_[track];
+  if (!CloseFile(&recording)) {
+    return false;
+  }
+  const std::string path = FilePath(track, ++recording.file_number);
+  if (!recording.file.Open(path)) {
+    return false;
+  }
+  recording.file_start_time = start_time;
+  recording.allocated_size = 0;
+  recording.last_sync = Clock::now();
+  VLOG(1) << "recording opened: " << path;
+  const int32 header_length = static_cast<int32>(recording.header.size());
+  return AppendToFile(&recording, &recording.header[0], header_length);
+}
+
+bool RecordingFileWriter::AppendToFile(TrackRecording* ptr_recording,
+                                       const uint8* ptr_data,
+                                       int32 data_length) {
+  RecordingFile& file = ptr_recording->file;
+  const int64 end = file.size() + data_length;
+  if (config_.preallocation_size > 0 && end > ptr_recording->allocated_size) {
+    // Failure only costs the extent layout; keep recording.
+    ptr_recording->allocated_size = end + config_.preallocation_size;
+    file.Preallocate(ptr_recording->allocated_size);
+  }
+  if (!file.Write(ptr_data, data_length)) {
+    return false;
+  }
+  if (config_.sync_interval > 0) {
+    const Clock::time_point now = Clock::now();
+    if (now - ptr_recording->last_sync >=
+        std::chrono::milliseconds(config_.sync_interval)) {
+      if (!file.Sync()) {
+        LOG(ERROR) << "cannot sync " << file.path();
+        return false;
+      }
+      ptr_recording->last_sync = now;
+    }
+  }
+  return true;
+}
+
+std::string RecordingFileWriter::FilePath(ChunkInfo::Track track,
+                                          int file_number) const {
+  std::ostringstream path;
+  path << config_.directory << "/" << config_.name;
+  if (track == ChunkInfo::kAudioTrack) {
+    path << "_audio";
+  } else if (track == ChunkInfo::kVideoTrack) {
+    path << "_video";
+  }
+  path << "_" << std::setw(6) << std::setfill('0') << file_number << ".webm";
+  return path.str();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RecordingSink
+//
+
+RecordingSink::RecordingSink() : finalize_(false) {
+}
+
+RecordingSink::~RecordingSink() {
+  Stop();
+}
+
+int RecordingSink::Init(const RecordingConfig& config) {
+  if (config.directory.empty() || config.name.empty()) {
+    LOG(ERROR) << "RecordingSink requires directory and name.";
+    return kInvalidArg;
+  }
+  if (config.max_file_duration < 0 || config.max_file_size < 0 ||
+      config.preallocation_size < 0 || config.sync_interval < 0) {
+    LOG(ERROR) << "invalid recording settings.";
+    return kInvalidArg;
+  }
+  finalize_ = config.finalize;
+  ptr_writer_.reset(
+      new (std::nothrow) RecordingFileWriter(  // NOLINT
+          config, finalize_ ? &finalizer_ : NULL));
+  if (!ptr_writer_) {
+    LOG(ERROR) << "cannot construct RecordingFileWriter.";
+    return kNoMemory;
+  }
+  const int status = io_stage_.Init(ptr_writer_.get(), config.queue_length);
+  if (status) {
+    LOG(ERROR) << "I/O stage Init failed: " << status;
+    return status == DataSinkStage::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  return kSuccess;
+}
+
+int RecordingSink::Run() {
+  if (!ptr_writer_) {
+    LOG(ERROR) << "RecordingSink cannot Run, Init required.";
+    return kRunFailed;
+  }
+  if (finalize_ && finalizer_.Run()) {
+    LOG(ERROR) << "finalizer Run failed.";
+    return kRunFailed;
+  }
+  const int status = io_runner_.Start("recording I/O", &io_stage_);
+  if (status) {
+    LOG(ERROR) << "I/O stage Start failed: " << status;
+    finalizer_.Stop();
+    return kRunFailed;
+  }
+  return kSuccess;
+}
+
+void RecordingSink::Stop() {
+  io_runner_.Stop(true);
+  if (ptr_writer_ && !ptr_writer_->Close()) {
+    LOG(ERROR) << "cannot close recording files.";
+  }
+  finalizer_.Stop();
+}
+
+// Reports ready after an I/O failure so that the next |WriteChunk()| call
+// returns the error instead of leaving the caller waiting.
+bool RecordingSink::Ready() const {
+  return !io_stage_.full() || !io_runner_.running();
+}
+
+bool RecordingSink::WriteData(const uint8* ptr_data, int32 data_length) {
+  ChunkInfo info;
+  return WriteChunk(info, ptr_data, data_length);
+}
+
+bool RecordingSink::WriteChunk(const ChunkInfo& info,
+                               const uint8* ptr_data,
+                               int32 data_length) {
+  if (!io_runner_.running()) {
+    LOG(ERROR) << "RecordingSink I/O stage not running: "
+               << io_runner_.status();
+    return false;
+  }
+  return io_stage_.Write(info, ptr_data, data_length) ==
+      DataSinkStage::kSuccess;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,121 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_RECORDING_SINK_H_
+#define WEBMLIVE_ENCODER_RECORDING_SINK_H_
+
+#include <memory>
+#include <string>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/data_sink_stage.h"
+#include "encoder/encoder_base.h"
+#include "encoder/pipeline_stage.h"
+#include "encoder/webm_finalizer.h"
+
+namespace webmlive {
+
+struct RecordingConfig {
+  // Default file space reserved ahead of the data written.
+  static const int64 kDefaultPreallocationSize = 16 * 1024 * 1024;
+
+  RecordingConfig();
+
+  // Directory in which recordings are written. Must exist.
+  std::string directory;
+
+  // Prefix of the recording file names. Files are named
+  // <name>[_<track>]_<number>.webm, where <track> is audio or video for per
+  // track output, and <number> counts files from 1.
+  std::string name;
+
+  // A new file is started at the first keyframe cluster that begins
+  // |max_file_duration| milliseconds or more after the start of the current
+  // file, or once the current file holds |max_file_size| bytes. 0 disables
+  // the limit. With both limits disabled each track is recorded to one file.
+  int64 max_file_duration;
+  int64 max_file_size;
+
+  // Bytes of disk space reserved at a time ahead of the data written, so that
+  // the file system allocates large extents. The reservation does not change
+  // the file size. 0 disables preallocation.
+  int64 preallocation_size;
+
+  // Milliseconds between flushes of the file being written to disk. 0 leaves
+  // flushing to the operating system. Files are always flushed when closed.
+  int sync_interval;
+
+  // Rewrite each closed file as a seekable WebM file with Cues, on a low
+  // priority thread. See |WebmFinalizer|.
+  bool finalize;
+
+  // Number of chunks queued for the I/O thread.
+  int queue_length;
+};
+
+// Forward declaration of the class that writes the files.
+class RecordingFileWriter;
+
+// Data sink that records the stream to local WebM files.
+//
+// Notes:
+// - File I/O runs on a dedicated thread, so recording adds no disk latency
+//   to the caller. |Ready()| returns false while the I/O queue is full.
+// - Files rotate only at clusters that start with a keyframe, so a file may
+//   run past the rotation limits until the next keyframe. The metadata chunk
+//   of each track is written again at the start of every file, so every file
+//   plays on its own.
+// - Manifest chunks are ignored, and media chunks that arrive before the
+//   metadata chunk of their track are dropped.
+// - When |RecordingConfig::finalize| is set, each file is finalized once it
+//   is closed, and |Stop()| waits for the files still being finalized.
+class RecordingSink : public DataSinkInterface {
+ public:
+  enum {
+    kRunFailed = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  RecordingSink();
+  virtual ~RecordingSink();
+
+  // Stores |config| and allocates the I/O queue. Returns |kSuccess| when
+  // successful.
+  int Init(const RecordingConfig& config);
+
+  // Starts the I/O thread.
+  int Run();
+
+  // Writes all queued chunks, closes the open files, and stops the I/O
+  // thread. Then finalizes the closed files when finalizing is enabled.
+  void Stop();
+
+  // DataSinkInterface methods. |WriteData()| treats data as muxed media.
+  virtual bool Ready() const;
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length);
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length);
+
+ private:
+  std::unique_ptr<RecordingFileWriter> ptr_writer_;
+
+  // Queue between the caller and |ptr_writer_|, and the I/O thread.
+  DataSinkStage io_stage_;
+  PipelineStageRunner io_runner_;
+
+  bool finalize_;
+  WebmFinalizer finalizer_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(RecordingSink);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_RECORDING_SINK_H_
@@ -0,0 +1,165 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/recording_sink.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const char kTestName[] = "recording_sink_unittest";
+const char kHeader[] = "header,";
+const int kMaxFiles = 10;
+const int64 kClusterDuration = 1000;
+
+// Returns true and sets |ptr_contents| when |path| can be read.
+bool ReadFile(const std::string& path, std::string* ptr_contents) {
+  FILE* const ptr_file = fopen(path.c_str(), "rb");
+  if (!ptr_file) {
+    return false;
+  }
+  ptr_contents->clear();
+  char buffer[1024];
+  size_t bytes_read = 0;
+  while ((bytes_read = fread(buffer, 1, sizeof(buffer), ptr_file)) > 0) {
+    ptr_contents->append(buffer, bytes_read);
+  }
+  fclose(ptr_file);
+  return true;
+}
+
+class RecordingSinkTest : public ::testing::Test {
+ protected:
+  RecordingSinkTest() {
+    config_.name = kTestName;
+    config_.preallocation_size = 0;
+  }
+
+  virtual ~RecordingSinkTest() {
+    sink_.Stop();
+    for (int i = 1; i <= kMaxFiles; ++i) {
+      remove(FilePath(i).c_str());
+    }
+  }
+
+  void StartSink() {
+    ASSERT_EQ(RecordingSink::kSuccess, sink_.Init(config_));
+    ASSERT_EQ(RecordingSink::kSuccess, sink_.Run());
+    ChunkInfo info;
+    info.type = ChunkInfo::kMetadata;
+    Write(info, kHeader);
+  }
+
+  // Writes |text| as a chunk described by |info| once the sink has room.
+  void Write(const ChunkInfo& info, const std::string& text) {
+    while (!sink_.Ready()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_TRUE(sink_.WriteChunk(info, reinterpret_cast<const uint8*>(
+        text.data()), static_cast<int32>(text.size())));
+  }
+
+  // Writes the chunk of cluster |number|, which is complete unless
+  // |complete| is false, and returns its text.
+  std::string WriteCluster(int64 number, bool keyframe, bool complete) {
+    ChunkInfo info;
+    info.number = number;
+    info.keyframe = keyframe;
+    info.complete = complete;
+    info.start_time = (number - 1) * kClusterDuration;
+    std::ostringstream text;
+    text << "cluster " << number << (complete ? "," : " part,");
+    Write(info, text.str());
+    return text.str();
+  }
+
+  // Returns the path of recording file |number|.
+  std::string FilePath(int number) const {
+    std::ostringstream path;
+    path << config_.directory << "/" << config_.name << "_"
+         << std::setw(6) << std::setfill('0') << number << ".webm";
+    return path.str();
+  }
+
+  void ExpectFile(int number, const std::string& expected) {
+    std::string contents;
+    ASSERT_TRUE(ReadFile(FilePath(number), &contents)) << number;
+    EXPECT_EQ(kHeader + expected, contents) << number;
+  }
+
+  RecordingConfig config_;
+  RecordingSink sink_;
+};
+
+TEST_F(RecordingSinkTest, InvalidConfig) {
+  config_.directory.clear();
+  EXPECT_EQ(RecordingSink::kInvalidArg, sink_.Init(config_));
+  config_.directory = ".";
+  config_.max_file_duration = -1;
+  EXPECT_EQ(RecordingSink::kInvalidArg, sink_.Init(config_));
+}
+
+// A file that reaches |max_file_duration| on a delta frame cluster runs on
+// to the next keyframe cluster, which starts the next file with the header.
+TEST_F(RecordingSinkTest, DurationRotatesAtKeyframes) {
+  config_.max_file_duration = 2 * kClusterDuration;
+  StartSink();
+  std::string expected[3];
+  for (int64 number = 1; number <= 9; ++number) {
+    expected[(number - 1) / 3] +=
+        WriteCluster(number, number % 3 == 1, true);
+  }
+  sink_.Stop();
+
+  for (int i = 0; i < 3; ++i) {
+    ExpectFile(i + 1, expected[i]);
+  }
+  std::string contents;
+  EXPECT_FALSE(ReadFile(FilePath(4), &contents));
+}
+
+TEST_F(RecordingSinkTest, SizeRotatesAtKeyframes) {
+  config_.max_file_size = 1;
+  StartSink();
+  std::string expected[2];
+  expected[0] = WriteCluster(1, true, true);
+  expected[0] += WriteCluster(2, false, true);
+  expected[1] = WriteCluster(3, true, true);
+  expected[1] += WriteCluster(4, false, true);
+  sink_.Stop();
+
+  ExpectFile(1, expected[0]);
+  ExpectFile(2, expected[1]);
+}
+
+// The chunks of a cluster split in low latency mode stay in one file, even
+// when the limit is reached within the cluster.
+TEST_F(RecordingSinkTest, PartialClustersStayInFile) {
+  config_.max_file_size = 1;
+  StartSink();
+  std::string expected[2];
+  expected[0] = WriteCluster(1, true, false);
+  expected[0] += WriteCluster(1, true, false);
+  expected[0] += WriteCluster(1, true, true);
+  expected[1] = WriteCluster(2, true, false);
+  expected[1] += WriteCluster(2, true, true);
+  sink_.Stop();
+
+  ExpectFile(1, expected[0]);
+  ExpectFile(2, expected[1]);
+}
+
+}  // namespace
+}  // namespace webmlive
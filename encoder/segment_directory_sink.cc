@@ -0,0 +1,287 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/segment_directory_sink.h"
+
+#include <cstdio>
+#include <deque>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "encoder/dash_writer.h"
+#include "glog/logging.h"
+
+namespace {
+
+const char kTempFileSuffix[] = ".tmp";
+
+// Flushes |ptr_file| to disk. Returns true when successful.
+bool SyncFile(FILE* ptr_file) {
+#ifdef _WIN32
+  return _commit(_fileno(ptr_file)) == 0;
+#else
+  return fsync(fileno(ptr_file)) == 0;
+#endif
+}
+
+// Renames |from| to |to|, replacing |to| when it exists. Returns true when
+// successful.
+bool RenameReplacing(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+  return MoveFileExA(from.c_str(), to.c_str(),
+                     MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+  return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+}  // namespace
+
+namespace webmlive {
+
+SegmentDirectoryConfig::SegmentDirectoryConfig()
+    : directory("."),
+      name(kDefaultDashName),
+      id(kDefaultDashId),
+      segment_window(0),
+      sync_policy(kSyncNone),
+      queue_length(DataSinkStage::kDefaultQueueLength) {
+}
+
+// Synchronous file writer run by |SegmentDirectorySink::io_stage_| on the I/O
+// thread.
+class SegmentFileWriter : public DataSinkInterface {
+ public:
+  enum {
+    kFileError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  explicit SegmentFileWriter(const SegmentDirectoryConfig& config);
+  virtual ~SegmentFileWriter() {}
+
+  // DataSinkInterface methods.
+  virtual bool Ready() const { return true; }
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length) {
+    ChunkInfo info;
+    return WriteChunk(info, ptr_data, data_length);
+  }
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length);
+
+ private:
+  static const int kNumTracks = ChunkInfo::kVideoTrack + 1;
+
+  // Writes |data_length| bytes from |ptr_data| to a temporary file in
+  // |config_.directory|, and renames it to |file_name|. Flushes the file to
+  // disk before the rename when |sync| is true.
+  int PublishFile(const std::string& file_name,
+                  const uint8* ptr_data,
+                  int32 data_length,
+                  bool sync);
+
+  // Deletes media segments of |track| beyond |config_.segment_window|.
+  void PruneSegments(ChunkInfo::Track track);
+
+  // Returns the path of |file_name| within |config_.directory|.
+  std::string FilePath(const std::string& file_name) const;
+
+  const SegmentDirectoryConfig config_;
+
+  // Media data of the cluster in progress, per track.
+  std::vector<uint8> pending_segments_[kNumTracks];
+
+  // Numbers of the published media segments, per track, oldest first.
+  std::deque<int64> published_segments_[kNumTracks];
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SegmentFileWriter);
+};
+
+SegmentFileWriter::SegmentFileWriter(const SegmentDirectoryConfig& config)
+    : config_(config) {
+}
+
+bool SegmentFileWriter::WriteChunk(const ChunkInfo& info,
+                                   const uint8* ptr_data,
+                                   int32 data_length) {
+  if (!ptr_data || data_length <= 0 ||
+      info.track < 0 || info.track >= kNumTracks) {
+    LOG(ERROR) << "SegmentFileWriter cannot write invalid chunk.";
+    return false;
+  }
+  const bool sync_segments =
+      config_.sync_policy != SegmentDirectoryConfig::kSyncNone;
+  int status = kSuccess;
+  switch (info.type) {
+    case ChunkInfo::kManifest:
+      status = PublishFile(DashWriter::ManifestName(config_.name),
+                           ptr_data, data_length,
+                           config_.sync_policy ==
+                               SegmentDirectoryConfig::kSyncAll);
+      break;
+    case ChunkInfo::kMetadata:
+      status = PublishFile(
+          DashWriter::InitializationName(config_.name, config_.id,
+                                         info.track),
+          ptr_data, data_length, sync_segments);
+      break;
+    case ChunkInfo::kMedia: {
+      std::vector<uint8>& segment = pending_segments_[info.track];
+      segment.insert(segment.end(), ptr_data, ptr_data + data_length);
+      if (!info.complete) {
+        break;
+      }
+      const int32 length = static_cast<int32>(segment.size());
+      status = PublishFile(
+          DashWriter::ChunkName(config_.name, config_.id, info.track,
+                                info.number),
+          &segment[0], length, sync_segments);
+      segment.clear();
+      if (status == kSuccess) {
+        published_segments_[info.track].push_back(info.number);
+        PruneSegments(info.track);
+      }
+      break;
+    }
+  }
+  return status == kSuccess;
+}
+
+int SegmentFileWriter::PublishFile(const std::string& file_name,
+                                   const uint8* ptr_data,
+                                   int32 data_length,
+                                   bool sync) {
+  const std::string path = FilePath(file_name);
+  const std::string temp_path = path + kTempFileSuffix;
+  FILE* const ptr_file = fopen(temp_path.c_str(), "wb");
+  if (!ptr_file) {
+    LOG(ERROR) << "cannot open " << temp_path;
+    return kFileError;
+  }
+  bool ok = fwrite(ptr_data, 1, data_length, ptr_file) ==
+      static_cast<size_t>(data_length);
+  ok = ok && fflush(ptr_file) == 0;
+  if (ok && sync) {
+    ok = SyncFile(ptr_file);
+  }
+  ok = (fclose(ptr_file) == 0) && ok;
+  if (!ok) {
+    LOG(ERROR) << "cannot write " << temp_path;
+    remove(temp_path.c_str());
+    return kFileError;
+  }
+  if (!RenameReplacing(temp_path, path)) {
+    LOG(ERROR) << "cannot rename " << temp_path << " to " << path;
+    remove(temp_path.c_str());
+    return kFileError;
+  }
+  VLOG(1) << "published " << path << " (" << data_length << " bytes)";
+  return kSuccess;
+}
+
+void SegmentFileWriter::PruneSegments(ChunkInfo::Track track) {
+  if (config_.segment_window <= 0) {
+    return;
+  }
+  std::deque<int64>& published = published_segments_[track];
+  while (published.size() > static_cast<size_t>(config_.segment_window)) {
+    const std::string path = FilePath(
+        DashWriter::ChunkName(config_.name, config_.id, track,
+                              published.front()));
+    if (remove(path.c_str())) {
+      LOG(WARNING) << "cannot delete " << path;
+    }
+    published.pop_front();
+  }
+}
+
+std::string SegmentFileWriter::FilePath(const std::string& file_name) const {
+  return config_.directory + "/" + file_name;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SegmentDirectorySink
+//
+
+SegmentDirectorySink::SegmentDirectorySink() {
+}
+
+SegmentDirectorySink::~SegmentDirectorySink() {
+}
+
+int SegmentDirectorySink::Init(const SegmentDirectoryConfig& config) {
+  if (config.directory.empty() || config.name.empty() || config.id.empty()) {
+    LOG(ERROR) << "SegmentDirectorySink requires directory, name and id.";
+    return kInvalidArg;
+  }
+  if (config.segment_window < 0) {
+    LOG(ERROR) << "invalid segment window: " << config.segment_window;
+    return kInvalidArg;
+  }
+  ptr_writer_.reset(new (std::nothrow) SegmentFileWriter(config));  // NOLINT
+  if (!ptr_writer_) {
+    LOG(ERROR) << "cannot construct SegmentFileWriter.";
+    return kNoMemory;
+  }
+  const int status = io_stage_.Init(ptr_writer_.get(), config.queue_length);
+  if (status) {
+    LOG(ERROR) << "I/O stage Init failed: " << status;
+    return status == DataSinkStage::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  return kSuccess;
+}
+
+int SegmentDirectorySink::Run() {
+  if (!ptr_writer_) {
+    LOG(ERROR) << "SegmentDirectorySink cannot Run, Init required.";
+    return kRunFailed;
+  }
+  const int status = io_runner_.Start("segment I/O", &io_stage_);
+  if (status) {
+    LOG(ERROR) << "I/O stage Start failed: " << status;
+    return kRunFailed;
+  }
+  return kSuccess;
+}
+
+void SegmentDirectorySink::Stop() {
+  io_runner_.Stop(true);
+}
+
+// Reports ready after an I/O failure so that the next |WriteChunk()| call
+// returns the error instead of leaving the caller waiting.
+bool SegmentDirectorySink::Ready() const {
+  return !io_stage_.full() || !io_runner_.running();
+}
+
+bool SegmentDirectorySink::WriteData(const uint8* ptr_data,
+                                     int32 data_length) {
+  ChunkInfo info;
+  return WriteChunk(info, ptr_data, data_length);
+}
+
+bool SegmentDirectorySink::WriteChunk(const ChunkInfo& info,
+                                      const uint8* ptr_data,
+                                      int32 data_length) {
+  if (!io_runner_.running()) {
+    LOG(ERROR) << "SegmentDirectorySink I/O stage not running: "
+               << io_runner_.status();
+    return false;
+  }
+  return io_stage_.Write(info, ptr_data, data_length) ==
+      DataSinkStage::kSuccess;
+}
+
+}  // namespace webmlive
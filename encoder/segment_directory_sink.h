@@ -0,0 +1,113 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SEGMENT_DIRECTORY_SINK_H_
+#define WEBMLIVE_ENCODER_SEGMENT_DIRECTORY_SINK_H_
+
+#include <memory>
+#include <string>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/data_sink_stage.h"
+#include "encoder/encoder_base.h"
+#include "encoder/pipeline_stage.h"
+
+namespace webmlive {
+
+struct SegmentDirectoryConfig {
+  // Controls when file data is flushed to disk before a file is published.
+  enum SyncPolicy {
+    // Leave flushing to the operating system.
+    kSyncNone = 0,
+
+    // Sync initialization and media segments.
+    kSyncSegments = 1,
+
+    // Sync segments and the manifest.
+    kSyncAll = 2,
+  };
+
+  SegmentDirectoryConfig();
+
+  // Directory in which files are published. Must exist.
+  std::string directory;
+
+  // Stream name and representation ID used to build file names. Must match
+  // the values passed to |DashWriter::Init()|.
+  std::string name;
+  std::string id;
+
+  // Number of media segments kept per track. Older segments are deleted. 0
+  // keeps all segments.
+  int segment_window;
+
+  SyncPolicy sync_policy;
+
+  // Number of chunks queued for the I/O thread.
+  int queue_length;
+};
+
+// Forward declaration of the class that writes the files.
+class SegmentFileWriter;
+
+// Data sink that publishes the DASH manifest, initialization segments, and
+// media segments as files for a static HTTP server, using the names from the
+// |DashWriter| SegmentTemplate patterns.
+//
+// Notes:
+// - Every file is written under a temporary name and renamed into place, so
+//   the server never sees a partial segment, and the manifest is replaced in
+//   place each time the encoder writes it.
+// - Each cluster is one media segment. Segments must start with a keyframe
+//   to match the manifest, so the encoder must only split clusters at
+//   keyframes; see |WebmEncoderConfig::kSplitAtKeyframeOnly|.
+// - Partial chunks from low latency mode are collected until their cluster
+//   completes, and the segment is published then.
+// - File I/O runs on a dedicated thread. |Ready()| returns false while its
+//   queue is full.
+class SegmentDirectorySink : public DataSinkInterface {
+ public:
+  enum {
+    kRunFailed = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  SegmentDirectorySink();
+  virtual ~SegmentDirectorySink();
+
+  // Stores |config| and allocates the I/O queue. Returns |kSuccess| when
+  // successful.
+  int Init(const SegmentDirectoryConfig& config);
+
+  // Starts the I/O thread.
+  int Run();
+
+  // Writes all queued chunks and stops the I/O thread.
+  void Stop();
+
+  // DataSinkInterface methods. |WriteData()| treats data as muxed media.
+  virtual bool Ready() const;
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length);
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length);
+
+ private:
+  std::unique_ptr<SegmentFileWriter> ptr_writer_;
+
+  // Queue between the caller and |ptr_writer_|, and the I/O thread.
+  DataSinkStage io_stage_;
+  PipelineStageRunner io_runner_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SegmentDirectorySink);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SEGMENT_DIRECTORY_SINK_H_
@@ -0,0 +1,161 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/segment_directory_sink.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "encoder/dash_writer.h"
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const char kTestName[] = "segment_directory_sink_unittest";
+const int kMaxSegments = 4;
+
+// Returns true and sets |ptr_contents| when |path| can be read.
+bool ReadFile(const std::string& path, std::string* ptr_contents) {
+  FILE* const ptr_file = fopen(path.c_str(), "rb");
+  if (!ptr_file) {
+    return false;
+  }
+  ptr_contents->clear();
+  char buffer[1024];
+  size_t bytes_read = 0;
+  while ((bytes_read = fread(buffer, 1, sizeof(buffer), ptr_file)) > 0) {
+    ptr_contents->append(buffer, bytes_read);
+  }
+  fclose(ptr_file);
+  return true;
+}
+
+class SegmentDirectorySinkTest : public ::testing::Test {
+ protected:
+  SegmentDirectorySinkTest() {
+    config_.name = kTestName;
+  }
+
+  virtual ~SegmentDirectorySinkTest() {
+    sink_.Stop();
+    remove(ManifestPath().c_str());
+    remove(InitializationPath().c_str());
+    for (int i = 1; i <= kMaxSegments; ++i) {
+      remove(SegmentPath(i).c_str());
+    }
+  }
+
+  void StartSink() {
+    ASSERT_EQ(SegmentDirectorySink::kSuccess, sink_.Init(config_));
+    ASSERT_EQ(SegmentDirectorySink::kSuccess, sink_.Run());
+  }
+
+  // Writes |text| as a chunk described by |info| once the sink has room.
+  void Write(const ChunkInfo& info, const std::string& text) {
+    while (!sink_.Ready()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_TRUE(sink_.WriteChunk(info, reinterpret_cast<const uint8*>(
+        text.data()), static_cast<int32>(text.size())));
+  }
+
+  void WriteMedia(int64 number, bool complete, const std::string& text) {
+    ChunkInfo info;
+    info.number = number;
+    info.complete = complete;
+    info.keyframe = true;
+    Write(info, text);
+  }
+
+  std::string ManifestPath() const {
+    return config_.directory + "/" + DashWriter::ManifestName(config_.name);
+  }
+  std::string InitializationPath() const {
+    return config_.directory + "/" +
+        DashWriter::InitializationName(config_.name, config_.id,
+                                       ChunkInfo::kAllTracks);
+  }
+  std::string SegmentPath(int64 number) const {
+    return config_.directory + "/" +
+        DashWriter::ChunkName(config_.name, config_.id,
+                              ChunkInfo::kAllTracks, number);
+  }
+
+  SegmentDirectoryConfig config_;
+  SegmentDirectorySink sink_;
+};
+
+TEST_F(SegmentDirectorySinkTest, RequiresDirectory) {
+  config_.directory.clear();
+  EXPECT_EQ(SegmentDirectorySink::kInvalidArg, sink_.Init(config_));
+  config_.directory = ".";
+  config_.segment_window = -1;
+  EXPECT_EQ(SegmentDirectorySink::kInvalidArg, sink_.Init(config_));
+}
+
+// Every chunk type is published under its SegmentTemplate name, and the
+// manifest is replaced in place.
+TEST_F(SegmentDirectorySinkTest, PublishesFiles) {
+  StartSink();
+  ChunkInfo manifest_info;
+  manifest_info.type = ChunkInfo::kManifest;
+  Write(manifest_info, "manifest 1");
+  ChunkInfo metadata_info;
+  metadata_info.type = ChunkInfo::kMetadata;
+  Write(metadata_info, "metadata");
+  WriteMedia(1, true, "segment 1");
+  Write(manifest_info, "manifest 2");
+  sink_.Stop();
+
+  std::string contents;
+  ASSERT_TRUE(ReadFile(ManifestPath(), &contents));
+  EXPECT_EQ("manifest 2", contents);
+  ASSERT_TRUE(ReadFile(InitializationPath(), &contents));
+  EXPECT_EQ("metadata", contents);
+  ASSERT_TRUE(ReadFile(SegmentPath(1), &contents));
+  EXPECT_EQ("segment 1", contents);
+
+  // No temporary file is left behind.
+  EXPECT_FALSE(ReadFile(ManifestPath() + ".tmp", &contents));
+  EXPECT_FALSE(ReadFile(SegmentPath(1) + ".tmp", &contents));
+}
+
+// Partial chunks are published as one segment once their cluster completes.
+TEST_F(SegmentDirectorySinkTest, CollectsPartialChunks) {
+  StartSink();
+  WriteMedia(1, false, "part 1, ");
+  WriteMedia(1, false, "part 2, ");
+  WriteMedia(1, true, "part 3");
+  WriteMedia(2, false, "incomplete");
+  sink_.Stop();
+
+  std::string contents;
+  ASSERT_TRUE(ReadFile(SegmentPath(1), &contents));
+  EXPECT_EQ("part 1, part 2, part 3", contents);
+  EXPECT_FALSE(ReadFile(SegmentPath(2), &contents));
+}
+
+TEST_F(SegmentDirectorySinkTest, SegmentWindow) {
+  config_.segment_window = 2;
+  StartSink();
+  for (int i = 1; i <= kMaxSegments; ++i) {
+    WriteMedia(i, true, "segment");
+  }
+  sink_.Stop();
+
+  std::string contents;
+  EXPECT_FALSE(ReadFile(SegmentPath(1), &contents));
+  EXPECT_FALSE(ReadFile(SegmentPath(2), &contents));
+  EXPECT_TRUE(ReadFile(SegmentPath(3), &contents));
+  EXPECT_TRUE(ReadFile(SegmentPath(4), &contents));
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -0,0 +1,100 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SPSC_QUEUE_INL_H_
+#define WEBMLIVE_ENCODER_SPSC_QUEUE_INL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+#include "encoder/spsc_queue.h"
+
+namespace webmlive {
+
+template <class Type, class Exchanger>
+inline SpscQueue<Type, Exchanger>::SpscQueue()
+    : capacity_(0), num_slots_(0), head_(0), tail_(0) {
+}
+
+template <class Type, class Exchanger>
+inline int SpscQueue<Type, Exchanger>::Init(int capacity) {
+  if (capacity <= 0) {
+    return kInvalidArg;
+  }
+  slots_.reset(new (std::nothrow) Type[capacity + 1]);  // NOLINT
+  if (!slots_) {
+    return kNoMemory;
+  }
+  capacity_ = capacity;
+  num_slots_ = capacity + 1;
+  head_.store(0, std::memory_order_relaxed);
+  tail_.store(0, std::memory_order_relaxed);
+  return kSuccess;
+}
+
+// The acquire load of |head_| pairs with the release store in |TryPop()|, so
+// the consumer is done with the slot before it is reused.
+template <class Type, class Exchanger>
+inline int SpscQueue<Type, Exchanger>::TryPush(Type* ptr_item) {
+  if (!ptr_item || !slots_) {
+    return kInvalidArg;
+  }
+  const int tail = tail_.load(std::memory_order_relaxed);
+  const int next_tail = Next(tail);
+  if (next_tail == head_.load(std::memory_order_acquire)) {
+    return kFull;
+  }
+  if (!Exchanger::Exchange(ptr_item, &slots_[tail])) {
+    return kNoMemory;
+  }
+  tail_.store(next_tail, std::memory_order_release);
+  return kSuccess;
+}
+
+// The acquire load of |tail_| pairs with the release store in |TryPush()|, so
+// the producer's writes to the slot are visible before it is read.
+template <class Type, class Exchanger>
+inline int SpscQueue<Type, Exchanger>::TryPop(Type* ptr_item) {
+  if (!ptr_item || !slots_) {
+    return kInvalidArg;
+  }
+  const int head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    return kEmpty;
+  }
+  if (!Exchanger::Exchange(&slots_[head], ptr_item)) {
+    return kNoMemory;
+  }
+  head_.store(Next(head), std::memory_order_release);
+  return kSuccess;
+}
+
+template <class Type, class Exchanger>
+inline const Type* SpscQueue<Type, Exchanger>::Front() const {
+  if (!slots_) {
+    return NULL;
+  }
+  const int head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    return NULL;
+  }
+  return &slots_[head];
+}
+
+template <class Type, class Exchanger>
+inline int SpscQueue<Type, Exchanger>::size() const {
+  const int head = head_.load(std::memory_order_acquire);
+  const int tail = tail_.load(std::memory_order_acquire);
+  return tail >= head ? tail - head : tail + num_slots_ - head;
+}
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SPSC_QUEUE_INL_H_
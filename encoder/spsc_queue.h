@@ -0,0 +1,123 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SPSC_QUEUE_H_
+#define WEBMLIVE_ENCODER_SPSC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+// Default |SpscQueue| exchange policy: moves items with |std::swap()|.
+template <class Type>
+struct SpscSwapExchange {
+  // Exchanges |*ptr_source| and |*ptr_target|, and returns true.
+  static bool Exchange(Type* ptr_source, Type* ptr_target) {
+    std::swap(*ptr_source, *ptr_target);
+    return true;
+  }
+};
+
+// |SpscQueue| exchange policy for the non-copyable buffer types passed
+// through |BufferPool|, such as |AudioBuffer| and |VideoFrame|: swaps storage
+// with |Type::Swap()| when the target has some, and copies the source with
+// |Type::Clone()| otherwise. Returns false when the copy fails.
+template <class Type>
+struct SpscBufferExchange {
+  static bool Exchange(Type* ptr_source, Type* ptr_target) {
+    if (ptr_target->buffer()) {
+      ptr_target->Swap(ptr_source);
+      return true;
+    }
+    return ptr_source->Clone(ptr_target) == 0;
+  }
+};
+
+// Bounded lock free queue used to pass items from exactly one producer thread
+// to exactly one consumer thread. Items are moved in and out of the queue's
+// slots with |Exchanger::Exchange()|, so types that own storage (for example
+// std::vector) hand their buffers back and forth instead of reallocating.
+//
+// Notes:
+// - |TryPush()| may only be called from the producer thread, and |TryPop()|
+//   and |Front()| only from the consumer thread. The producer or consumer may
+//   move between threads when each move is ordered by other synchronization,
+//   as when a |WorkerPool| stage moves between workers.
+// - |Init()| must complete before either thread uses the queue.
+template <class Type, class Exchanger = SpscSwapExchange<Type> >
+class SpscQueue {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+
+    // No items waiting.
+    kEmpty = 1,
+
+    // No free slots.
+    kFull = 2,
+  };
+
+  SpscQueue();
+  ~SpscQueue() {}
+
+  // Allocates |capacity| slots and returns |kSuccess|. Returns |kInvalidArg|
+  // when |capacity| is <= 0.
+  int Init(int capacity);
+
+  // Moves |ptr_item| into the tail slot and returns |kSuccess|. Returns
+  // |kFull| when no slot is free, and |kNoMemory| when |Exchanger| fails; the
+  // queue is unchanged in both cases. After a successful swap |ptr_item|
+  // holds whatever the slot held before, which is an item previously popped
+  // by the consumer or a default constructed |Type|.
+  int TryPush(Type* ptr_item);
+
+  // Moves the head slot into |ptr_item| and returns |kSuccess|. Returns
+  // |kEmpty| when no items are waiting, and |kNoMemory| when |Exchanger|
+  // fails; the item stays queued in that case.
+  int TryPop(Type* ptr_item);
+
+  // Returns the item the next |TryPop()| returns, or NULL when no items are
+  // waiting. The item stays valid until the consumer pops it.
+  const Type* Front() const;
+
+  // Returns the number of items waiting. The value is exact only when called
+  // from the producer or consumer thread while the other is idle.
+  int size() const;
+
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() == capacity_; }
+  int capacity() const { return capacity_; }
+
+ private:
+  // Returns the slot index following |index|.
+  int Next(int index) const { return index + 1 == num_slots_ ? 0 : index + 1; }
+
+  // One slot more than |capacity_| is allocated so that a full queue can be
+  // told apart from an empty one without a shared counter.
+  std::unique_ptr<Type[]> slots_;
+  int capacity_;
+  int num_slots_;
+
+  // Index of the next slot to pop; written only by the consumer.
+  std::atomic<int> head_;
+
+  // Index of the next slot to push; written only by the producer.
+  std::atomic<int> tail_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SpscQueue);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SPSC_QUEUE_H_
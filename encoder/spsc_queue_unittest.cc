@@ -0,0 +1,157 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/spsc_queue.h"
+#include "encoder/spsc_queue-inl.h"
+
+#include <thread>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+TEST(SpscQueueTest, RejectsInvalidCapacity) {
+  SpscQueue<int> queue;
+  EXPECT_EQ(SpscQueue<int>::kInvalidArg, queue.Init(0));
+  EXPECT_EQ(SpscQueue<int>::kInvalidArg, queue.Init(-1));
+  int item = 0;
+  EXPECT_EQ(SpscQueue<int>::kInvalidArg, queue.TryPush(&item));
+  EXPECT_EQ(SpscQueue<int>::kInvalidArg, queue.TryPop(&item));
+}
+
+TEST(SpscQueueTest, FullAndEmpty) {
+  SpscQueue<int> queue;
+  ASSERT_EQ(SpscQueue<int>::kSuccess, queue.Init(2));
+  int item = 0;
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(SpscQueue<int>::kEmpty, queue.TryPop(&item));
+  item = 1;
+  EXPECT_EQ(SpscQueue<int>::kSuccess, queue.TryPush(&item));
+  item = 2;
+  EXPECT_EQ(SpscQueue<int>::kSuccess, queue.TryPush(&item));
+  EXPECT_TRUE(queue.full());
+  item = 3;
+  EXPECT_EQ(SpscQueue<int>::kFull, queue.TryPush(&item));
+  EXPECT_EQ(2, queue.size());
+}
+
+// Pushes and pops past the end of the slot array many times, at every fill
+// level, and checks order and size on the way.
+TEST(SpscQueueTest, Wraparound) {
+  const int kCapacity = 3;
+  SpscQueue<int> queue;
+  ASSERT_EQ(SpscQueue<int>::kSuccess, queue.Init(kCapacity));
+  int next_push = 0;
+  int next_pop = 0;
+  for (int round = 0; round < 20; ++round) {
+    const int batch = round % kCapacity + 1;
+    for (int i = 0; i < batch; ++i) {
+      int item = next_push++;
+      ASSERT_EQ(SpscQueue<int>::kSuccess, queue.TryPush(&item));
+    }
+    EXPECT_EQ(batch, queue.size());
+    for (int i = 0; i < batch; ++i) {
+      int item = -1;
+      ASSERT_EQ(SpscQueue<int>::kSuccess, queue.TryPop(&item));
+      EXPECT_EQ(next_pop++, item);
+    }
+    EXPECT_TRUE(queue.empty());
+  }
+}
+
+// Items are swapped in and out of the slots, so vectors change hands without
+// copying their storage.
+TEST(SpscQueueTest, SwapsStorage) {
+  typedef std::vector<int> Buffer;
+  SpscQueue<Buffer> queue;
+  ASSERT_EQ(SpscQueue<Buffer>::kSuccess, queue.Init(1));
+  Buffer buffer(16, 7);
+  const int* const ptr_storage = &buffer[0];
+  ASSERT_EQ(SpscQueue<Buffer>::kSuccess, queue.TryPush(&buffer));
+  EXPECT_TRUE(buffer.empty());
+  Buffer popped;
+  ASSERT_EQ(SpscQueue<Buffer>::kSuccess, queue.TryPop(&popped));
+  EXPECT_EQ(ptr_storage, &popped[0]);
+  EXPECT_EQ(16u, popped.size());
+}
+
+TEST(SpscQueueTest, Front) {
+  SpscQueue<int> queue;
+  ASSERT_EQ(SpscQueue<int>::kSuccess, queue.Init(2));
+  EXPECT_TRUE(queue.Front() == NULL);
+  int item = 5;
+  ASSERT_EQ(SpscQueue<int>::kSuccess, queue.TryPush(&item));
+  ASSERT_TRUE(queue.Front() != NULL);
+  EXPECT_EQ(5, *queue.Front());
+  EXPECT_EQ(1, queue.size());
+  ASSERT_EQ(SpscQueue<int>::kSuccess, queue.TryPop(&item));
+  EXPECT_TRUE(queue.Front() == NULL);
+}
+
+// Buffers that cannot be copied are cloned into empty slots, and swapped once
+// both sides hold storage, so that steady state hand-offs do not allocate.
+TEST(SpscQueueTest, BufferExchange) {
+  typedef SpscQueue<AudioBuffer, SpscBufferExchange<AudioBuffer> > Queue;
+  Queue queue;
+  ASSERT_EQ(Queue::kSuccess, queue.Init(1));
+  const uint8 data[4] = {1, 2, 3, 4};
+  AudioBuffer producer_buffer;
+  ASSERT_EQ(AudioBuffer::kSuccess,
+            producer_buffer.Init(AudioConfig(), 10, 1, data, sizeof(data)));
+  ASSERT_EQ(Queue::kSuccess, queue.TryPush(&producer_buffer));
+  EXPECT_TRUE(producer_buffer.buffer() != NULL);
+  EXPECT_EQ(10, queue.Front()->timestamp());
+
+  AudioBuffer consumer_buffer;
+  ASSERT_EQ(Queue::kSuccess, queue.TryPop(&consumer_buffer));
+  EXPECT_EQ(10, consumer_buffer.timestamp());
+  ASSERT_EQ(4, consumer_buffer.buffer_length());
+  EXPECT_EQ(4, consumer_buffer.buffer()[3]);
+
+  // The second slot is filled the same way. Once every slot and both sides
+  // own storage, round trips swap it.
+  ASSERT_EQ(Queue::kSuccess, queue.TryPush(&producer_buffer));
+  ASSERT_EQ(Queue::kSuccess, queue.TryPop(&consumer_buffer));
+  producer_buffer.set_timestamp(20);
+  const uint8* const ptr_storage = producer_buffer.buffer();
+  ASSERT_EQ(Queue::kSuccess, queue.TryPush(&producer_buffer));
+  ASSERT_EQ(Queue::kSuccess, queue.TryPop(&consumer_buffer));
+  EXPECT_EQ(20, consumer_buffer.timestamp());
+  EXPECT_EQ(ptr_storage, consumer_buffer.buffer());
+}
+
+TEST(SpscQueueTest, TwoThreads) {
+  const int kNumItems = 100000;
+  SpscQueue<int> queue;
+  ASSERT_EQ(SpscQueue<int>::kSuccess, queue.Init(4));
+  std::thread producer([&queue] {
+    for (int i = 0; i < kNumItems; ++i) {
+      int item = i;
+      while (queue.TryPush(&item) != SpscQueue<int>::kSuccess) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  int expected = 0;
+  while (expected < kNumItems) {
+    int item = -1;
+    if (queue.TryPop(&item) == SpscQueue<int>::kSuccess) {
+      ASSERT_EQ(expected, item);
+      ++expected;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(queue.empty());
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -0,0 +1,370 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/tee_sink.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+// Child sinks do not signal readiness, so the child thread rechecks
+// |DataSinkInterface::Ready()| at this interval, or when woken by |Push()|
+// or |Stop()|. After |Stop()| it gives a busy sink
+// |kStopWaitMilliseconds| to become ready before dropping the queue.
+static const int kSinkReadyWaitMilliseconds = 10;
+static const int kStopWaitMilliseconds = 5000;
+
+// Chunk shared by the queues of all children.
+struct TeeChunk {
+  ChunkInfo info;
+  std::vector<uint8> data;
+};
+typedef std::shared_ptr<const TeeChunk> TeeChunkPtr;
+
+// Queue and thread feeding one child sink of |TeeSink|.
+class TeeSinkChild {
+ public:
+  TeeSinkChild(const std::string& name,
+               DataSinkInterface* ptr_sink,
+               TeeSink::LagPolicy policy,
+               int queue_length);
+  ~TeeSinkChild();
+
+  // Starts the child thread.
+  int Run();
+
+  // Writes all queued chunks, and stops the child thread. Queued chunks are
+  // dropped when the sink is not ready within |kStopWaitMilliseconds|.
+  void Stop();
+
+  // Returns true when |Push()| would not wait.
+  bool Ready() const;
+
+  // Queues |chunk|, or drops it when the queue is full and |policy_| is
+  // |kDrop|. Waits for queue space when |policy_| is |kBackpressure|.
+  // Clusters are dropped whole: a chunk that continues a queued cluster is
+  // queued even when the queue is full. Returns false when the child has
+  // failed.
+  bool Push(const TeeChunkPtr& chunk);
+
+  int64 dropped_chunks() const;
+
+ private:
+  static const int kNumTracks = ChunkInfo::kVideoTrack + 1;
+
+  // Child thread function. Passes queued chunks to |ptr_sink_| until
+  // stopped and the queue is empty, or until the sink fails.
+  void ChildThread();
+
+  // Waits until |ptr_sink_| is ready. Returns false when stopped and the
+  // sink is still not ready after |kStopWaitMilliseconds|.
+  bool WaitForSinkReady();
+
+  const std::string name_;
+  DataSinkInterface* const ptr_sink_;
+  const TeeSink::LagPolicy policy_;
+  const size_t queue_length_;
+
+  // Per track state used by |Push()|: whether the last chunk pushed left its
+  // cluster open, and whether the rest of that cluster is skipped.
+  bool in_cluster_[kNumTracks];
+  bool skipping_[kNumTracks];
+
+  // All protected by |mutex_|. The chunk being written stays at the front
+  // of |queue_| until the sink returns.
+  std::deque<TeeChunkPtr> queue_;
+  int64 dropped_chunks_;
+  bool stop_;
+  bool failed_;
+  mutable std::mutex mutex_;
+
+  // Wakes the child thread when a chunk is queued or stop is requested.
+  std::condition_variable chunk_queued_;
+
+  // Wakes |Push()| when the child thread removes a chunk from |queue_|.
+  std::condition_variable chunk_written_;
+
+  std::shared_ptr<std::thread> thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TeeSinkChild);
+};
+
+TeeSinkChild::TeeSinkChild(const std::string& name,
+                           DataSinkInterface* ptr_sink,
+                           TeeSink::LagPolicy policy,
+                           int queue_length)
+    : name_(name),
+      ptr_sink_(ptr_sink),
+      policy_(policy),
+      queue_length_(queue_length),
+      dropped_chunks_(0),
+      stop_(false),
+      failed_(false) {
+  for (int i = 0; i < kNumTracks; ++i) {
+    in_cluster_[i] = false;
+    skipping_[i] = false;
+  }
+}
+
+TeeSinkChild::~TeeSinkChild() {
+  Stop();
+}
+
+int TeeSinkChild::Run() {
+  using std::bind;
+  using std::nothrow;
+  using std::shared_ptr;
+  using std::thread;
+  thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&TeeSinkChild::ChildThread,  // NOLINT
+                                this)));
+  if (!thread_) {
+    LOG(ERROR) << "cannot construct " << name_ << " tee thread.";
+    return TeeSink::kNoMemory;
+  }
+  return TeeSink::kSuccess;
+}
+
+void TeeSinkChild::Stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  chunk_queued_.notify_one();
+  thread_->join();
+  thread_.reset();
+}
+
+bool TeeSinkChild::Ready() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_ || policy_ == TeeSink::kDrop || queue_.size() < queue_length_;
+}
+
+bool TeeSinkChild::Push(const TeeChunkPtr& chunk) {
+  const ChunkInfo& info = chunk->info;
+  const bool media = info.type == ChunkInfo::kMedia;
+  bool starts_cluster = false;
+  if (media) {
+    starts_cluster = !in_cluster_[info.track];
+    in_cluster_[info.track] = !info.complete;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (failed_) {
+    return false;
+  }
+  if (media && skipping_[info.track]) {
+    // Skip the rest of the cluster a dropped chunk belonged to.
+    ++dropped_chunks_;
+    skipping_[info.track] = !info.complete;
+    return true;
+  }
+  if (media && queue_.size() >= queue_length_) {
+    if (policy_ == TeeSink::kDrop) {
+      if (starts_cluster) {
+        VLOG(1) << name_ << " lagging, dropped chunk " << info.number
+                << " of track " << info.track;
+        ++dropped_chunks_;
+        skipping_[info.track] = !info.complete;
+        return true;
+      }
+      // Finish the cluster already queued.
+      queue_.push_back(chunk);
+      lock.unlock();
+      chunk_queued_.notify_one();
+      return true;
+    }
+    chunk_written_.wait(lock, [this] {
+      return failed_ || queue_.size() < queue_length_;
+    });
+    if (failed_) {
+      return false;
+    }
+  }
+  queue_.push_back(chunk);
+  lock.unlock();
+  chunk_queued_.notify_one();
+  return true;
+}
+
+int64 TeeSinkChild::dropped_chunks() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_chunks_;
+}
+
+void TeeSinkChild::ChildThread() {
+  LOG(INFO) << name_ << " tee thread running...";
+  for (;;) {
+    TeeChunkPtr chunk;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      chunk_queued_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        break;
+      }
+      chunk = queue_.front();
+    }
+    if (!WaitForSinkReady()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      LOG(WARNING) << name_ << " sink not ready after stop, dropped "
+                   << queue_.size() << " chunk(s).";
+      dropped_chunks_ += queue_.size();
+      queue_.clear();
+      break;
+    }
+    const int32 length = static_cast<int32>(chunk->data.size());
+    const bool written =
+        ptr_sink_->WriteChunk(chunk->info, &chunk->data[0], length);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.pop_front();
+      if (!written) {
+        LOG(ERROR) << name_ << " sink write failed, stopping its tee thread.";
+        failed_ = true;
+        queue_.clear();
+      }
+    }
+    chunk_written_.notify_one();
+    if (!written) {
+      break;
+    }
+  }
+  LOG(INFO) << name_ << " tee thread done";
+}
+
+bool TeeSinkChild::WaitForSinkReady() {
+  typedef std::chrono::steady_clock Clock;
+  bool stopping = false;
+  Clock::time_point stop_deadline;
+  while (!ptr_sink_->Ready()) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stop_) {
+      const Clock::time_point now = Clock::now();
+      if (!stopping) {
+        stopping = true;
+        stop_deadline =
+            now + std::chrono::milliseconds(kStopWaitMilliseconds);
+      } else if (now >= stop_deadline) {
+        return false;
+      }
+    }
+    chunk_queued_.wait_for(
+        lock, std::chrono::milliseconds(kSinkReadyWaitMilliseconds));
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// TeeSink
+//
+
+TeeSink::TeeSink() {
+}
+
+TeeSink::~TeeSink() {
+  Stop();
+}
+
+int TeeSink::AddSink(const std::string& name,
+                     DataSinkInterface* ptr_sink,
+                     LagPolicy policy,
+                     int queue_length) {
+  if (!ptr_sink || queue_length < 1 ||
+      (policy != kBackpressure && policy != kDrop)) {
+    LOG(ERROR) << "invalid tee sink child " << name;
+    return kInvalidArg;
+  }
+  std::unique_ptr<TeeSinkChild> child(
+      new (std::nothrow) TeeSinkChild(name, ptr_sink, policy,  // NOLINT
+                                      queue_length));
+  if (!child) {
+    LOG(ERROR) << "cannot construct TeeSinkChild.";
+    return kNoMemory;
+  }
+  children_.push_back(std::move(child));
+  return kSuccess;
+}
+
+int TeeSink::Run() {
+  if (children_.empty()) {
+    LOG(ERROR) << "TeeSink cannot Run without sinks.";
+    return kRunFailed;
+  }
+  for (size_t i = 0; i < children_.size(); ++i) {
+    const int status = children_[i]->Run();
+    if (status) {
+      Stop();
+      return kRunFailed;
+    }
+  }
+  return kSuccess;
+}
+
+void TeeSink::Stop() {
+  for (size_t i = 0; i < children_.size(); ++i) {
+    children_[i]->Stop();
+  }
+}
+
+int64 TeeSink::dropped_chunks(int index) const {
+  if (index < 0 || index >= num_sinks()) {
+    return 0;
+  }
+  return children_[index]->dropped_chunks();
+}
+
+bool TeeSink::Ready() const {
+  for (size_t i = 0; i < children_.size(); ++i) {
+    if (!children_[i]->Ready()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TeeSink::WriteData(const uint8* ptr_data, int32 data_length) {
+  ChunkInfo info;
+  return WriteChunk(info, ptr_data, data_length);
+}
+
+bool TeeSink::WriteChunk(const ChunkInfo& info,
+                         const uint8* ptr_data,
+                         int32 data_length) {
+  if (!ptr_data || data_length <= 0 ||
+      info.track < 0 || info.track > ChunkInfo::kVideoTrack) {
+    LOG(ERROR) << "TeeSink cannot write invalid chunk.";
+    return false;
+  }
+  std::shared_ptr<TeeChunk> chunk(new (std::nothrow) TeeChunk());  // NOLINT
+  if (!chunk) {
+    LOG(ERROR) << "cannot construct TeeChunk.";
+    return false;
+  }
+  chunk->info = info;
+  chunk->data.assign(ptr_data, ptr_data + data_length);
+
+  bool written = false;
+  for (size_t i = 0; i < children_.size(); ++i) {
+    written = children_[i]->Push(chunk) || written;
+  }
+  if (!written) {
+    LOG(ERROR) << "every TeeSink child has failed.";
+  }
+  return written;
+}
+
+}  // namespace webmlive
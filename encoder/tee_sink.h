@@ -0,0 +1,100 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_TEE_SINK_H_
+#define WEBMLIVE_ENCODER_TEE_SINK_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+// Forward declaration of the class that feeds one child sink.
+class TeeSinkChild;
+
+// Data sink that passes every chunk to several child sinks, so that one
+// encode can feed several ingest servers, a recorder, and a segment
+// directory at once.
+//
+// Notes:
+// - Each child has its own bounded queue and thread, so a slow child does
+//   not delay the others. Each chunk is copied once; the children's queues
+//   share it.
+// - |kBackpressure| children hold the caller: |Ready()| returns false while
+//   one of their queues is full. |kDrop| children drop clusters that start
+//   while their queue is full. Clusters are dropped whole, so that every
+//   child receives whole clusters; a cluster already started is finished
+//   even when that takes the queue past its length.
+// - Manifest and metadata chunks are never dropped.
+// - A child whose sink fails is stopped, and no longer holds the caller.
+//   |WriteChunk()| fails only when every child has failed.
+class TeeSink : public DataSinkInterface {
+ public:
+  enum {
+    kRunFailed = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // What a child does when its queue is full.
+  enum LagPolicy {
+    // Hold the caller until the child's queue has room.
+    kBackpressure = 0,
+
+    // Drop chunks for the lagging child only.
+    kDrop = 1,
+  };
+
+  // Default number of chunks queued per child.
+  static const int kDefaultQueueLength = 8;
+
+  TeeSink();
+  virtual ~TeeSink();
+
+  // Adds |ptr_sink| as a child with a queue of |queue_length| chunks. |name|
+  // is used in log messages. Must be called before |Run()|. The sink must
+  // outlive the tee sink.
+  int AddSink(const std::string& name,
+              DataSinkInterface* ptr_sink,
+              LagPolicy policy,
+              int queue_length);
+
+  // Starts the child threads.
+  int Run();
+
+  // Writes all queued chunks, and stops the child threads. A child whose
+  // sink stays busy for five seconds after the call drops its queue.
+  void Stop();
+
+  // Returns the number of children.
+  int num_sinks() const { return static_cast<int>(children_.size()); }
+
+  // Returns the number of chunks dropped for child |index|, or 0 when
+  // |index| is invalid.
+  int64 dropped_chunks(int index) const;
+
+  // DataSinkInterface methods. |WriteData()| treats data as muxed media.
+  virtual bool Ready() const;
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length);
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length);
+
+ private:
+  std::vector<std::unique_ptr<TeeSinkChild>> children_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TeeSink);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_TEE_SINK_H_
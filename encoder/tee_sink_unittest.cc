@@ -0,0 +1,136 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/tee_sink.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+// Sink that records the chunk numbers written to it. While |blocked| is
+// true it is not ready, which holds its tee thread.
+class RecordingSink : public DataSinkInterface {
+ public:
+  RecordingSink() : blocked(false), fail(false) {}
+  virtual ~RecordingSink() {}
+
+  virtual bool Ready() const { return !blocked; }
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length) {
+    return WriteChunk(ChunkInfo(), ptr_data, data_length);
+  }
+  virtual bool WriteChunk(const ChunkInfo& info,
+                          const uint8* ptr_data,
+                          int32 data_length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    numbers.push_back(info.number);
+    return !fail;
+  }
+
+  std::vector<int64> Numbers() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return numbers;
+  }
+
+  std::atomic<bool> blocked;
+  std::atomic<bool> fail;
+  std::mutex mutex;
+  std::vector<int64> numbers;
+};
+
+bool WriteChunk(TeeSink* ptr_tee, int64 number, bool complete) {
+  ChunkInfo info;
+  info.number = number;
+  info.complete = complete;
+  const uint8 data[4] = {0};
+  return ptr_tee->WriteChunk(info, data, sizeof(data));
+}
+
+TEST(TeeSinkTest, RejectsInvalidSinks) {
+  TeeSink tee;
+  RecordingSink sink;
+  EXPECT_EQ(TeeSink::kRunFailed, tee.Run());
+  EXPECT_EQ(TeeSink::kInvalidArg,
+            tee.AddSink("null", NULL, TeeSink::kDrop, 1));
+  EXPECT_EQ(TeeSink::kInvalidArg,
+            tee.AddSink("empty", &sink, TeeSink::kDrop, 0));
+}
+
+// Every child receives every chunk, and |Stop()| writes the queued ones.
+TEST(TeeSinkTest, StopWritesQueuedChunks) {
+  TeeSink tee;
+  RecordingSink first;
+  RecordingSink second;
+  ASSERT_EQ(TeeSink::kSuccess,
+            tee.AddSink("first", &first, TeeSink::kBackpressure, 2));
+  ASSERT_EQ(TeeSink::kSuccess, tee.AddSink("second", &second, TeeSink::kDrop,
+                                           TeeSink::kDefaultQueueLength));
+  ASSERT_EQ(TeeSink::kSuccess, tee.Run());
+  for (int64 number = 1; number <= 10; ++number) {
+    while (!tee.Ready()) {
+      std::this_thread::yield();
+    }
+    ASSERT_TRUE(WriteChunk(&tee, number, true));
+  }
+  tee.Stop();
+  EXPECT_EQ(10u, first.Numbers().size());
+  EXPECT_EQ(10u, second.Numbers().size());
+  EXPECT_EQ(0, tee.dropped_chunks(0));
+}
+
+// A lagging |kDrop| child drops whole clusters and does not hold the caller,
+// and a cluster it already started is finished.
+TEST(TeeSinkTest, DropsWholeClusters) {
+  TeeSink tee;
+  RecordingSink sink;
+  sink.blocked = true;
+  ASSERT_EQ(TeeSink::kSuccess, tee.AddSink("lagging", &sink, TeeSink::kDrop,
+                                           1));
+  ASSERT_EQ(TeeSink::kSuccess, tee.Run());
+
+  // Cluster 1 is queued in two parts; the second part goes past the queue
+  // length. Cluster 2 is dropped with all of its parts.
+  ASSERT_TRUE(WriteChunk(&tee, 1, false));
+  ASSERT_TRUE(WriteChunk(&tee, 1, true));
+  EXPECT_TRUE(tee.Ready());
+  ASSERT_TRUE(WriteChunk(&tee, 2, false));
+  ASSERT_TRUE(WriteChunk(&tee, 2, true));
+  EXPECT_EQ(2, tee.dropped_chunks(0));
+
+  sink.blocked = false;
+  tee.Stop();
+  const std::vector<int64> numbers = sink.Numbers();
+  ASSERT_EQ(2u, numbers.size());
+  EXPECT_EQ(1, numbers[0]);
+  EXPECT_EQ(1, numbers[1]);
+}
+
+// A failed child is stopped, and the tee fails once every child has.
+TEST(TeeSinkTest, FailedChild) {
+  TeeSink tee;
+  RecordingSink sink;
+  sink.fail = true;
+  ASSERT_EQ(TeeSink::kSuccess,
+            tee.AddSink("failing", &sink, TeeSink::kBackpressure, 1));
+  ASSERT_EQ(TeeSink::kSuccess, tee.Run());
+  ASSERT_TRUE(WriteChunk(&tee, 1, true));
+  bool written = true;
+  for (int i = 0; i < 1000 && written; ++i) {
+    written = WriteChunk(&tee, 2, true);
+  }
+  EXPECT_FALSE(written);
+  EXPECT_TRUE(tee.Ready());
+  tee.Stop();
+}
+
+}  // namespace
+}  // namespace webmlive
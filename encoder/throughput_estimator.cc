@@ -0,0 +1,52 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/throughput_estimator.h"
+
+namespace webmlive {
+
+const double ThroughputEstimator::kAverageWeight = 0.25;
+const int ThroughputEstimator::kWindowMilliseconds;
+
+ThroughputEstimator::ThroughputEstimator() : average_(0) {
+}
+
+ThroughputEstimator::~ThroughputEstimator() {
+}
+
+void ThroughputEstimator::Reset() {
+  average_ = 0;
+  window_.clear();
+}
+
+void ThroughputEstimator::AddSample(Clock::time_point time,
+                                    double bytes,
+                                    double seconds) {
+  if (bytes <= 0 || seconds <= 0) {
+    return;
+  }
+  const double rate = bytes / seconds;
+  average_ = average_ == 0 ?
+      rate :
+      average_ + kAverageWeight * (rate - average_);
+  while (!window_.empty() && window_.back().rate <= rate) {
+    window_.pop_back();
+  }
+  const Sample sample = {time, rate};
+  window_.push_back(sample);
+}
+
+double ThroughputEstimator::WindowMax(Clock::time_point now) {
+  const Clock::time_point window_start =
+      now - std::chrono::milliseconds(kWindowMilliseconds);
+  while (!window_.empty() && window_.front().time < window_start) {
+    window_.pop_front();
+  }
+  return window_.empty() ? 0 : window_.front().rate;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,70 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_THROUGHPUT_ESTIMATOR_H_
+#define WEBMLIVE_ENCODER_THROUGHPUT_ESTIMATOR_H_
+
+#include <chrono>
+#include <deque>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+// Estimates upload throughput from samples of bytes sent over a time span:
+// an exponentially weighted moving average of the sample rates, and the
+// maximum rate of the samples taken in the last |kWindowMilliseconds|.
+//
+// Notes:
+// - Sample times and spans are wall clock times; |HttpUploader| takes them
+//   from |std::chrono::steady_clock| and libcurl's transfer timers.
+class ThroughputEstimator {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Weight of a new sample in the moving average.
+  static const double kAverageWeight;
+
+  // Span of the window maximum.
+  static const int kWindowMilliseconds = 10000;
+
+  ThroughputEstimator();
+  ~ThroughputEstimator();
+
+  // Drops all samples.
+  void Reset();
+
+  // Adds a sample of |bytes| sent in |seconds|, taken at |time|. Samples
+  // that sent nothing, or took no time, are ignored.
+  void AddSample(Clock::time_point time, double bytes, double seconds);
+
+  // Returns the moving average rate in bytes per second, or 0 before the
+  // first sample.
+  double average() const { return average_; }
+
+  // Returns the maximum rate of the samples taken in the window ending at
+  // |now|, or 0 when there are none. Samples older than the window are
+  // dropped.
+  double WindowMax(Clock::time_point now);
+
+ private:
+  struct Sample {
+    Clock::time_point time;
+    double rate;
+  };
+  double average_;
+
+  // Samples that can still become the maximum, in decreasing rate order: a
+  // sample hides every older, lower one.
+  std::deque<Sample> window_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(ThroughputEstimator);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_THROUGHPUT_ESTIMATOR_H_
@@ -0,0 +1,75 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/throughput_estimator.h"
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+typedef ThroughputEstimator::Clock Clock;
+
+// Returns |start| advanced by |milliseconds|.
+Clock::time_point After(Clock::time_point start, int milliseconds) {
+  return start + std::chrono::milliseconds(milliseconds);
+}
+
+class ThroughputEstimatorTest : public ::testing::Test {
+ protected:
+  ThroughputEstimatorTest() : start_(Clock::now()) {}
+
+  Clock::time_point start_;
+  ThroughputEstimator estimator_;
+};
+
+TEST_F(ThroughputEstimatorTest, NoSamples) {
+  EXPECT_EQ(0, estimator_.average());
+  EXPECT_EQ(0, estimator_.WindowMax(start_));
+
+  // Samples that sent nothing, or took no time, carry no rate.
+  estimator_.AddSample(start_, 0, 1);
+  estimator_.AddSample(start_, 1000, 0);
+  EXPECT_EQ(0, estimator_.average());
+  EXPECT_EQ(0, estimator_.WindowMax(start_));
+}
+
+// The rate is bytes over the sample span, whatever the time between samples.
+TEST_F(ThroughputEstimatorTest, SampleRate) {
+  estimator_.AddSample(start_, 5000, 0.5);
+  EXPECT_DOUBLE_EQ(10000, estimator_.average());
+  EXPECT_DOUBLE_EQ(10000, estimator_.WindowMax(After(start_, 5000)));
+}
+
+TEST_F(ThroughputEstimatorTest, MovingAverage) {
+  estimator_.AddSample(start_, 1000, 1);
+  estimator_.AddSample(After(start_, 1000), 5000, 1);
+  const double expected =
+      1000 + ThroughputEstimator::kAverageWeight * (5000 - 1000);
+  EXPECT_DOUBLE_EQ(expected, estimator_.average());
+
+  estimator_.Reset();
+  EXPECT_EQ(0, estimator_.average());
+  EXPECT_EQ(0, estimator_.WindowMax(start_));
+}
+
+// The maximum covers the samples of the last |kWindowMilliseconds|, so a
+// peak ages out while lower, newer samples take its place.
+TEST_F(ThroughputEstimatorTest, WindowMax) {
+  const int kWindow = ThroughputEstimator::kWindowMilliseconds;
+  estimator_.AddSample(start_, 3000, 1);
+  estimator_.AddSample(After(start_, 1000), 1000, 1);
+  estimator_.AddSample(After(start_, 2000), 2000, 1);
+  EXPECT_DOUBLE_EQ(3000, estimator_.WindowMax(After(start_, kWindow)));
+  EXPECT_DOUBLE_EQ(2000, estimator_.WindowMax(After(start_, kWindow + 1)));
+  EXPECT_DOUBLE_EQ(2000,
+                   estimator_.WindowMax(After(start_, kWindow + 2000)));
+  EXPECT_EQ(0, estimator_.WindowMax(After(start_, kWindow + 2001)));
+}
+
+}  // namespace
+}  // namespace webmlive
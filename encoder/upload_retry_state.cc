@@ -0,0 +1,98 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/upload_retry_state.h"
+
+#include <algorithm>
+
+namespace webmlive {
+
+UploadRetryState::UploadRetryState()
+    : max_attempts_(HttpUploaderSettings::kDefaultMaxUploadAttempts),
+      retry_delay_milliseconds_(
+          HttpUploaderSettings::kDefaultRetryDelayMilliseconds),
+      max_retry_delay_milliseconds_(
+          HttpUploaderSettings::kDefaultMaxRetryDelayMilliseconds),
+      resume_allowed_(false),
+      chunk_length_(0),
+      attempts_(0),
+      resume_offset_(0),
+      resume_query_pending_(false) {
+}
+
+UploadRetryState::~UploadRetryState() {
+}
+
+void UploadRetryState::Init(const HttpUploaderSettings& settings,
+                            unsigned int seed) {
+  max_attempts_ = settings.max_upload_attempts;
+  retry_delay_milliseconds_ = settings.retry_delay_milliseconds;
+  max_retry_delay_milliseconds_ = settings.max_retry_delay_milliseconds;
+  resume_allowed_ = settings.resume_uploads &&
+      settings.post_mode == webmlive::HTTP_POST;
+  random_.seed(seed);
+}
+
+void UploadRetryState::StartChunk(int32 chunk_length) {
+  chunk_length_ = chunk_length;
+  attempts_ = 0;
+  resume_offset_ = 0;
+  resume_query_pending_ = false;
+}
+
+// Transport errors, timeouts, rate limiting, and server errors are transient.
+UploadRetryState::Result UploadRetryState::RequestDone(int response_code,
+                                                       double bytes_sent,
+                                                       int* ptr_retry_delay) {
+  if (response_code > 0 && response_code < 400) {
+    return kChunkSent;
+  }
+  bool transient = response_code == 0 || response_code == 408 ||
+      response_code == 429 || response_code >= 500;
+
+  // The server lacks the start of the chunk; resend it whole.
+  if (response_code == 416 && resume_offset_ > 0) {
+    transient = true;
+    resume_offset_ = 0;
+  }
+
+  // Ask the server where to resume once enough of the chunk was sent to be
+  // worth the extra round trip.
+  resume_query_pending_ = resume_allowed_ &&
+      resume_offset_ + bytes_sent >= kBytesRequiredForResume;
+
+  if (!transient || attempts_ >= max_attempts_) {
+    return kChunkLost;
+  }
+  *ptr_retry_delay = RetryDelay();
+  return kRetryChunk;
+}
+
+void UploadRetryState::ResumeQueryDone(int response_code,
+                                       int64 received_offset) {
+  resume_query_pending_ = false;
+  resume_offset_ = 0;
+  if (response_code >= 200 && response_code < 300 &&
+      received_offset >= kBytesRequiredForResume &&
+      received_offset < chunk_length_) {
+    resume_offset_ = static_cast<int32>(received_offset);
+  }
+}
+
+int UploadRetryState::RetryDelay() {
+  int64 delay = retry_delay_milliseconds_;
+  for (int i = 1; i < attempts_ && delay < max_retry_delay_milliseconds_;
+       ++i) {
+    delay *= 2;
+  }
+  delay = std::min<int64>(delay, max_retry_delay_milliseconds_);
+  std::uniform_int_distribution<int> jitter(static_cast<int>(delay / 2),
+                                            static_cast<int>(delay));
+  return jitter(random_);
+}
+
+}  // namespace webmlive
@@ -0,0 +1,103 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_UPLOAD_RETRY_STATE_H_
+#define WEBMLIVE_ENCODER_UPLOAD_RETRY_STATE_H_
+
+#include <random>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+#include "encoder/http_uploader.h"
+
+namespace webmlive {
+
+// Retry, backoff, and resume decisions for the chunk |HttpUploader| is
+// sending. The uploader reports how each request ended, and the state says
+// whether to retry, how long to wait first, and whether to ask the server
+// how much of the chunk it holds before the next request.
+//
+// Notes:
+// - |Init()| must be called before any other method.
+// - A failed request that sent at least |kBytesRequiredForResume| bytes sets
+//   |resume_query_pending()| when |HttpUploaderSettings::resume_uploads| is
+//   true and the post mode is |HTTP_POST|. Bytes sent are never used as the
+//   resume offset, because libcurl cannot tell what the server received.
+// - A 416 response to a resumed request sends the chunk whole again.
+class UploadRetryState {
+ public:
+  // Result of |RequestDone()|.
+  enum Result {
+    // The server accepted the chunk.
+    kChunkSent = 0,
+
+    // Send another request for the chunk after the returned delay.
+    kRetryChunk = 1,
+
+    // The server rejected the chunk, or its retry budget is used up.
+    kChunkLost = 2,
+  };
+
+  // Bytes a failed request must send before a resume is worth the extra
+  // round trip of the resume query.
+  static const int kBytesRequiredForResume = 32 * 1024;
+
+  UploadRetryState();
+  ~UploadRetryState();
+
+  // Stores the retry settings from |settings|, and seeds the backoff jitter
+  // with |seed|.
+  void Init(const HttpUploaderSettings& settings, unsigned int seed);
+
+  // Resets the state for a new chunk of |chunk_length| bytes.
+  void StartChunk(int32 chunk_length);
+
+  // Counts a data request for the current chunk.
+  void StartAttempt() { ++attempts_; }
+
+  // Records the end of a data request. |response_code| is the HTTP status,
+  // or 0 when the request failed before a response. |bytes_sent| is what
+  // libcurl sent. Returns |kRetryChunk| and sets |ptr_retry_delay| to the
+  // backoff delay in milliseconds when the chunk should be sent again.
+  Result RequestDone(int response_code, double bytes_sent,
+                     int* ptr_retry_delay);
+
+  // Records the end of the resume query. |response_code| is its HTTP status,
+  // or 0 when it failed. |received_offset| is the X-WebM-Chunk-Received value
+  // of the response, or -1. The next request resumes at |received_offset|
+  // when the server confirmed at least |kBytesRequiredForResume| bytes and
+  // less than the whole chunk, and otherwise sends the chunk whole.
+  void ResumeQueryDone(int response_code, int64 received_offset);
+
+  // Accessors.
+  int attempts() const { return attempts_; }
+  int32 resume_offset() const { return resume_offset_; }
+  bool resume_query_pending() const { return resume_query_pending_; }
+
+ private:
+  // Returns the backoff delay before the next attempt: the first retry delay
+  // doubled for each earlier retry, capped, and randomly shortened by up to
+  // half.
+  int RetryDelay();
+
+  int max_attempts_;
+  int retry_delay_milliseconds_;
+  int max_retry_delay_milliseconds_;
+  bool resume_allowed_;
+  int32 chunk_length_;
+  int attempts_;
+  int32 resume_offset_;
+  bool resume_query_pending_;
+
+  // Source of the retry delay jitter.
+  std::minstd_rand random_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(UploadRetryState);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_UPLOAD_RETRY_STATE_H_
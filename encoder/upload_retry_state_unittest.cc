@@ -0,0 +1,203 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/upload_retry_state.h"
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const int32 kChunkLength = 100 * 1024;
+const int kResumeBytes = UploadRetryState::kBytesRequiredForResume;
+
+HttpUploaderSettings RetrySettings(bool resume_uploads) {
+  HttpUploaderSettings settings;
+  settings.max_upload_attempts = 4;
+  settings.retry_delay_milliseconds = 100;
+  settings.max_retry_delay_milliseconds = 300;
+  settings.resume_uploads = resume_uploads;
+  return settings;
+}
+
+TEST(UploadRetryStateTest, FirstAttemptSent) {
+  UploadRetryState state;
+  state.Init(RetrySettings(false), 1);
+  state.StartChunk(kChunkLength);
+  state.StartAttempt();
+  int delay = -1;
+  EXPECT_EQ(UploadRetryState::kChunkSent, state.RequestDone(200, 0, &delay));
+  EXPECT_EQ(-1, delay);
+  EXPECT_EQ(1, state.attempts());
+}
+
+// Transport failures, 408, 429 and 5xx responses are retried; other client
+// errors lose the chunk at once.
+TEST(UploadRetryStateTest, TransientErrors) {
+  const int kTransient[] = {0, 408, 429, 500, 503};
+  for (int i = 0; i < 5; ++i) {
+    UploadRetryState state;
+    state.Init(RetrySettings(false), 1);
+    state.StartChunk(kChunkLength);
+    state.StartAttempt();
+    int delay = -1;
+    EXPECT_EQ(UploadRetryState::kRetryChunk,
+              state.RequestDone(kTransient[i], 0, &delay))
+        << kTransient[i];
+  }
+  const int kRejected[] = {400, 403, 404, 416};
+  for (int i = 0; i < 4; ++i) {
+    UploadRetryState state;
+    state.Init(RetrySettings(false), 1);
+    state.StartChunk(kChunkLength);
+    state.StartAttempt();
+    int delay = -1;
+    EXPECT_EQ(UploadRetryState::kChunkLost,
+              state.RequestDone(kRejected[i], 0, &delay))
+        << kRejected[i];
+  }
+}
+
+// Delays double from |retry_delay_milliseconds| up to the cap, and jitter
+// only shortens them, by at most half.
+TEST(UploadRetryStateTest, Backoff) {
+  const int kExpectedMax[] = {100, 200, 300};
+  for (unsigned int seed = 1; seed <= 20; ++seed) {
+    UploadRetryState state;
+    state.Init(RetrySettings(false), seed);
+    state.StartChunk(kChunkLength);
+    for (int attempt = 0; attempt < 3; ++attempt) {
+      state.StartAttempt();
+      int delay = -1;
+      ASSERT_EQ(UploadRetryState::kRetryChunk,
+                state.RequestDone(503, 0, &delay));
+      EXPECT_LE(kExpectedMax[attempt] / 2, delay);
+      EXPECT_GE(kExpectedMax[attempt], delay);
+    }
+    state.StartAttempt();
+    int delay = -1;
+    EXPECT_EQ(UploadRetryState::kChunkLost, state.RequestDone(503, 0, &delay));
+    EXPECT_EQ(4, state.attempts());
+  }
+}
+
+TEST(UploadRetryStateTest, StartChunkResets) {
+  UploadRetryState state;
+  state.Init(RetrySettings(true), 1);
+  state.StartChunk(kChunkLength);
+  state.StartAttempt();
+  int delay = 0;
+  ASSERT_EQ(UploadRetryState::kRetryChunk,
+            state.RequestDone(0, kResumeBytes, &delay));
+  ASSERT_TRUE(state.resume_query_pending());
+  state.StartChunk(kChunkLength);
+  EXPECT_EQ(0, state.attempts());
+  EXPECT_EQ(0, state.resume_offset());
+  EXPECT_FALSE(state.resume_query_pending());
+}
+
+// A failed request that sent enough of the chunk leads to a resume query, and
+// the next request starts at the offset the server confirms.
+TEST(UploadRetryStateTest, ResumeAtConfirmedOffset) {
+  UploadRetryState state;
+  state.Init(RetrySettings(true), 1);
+  state.StartChunk(kChunkLength);
+  state.StartAttempt();
+  int delay = 0;
+  ASSERT_EQ(UploadRetryState::kRetryChunk,
+            state.RequestDone(0, kResumeBytes + 1000, &delay));
+  ASSERT_TRUE(state.resume_query_pending());
+
+  // The server holds less than libcurl sent; its offset wins.
+  state.ResumeQueryDone(200, kResumeBytes + 10);
+  EXPECT_FALSE(state.resume_query_pending());
+  EXPECT_EQ(kResumeBytes + 10, state.resume_offset());
+
+  state.StartAttempt();
+  EXPECT_EQ(UploadRetryState::kChunkSent, state.RequestDone(200, 0, &delay));
+  EXPECT_EQ(2, state.attempts());
+}
+
+TEST(UploadRetryStateTest, NoResumeQuery) {
+  // Too little sent.
+  UploadRetryState state;
+  state.Init(RetrySettings(true), 1);
+  state.StartChunk(kChunkLength);
+  state.StartAttempt();
+  int delay = 0;
+  ASSERT_EQ(UploadRetryState::kRetryChunk,
+            state.RequestDone(0, kResumeBytes - 1, &delay));
+  EXPECT_FALSE(state.resume_query_pending());
+
+  // Resume disabled.
+  state.Init(RetrySettings(false), 1);
+  state.StartChunk(kChunkLength);
+  state.StartAttempt();
+  ASSERT_EQ(UploadRetryState::kRetryChunk,
+            state.RequestDone(0, kResumeBytes, &delay));
+  EXPECT_FALSE(state.resume_query_pending());
+
+  // Form posts cannot be resumed.
+  HttpUploaderSettings settings = RetrySettings(true);
+  settings.post_mode = HTTP_FORM_POST;
+  state.Init(settings, 1);
+  state.StartChunk(kChunkLength);
+  state.StartAttempt();
+  ASSERT_EQ(UploadRetryState::kRetryChunk,
+            state.RequestDone(0, kResumeBytes, &delay));
+  EXPECT_FALSE(state.resume_query_pending());
+}
+
+// Offsets the server did not confirm, or that leave nothing to send, resend
+// the chunk whole.
+TEST(UploadRetryStateTest, UnconfirmedOffsetSendsWholeChunk) {
+  struct {
+    int response_code;
+    int64 received_offset;
+  } const kResponses[] = {
+    {0, kResumeBytes},              // Query failed.
+    {404, kResumeBytes},            // Server does not support the query.
+    {200, -1},                      // No X-WebM-Chunk-Received header.
+    {200, kResumeBytes - 1},        // Too little to be worth resuming.
+    {200, kChunkLength},            // Server already has the whole chunk.
+  };
+  for (int i = 0; i < 5; ++i) {
+    UploadRetryState state;
+    state.Init(RetrySettings(true), 1);
+    state.StartChunk(kChunkLength);
+    state.StartAttempt();
+    int delay = 0;
+    ASSERT_EQ(UploadRetryState::kRetryChunk,
+              state.RequestDone(0, kChunkLength, &delay));
+    ASSERT_TRUE(state.resume_query_pending());
+    state.ResumeQueryDone(kResponses[i].response_code,
+                          kResponses[i].received_offset);
+    EXPECT_FALSE(state.resume_query_pending()) << i;
+    EXPECT_EQ(0, state.resume_offset()) << i;
+  }
+}
+
+// A 416 response to a resumed request is retried with the whole chunk.
+TEST(UploadRetryStateTest, RangeNotSatisfiable) {
+  UploadRetryState state;
+  state.Init(RetrySettings(true), 1);
+  state.StartChunk(kChunkLength);
+  state.StartAttempt();
+  int delay = 0;
+  ASSERT_EQ(UploadRetryState::kRetryChunk,
+            state.RequestDone(0, kResumeBytes, &delay));
+  state.ResumeQueryDone(200, kResumeBytes);
+  ASSERT_EQ(kResumeBytes, state.resume_offset());
+
+  state.StartAttempt();
+  EXPECT_EQ(UploadRetryState::kRetryChunk, state.RequestDone(416, 0, &delay));
+  EXPECT_EQ(0, state.resume_offset());
+  EXPECT_FALSE(state.resume_query_pending());
+}
+
+}  // namespace
+}  // namespace webmlive
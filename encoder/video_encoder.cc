@@ -290,6 +290,12 @@ int VideoEncoder::EncodeFrame(const VideoFrame& raw_frame,
   return ptr_vpx_encoder_->EncodeFrame(raw_frame, ptr_vpx_frame);
 }
 
+void VideoEncoder::RequestKeyframe() {
+  if (ptr_vpx_encoder_) {
+    ptr_vpx_encoder_->RequestKeyframe();
+  }
+}
+
 int64 VideoEncoder::frames_in() const {
   return ptr_vpx_encoder_ ? ptr_vpx_encoder_->frames_in() : 0;
 }
@@ -292,6 +292,9 @@ class VideoEncoder {
   int32 Init(const WebmEncoderConfig& config);
   int32 EncodeFrame(const VideoFrame& raw_frame, VideoFrame* ptr_vpx_frame);
 
+  // Forces a keyframe on the next frame encoded. Safe to call from any thread.
+  void RequestKeyframe();
+
   // Accessors.
   int64 frames_in() const;
   int64 frames_out() const;
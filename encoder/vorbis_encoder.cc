@@ -45,41 +45,6 @@ int StorePacketPayload(const ogg_packet& packet,
   return VorbisEncoder::kSuccess;
 }
 
-// Stores payload data from |packet| in |ptr_storage|. Returns |kSuccess| after
-// successful allocation of storage and copy of ogg_packet data.
-int StorePacketPayload(const ogg_packet& packet,
-                       std::vector<uint8>* ptr_storage) {
-  using namespace webmlive;
-  if (!ptr_storage) {
-    LOG(ERROR) << "cannot StoreDataPacket with NULL storage.";
-    return VorbisEncoder::kInvalidArg;
-  }
-  if (!ValidOggPacket(packet)) {
-    LOG(ERROR) << "cannot StoreDataPacket with invalid packet.";
-    return VorbisEncoder::kInvalidArg;
-  }
-  std::copy(packet.packet, packet.packet + packet.bytes,
-            std::back_inserter(*ptr_storage));
-  return VorbisEncoder::kSuccess;
-}
-
-// Stores |packet| in |ptr_storage|. Returns |kSuccess| after successful
-// allocation of storage and copy of ogg_packet data.
-int StorePacket(const ogg_packet& packet, std::vector<uint8>* ptr_storage) {
-  using namespace webmlive;
-  if (!ptr_storage) {
-    LOG(ERROR) << "cannot StoreDataPacket with NULL storage.";
-    return VorbisEncoder::kInvalidArg;
-  }
-  if (!ValidOggPacket(packet)) {
-    LOG(ERROR) << "cannot StoreDataPacket with invalid packet.";
-    return VorbisEncoder::kInvalidArg;
-  }
-  const uint8* p = reinterpret_cast<const uint8*>(&packet);
-  std::copy(p, p + sizeof(ogg_packet), std::back_inserter(*ptr_storage));
-  return VorbisEncoder::kSuccess;
-}
-
 }  // namespace
 
 namespace webmlive {
@@ -93,6 +58,9 @@ VorbisEncoder::VorbisEncoder()
       last_timestamp_(0),
       time_encoded_(0),
       first_input_timestamp_(-1),
+      last_granulepos_(0),
+      ring_read_index_(0),
+      ring_count_(0),
       block_initialized_(false),
       dsp_initialized_(false),
       info_initialized_(false) {
@@ -195,6 +163,18 @@ int VorbisEncoder::Init(const AudioConfig& audio_config,
   audio_config_ = audio_config;
   audio_config_.format_tag = kAudioFormatVorbis;
   vorbis_config_ = vorbis_config;
+
+  // Preallocate packet storage to avoid allocations while encoding.
+  const std::vector<uint8> empty_payload(kInitialPacketCapacity, 0);
+  for (int i = 0; i < kPacketRingSize; ++i) {
+    status = packet_ring_[i].buffer.Init(audio_config_, 0, 0,
+                                         &empty_payload[0],
+                                         kInitialPacketCapacity);
+    if (status) {
+      LOG(ERROR) << "packet ring AudioBuffer Init failed: " << status;
+      return kNoMemory;
+    }
+  }
   return kSuccess;
 }
 
@@ -245,88 +225,114 @@ int VorbisEncoder::Encode(const AudioBuffer& input_buffer) {
   return kSuccess;
 }
 
+// Packets are handed out one at a time from |packet_ring_|. Another block is
+// analyzed only when the ring is empty, which keeps ring usage bounded by the
+// number of packets libvorbis flushes for a single block.
 int VorbisEncoder::ReadCompressedAudio(AudioBuffer* ptr_buffer) {
   if (!ptr_buffer) {
     LOG(ERROR) << "ReadCompressedAudio requires a non-NULL ptr_buffer.";
     return kInvalidArg;
   }
-  ogg_packet packet = {0};
-  if (SamplesAvailable()) {
-    // There's a compressed block available-- give libvorbis a chance to
-    // optimize distribution of data for the current encode settings.
-    int status = vorbis_analysis(&block_, &packet);
+  while (ring_count_ == 0 && SamplesAvailable()) {
+    const int status = FlushPacketsToRing();
     if (status) {
-      LOG(ERROR) << "vorbis_analysis failed: " << status;
-      return kCodecError;
+      LOG(ERROR) << "FlushPacketsToRing failed: " << status;
+      return status;
     }
-    status = vorbis_bitrate_addblock(&block_);
+  }
+  if (ring_count_ == 0) {
+    return kNoSamples;
+  }
+
+  PacketSlot& slot = packet_ring_[ring_read_index_];
+  if (ptr_buffer->buffer()) {
+    // Exchange storage with the user's buffer; the slot receives the user's
+    // old storage and is reused for a later packet.
+    ptr_buffer->Swap(&slot.buffer);
+  } else {
+    const int status = slot.buffer.Clone(ptr_buffer);
     if (status) {
-      LOG(ERROR) << "vorbis_bitrate_addblock failed: " << status;
+      LOG(ERROR) << "AudioBuffer Clone failed: " << status;
       return kCodecError;
     }
-    while ((status = vorbis_bitrate_flushpacket(&dsp_state_, &packet)) == 1) {
-      if (StorePacket(packet, &ogg_packets_)) {
-        LOG(ERROR) << "StorePacket failed: " << status;
-        return kCodecError;
-      }
-      if (StorePacketPayload(packet, &vorbis_samples_)) {
-        LOG(ERROR) << "StorePacketPayload failed: " << status;
-        return kCodecError;
-      }
+  }
+  ring_read_index_ = (ring_read_index_ + 1) % kPacketRingSize;
+  --ring_count_;
+
+  VLOG(4) << "ReadCompressedAudio\n"
+      << "   samples_encoded_=" << samples_encoded_ << "\n"
+      << "   timestamp="      << ptr_buffer->timestamp() << "\n"
+      << "   duration= "      << ptr_buffer->duration() << "\n";
+  last_timestamp_ = ptr_buffer->timestamp();
+  samples_encoded_ = slot.granulepos;
+  time_encoded_ = SamplesToMilliseconds(samples_encoded_);
+  return kSuccess;
+}
+
+int VorbisEncoder::FlushPacketsToRing() {
+  // There's a compressed block available-- give libvorbis a chance to
+  // optimize distribution of data for the current encode settings.
+  ogg_packet packet = {0};
+  int status = vorbis_analysis(&block_, NULL);
+  if (status) {
+    LOG(ERROR) << "vorbis_analysis failed: " << status;
+    return kCodecError;
+  }
+  status = vorbis_bitrate_addblock(&block_);
+  if (status) {
+    LOG(ERROR) << "vorbis_bitrate_addblock failed: " << status;
+    return kCodecError;
+  }
+  while ((status = vorbis_bitrate_flushpacket(&dsp_state_, &packet)) == 1) {
+    status = PushPacket(packet);
+    if (status) {
+      LOG(ERROR) << "PushPacket failed: " << status;
+      return status;
     }
   }
-  if (ogg_packets_.size() < sizeof(packet) || vorbis_samples_.size() == 0) {
-    return kNoSamples;
+  if (status < 0) {
+    LOG(ERROR) << "vorbis_bitrate_flushpacket failed: " << status;
+    return kCodecError;
   }
-  if (vorbis_samples_.size() < static_cast<size_t>(packet.bytes)) {
-    LOG(ERROR) << "Error reading packets from libvorbis.";
+  return kSuccess;
+}
+
+// Each packet starts at the granule position of the previous packet, and
+// ends at its own granule position.
+int VorbisEncoder::PushPacket(const ogg_packet& packet) {
+  if (!ValidOggPacket(packet)) {
+    LOG(ERROR) << "cannot PushPacket with invalid packet.";
+    return kInvalidArg;
+  }
+  if (ring_count_ == kPacketRingSize) {
+    LOG(ERROR) << "cannot PushPacket, packet ring full.";
     return kEncoderError;
   }
 
-  // Use first packet with non-zero |granualpos| for delay.
-  if (audio_delay_ == 0) {
-    const int num_packets = ogg_packets_.size() / sizeof(packet);
-    for (int i = 0; i < num_packets; ++i ) {
-      const ogg_packet* const p =
-          reinterpret_cast<ogg_packet*>(&ogg_packets_[i * sizeof(packet)]);
-      if (packet.granulepos > 0) {
-        audio_delay_ = SamplesToMilliseconds(p->granulepos);
-        LOG(INFO) << "VorbisEncoder audio_delay_=" << audio_delay_;
-        break;
-      }
-    }
+  // Use first packet with non-zero |granulepos| for delay.
+  if (audio_delay_ == 0 && packet.granulepos > 0) {
+    audio_delay_ = SamplesToMilliseconds(packet.granulepos);
+    LOG(INFO) << "VorbisEncoder audio_delay_=" << audio_delay_;
   }
 
-  // Use |granualpos| from the first packet returned by
-  // |vorbis_bitrate_flushpacket()| to calculate |timestamp|.
-  const ogg_packet* const p = reinterpret_cast<ogg_packet*>(&ogg_packets_[0]);
-  const int64 timestamp =
-      SamplesToMilliseconds(p->granulepos) + first_input_timestamp_;
-
-  // |packet.granulepos| is the last complete sample in the packet, use it to
-  // calculate |duration|.
+  const int64 start_time = SamplesToMilliseconds(last_granulepos_);
+  const int64 timestamp = first_input_timestamp_ + start_time;
   const int64 duration =
-      SamplesToMilliseconds(packet.granulepos - samples_encoded_);
-  const int status = ptr_buffer->Init(audio_config_,
+      SamplesToMilliseconds(packet.granulepos) - start_time;
+  const int write_index = (ring_read_index_ + ring_count_) % kPacketRingSize;
+  PacketSlot& slot = packet_ring_[write_index];
+  const int status = slot.buffer.Init(audio_config_,
                                       timestamp,
                                       duration,
-                                      &vorbis_samples_[0],
-                                      vorbis_samples_.size());
+                                      packet.packet,
+                                      static_cast<int32>(packet.bytes));
   if (status) {
     LOG(ERROR) << "AudioBuffer Init failed: " << status;
-    return kCodecError;
+    return status == AudioBuffer::kNoMemory ? kNoMemory : kEncoderError;
   }
-  LOG(INFO) << "ReadCompressedAudio\n"
-      << "   samples_encoded_=" << samples_encoded_ << "\n"
-      << "   timestamp(sec)=" << (timestamp / 1000.0) << "\n"
-      << "   timestamp="      << timestamp << "\n"
-      << "   duration(sec)= " << (duration / 1000.0) << "\n"
-      << "   duration= "      << duration << "\n";
-  last_timestamp_ = timestamp;
-  samples_encoded_ = packet.granulepos;
-  time_encoded_ = SamplesToMilliseconds(samples_encoded_);
-  ogg_packets_.clear();
-  vorbis_samples_.clear();
+  slot.granulepos = packet.granulepos;
+  last_granulepos_ = packet.granulepos;
+  ++ring_count_;
   return kSuccess;
 }
 
@@ -40,6 +40,10 @@ class VorbisEncoder {
     kNoSamples = 1,
   };
 
+  // Number of sample frames passed to |Encode()| per call when the caller is
+  // able to choose; matches the libvorbis long block hop size.
+  static const int32 kPreferredBlockSize = 1024;
+
   VorbisEncoder();
   ~VorbisEncoder();
 
@@ -52,9 +56,11 @@ class VorbisEncoder {
   // |kSuccess| after successful handoff of samples to the encoder.
   int Encode(const AudioBuffer& uncompressed_buffer);
 
-  // Returns vorbis audio samples via |ptr_buffer| when libvorbis is able to
+  // Returns a single vorbis packet via |ptr_buffer| when libvorbis is able to
   // provide compressed data. Returns |kNoSamples| when libvorbis has no data
-  // ready. Returns |kSuccess| when samples are written to |ptr_buffer|.
+  // ready. Returns |kSuccess| when a packet is written to |ptr_buffer|.
+  // Note: storage is exchanged with |ptr_buffer| when it is non-empty; callers
+  //       must not hold pointers to the data of |ptr_buffer| across calls.
   int ReadCompressedAudio(AudioBuffer* ptr_buffer);
 
   // Accessors.
@@ -78,6 +84,24 @@ class VorbisEncoder {
   int64 time_encoded() const;
 
  private:
+  // Number of slots in |packet_ring_|. A single libvorbis block rarely yields
+  // more than one or two packets, and |ReadCompressedAudio()| drains the ring
+  // before analyzing another block.
+  static const int kPacketRingSize = 16;
+
+  // Initial payload capacity of each |packet_ring_| slot. Slots grow when
+  // libvorbis produces a larger packet.
+  static const int32 kInitialPacketCapacity = 4096;
+
+  // Compressed packet storage. |buffer| holds the packet payload, timestamp
+  // and duration; |granulepos| is the libvorbis granule position of the last
+  // sample in the packet.
+  struct PacketSlot {
+    PacketSlot() : granulepos(0) {}
+    AudioBuffer buffer;
+    int64 granulepos;
+  };
+
   // Reads the vorbis headers used to generate the WebM Vorbis track Codec
   // Private element. Stores header data in |ident_header_|,
   // |comments_header_|, and |setup_header_|. Returns |kSuccess| after
@@ -87,6 +111,15 @@ class VorbisEncoder {
   // Returns true when libvorbis has compressed samples available.
   bool SamplesAvailable();
 
+  // Analyzes the block made available by |SamplesAvailable()|, and moves all
+  // packets flushed by libvorbis into |packet_ring_|. Returns |kSuccess| when
+  // successful.
+  int FlushPacketsToRing();
+
+  // Copies |packet| into the next free slot of |packet_ring_|. Returns
+  // |kEncoderError| when the ring is full.
+  int PushPacket(const ogg_packet& packet);
+
   // Converts |num_samples| to milliseconds.
   int64 SamplesToMilliseconds(int64 num_samples) const;
 
@@ -114,8 +147,13 @@ class VorbisEncoder {
   std::unique_ptr<uint8[]> comments_header_;
   std::unique_ptr<uint8[]> setup_header_;
 
-  std::vector<uint8> ogg_packets_;
-  std::vector<uint8> vorbis_samples_;
+  // Granule position of the last packet stored in |packet_ring_|.
+  int64 last_granulepos_;
+
+  // Ring of compressed packets awaiting |ReadCompressedAudio()|.
+  PacketSlot packet_ring_[kPacketRingSize];
+  int ring_read_index_;
+  int ring_count_;
   bool block_initialized_;
   bool dsp_initialized_;
   bool info_initialized_;
@@ -23,6 +23,7 @@ VpxEncoder::VpxEncoder()
     : frames_in_(0),
       frames_out_(0),
       last_keyframe_time_(0),
+      keyframe_requested_(false),
       last_timestamp_(0) {
   memset(&vpx_context_, 0, sizeof(vpx_context_));
 }
@@ -189,10 +190,12 @@ int VpxEncoder::EncodeFrame(const VideoFrame& raw_frame,
     }
   }
 
-  // Determine if it's time to force a keyframe.
+  // Determine if it's time to force a keyframe, or if one was requested.
   const int64 time_since_keyframe =
       raw_frame.timestamp() - last_keyframe_time_;
-  const bool force_keyframe = time_since_keyframe > config_.keyframe_interval;
+  const bool keyframe_requested = keyframe_requested_.exchange(false);
+  const bool force_keyframe =
+      keyframe_requested || time_since_keyframe > config_.keyframe_interval;
 
   // Use the |vpx_img_wrap| to wrap the buffer within |ptr_raw_frame| in
   // |vpx_image| for passing the buffer to libvpx.
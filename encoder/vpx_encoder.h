@@ -9,6 +9,8 @@
 #ifndef WEBMLIVE_ENCODER_VPX_ENCODER_H_
 #define WEBMLIVE_ENCODER_VPX_ENCODER_H_
 
+#include <atomic>
+
 #include "encoder/basictypes.h"
 #include "encoder/encoder_base.h"
 #include "encoder/video_encoder.h"
@@ -54,6 +56,9 @@ class VpxEncoder {
   // |kEncoderError| - compressed data cannot be stored in |ptr_vpx_frame|.
   int EncodeFrame(const VideoFrame& raw_frame, VideoFrame* ptr_vpx_frame);
 
+  // Forces a keyframe on the next frame encoded. Safe to call from any thread.
+  void RequestKeyframe() { keyframe_requested_ = true; }
+
   // Accessors.
   int64 frames_in() const { return frames_in_; }
   int64 frames_out() const { return frames_out_; }
@@ -77,6 +82,9 @@ class VpxEncoder {
   // Time of last keyframe reported by libvpx in |EncodeFrame|.
   int64 last_keyframe_time_;
 
+  // Set by |RequestKeyframe()|, and cleared when the next frame is encoded.
+  std::atomic<bool> keyframe_requested_;
+
   // Webmlive libvpx settings structure.
   VpxConfig config_;
 
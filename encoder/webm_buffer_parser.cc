@@ -7,109 +7,51 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/webm_buffer_parser.h"
 
-#include <cassert>
+#include <limits>
 
 #include "glog/logging.h"
-#include "libwebm/mkvparser.hpp"
 
-namespace webmlive {
-// Provides a moving window into a buffer, and implements libwebm's IMkvReader
-// interface.  |WebmBufferParser| sets the window into a buffer by calling
-// |SetBufferWindow|, and libwebm parses the data using the |Read| and |Length|
-// methods.
-class WebmBufferReader : public mkvparser::IMkvReader {
- public:
-  enum {
-    kInvalidArg   = WebmBufferParser::kInvalidArg,
-    kSuccess      = WebmBufferParser::kSuccess,
-    kNeedMoreData = WebmBufferParser::kNeedMoreData,
-  };
-  WebmBufferReader();
-  virtual ~WebmBufferReader();
-  // Updates the buffer window and returns |kSuccess|.
-  int SetBufferWindow(const uint8* ptr_buffer, int32 length,
-                      int64 bytes_consumed);
-  // IMkvReader methods.
-  virtual int Read(int64 read_pos, long length_requested,  // NOLINT
-                   uint8* ptr_buf);
-  virtual int Length(int64* ptr_total, int64* ptr_available);
- private:
-  // Buffer window pointer.
-  const uint8* ptr_buffer_;
-  // Length of the buffer window to which |ptr_buffer_| provides access.
-  int32 length_;
-  // Sum of all parsed element lengths.
-  int64 bytes_consumed_;
-  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmBufferReader);
-};
+namespace {
 
-WebmBufferReader::WebmBufferReader()
-    : ptr_buffer_(NULL),
-      length_(0),
-      bytes_consumed_(0) {
-}
+// Element IDs.
+const uint32 kEbmlId = 0x1A45DFA3;
+const uint32 kSegmentId = 0x18538067;
+const uint32 kSeekHeadId = 0x114D9B74;
+const uint32 kInfoId = 0x1549A966;
+const uint32 kTracksId = 0x1654AE6B;
+const uint32 kClusterId = 0x1F43B675;
+const uint32 kCuesId = 0x1C53BB6B;
+const uint32 kAttachmentsId = 0x1941A469;
+const uint32 kChaptersId = 0x1043A770;
+const uint32 kTagsId = 0x1254C367;
 
-WebmBufferReader::~WebmBufferReader() {
-}
+const int kMaxIdLength = 4;
+const int kMaxSizeLength = 8;
 
-// Updates the buffer window.
-int WebmBufferReader::SetBufferWindow(const uint8* ptr_buffer, int32 length,
-                                      int64 bytes_consumed) {
-  if (!ptr_buffer || !length) {
-    LOG(ERROR) << "invalid arg(s)";
-    return kInvalidArg;
+// Returns true when |id| ends a cluster of unknown size: the ID of a top level
+// element, or of the EBML header of a new segment.
+bool EndsCluster(uint32 id) {
+  switch (id) {
+    case kEbmlId:
+    case kSeekHeadId:
+    case kInfoId:
+    case kTracksId:
+    case kClusterId:
+    case kCuesId:
+    case kAttachmentsId:
+    case kChaptersId:
+    case kTagsId:
+      return true;
   }
-  ptr_buffer_ = ptr_buffer;
-  length_ = length;
-  bytes_consumed_ = bytes_consumed;
-  return kSuccess;
+  return false;
 }
 
-// Called by libwebm to read data from |ptr_buffer_|.
-int WebmBufferReader::Read(int64 read_pos, long length_requested,  // NOLINT
-                           uint8* ptr_buf) {
-  if (!ptr_buf) {
-    LOG(ERROR) << "NULL ptr_buf";
-    return 0;
-  }
-  // |read_pos| includes |bytes_consumed_|, which is not going to work with the
-  // buffer window-- calculate actual offset within |ptr_buf|.
-  const int64 window_pos = read_pos - bytes_consumed_;
-  assert(window_pos >= 0);
-  // Is enough data in the buffer?
-  const int64 bytes_available = length_ - window_pos;
-  if (bytes_available < length_requested) {
-    // No, not enough data buffered.
-    return mkvparser::E_BUFFER_NOT_FULL;
-  }
-  VLOG(4) << "read_pos=" << read_pos << " window_pos=" << window_pos
-          << " length_=" << length_ << " length_requested=" << length_requested
-          << " available=" << bytes_available;
-  // Yes, there's enough data in the buffer.
-  memcpy(ptr_buf, ptr_buffer_ + window_pos, length_requested);
-  return kSuccess;
-}
-
-// Called by libwebm to obtain length of readable data.  Returns
-// |bytes_consumed_| + |length_| as available amount, which is the size of the
-// buffer current window plus the sum of the sizes of all parsed elements.
-int WebmBufferReader::Length(int64* ptr_total, int64* ptr_available) {
-  if (!ptr_total || !ptr_available) {
-    LOG(ERROR) << "invalid arg(s)";
-    return -1;
-  }
-  *ptr_total = -1;  // Total file size is unknown.
-  *ptr_available = bytes_consumed_ + length_;
-  return 0;
-}
+}  // namespace
 
-///////////////////////////////////////////////////////////////////////////////
-// WebmBufferParser
-//
+namespace webmlive {
 
 WebmBufferParser::WebmBufferParser()
-    : ptr_cluster_(NULL),
-      cluster_parse_offset_(0),
+    : cluster_scan_offset_(0),
       total_bytes_parsed_(0),
       parse_func_(&WebmBufferParser::ParseSegmentHeaders) {
 }
@@ -117,13 +59,10 @@ WebmBufferParser::WebmBufferParser()
 WebmBufferParser::~WebmBufferParser() {
 }
 
-// Constructs |reader_|.
 int WebmBufferParser::Init() {
-  reader_.reset(new (std::nothrow) WebmBufferReader());  // NOLINT
-  if (!reader_) {
-    LOG(ERROR) << "out of memory";
-    return kOutOfMemory;
-  }
+  cluster_scan_offset_ = 0;
+  total_bytes_parsed_ = 0;
+  parse_func_ = &WebmBufferParser::ParseSegmentHeaders;
   return kSuccess;
 }
 
@@ -138,125 +77,183 @@ int WebmBufferParser::Parse(const Buffer& buf, int32* ptr_element_size) {
   if (buf.empty()) {
     return kNeedMoreData;
   }
-  // Update |reader_|'s buffer window...
-  if (reader_->SetBufferWindow(&buf[0], buf.size(), total_bytes_parsed_)) {
-    LOG(ERROR) << "could not update buffer window";
-    return kParseError;
-  }
   // Just return the result of the parsing attempt.
-  return (this->*parse_func_)(ptr_element_size);
+  return (this->*parse_func_)(&buf[0], static_cast<int64>(buf.size()),
+                              ptr_element_size);
 }
 
-// Tries to parse the segment headers, segment info and segment tracks.
-// Returns |kNeedMoreData| if unable to parse them.  Returns |kSuccess| and
-// sets |ptr_element_size| when successful.
-int WebmBufferParser::ParseSegmentHeaders(int32* ptr_element_size) {
-  mkvparser::EBMLHeader ebml_header;
-  int64 pos = 0;
-  int64 parse_status = ebml_header.Parse(reader_.get(), pos);
-  if (parse_status) {
-    LOG(INFO) << "EBML header parse failed, parse_status=" << parse_status;
+// IDs keep their length marker bits; sizes lose them. A size with all value
+// bits set is unknown.
+int WebmBufferParser::ReadElementHeader(const uint8* ptr_data, int64 length,
+                                        ElementHeader* ptr_header) {
+  if (length < 1) {
     return kNeedMoreData;
   }
-  // |pos| is equal to the length of the EBML header; start a running total now
-  // since |ebml_header| doesn't store a length.
-  int64 headers_length = pos;
-  // Create and start parse of the segment...
-  mkvparser::Segment* ptr_segment = NULL;
-  parse_status = mkvparser::Segment::CreateInstance(reader_.get(), pos,
-                                                    ptr_segment);
-  if (parse_status) {
-    LOG(INFO) << "segment creation failed, parse_status=" << parse_status;
+  int id_length = 1;
+  for (uint8 mask = 0x80; !(ptr_data[0] & mask); mask >>= 1) {
+    if (++id_length > kMaxIdLength) {
+      return kParseError;
+    }
+  }
+  if (length < id_length + 1) {
     return kNeedMoreData;
   }
-  segment_.reset(ptr_segment);
-  // Add the segment header length to the running total. The position argument
-  // to the |CreateInstance| call above is not passed by reference (as is the
-  // case with |ebml_header|), so |pos| is still correct.
-  headers_length += segment_->m_start - pos;
-  // |ParseHeaders| reads data until it runs out or finds a cluster. If it
-  // finds a cluster, it returns 0 ONLY if segment info and segment tracks
-  // elements were found as well.
-  parse_status = segment_->ParseHeaders();
-  if (parse_status) {
-    LOG(INFO) << "segment header parse failed, parse_status=" << parse_status;
+  uint32 id = 0;
+  for (int i = 0; i < id_length; ++i) {
+    id = (id << 8) | ptr_data[i];
+  }
+
+  const uint8* const ptr_size = ptr_data + id_length;
+  int size_length = 1;
+  uint8 size_mask = 0x80;
+  for (; !(ptr_size[0] & size_mask); size_mask >>= 1) {
+    if (++size_length > kMaxSizeLength) {
+      return kParseError;
+    }
+  }
+  if (length < id_length + size_length) {
     return kNeedMoreData;
   }
-  // Get the segment info to obtain its length.
-  const mkvparser::SegmentInfo* ptr_segment_info = segment_->GetInfo();
-  if (!ptr_segment_info) {
-    LOG(ERROR) << "missing MKV segment info";
+  uint64 size = ptr_size[0] & (size_mask - 1);
+  bool all_ones = (size == static_cast<uint64>(size_mask - 1));
+  for (int i = 1; i < size_length; ++i) {
+    size = (size << 8) | ptr_size[i];
+    all_ones = all_ones && ptr_size[i] == 0xFF;
+  }
+  if (size > static_cast<uint64>(std::numeric_limits<int64>::max())) {
     return kParseError;
   }
-  if (headers_length != ptr_segment_info->m_element_start) {
-    LOG(ERROR) << "ERROR: unexpected segment info offset (expected="
-               << headers_length << " actual="
-               << ptr_segment_info->m_element_start << ")";
+  ptr_header->id = id;
+  ptr_header->size = all_ones ? kUnknownSize : static_cast<int64>(size);
+  ptr_header->header_length = id_length + size_length;
+  return kSuccess;
+}
+
+// Tries to parse the segment headers: the EBML header, the segment element
+// header, and the top level elements up to the first cluster. Returns
+// |kNeedMoreData| until the start of the first cluster is buffered.  Returns
+// |kSuccess| and sets |ptr_element_size| when successful.
+int WebmBufferParser::ParseSegmentHeaders(const uint8* ptr_data, int64 length,
+                                          int32* ptr_element_size) {
+  ElementHeader header;
+  int status = ReadElementHeader(ptr_data, length, &header);
+  if (status) {
+    return status;
+  }
+  if (header.id != kEbmlId || header.size == kUnknownSize) {
+    LOG(ERROR) << "missing EBML header, id=" << std::hex << header.id;
     return kParseError;
   }
-  VLOG(4) << "segment info size=" << ptr_segment_info->m_element_size;
-  headers_length += ptr_segment_info->m_element_size;
-  // Get the segment tracks to obtain its length.
-  const mkvparser::Tracks* ptr_tracks = segment_->GetTracks();
-  if (!ptr_tracks) {
-    LOG(ERROR) << "missing MKV segment tracks";
+  int64 headers_length = header.header_length + header.size;
+  if (headers_length >= length) {
+    return kNeedMoreData;
+  }
+  status = ReadElementHeader(ptr_data + headers_length,
+                             length - headers_length, &header);
+  if (status) {
+    return status;
+  }
+  if (header.id != kSegmentId) {
+    LOG(ERROR) << "missing segment, id=" << std::hex << header.id;
     return kParseError;
   }
-  VLOG(4) << "segment tracks size=" << ptr_tracks->m_element_size;
-  headers_length += ptr_tracks->m_element_size;
+  headers_length += header.header_length;
+
+  // Walk the top level elements until the first cluster starts.
+  for (;;) {
+    if (headers_length >= length) {
+      return kNeedMoreData;
+    }
+    status = ReadElementHeader(ptr_data + headers_length,
+                               length - headers_length, &header);
+    if (status) {
+      return status;
+    }
+    if (header.id == kClusterId) {
+      break;
+    }
+    if (header.size == kUnknownSize) {
+      LOG(ERROR) << "segment header element with unknown size, id="
+                 << std::hex << header.id;
+      return kParseError;
+    }
+    VLOG(4) << "segment header element id=" << std::hex << header.id
+            << std::dec << " size=" << header.size;
+    headers_length += header.header_length + header.size;
+  }
   VLOG(4) << "element_size=" << headers_length;
-  total_bytes_parsed_ = headers_length;
-  *ptr_element_size = static_cast<int32>(headers_length);
-  parse_func_ = &WebmBufferParser::ParseCluster;
-  return kSuccess;
+  status = ElementParsed(headers_length, ptr_element_size);
+  if (status == kSuccess) {
+    parse_func_ = &WebmBufferParser::ParseCluster;
+  }
+  return status;
 }
 
-// Tries to parse a cluster.  Loads and parses the cluster header, and then
-// attempts to walk through the cluster block entries.  Returns |kNeedMoreData|
-// when unable to walk through all blocks in the cluster.  Returns |kSuccess|
-// and sets |ptr_element_size| when successful.
-int WebmBufferParser::ParseCluster(int32* ptr_element_size) {
-  // A NULL |ptr_cluster_| means either:
-  // - No clusters have been parsed, or...
-  // - The last cluster was parsed.
-  // In either case it's time to load a new one...
-  int status;
-  long length = 0;  // NOLINT
-  if (!ptr_cluster_) {
-    // Load/parse a cluster header...
-    int64 current_pos = total_bytes_parsed_;
-    status = segment_->LoadCluster(current_pos, length);
-    if (status) {
+// Tries to parse a cluster. Clusters of known size are complete once all of
+// their data is buffered. Clusters of unknown size, written by live muxers,
+// end where the next top level element starts: their children are walked by
+// ID and size, and |cluster_scan_offset_| remembers where the walk stopped so
+// that no child is read twice.
+int WebmBufferParser::ParseCluster(const uint8* ptr_data, int64 length,
+                                   int32* ptr_element_size) {
+  ElementHeader header;
+  int status = ReadElementHeader(ptr_data, length, &header);
+  if (status) {
+    return status;
+  }
+  if (header.size != kUnknownSize) {
+    const int64 element_size = header.header_length + header.size;
+    if (element_size > length) {
       return kNeedMoreData;
     }
-    const mkvparser::Cluster* ptr_cluster = segment_->GetLast();
-    if (!ptr_cluster || ptr_cluster->EOS()) {
-      return kNeedMoreData;
+    if (header.id != kClusterId) {
+      VLOG(1) << "top level element id=" << std::hex << header.id
+              << std::dec << " size=" << element_size;
     }
-    cluster_parse_offset_ = current_pos;
-    ptr_cluster_ = ptr_cluster;
+    return ElementParsed(element_size, ptr_element_size);
+  }
+  if (header.id != kClusterId) {
+    LOG(ERROR) << "element with unknown size, id=" << std::hex << header.id;
+    return kParseError;
+  }
+
+  if (cluster_scan_offset_ == 0) {
+    cluster_scan_offset_ = header.header_length;
   }
-  const int kClusterComplete = 1;
   for (;;) {
-    status = ptr_cluster_->Parse(cluster_parse_offset_, length);
-    if (status == kClusterComplete) {
+    if (cluster_scan_offset_ >= length) {
+      return kNeedMoreData;
+    }
+    ElementHeader child;
+    status = ReadElementHeader(ptr_data + cluster_scan_offset_,
+                               length - cluster_scan_offset_, &child);
+    if (status) {
+      return status;
+    }
+    if (EndsCluster(child.id)) {
       break;
     }
-    if (status < 0) {
-      return kNeedMoreData;
+    if (child.size == kUnknownSize) {
+      LOG(ERROR) << "cluster child with unknown size, id="
+                 << std::hex << child.id;
+      return kParseError;
     }
+    cluster_scan_offset_ += child.header_length + child.size;
   }
-  const int64 cluster_size = ptr_cluster_->GetElementSize();
-  if (cluster_size == -1) {
-    // Should never happen... the parser should never report a complete cluster
-    // without setting its length.
+  const int64 cluster_size = cluster_scan_offset_;
+  cluster_scan_offset_ = 0;
+  return ElementParsed(cluster_size, ptr_element_size);
+}
+
+int WebmBufferParser::ElementParsed(int64 element_size,
+                                    int32* ptr_element_size) {
+  if (element_size > std::numeric_limits<int32>::max()) {
+    LOG(ERROR) << "element too large: " << element_size;
     return kParseError;
   }
-  ptr_cluster_ = NULL;
-  cluster_parse_offset_ = 0;
-  total_bytes_parsed_ += cluster_size;
-  *ptr_element_size = static_cast<int32>(cluster_size);
-  VLOG(4) << "cluster_size=" << cluster_size << " total_bytes_parsed_="
+  total_bytes_parsed_ += element_size;
+  *ptr_element_size = static_cast<int32>(element_size);
+  VLOG(4) << "element_size=" << element_size << " total_bytes_parsed_="
           << total_bytes_parsed_;
   return kSuccess;
 }
@@ -8,23 +8,17 @@
 #ifndef WEBMLIVE_ENCODER_WEBM_BUFFER_PARSER_H_
 #define WEBMLIVE_ENCODER_WEBM_BUFFER_PARSER_H_
 
-#include <memory>
-#include <string>
 #include <vector>
 
 #include "encoder/basictypes.h"
 #include "encoder/encoder_base.h"
 
-namespace mkvparser {
-
-class Cluster;
-class Segment;
-
-}  // namespace mkvparser
-
 namespace webmlive {
 
-class WebmBufferReader;
+// Scans WebM data for chunk boundaries: the segment headers, and then each
+// cluster. Reads element IDs and sizes directly from the buffer passed to
+// |Parse()|, and walks the children of clusters with unknown size until the
+// next top level element starts.
 class WebmBufferParser {
  public:
   typedef std::vector<uint8> Buffer;
@@ -40,40 +34,61 @@ class WebmBufferParser {
     // element.  Add more data to your buffer.
     kNeedMoreData = 1,
   };
+
+  // Element size value of elements with unknown size.
+  static const int64 kUnknownSize = -1;
+
+  // ID and size of an EBML element, and the length of the ID and size.
+  struct ElementHeader {
+    ElementHeader() : id(0), size(0), header_length(0) {}
+    uint32 id;
+    int64 size;
+    int32 header_length;
+  };
+
   WebmBufferParser();
   ~WebmBufferParser();
-  // Constructs |reader_|.
+  // Resets the parser to expect the segment headers.
   int Init();
   // Tries to parse some data in |buf| using |ParseSegmentHeaders| or
-  // |ParseCluster|, depending on the |mode_| value.
+  // |ParseCluster|, depending on |parse_func_|. |buf| must start where
+  // the last element parsed ended: callers erase each element once |Parse()|
+  // reports it.
   // Returns |kNeedMoreData| when more data is needed. Returns |kSuccess| and
   // sets |ptr_element_size| when all data has been parsed.
   int Parse(const Buffer& buf, int32* ptr_element_size);
 
+  // Reads the element ID and size at |ptr_data| into |ptr_header|. Returns
+  // |kNeedMoreData| when |length| bytes do not hold them, and |kParseError|
+  // when the ID or size is invalid.
+  static int ReadElementHeader(const uint8* ptr_data, int64 length,
+                               ElementHeader* ptr_header);
+
  private:
   // Parse function pointer type.
-  typedef int (WebmBufferParser::*ParseFunc)(int32* ptr_element_size);
-  // Tries to parse the segment headers: segment info and segment tracks.
+  typedef int (WebmBufferParser::*ParseFunc)(const uint8* ptr_data,
+                                             int64 length,
+                                             int32* ptr_element_size);
+  // Tries to parse the EBML header, the segment header, and the top level
+  // elements preceding the first cluster (segment info and segment tracks).
   // Returns |kNeedMoreData| if more data is needed.  Returns |kSuccess| and
   // sets |ptr_element_size| when successful.
-  int ParseSegmentHeaders(int32* ptr_element_size);
+  int ParseSegmentHeaders(const uint8* ptr_data, int64 length,
+                          int32* ptr_element_size);
   // Tries to parse a cluster.  Returns |kNeedMoreData| when more data is
   // needed. Returns |kSuccess| and sets |ptr_element_size| when all cluster
-  // data has been parsed.
-  int ParseCluster(int32* ptr_element_size);
-  // Pointer to current cluster when |ParseCluster| only partially parses
-  // cluster data.  NULL otherwise. Note that |ptr_cluster_| is memory owned by
-  // libwebm's mkvparser.
-  const mkvparser::Cluster* ptr_cluster_;
-  // Pointer to libwebm segment; needed for cluster parsing operations.
-  std::unique_ptr<mkvparser::Segment> segment_;
-  // Buffer object that implements the IMkvReader interface required by
-  // libwebm's mkvparser using a window into the |buf| argument passed to
-  // |Parse|.
-  std::unique_ptr<WebmBufferReader> reader_;
-  // Bytes read in partially parsed cluster.
-  int64 cluster_parse_offset_;
-  // Sum of parsed element lengths.  Used to update |parser_| window.
+  // data has been parsed. Top level elements other than clusters are
+  // reported as they are found.
+  int ParseCluster(const uint8* ptr_data, int64 length,
+                   int32* ptr_element_size);
+  // Records an element of |element_size| bytes as parsed, and stores its
+  // size in |ptr_element_size|. Returns |kParseError| when |element_size|
+  // does not fit in an int32.
+  int ElementParsed(int64 element_size, int32* ptr_element_size);
+  // Offset of the next cluster child to read when |ParseCluster| only
+  // partially scanned a cluster with unknown size. 0 otherwise.
+  int64 cluster_scan_offset_;
+  // Sum of parsed element lengths.
   int64 total_bytes_parsed_;
   // Parsing function-- either |ParseSegmentHeaders| or |ParseCluster|.
   ParseFunc parse_func_;
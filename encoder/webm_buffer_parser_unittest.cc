@@ -0,0 +1,157 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/webm_buffer_parser.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+typedef WebmBufferParser::Buffer Buffer;
+
+// Appends the bytes of |id|, without leading zero bytes.
+void AppendId(uint32 id, Buffer* ptr_buffer) {
+  bool started = false;
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    const uint8 byte = static_cast<uint8>(id >> shift);
+    if (byte || started) {
+      ptr_buffer->push_back(byte);
+      started = true;
+    }
+  }
+}
+
+// Appends an element of known size holding |payload_length| zero bytes. The
+// size is coded in one byte, so |payload_length| must be below 127.
+void AppendElement(uint32 id, int payload_length, Buffer* ptr_buffer) {
+  AppendId(id, ptr_buffer);
+  ptr_buffer->push_back(static_cast<uint8>(0x80 | payload_length));
+  ptr_buffer->insert(ptr_buffer->end(), payload_length, 0);
+}
+
+// Appends the header of an element of unknown size, as live muxers write
+// segments and clusters.
+void AppendUnknownSizeHeader(uint32 id, Buffer* ptr_buffer) {
+  AppendId(id, ptr_buffer);
+  ptr_buffer->push_back(0x01);
+  ptr_buffer->insert(ptr_buffer->end(), 7, 0xFF);
+}
+
+const uint32 kEbmlId = 0x1A45DFA3;
+const uint32 kSegmentId = 0x18538067;
+const uint32 kInfoId = 0x1549A966;
+const uint32 kTracksId = 0x1654AE6B;
+const uint32 kClusterId = 0x1F43B675;
+const uint32 kTimecodeId = 0xE7;
+const uint32 kSimpleBlockId = 0xA3;
+
+// Returns the segment headers of a live stream.
+Buffer SegmentHeaders() {
+  Buffer buffer;
+  AppendElement(kEbmlId, 20, &buffer);
+  AppendUnknownSizeHeader(kSegmentId, &buffer);
+  AppendElement(kInfoId, 10, &buffer);
+  AppendElement(kTracksId, 30, &buffer);
+  return buffer;
+}
+
+// Returns a cluster of unknown size holding a timecode and |num_blocks|
+// blocks of |block_length| bytes.
+Buffer UnknownSizeCluster(int num_blocks, int block_length) {
+  Buffer buffer;
+  AppendUnknownSizeHeader(kClusterId, &buffer);
+  AppendElement(kTimecodeId, 1, &buffer);
+  for (int i = 0; i < num_blocks; ++i) {
+    AppendElement(kSimpleBlockId, block_length, &buffer);
+  }
+  return buffer;
+}
+
+TEST(WebmBufferParserTest, ReadsUnknownSize) {
+  Buffer buffer;
+  AppendUnknownSizeHeader(kClusterId, &buffer);
+  WebmBufferParser::ElementHeader header;
+  ASSERT_EQ(WebmBufferParser::kSuccess,
+            WebmBufferParser::ReadElementHeader(&buffer[0], buffer.size(),
+                                                &header));
+  EXPECT_EQ(kClusterId, header.id);
+  EXPECT_EQ(WebmBufferParser::kUnknownSize, header.size);
+  EXPECT_EQ(12, header.header_length);
+  EXPECT_EQ(WebmBufferParser::kNeedMoreData,
+            WebmBufferParser::ReadElementHeader(&buffer[0], 6, &header));
+}
+
+TEST(WebmBufferParserTest, SegmentHeadersEndAtFirstCluster) {
+  WebmBufferParser parser;
+  ASSERT_EQ(WebmBufferParser::kSuccess, parser.Init());
+  const Buffer headers = SegmentHeaders();
+  Buffer buffer = headers;
+  int32 element_size = 0;
+  EXPECT_EQ(WebmBufferParser::kNeedMoreData,
+            parser.Parse(buffer, &element_size));
+  const Buffer cluster = UnknownSizeCluster(1, 10);
+  buffer.insert(buffer.end(), cluster.begin(), cluster.end());
+  ASSERT_EQ(WebmBufferParser::kSuccess, parser.Parse(buffer, &element_size));
+  EXPECT_EQ(static_cast<int32>(headers.size()), element_size);
+}
+
+// A cluster of unknown size ends where the next cluster starts. Data arrives
+// a few bytes at a time, splitting block headers and payloads, and the
+// parser must report each cluster once with its exact size.
+TEST(WebmBufferParserTest, SplitsUnknownSizeClusters) {
+  WebmBufferParser parser;
+  ASSERT_EQ(WebmBufferParser::kSuccess, parser.Init());
+  Buffer stream = SegmentHeaders();
+  const int headers_size = static_cast<int>(stream.size());
+  const Buffer first = UnknownSizeCluster(3, 50);
+  const Buffer second = UnknownSizeCluster(2, 20);
+  stream.insert(stream.end(), first.begin(), first.end());
+  stream.insert(stream.end(), second.begin(), second.end());
+  stream.insert(stream.end(), first.begin(), first.end());
+
+  std::vector<int32> element_sizes;
+  Buffer buffer;
+  const size_t kStep = 7;
+  for (size_t offset = 0; offset < stream.size(); offset += kStep) {
+    const size_t end = std::min(stream.size(), offset + kStep);
+    buffer.insert(buffer.end(), stream.begin() + offset, stream.begin() + end);
+    for (;;) {
+      int32 element_size = 0;
+      const int status = parser.Parse(buffer, &element_size);
+      if (status == WebmBufferParser::kNeedMoreData) {
+        break;
+      }
+      ASSERT_EQ(WebmBufferParser::kSuccess, status);
+      element_sizes.push_back(element_size);
+      buffer.erase(buffer.begin(), buffer.begin() + element_size);
+    }
+  }
+
+  // The last cluster stays buffered until something follows it.
+  ASSERT_EQ(3u, element_sizes.size());
+  EXPECT_EQ(headers_size, element_sizes[0]);
+  EXPECT_EQ(static_cast<int32>(first.size()), element_sizes[1]);
+  EXPECT_EQ(static_cast<int32>(second.size()), element_sizes[2]);
+  EXPECT_EQ(first.size(), buffer.size());
+}
+
+TEST(WebmBufferParserTest, RejectsMissingEbmlHeader) {
+  WebmBufferParser parser;
+  ASSERT_EQ(WebmBufferParser::kSuccess, parser.Init());
+  Buffer buffer;
+  AppendElement(kInfoId, 10, &buffer);
+  int32 element_size = 0;
+  EXPECT_EQ(WebmBufferParser::kParseError,
+            parser.Parse(buffer, &element_size));
+}
+
+}  // namespace
+}  // namespace webmlive
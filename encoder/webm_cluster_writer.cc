@@ -0,0 +1,198 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/webm_cluster_writer.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+#include "libwebm/webmids.hpp"
+
+namespace {
+
+// Largest block timecode relative to its cluster.
+const int64 kMaxRelativeTimecode = 32767;
+
+// Largest track number coded in one byte.
+const uint64 kMaxTrackNumber = 126;
+
+// Cluster ID, 4 bytes, and unknown size, 8 bytes, Timecode ID and size, 2
+// bytes, and at most 8 bytes of timecode.
+const int kMaxClusterHeaderLength = 22;
+
+// SimpleBlock ID, 1 byte, size, at most 8 bytes, track number, 1 byte,
+// relative timecode, 2 bytes, and flags, 1 byte.
+const int kMaxBlockHeaderLength = 13;
+
+// Writes the EBML ID |id| to |ptr_data|, and returns its length.
+int WriteId(uint64 id, uint8* ptr_data) {
+  int length = 1;
+  while (length < 4 && (id >> (8 * length)) != 0) {
+    ++length;
+  }
+  for (int i = 0; i < length; ++i) {
+    ptr_data[i] = static_cast<uint8>(id >> (8 * (length - 1 - i)));
+  }
+  return length;
+}
+
+// Writes |value| to |ptr_data| as an EBML coded unsigned integer of the
+// shortest length, and returns its length. All ones values are reserved, so
+// a value of 2^(7*length)-1 needs one more byte.
+int WriteCodedUInt(uint64 value, uint8* ptr_data) {
+  int length = 1;
+  while (length < 8 && value >= (1ULL << (7 * length)) - 1) {
+    ++length;
+  }
+  const uint64 coded = value | (1ULL << (7 * length));
+  for (int i = 0; i < length; ++i) {
+    ptr_data[i] = static_cast<uint8>(coded >> (8 * (length - 1 - i)));
+  }
+  return length;
+}
+
+// Writes the unsigned integer element |id| with |value| to |ptr_data|, and
+// returns its length.
+int WriteUIntElement(uint64 id, uint64 value, uint8* ptr_data) {
+  int value_length = 1;
+  while (value_length < 8 && (value >> (8 * value_length)) != 0) {
+    ++value_length;
+  }
+  int length = WriteId(id, ptr_data);
+  ptr_data[length++] = static_cast<uint8>(0x80 | value_length);
+  for (int i = 0; i < value_length; ++i) {
+    ptr_data[length++] =
+        static_cast<uint8>(value >> (8 * (value_length - 1 - i)));
+  }
+  return length;
+}
+
+}  // namespace
+
+namespace webmlive {
+
+WebmClusterWriter::WebmClusterWriter()
+    : max_cluster_duration_(0),
+      max_cluster_size_(0),
+      video_track_number_(0),
+      force_new_cluster_(false),
+      clusters_started_(0),
+      cluster_timecode_(0),
+      cluster_size_(0),
+      last_timecode_(0) {
+}
+
+WebmClusterWriter::~WebmClusterWriter() {
+}
+
+int WebmClusterWriter::Init(int64 max_cluster_duration) {
+  if (max_cluster_duration < 0) {
+    LOG(ERROR) << "invalid max cluster duration: " << max_cluster_duration;
+    return kInvalidArg;
+  }
+  max_cluster_duration_ = max_cluster_duration;
+  return kSuccess;
+}
+
+int WebmClusterWriter::WriteFrame(uint64 track_number,
+                                  int64 timecode,
+                                  bool keyframe,
+                                  const uint8* ptr_data,
+                                  int32 data_length,
+                                  Buffer* ptr_buffer,
+                                  FrameOffsets* ptr_offsets) {
+  if (!ptr_data || data_length <= 0 || !ptr_buffer || !ptr_offsets ||
+      track_number == 0 || track_number > kMaxTrackNumber || timecode < 0) {
+    LOG(ERROR) << "WebmClusterWriter cannot write invalid frame.";
+    return kInvalidArg;
+  }
+  if (clusters_started_ > 0 && timecode < last_timecode_) {
+    LOG(ERROR) << "frame timecode " << timecode << " is older than "
+               << last_timecode_;
+    return kTimecodeOutOfOrder;
+  }
+
+  // Build the element headers first, so the buffer grows at most once.
+  uint8 cluster_header[kMaxClusterHeaderLength];
+  int cluster_header_length = 0;
+  const bool new_cluster = NewClusterDue(track_number, timecode, keyframe);
+  if (new_cluster) {
+    cluster_header_length = WriteId(mkvmuxer::kMkvCluster, cluster_header);
+    cluster_header[cluster_header_length++] = 0x01;
+    for (int i = 0; i < 7; ++i) {
+      cluster_header[cluster_header_length++] = 0xFF;
+    }
+    cluster_header_length +=
+        WriteUIntElement(mkvmuxer::kMkvTimecode, timecode,
+                         cluster_header + cluster_header_length);
+  }
+  const int64 cluster_timecode = new_cluster ? timecode : cluster_timecode_;
+  const int16 relative_timecode =
+      static_cast<int16>(timecode - cluster_timecode);
+
+  uint8 block_header[kMaxBlockHeaderLength];
+  const int kBlockFieldsLength = 4;
+  int block_header_length = WriteId(mkvmuxer::kMkvSimpleBlock, block_header);
+  block_header_length +=
+      WriteCodedUInt(kBlockFieldsLength + data_length,
+                     block_header + block_header_length);
+  block_header[block_header_length++] =
+      static_cast<uint8>(0x80 | track_number);
+  block_header[block_header_length++] =
+      static_cast<uint8>(relative_timecode >> 8);
+  block_header[block_header_length++] =
+      static_cast<uint8>(relative_timecode & 0xFF);
+  block_header[block_header_length++] = keyframe ? 0x80 : 0;
+
+  const size_t start = ptr_buffer->size();
+  const size_t end =
+      start + cluster_header_length + block_header_length + data_length;
+  if (end > ptr_buffer->capacity()) {
+    ptr_buffer->reserve(std::max(end, 2 * ptr_buffer->capacity()));
+  }
+  ptr_buffer->insert(ptr_buffer->end(), cluster_header,
+                     cluster_header + cluster_header_length);
+  ptr_buffer->insert(ptr_buffer->end(), block_header,
+                     block_header + block_header_length);
+  ptr_buffer->insert(ptr_buffer->end(), ptr_data, ptr_data + data_length);
+
+  ptr_offsets->cluster_offset = new_cluster ? static_cast<int64>(start) : -1;
+  ptr_offsets->block_offset = static_cast<int64>(start) + cluster_header_length;
+  if (new_cluster) {
+    cluster_timecode_ = timecode;
+    cluster_size_ = 0;
+    force_new_cluster_ = false;
+    ++clusters_started_;
+  }
+  cluster_size_ += static_cast<int64>(end - start);
+  last_timecode_ = timecode;
+  return kSuccess;
+}
+
+bool WebmClusterWriter::NewClusterDue(uint64 track_number,
+                                      int64 timecode,
+                                      bool keyframe) const {
+  const int64 cluster_age = timecode - cluster_timecode_;
+  if (clusters_started_ == 0 || force_new_cluster_ ||
+      cluster_age > kMaxRelativeTimecode) {
+    return true;
+  }
+  // Audio never starts a cluster when there is video. libwebm holds audio
+  // until the next video frame so that audio preceding a keyframe moves into
+  // the keyframe's cluster; this writer does not, so that audio stays in the
+  // cluster before it.
+  if (video_track_number_ != 0 && track_number != video_track_number_) {
+    return false;
+  }
+  if (keyframe && track_number == video_track_number_) {
+    return true;
+  }
+  return (max_cluster_duration_ > 0 && cluster_age >= max_cluster_duration_) ||
+      (max_cluster_size_ > 0 && cluster_size_ >= max_cluster_size_);
+}
+
+}  // namespace webmlive
@@ -0,0 +1,110 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WEBM_CLUSTER_WRITER_H_
+#define WEBMLIVE_ENCODER_WEBM_CLUSTER_WRITER_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+// Writes the clusters of a live WebM stream without libwebm. Element headers
+// are built on the stack, and each SimpleBlock is appended to the output
+// buffer with its payload in one step; frames are never copied elsewhere
+// first.
+//
+// Notes:
+// - Output matches libwebm's live mode: clusters have unknown size, and the
+//   timecode scale is 1 millisecond.
+// - A cluster starts with the first frame, with each video keyframe, when a
+//   frame is |max_cluster_duration| or more past the cluster start, when the
+//   cluster holds |max_cluster_size| bytes or more, when the frame's timecode
+//   does not fit in a block relative to the cluster, and after
+//   |ForceNewCluster()|. When the stream has a video track only video frames
+//   start clusters, as with libwebm.
+// - Frames must be written in timestamp order. Unlike libwebm, audio frames
+//   are not held until the next video frame, so audio that precedes a video
+//   keyframe stays in the cluster before it.
+// - Track numbers must be below 127, so that they are coded in one byte.
+class WebmClusterWriter {
+ public:
+  typedef std::vector<uint8> Buffer;
+
+  enum {
+    kTimecodeOutOfOrder = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Offsets, within the output buffer, of the elements appended by
+  // |WriteFrame()|. |cluster_offset| is -1 when no cluster started.
+  struct FrameOffsets {
+    FrameOffsets() : cluster_offset(-1), block_offset(-1) {}
+    int64 cluster_offset;
+    int64 block_offset;
+  };
+
+  WebmClusterWriter();
+  ~WebmClusterWriter();
+
+  // Stores |max_cluster_duration| in milliseconds. 0 disables duration based
+  // clustering. Returns |kSuccess| when successful.
+  int Init(int64 max_cluster_duration);
+
+  // Appends a SimpleBlock holding |data_length| bytes from |ptr_data| to
+  // |ptr_buffer|, preceded by a cluster header when a cluster is due.
+  // |timecode| is in milliseconds. Returns |kTimecodeOutOfOrder| when
+  // |timecode| is older than the last frame written.
+  int WriteFrame(uint64 track_number,
+                 int64 timecode,
+                 bool keyframe,
+                 const uint8* ptr_data,
+                 int32 data_length,
+                 Buffer* ptr_buffer,
+                 FrameOffsets* ptr_offsets);
+
+  // Starts a new cluster with the next frame written.
+  void ForceNewCluster() { force_new_cluster_ = true; }
+
+  // Sets the cluster size, in bytes, at which the next frame starts a new
+  // cluster. 0, the default, disables size based clustering.
+  void set_max_cluster_size(int64 max_cluster_size) {
+    max_cluster_size_ = max_cluster_size;
+  }
+
+  // Sets the track whose keyframes start clusters. 0 means no video track.
+  void set_video_track_number(uint64 track_number) {
+    video_track_number_ = track_number;
+  }
+
+  int64 clusters_started() const { return clusters_started_; }
+
+  // Returns the bytes written to the current cluster, its header included.
+  int64 cluster_size() const { return cluster_size_; }
+
+ private:
+  // Returns true when a frame of |track_number| at |timecode| must start a
+  // new cluster.
+  bool NewClusterDue(uint64 track_number, int64 timecode, bool keyframe) const;
+
+  int64 max_cluster_duration_;
+  int64 max_cluster_size_;
+  uint64 video_track_number_;
+  bool force_new_cluster_;
+  int64 clusters_started_;
+  int64 cluster_timecode_;
+  int64 cluster_size_;
+  int64 last_timecode_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmClusterWriter);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WEBM_CLUSTER_WRITER_H_
@@ -0,0 +1,148 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/webm_cluster_writer.h"
+
+#include <vector>
+
+#include "encoder/webm_buffer_parser.h"
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+const uint64 kVideoTrack = 1;
+const uint64 kAudioTrack = 2;
+const uint32 kClusterId = 0x1F43B675;
+const uint32 kSimpleBlockId = 0xA3;
+
+class WebmClusterWriterTest : public ::testing::Test {
+ protected:
+  WebmClusterWriterTest() : frame_(100, 0x55) {}
+
+  // Writes a frame and returns true when it started a cluster.
+  bool WriteFrame(uint64 track_number, int64 timecode, bool keyframe) {
+    WebmClusterWriter::FrameOffsets offsets;
+    EXPECT_EQ(WebmClusterWriter::kSuccess,
+              writer_.WriteFrame(track_number, timecode, keyframe,
+                                 &frame_[0],
+                                 static_cast<int32>(frame_.size()),
+                                 &buffer_, &offsets));
+    EXPECT_GE(offsets.block_offset, 0);
+    return offsets.cluster_offset >= 0;
+  }
+
+  WebmClusterWriter writer_;
+  std::vector<uint8> frame_;
+  WebmClusterWriter::Buffer buffer_;
+};
+
+TEST_F(WebmClusterWriterTest, VideoKeyframesStartClusters) {
+  ASSERT_EQ(WebmClusterWriter::kSuccess, writer_.Init(0));
+  writer_.set_video_track_number(kVideoTrack);
+  EXPECT_TRUE(WriteFrame(kVideoTrack, 0, true));
+  EXPECT_FALSE(WriteFrame(kAudioTrack, 10, true));
+  EXPECT_FALSE(WriteFrame(kVideoTrack, 33, false));
+  EXPECT_TRUE(WriteFrame(kVideoTrack, 66, true));
+  EXPECT_EQ(2, writer_.clusters_started());
+}
+
+// Unlike libwebm, audio that precedes a video keyframe is not held for the
+// cluster the keyframe starts; it stays in the cluster before it.
+TEST_F(WebmClusterWriterTest, AudioBeforeKeyframeNotHeld) {
+  ASSERT_EQ(WebmClusterWriter::kSuccess, writer_.Init(0));
+  writer_.set_video_track_number(kVideoTrack);
+  EXPECT_TRUE(WriteFrame(kVideoTrack, 0, true));
+  EXPECT_FALSE(WriteFrame(kVideoTrack, 33, false));
+
+  WebmClusterWriter::FrameOffsets audio_offsets;
+  ASSERT_EQ(WebmClusterWriter::kSuccess,
+            writer_.WriteFrame(kAudioTrack, 60, true, &frame_[0],
+                               static_cast<int32>(frame_.size()), &buffer_,
+                               &audio_offsets));
+  EXPECT_EQ(-1, audio_offsets.cluster_offset);
+
+  WebmClusterWriter::FrameOffsets video_offsets;
+  ASSERT_EQ(WebmClusterWriter::kSuccess,
+            writer_.WriteFrame(kVideoTrack, 66, true, &frame_[0],
+                               static_cast<int32>(frame_.size()), &buffer_,
+                               &video_offsets));
+  EXPECT_LT(audio_offsets.block_offset, video_offsets.cluster_offset);
+  EXPECT_EQ(2, writer_.clusters_started());
+
+  // The audio block is coded relative to the first cluster.
+  const size_t timecode_offset =
+      static_cast<size_t>(audio_offsets.block_offset) + 3;
+  EXPECT_EQ(0, buffer_[timecode_offset]);
+  EXPECT_EQ(60, buffer_[timecode_offset + 1]);
+
+  // Audio after the keyframe joins its cluster.
+  EXPECT_FALSE(WriteFrame(kAudioTrack, 70, true));
+  EXPECT_EQ(2, writer_.clusters_started());
+}
+
+TEST_F(WebmClusterWriterTest, DurationAndSizeLimits) {
+  ASSERT_EQ(WebmClusterWriter::kSuccess, writer_.Init(100));
+  EXPECT_TRUE(WriteFrame(kAudioTrack, 0, true));
+  EXPECT_FALSE(WriteFrame(kAudioTrack, 99, true));
+  EXPECT_TRUE(WriteFrame(kAudioTrack, 100, true));
+
+  writer_.set_max_cluster_size(200);
+  EXPECT_FALSE(WriteFrame(kAudioTrack, 110, true));
+  EXPECT_GE(writer_.cluster_size(), 200);
+  EXPECT_TRUE(WriteFrame(kAudioTrack, 120, true));
+
+  writer_.ForceNewCluster();
+  EXPECT_TRUE(WriteFrame(kAudioTrack, 130, true));
+}
+
+TEST_F(WebmClusterWriterTest, RejectsOutOfOrderFrames) {
+  ASSERT_EQ(WebmClusterWriter::kSuccess, writer_.Init(0));
+  EXPECT_TRUE(WriteFrame(kAudioTrack, 50, true));
+  WebmClusterWriter::FrameOffsets offsets;
+  EXPECT_EQ(WebmClusterWriter::kTimecodeOutOfOrder,
+            writer_.WriteFrame(kAudioTrack, 49, true, &frame_[0],
+                               static_cast<int32>(frame_.size()), &buffer_,
+                               &offsets));
+}
+
+// The output is a sequence of unknown size clusters holding a timecode and
+// SimpleBlocks whose sizes cover exactly the bytes written.
+TEST_F(WebmClusterWriterTest, OutputParses) {
+  ASSERT_EQ(WebmClusterWriter::kSuccess, writer_.Init(0));
+  writer_.set_video_track_number(kVideoTrack);
+  WriteFrame(kVideoTrack, 0, true);
+  WriteFrame(kVideoTrack, 33, false);
+  WriteFrame(kVideoTrack, 66, true);
+
+  int clusters = 0;
+  int blocks = 0;
+  size_t offset = 0;
+  while (offset < buffer_.size()) {
+    WebmBufferParser::ElementHeader header;
+    ASSERT_EQ(WebmBufferParser::kSuccess,
+              WebmBufferParser::ReadElementHeader(
+                  &buffer_[offset], buffer_.size() - offset, &header));
+    offset += header.header_length;
+    if (header.id == kClusterId) {
+      EXPECT_EQ(WebmBufferParser::kUnknownSize, header.size);
+      ++clusters;
+      continue;
+    }
+    if (header.id == kSimpleBlockId) {
+      EXPECT_EQ(static_cast<int64>(frame_.size() + 4), header.size);
+      ++blocks;
+    }
+    offset += static_cast<size_t>(header.size);
+  }
+  EXPECT_EQ(buffer_.size(), offset);
+  EXPECT_EQ(2, clusters);
+  EXPECT_EQ(3, blocks);
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -16,6 +16,9 @@
 
 #include "encoder/buffer_pool-inl.h"
 #include "encoder/dash_writer.h"
+#include "encoder/opus_encoder.h"
+#include "encoder/spsc_queue-inl.h"
+#include "encoder/vorbis_encoder.h"
 #include "encoder/webm_mux.h"
 #ifdef _WIN32
 #include "encoder/win/media_source_dshow.h"
@@ -39,16 +42,92 @@ int OffsetTimestamp(int64 timestamp_offset, T* ptr_sample) {
   return WebmEncoder::kSuccess;
 }
 
+// Returns the |ClusterStats| bucket that counts |value|.
+int StatsBucket(int64 value) {
+  int bucket = 0;
+  while (value > 0 && bucket < webmlive::ClusterStats::kNumBuckets - 1) {
+    value >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+// Returns the top of the bucket in |buckets| that holds the |percentile|th of
+// |count| values, capped by |max_value|.
+int64 BucketPercentile(const int64* buckets,
+                       int64 count,
+                       int64 max_value,
+                       double percentile) {
+  const double rank = count * percentile / 100.0;
+  int64 values_seen = 0;
+  for (int i = 0; i < webmlive::ClusterStats::kNumBuckets; ++i) {
+    values_seen += buckets[i];
+    if (values_seen > 0 && values_seen >= rank) {
+      const int64 bucket_top = i == 0 ? 0 : (1LL << i) - 1;
+      return std::min(bucket_top, max_value);
+    }
+  }
+  return max_value;
+}
+
 }  // anonymous namespace
 
 namespace webmlive {
 
+ClusterStats::ClusterStats()
+    : clusters(0),
+      total_size(0),
+      total_duration(0),
+      max_size(0),
+      max_duration(0),
+      delta_frame_splits(0) {
+  std::fill(size_buckets, size_buckets + kNumBuckets, 0);
+  std::fill(duration_buckets, duration_buckets + kNumBuckets, 0);
+}
+
+void ClusterStats::AddCluster(int64 size, int64 duration) {
+  ++clusters;
+  total_size += size;
+  total_duration += duration;
+  max_size = std::max(max_size, size);
+  max_duration = std::max(max_duration, duration);
+  ++size_buckets[StatsBucket(size)];
+  ++duration_buckets[StatsBucket(duration)];
+}
+
+int64 ClusterStats::SizePercentile(double percentile) const {
+  return BucketPercentile(size_buckets, clusters, max_size, percentile);
+}
+
+int64 ClusterStats::DurationPercentile(double percentile) const {
+  return BucketPercentile(duration_buckets, clusters, max_duration,
+                          percentile);
+}
+
+// Defined here because |std::chrono::milliseconds| binds it to a reference.
+const int WebmEncoder::kMuxIdleWaitMilliseconds;
+
 WebmEncoder::WebmEncoder()
     : initialized_(false),
       stop_(false),
+      ptr_pending_muxer_(NULL),
+      pending_chunk_length_(0),
+      mux_work_pending_(false),
+      manifest_update_pending_(false),
+      newest_audio_timestamp_(0),
+      newest_video_timestamp_(0),
+      audio_commit_blocked_(false),
+      video_commit_blocked_(false),
+      convert_commit_blocked_(false),
+      last_mux_timestamp_(0),
+      split_keyframe_requested_(false),
       encoded_duration_(0),
-      ptr_encode_func_(NULL),
-      timestamp_offset_(0) {
+      flush_audio_(false),
+      timestamp_offset_(0),
+      convert_stage_(this, &WebmEncoder::ConvertAudioBuffer),
+      audio_encode_stage_(this, &WebmEncoder::EncodeAudioBuffer),
+      video_encode_stage_(this, &WebmEncoder::EncodeVideoFrame) {
+  std::fill(cluster_bytes_read_, cluster_bytes_read_ + 3, 0);
 }
 
 WebmEncoder::~WebmEncoder() {
@@ -65,10 +144,38 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
     LOG(ERROR) << "NULL data sink!";
     return kInvalidArg;
   }
+  if (config.dash_time_shift_buffer_depth < 0) {
+    LOG(ERROR) << "invalid DASH time shift buffer depth: "
+               << config.dash_time_shift_buffer_depth;
+    return kInvalidArg;
+  }
+  if (config.mux_reorder_window < 0) {
+    LOG(ERROR) << "invalid mux reorder window: " << config.mux_reorder_window;
+    return kInvalidArg;
+  }
+  if (config.max_cluster_size < 0) {
+    LOG(ERROR) << "invalid max cluster size: " << config.max_cluster_size;
+    return kInvalidArg;
+  }
 
   config_ = config;
   ptr_data_sink_ = ptr_data_sink;
 
+  int status = sink_stage_.Init(ptr_data_sink_, config_.sink_queue_length);
+  if (status) {
+    LOG(ERROR) << "sink stage Init failed " << status;
+    return kInitFailed;
+  }
+  sink_stage_.set_space_callback(this);
+  if (!config_.spill_directory.empty()) {
+    status = sink_stage_.EnableSpill(config_.spill_directory,
+                                     config_.spill_threshold);
+    if (status) {
+      LOG(ERROR) << "sink stage EnableSpill failed " << status;
+      return kInitFailed;
+    }
+  }
+
   // Allocate the chunk buffer.
   chunk_buffer_.reset(
       new (std::nothrow) uint8[kDefaultChunkBufferSize]);  // NOLINT
@@ -84,22 +191,47 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
     LOG(ERROR) << "cannot construct media source!";
     return kInitFailed;
   }
-  int status = ptr_media_source_->Init(config_, this, this);
+  status = ptr_media_source_->Init(config_, this, this);
   if (status) {
     LOG(ERROR) << "media source Init failed " << status;
     return kInitFailed;
   }
 
-  // Construct and initialize the muxer.
-  ptr_muxer_.reset(new (std::nothrow) LiveWebmMuxer());  // NOLINT
-  if (!ptr_muxer_) {
-    LOG(ERROR) << "cannot construct live muxer!";
-    return kInitFailed;
-  }
-  status = ptr_muxer_->Init(config_.vpx_config.keyframe_interval);
+  // Construct and initialize the muxer(s). In per-track mode with both tracks
+  // enabled the audio muxer does not start clusters on its own;
+  // |MuxCompressedPackets()| starts them where video clusters start.
+  status = CreateMuxer(config_.vpx_config.keyframe_interval, &ptr_muxer_);
   if (status) {
-    LOG(ERROR) << "live muxer Init failed " << status;
-    return kInitFailed;
+    return status;
+  }
+  if (config_.per_track_output) {
+    if (!config_.disable_audio && !config_.disable_video) {
+      status = CreateMuxer(0, &ptr_audio_muxer_);
+      if (status) {
+        return status;
+      }
+      ptr_audio_muxer_->set_chunk_track(ChunkInfo::kAudioTrack);
+      ptr_muxer_->set_chunk_track(ChunkInfo::kVideoTrack);
+    } else {
+      ptr_muxer_->set_chunk_track(config_.disable_video ?
+                                  ChunkInfo::kAudioTrack :
+                                  ChunkInfo::kVideoTrack);
+    }
+  }
+
+  // The muxer splits clusters at the size limit on its own. With keyframe
+  // splits |MuxCompressedPackets()| requests a keyframe at the limit instead,
+  // and the muxer only splits clusters whose keyframe comes too late, or
+  // never with |kSplitAtKeyframeOnly|.
+  const WebmEncoderConfig::ClusterSplitPolicy policy =
+      config_.disable_video ? WebmEncoderConfig::kSplitAtAnyFrame :
+                              config_.cluster_split_policy;
+  if (config_.max_cluster_size > 0 &&
+      policy != WebmEncoderConfig::kSplitAtKeyframeOnly) {
+    ptr_muxer_->set_max_cluster_size(
+        policy == WebmEncoderConfig::kSplitAtKeyframe ?
+            2 * config_.max_cluster_size :
+            config_.max_cluster_size);
   }
 
   if (config_.disable_video == false) {
@@ -110,9 +242,6 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
     const double& fps = config_.actual_video_config.frame_rate;
 
     // Buffer up to half a second of video when audio is enabled.
-    // TODO(tomfinegan): Add a VP8 frame pool to store compressed frames while
-    //                   waiting for audio instead of throwing memory at the
-    //                   problem.
     const int num_video_buffers =
         config_.disable_audio ? default_count : static_cast<int>(fps / 2.0);
     if (video_pool_.Init(false, num_video_buffers)) {
@@ -120,6 +249,14 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
       return kInitFailed;
     }
 
+    // Size the compressed frame queue to hold the reorder window.
+    const int num_compressed_buffers = default_count +
+        static_cast<int>(fps * config_.mux_reorder_window / kTimebase);
+    if (compressed_video_queue_.Init(num_compressed_buffers)) {
+      LOG(ERROR) << "compressed VideoFrame queue Init failed!";
+      return kInitFailed;
+    }
+
     // Initialize the video encoder.
     status = video_encoder_.Init(config_);
     if (status) {
@@ -140,46 +277,97 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
   if (config_.disable_audio == false) {
     config_.actual_audio_config = ptr_media_source_->actual_audio_config();
 
-    // Initialize the audio buffer pool.
-    const int num_audio_buffers = BufferPool<AudioBuffer>::kDefaultBufferCount;
-    if (audio_pool_.Init(true, num_audio_buffers)) {
-      LOG(ERROR) << "BufferPool<AudioBuffer> Init failed!";
-      return kInitFailed;
+    // Set up conversion when the capture format is not what the user asked
+    // for, or cannot be encoded as captured.
+    AudioConverterConfig& conversion = config_.audio_conversion;
+    const AudioConfig& capture_config = config_.actual_audio_config;
+    if (conversion.channels == 0 && capture_config.channels > 2) {
+      conversion.channels = 2;
+    }
+    if (config_.audio_codec == kAudioFormatOpus &&
+        conversion.sample_rate == 0 &&
+        !OpusAudioEncoder::SampleRateSupported(capture_config.sample_rate)) {
+      conversion.sample_rate = OpusAudioEncoder::kOpusDecodeRate;
+    }
+    config_.encoded_audio_config = capture_config;
+    if (AudioConverter::ConversionRequired(capture_config, conversion)) {
+      ptr_audio_converter_.reset(new (std::nothrow) AudioConverter());  // NOLINT
+      if (!ptr_audio_converter_) {
+        LOG(ERROR) << "cannot construct audio converter.";
+        return kNoMemory;
+      }
+      status = ptr_audio_converter_->Init(capture_config, conversion);
+      if (status) {
+        LOG(ERROR) << "audio converter Init failed " << status;
+        return kAudioConfigureError;
+      }
+      config_.encoded_audio_config = ptr_audio_converter_->output_config();
+      const int num_buffers = BufferPool<AudioBuffer>::kDefaultBufferCount;
+      if (converted_audio_queue_.Init(num_buffers)) {
+        LOG(ERROR) << "converted AudioBuffer queue Init failed!";
+        return kInitFailed;
+      }
     }
 
-    // Initialize the vorbis encoder.
-    status = vorbis_encoder_.Init(config_.actual_audio_config,
-                                  config_.vorbis_config);
+    // Initialize the audio encoder.
+    status = audio_encoder_.Init(config_.audio_codec,
+                                 config_.encoded_audio_config,
+                                 config_.opus_config,
+                                 config_.vorbis_config);
     if (status) {
       LOG(ERROR) << "audio encoder Init failed " << status;
       return kInitFailed;
     }
 
-    // Fill in the private data structure.
-    VorbisCodecPrivate codec_private;
-    codec_private.ptr_ident = vorbis_encoder_.ident_header();
-    codec_private.ident_length = vorbis_encoder_.ident_header_length();
-    codec_private.ptr_comments = vorbis_encoder_.comments_header();
-    codec_private.comments_length = vorbis_encoder_.comments_header_length();
-    codec_private.ptr_setup = vorbis_encoder_.setup_header();
-    codec_private.setup_length = vorbis_encoder_.setup_header_length();
+    // Initialize the audio sample queue.
+    if (audio_queue_.Init(config_.actual_audio_config,
+                          config_.audio_queue_duration,
+                          AudioBlockFrames())) {
+      LOG(ERROR) << "AudioQueue Init failed!";
+      return kInitFailed;
+    }
+
+    // Size the compressed audio queue to hold the reorder window. Audio
+    // packets are assumed to be no shorter than 10 milliseconds; when they are
+    // the audio encoder thread waits on the queue and the mux stage drains it.
+    const int kMinAudioPacketDuration = 10;
+    const int num_compressed_buffers =
+        BufferPool<AudioBuffer>::kDefaultBufferCount +
+        config_.mux_reorder_window / kMinAudioPacketDuration;
+    if (compressed_audio_queue_.Init(num_compressed_buffers)) {
+      LOG(ERROR) << "compressed AudioBuffer queue Init failed!";
+      return kInitFailed;
+    }
 
-    // Add the vorbis track.
-    status = ptr_muxer_->AddTrack(config_.actual_audio_config, codec_private);
+    // Add the audio track.
+    if (config_.audio_codec == kAudioFormatOpus) {
+      const OpusAudioEncoder* const ptr_opus = audio_encoder_.opus_encoder();
+      OpusCodecPrivate codec_private;
+      codec_private.ptr_opus_head = ptr_opus->opus_head();
+      codec_private.opus_head_length = ptr_opus->opus_head_length();
+      codec_private.codec_delay = ptr_opus->codec_delay();
+      codec_private.seek_pre_roll = OpusAudioEncoder::kSeekPreRoll;
+      status = audio_muxer()->AddTrack(config_.encoded_audio_config,
+                                       codec_private);
+    } else {
+      // Fill in the private data structure.
+      const VorbisEncoder* const ptr_vorbis = audio_encoder_.vorbis_encoder();
+      VorbisCodecPrivate codec_private;
+      codec_private.ptr_ident = ptr_vorbis->ident_header();
+      codec_private.ident_length = ptr_vorbis->ident_header_length();
+      codec_private.ptr_comments = ptr_vorbis->comments_header();
+      codec_private.comments_length = ptr_vorbis->comments_header_length();
+      codec_private.ptr_setup = ptr_vorbis->setup_header();
+      codec_private.setup_length = ptr_vorbis->setup_header_length();
+      status = audio_muxer()->AddTrack(config_.encoded_audio_config,
+                                       codec_private);
+    }
     if (status) {
       LOG(ERROR) << "live muxer AddTrack(audio) failed " << status;
       return kInitFailed;
     }
   }
 
-  if (config.disable_audio) {
-    ptr_encode_func_ = &WebmEncoder::EncodeVideoFrame;
-  } else if (config.disable_video) {
-    ptr_encode_func_ = &WebmEncoder::EncodeAudioOnly;
-  } else {
-    ptr_encode_func_ = &WebmEncoder::AVEncode;
-  }
-
   initialized_ = true;
   return kSuccess;
 }
@@ -213,6 +401,7 @@ void WebmEncoder::Stop() {
   mutex_.lock();
   stop_ = true;
   mutex_.unlock();
+  WakeMuxer();
   encode_thread_->join();
 }
 
@@ -222,17 +411,33 @@ int64 WebmEncoder::encoded_duration() const {
   return encoded_duration_;
 }
 
+ClusterStats WebmEncoder::cluster_stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cluster_stats_;
+}
+
 // AudioSamplesCallbackInterface
 int WebmEncoder::OnSamplesReceived(AudioBuffer* ptr_buffer) {
-  const int status = audio_pool_.Commit(ptr_buffer);
+  if (!ptr_buffer) {
+    return AudioSamplesCallbackInterface::kInvalidArg;
+  }
+  const int status = audio_queue_.Write(*ptr_buffer);
   if (status) {
-    LOG(ERROR) << "AudioBuffer pool Commit failed! " << status;
-    return AudioSamplesCallbackInterface::kNoMemory;
+    LOG(ERROR) << "AudioQueue Write failed! " << status;
+    return (status == AudioQueue::kInvalidArg ||
+            status == AudioQueue::kBufferTooLarge) ?
+        AudioSamplesCallbackInterface::kInvalidArg :
+        AudioSamplesCallbackInterface::kNoMemory;
   }
-  LOG(INFO) << "OnSamplesReceived committed an audio buffer.";
+  VLOG(4) << "OnSamplesReceived queued an audio buffer.";
   return kSuccess;
 }
 
+// SinkSpaceCallbackInterface
+void WebmEncoder::OnSinkSpaceAvailable() {
+  WakeMuxer();
+}
+
 // VideoFrameCallbackInterface
 int WebmEncoder::OnVideoFrameReceived(VideoFrame* ptr_frame) {
   const int status = video_pool_.Commit(ptr_frame);
@@ -259,7 +464,43 @@ bool WebmEncoder::StopRequested() {
   return stop_requested;
 }
 
-bool WebmEncoder::ReadChunkFromMuxer(int32 chunk_length) {
+void WebmEncoder::WakeMuxer() {
+  std::lock_guard<std::mutex> lock(mux_work_mutex_);
+  mux_work_pending_ = true;
+  mux_work_ready_.notify_one();
+}
+
+void WebmEncoder::WaitForMuxWork() {
+  std::unique_lock<std::mutex> lock(mux_work_mutex_);
+  mux_work_ready_.wait_for(
+      lock, std::chrono::milliseconds(kMuxIdleWaitMilliseconds),
+      [this] { return mux_work_pending_; });
+  mux_work_pending_ = false;
+}
+
+int WebmEncoder::CreateMuxer(int32 cluster_duration_milliseconds,
+                             std::unique_ptr<LiveWebmMuxer>* ptr_muxer) {
+  ptr_muxer->reset(new (std::nothrow) LiveWebmMuxer());  // NOLINT
+  if (!*ptr_muxer) {
+    LOG(ERROR) << "cannot construct live muxer!";
+    return kInitFailed;
+  }
+  const int status = (*ptr_muxer)->Init(cluster_duration_milliseconds,
+                                        config_.low_latency,
+                                        config_.native_clusters);
+  if (status) {
+    LOG(ERROR) << "live muxer Init failed " << status;
+    return kInitFailed;
+  }
+  return kSuccess;
+}
+
+LiveWebmMuxer* WebmEncoder::audio_muxer() const {
+  return ptr_audio_muxer_ ? ptr_audio_muxer_.get() : ptr_muxer_.get();
+}
+
+bool WebmEncoder::ReadChunkFromMuxer(LiveWebmMuxer* ptr_muxer,
+                                     int32 chunk_length) {
   // Confirm that there's enough space in the chunk buffer.
   if (chunk_length > chunk_buffer_size_) {
     const int32 new_size = chunk_length * 2;
@@ -272,8 +513,8 @@ bool WebmEncoder::ReadChunkFromMuxer(int32 chunk_length) {
   }
 
   // Read the chunk into |chunk_buffer_|.
-  const int status = ptr_muxer_->ReadChunk(chunk_buffer_size_,
-                                           chunk_buffer_.get());
+  const int status = ptr_muxer->ReadChunk(chunk_buffer_size_,
+                                          chunk_buffer_.get());
   if (status) {
     LOG(ERROR) << "error reading chunk: " << status;
     return false;
@@ -282,38 +523,235 @@ bool WebmEncoder::ReadChunkFromMuxer(int32 chunk_length) {
   return true;
 }
 
-void WebmEncoder::EncoderThread() {
-  LOG(INFO) << "EncoderThread started.";
+bool WebmEncoder::MoveChunkToSink(LiveWebmMuxer* ptr_muxer, bool* ptr_moved) {
+  if (sink_stage_.full()) {
+    return true;
+  }
+  int32 chunk_length = 0;
+  ChunkInfo chunk_info;
+  if (ptr_pending_muxer_) {
+    // |chunk_buffer_| holds a refused chunk; nothing else can be read into it
+    // until that chunk is queued.
+    if (ptr_pending_muxer_ != ptr_muxer) {
+      return true;
+    }
+    chunk_length = pending_chunk_length_;
+    chunk_info = pending_chunk_info_;
+  } else {
+    if (!ptr_muxer->ChunkReady(&chunk_length, &chunk_info)) {
+      return true;
+    }
+    // A chunk is waiting in |ptr_muxer|'s buffer.
+    if (!ReadChunkFromMuxer(ptr_muxer, chunk_length)) {
+      LOG(ERROR) << "cannot read WebM chunk.";
+      return false;
+    }
+  }
+  const int status =
+      sink_stage_.Write(chunk_info, chunk_buffer_.get(), chunk_length);
+  if (status == DataSinkStage::kFull) {
+    VLOG(1) << "sink stage full, holding chunk.";
+    ptr_pending_muxer_ = ptr_muxer;
+    pending_chunk_info_ = chunk_info;
+    pending_chunk_length_ = chunk_length;
+    return true;
+  }
+  ptr_pending_muxer_ = NULL;
+  if (status) {
+    LOG(ERROR) << "sink stage write failed!";
+    return false;
+  }
+  ChunkQueued(chunk_info, chunk_length);
+  *ptr_moved = true;
+  return true;
+}
 
-  // Set to true the encode loop breaks because |StopRequested()| returns true.
-  bool user_initiated_stop = false;
+void WebmEncoder::ChunkQueued(const ChunkInfo& info, int32 length) {
+  AddManifestSegment(info);
+  UpdateClusterStats(info, length);
+}
 
-  if (!ptr_encode_func_) {
-    // NULL encode function pointer; fatal/die:
-    LOG(FATAL) << "NULL encode function pointer!";
+bool WebmEncoder::WritePendingChunk() {
+  if (!ptr_pending_muxer_) {
+    return true;
   }
+  ptr_pending_muxer_ = NULL;
+  if (!QueueForSink(pending_chunk_info_, chunk_buffer_.get(),
+                    pending_chunk_length_)) {
+    LOG(ERROR) << "cannot queue held chunk!";
+    return false;
+  }
+  ChunkQueued(pending_chunk_info_, pending_chunk_length_);
+  return true;
+}
 
-  // Run the media source to get samples flowing.
-  int status = ptr_media_source_->Run();
+bool WebmEncoder::QueueForSink(const ChunkInfo& info,
+                               const uint8* ptr_data,
+                               int32 data_length) {
+  if (held_chunks_.empty()) {
+    const int status = sink_stage_.Write(info, ptr_data, data_length);
+    if (status == DataSinkStage::kSuccess) {
+      return true;
+    } else if (status != DataSinkStage::kFull) {
+      LOG(ERROR) << "sink stage write failed: " << status;
+      return false;
+    }
+  }
+  held_chunks_.push_back(HeldChunk());
+  HeldChunk& held = held_chunks_.back();
+  held.info = info;
+  held.data.assign(ptr_data, ptr_data + data_length);
+  return true;
+}
+
+bool WebmEncoder::WriteHeldChunks() {
+  while (!held_chunks_.empty()) {
+    const HeldChunk& held = held_chunks_.front();
+    const int status = sink_stage_.Write(held.info, &held.data[0],
+                                         static_cast<int32>(held.data.size()));
+    if (status == DataSinkStage::kFull) {
+      return true;
+    } else if (status) {
+      LOG(ERROR) << "sink stage write failed: " << status;
+      return false;
+    }
+    held_chunks_.pop_front();
+  }
+  return true;
+}
+
+void WebmEncoder::FinalizeMuxer(LiveWebmMuxer* ptr_muxer) {
+  // Reading the final chunks overwrites |chunk_buffer_|.
+  if (!WritePendingChunk()) {
+    return;
+  }
+  const int status = ptr_muxer->Finalize();
   if (status) {
-    // media source Run failed; fatal/die:
-    LOG(FATAL) << "Unable to run the media source! " << status;
+    LOG(ERROR) << "muxer Finalize failed: " << status;
+    return;
   }
+  int32 chunk_length = 0;
+  ChunkInfo chunk_info;
+  while (ptr_muxer->ChunkReady(&chunk_length, &chunk_info)) {
+    if (!ReadChunkFromMuxer(ptr_muxer, chunk_length) ||
+        !QueueForSink(chunk_info, chunk_buffer_.get(), chunk_length)) {
+      LOG(ERROR) << "cannot queue final chunk!";
+      break;
+    }
+    ChunkQueued(chunk_info, chunk_length);
+    LOG(INFO) << "Final chunk queued.";
+  }
+}
 
-  // Send the DASH manifest.
+void WebmEncoder::QueueManifest() {
   DashConfig dash_config;
-  DashWriter dash_writer;
-  if (!dash_writer.Init("webmlive", "webmlive", config_, &dash_config)) {
+  ptr_dash_writer_.reset(new (std::nothrow) DashWriter());  // NOLINT
+  if (!ptr_dash_writer_) {
+    LOG(ERROR) << "cannot construct DashWriter.";
+    return;
+  }
+  if (!ptr_dash_writer_->Init(kDefaultDashName, kDefaultDashId, config_,
+                              &dash_config)) {
     LOG(ERROR) << "DashWriter::Init failed.";
   }
   std::string dash_manifest;
-  if (!dash_writer.WriteManifest(dash_config, &dash_manifest)) {
+  if (!ptr_dash_writer_->WriteManifest(dash_config, &dash_manifest)) {
     LOG(ERROR) << "DashWriter::WriteManifest failed.";
   }
+  ChunkInfo manifest_info;
+  manifest_info.type = ChunkInfo::kManifest;
+  sink_stage_.Write(manifest_info,
+                    reinterpret_cast<const uint8*>(dash_manifest.data()),
+                    static_cast<int32>(dash_manifest.length()));
+}
 
-  ptr_data_sink_->WriteData(
-      reinterpret_cast<const uint8*>(dash_manifest.data()),
-      dash_manifest.length());
+void WebmEncoder::AddManifestSegment(const ChunkInfo& info) {
+  if (!ptr_dash_writer_ || !ptr_dash_writer_->dynamic() ||
+      info.type != ChunkInfo::kMedia || !info.complete) {
+    return;
+  }
+  if (ptr_dash_writer_->AppendSegment(info.track, info.number,
+                                      info.start_time, info.duration)) {
+    manifest_update_pending_ = true;
+  }
+}
+
+void WebmEncoder::UpdateClusterStats(const ChunkInfo& info,
+                                     int32 chunk_length) {
+  if (info.type != ChunkInfo::kMedia) {
+    return;
+  }
+  int64& cluster_size = cluster_bytes_read_[info.track];
+  cluster_size += chunk_length;
+  if (info.complete) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cluster_stats_.AddCluster(cluster_size, info.duration);
+    cluster_size = 0;
+  }
+}
+
+void WebmEncoder::LogClusterStats() const {
+  const ClusterStats stats = cluster_stats();
+  if (stats.clusters == 0) {
+    return;
+  }
+  LOG(INFO) << "clusters: " << stats.clusters
+            << " delta frame splits: " << stats.delta_frame_splits;
+  LOG(INFO) << "cluster size (bytes): mean "
+            << stats.total_size / stats.clusters
+            << " p50 <= " << stats.SizePercentile(50)
+            << " p90 <= " << stats.SizePercentile(90)
+            << " p99 <= " << stats.SizePercentile(99)
+            << " max " << stats.max_size;
+  LOG(INFO) << "cluster duration (ms): mean "
+            << stats.total_duration / stats.clusters
+            << " p50 <= " << stats.DurationPercentile(50)
+            << " p90 <= " << stats.DurationPercentile(90)
+            << " p99 <= " << stats.DurationPercentile(99)
+            << " max " << stats.max_duration;
+}
+
+bool WebmEncoder::QueueManifestUpdate(bool hold) {
+  if (!manifest_update_pending_ || (!hold && sink_stage_.full())) {
+    return true;
+  }
+  std::string dash_manifest;
+  if (!ptr_dash_writer_->UpdateManifest(&dash_manifest)) {
+    LOG(ERROR) << "DashWriter::UpdateManifest failed.";
+    return false;
+  }
+  ChunkInfo manifest_info;
+  manifest_info.type = ChunkInfo::kManifest;
+  const uint8* const ptr_manifest =
+      reinterpret_cast<const uint8*>(dash_manifest.data());
+  const int32 manifest_length = static_cast<int32>(dash_manifest.length());
+  const bool queued = hold ?
+      QueueForSink(manifest_info, ptr_manifest, manifest_length) :
+      sink_stage_.Write(manifest_info, ptr_manifest, manifest_length) ==
+          DataSinkStage::kSuccess;
+  if (!queued) {
+    LOG(ERROR) << "cannot queue manifest update!";
+    return false;
+  }
+  manifest_update_pending_ = false;
+  return true;
+}
+
+void WebmEncoder::EncoderThread() {
+  LOG(INFO) << "EncoderThread started.";
+
+  // Set to true the encode loop breaks because |StopRequested()| returns true.
+  bool user_initiated_stop = false;
+
+  // Run the media source to get samples flowing.
+  int status = ptr_media_source_->Run();
+  if (status) {
+    // media source Run failed; fatal/die:
+    LOG(FATAL) << "Unable to run the media source! " << status;
+  }
+
+  // Queue the DASH manifest. The sink stage writes it once it starts.
+  QueueManifest();
 
   // Wait for an input sample from each input stream-- this sets the
   // |timestamp_offset_| value when one or both streams starts with a negative
@@ -321,6 +759,11 @@ void WebmEncoder::EncoderThread() {
   status = WaitForSamples();
   if (status) {
     LOG(ERROR) << "WaitForSamples failed: " << status;
+  } else if ((status = StartStages()) != kSuccess) {
+    LOG(ERROR) << "StartStages failed: " << status;
+    StopEncodeStages();
+    sink_runner_.Stop(false);
+    ptr_media_source_->Stop();
   } else {
     for (;;) {
       if (StopRequested()) {
@@ -333,202 +776,218 @@ void WebmEncoder::EncoderThread() {
         LOG(ERROR) << "Media source in a bad state, stopping: " << status;
         break;
       }
-      status = (this->*ptr_encode_func_)();
+      status = StageStatus();
       if (status) {
-        LOG(ERROR) << "encoding failed: " << status;
+        LOG(ERROR) << "pipeline stage failed: " << status;
         break;
       }
-      if (ptr_data_sink_->Ready()) {
-        int32 chunk_length = 0;
-        const bool chunk_ready = ptr_muxer_->ChunkReady(&chunk_length);
-
-        if (chunk_ready) {
-          // A complete chunk is waiting in |ptr_muxer_|'s buffer.
-          if (!ReadChunkFromMuxer(chunk_length)) {
-            LOG(ERROR) << "cannot read WebM chunk.";
-            break;
-          }
-
-          // Pass the chunk to |ptr_data_sink_|.
-          if (!ptr_data_sink_->WriteData(chunk_buffer_.get(), chunk_length)) {
-            LOG(ERROR) << "data sink write failed!";
-            break;
-          }
+
+      // Move finished chunks to the sink stage first; when its queue is full
+      // stop muxing, and let the compressed queues fill behind the muxers.
+      bool did_work = false;
+      if (!MoveChunkToSink(ptr_muxer_.get(), &did_work) ||
+          (ptr_audio_muxer_ &&
+           !MoveChunkToSink(ptr_audio_muxer_.get(), &did_work)) ||
+          !QueueManifestUpdate(false)) {
+        break;
+      }
+      if (!sink_stage_.full()) {
+        bool muxed = false;
+        status = MuxCompressedPackets(false, &muxed);
+        if (status) {
+          LOG(ERROR) << "muxing failed: " << status;
+          break;
         }
+        did_work = did_work || muxed;
+      }
+      if (!did_work) {
+        WaitForMuxWork();
       }
     }
 
+    StopEncodeStages();
+
     if (user_initiated_stop) {
       // When |user_initiated_stop| is true the encode loop has been broken
-      // cleanly (without error). Call |LiveWebmMuxer::Finalize()| to flush any
-      // buffered samples, and upload the final chunk if one becomes available.
-      status = ptr_muxer_->Finalize();
-
+      // cleanly (without error). Encode the audio still queued, mux the
+      // packets still waiting in the compressed queues, call
+      // |LiveWebmMuxer::Finalize()| to flush any buffered samples, and queue
+      // the remaining chunks for the sink stage.
+      if (!config_.disable_audio) {
+        FlushAudio();
+      }
+      bool muxed = false;
+      status = MuxCompressedPackets(true, &muxed);
       if (status) {
-        LOG(ERROR) << "muxer Finalize failed: " << status;
-      } else {
-        int32 chunk_length = 0;
-        if (ptr_muxer_->ChunkReady(&chunk_length)) {
-          LOG(INFO) << "mkvmuxer Finalize produced a chunk.";
-
-          while (!ptr_data_sink_->Ready())
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-          if (ReadChunkFromMuxer(chunk_length)) {
-            const bool sink_write_ok =
-                ptr_data_sink_->WriteData(chunk_buffer_.get(), chunk_length);
-            if (!sink_write_ok) {
-              LOG(ERROR) << "data sink write failed for final chunk!";
-            } else {
-              LOG(INFO) << "Final chunk upload initiated.";
-            }
-          }
+        LOG(ERROR) << "final MuxCompressedPackets failed: " << status;
+      }
+      FinalizeMuxer(ptr_muxer_.get());
+      if (ptr_audio_muxer_) {
+        FinalizeMuxer(ptr_audio_muxer_.get());
+      }
+      QueueManifestUpdate(true);
+
+      // Pass the chunks the sink stage had no room for as it makes room.
+      while (!held_chunks_.empty() && sink_runner_.running() &&
+             WriteHeldChunks()) {
+        if (!held_chunks_.empty()) {
+          WaitForMuxWork();
         }
       }
+      if (!held_chunks_.empty()) {
+        LOG(ERROR) << "sink stage stopped with " << held_chunks_.size()
+                   << " final chunks unwritten.";
+      }
     }
 
+    // Wait for the sink stage to write everything queued when stopping
+    // cleanly.
+    sink_runner_.Stop(user_initiated_stop);
     ptr_media_source_->Stop();
   }
+  if (!config_.disable_audio) {
+    LOG(INFO) << "AudioQueue dropped frames: "
+              << audio_queue_.dropped_frames();
+  }
+  LogClusterStats();
   LOG(INFO) << "EncoderThread finished.";
 }
 
-// On each encoding pass:
-// - Attempts to read one uncompressed audio buffer from |audio_pool_|, and
-//   feeds it |vorbis_encoder_| for compression when successful.
-// - Passes all available compressed audio produced by |vorbis_encoder_| to
-//   |ptr_muxer_| for muxing.
-int WebmEncoder::EncodeAudioOnly() {
-  // Encode a single audio buffer.
-  int status = EncodeAudioBuffer();
+int WebmEncoder::StartStages() {
+  int status = StartStage("sink", &sink_stage_, &sink_runner_);
   if (status) {
-    LOG(ERROR) << "EncodeAudioBuffer failed: " << status;
     return status;
   }
-
-  // Read and mux vorbis data until no more is available from |vorbis_encoder_|.
-  AudioBuffer* vb = &vorbis_audio_buffer_;
-  VorbisEncoder* ve = &vorbis_encoder_;
-  while ((status = ve->ReadCompressedAudio(vb)) == kSuccess) {
-    // Mux the vorbis data.
-    const int mux_status = ptr_muxer_->WriteAudioBuffer(*vb);
-    if (mux_status) {
-      LOG(ERROR) << "Audio buffer mux failed " << mux_status;
-      return mux_status;
+  if (!config_.disable_audio) {
+    if (ptr_audio_converter_) {
+      status = StartStage("audio convert", &convert_stage_, &convert_runner_);
+      if (status) {
+        return status;
+      }
     }
-    LOG(INFO) << "muxed (audio) " << vorbis_audio_buffer_.timestamp() / 1000.0;
-
-    // Update encoded duration if able to obtain the lock.
-    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-    if (lock.owns_lock()) {
-      encoded_duration_ = vb->timestamp();
+    status = StartStage("audio encode", &audio_encode_stage_,
+                        &audio_encode_runner_);
+    if (status) {
+      return status;
     }
   }
-  if (status < 0) {
-    LOG(ERROR) << "Error reading vorbis samples: " << status;
-    return kAudioEncoderError;
+  if (!config_.disable_video) {
+    status = StartStage("video encode", &video_encode_stage_,
+                        &video_encode_runner_);
+    if (status) {
+      return status;
+    }
   }
   return kSuccess;
 }
 
-// On each encoding pass:
-// - Attempts to read an uncompressed audio buffer from |audio_pool_|, and
-//   passes it to |vorbis_encoder_| when a buffer is available.
-// - Stores the timestamp of the first available video frame from |video_pool_|
-//   in |video_timestamp|, or uses the last encoded timestamp added to the
-//   calculated time per frame if no frame is available.
-// - Reads one compressed audio buffer from |vorbis_encoder_| into
-//   |vorbis_audio_buffer_|, and
-//   - Passes it to |ptr_muxer_| when the compressed audio buffer timestamp is
-//     less than the stored video timestamp, or
-//   - Stores the compressed audio buffer and sets the |vorbis_buffered| flag
-//     to true, and then waits to mux the audio until:
-// - When the stored |video_timestamp| is less than or equal to the _estimated_
-//   timestamp of the next compressed audio buffer from |vorbis_encoder_|, calls
-//   |EncodeVideoFrame()| to attempt read and encode of a video frame. This is
-//   repeated until no video frames are available, or the next frame available
-//   would cause video to get ahead of audio.
-// - When the |vorbis_buffered| flag was been set because the audio timestamp
-//   produced by |vorbis_encoder_| was greater than |video_timestamp|, passes
-//   |vorbis_audio_buffer_| to |ptr_muxer_|.
-int WebmEncoder::AVEncode() {
-  // Encode a single audio buffer.
-  int status = EncodeAudioBuffer();
+int WebmEncoder::StartStage(const std::string& name,
+                            PipelineStageInterface* ptr_stage,
+                            PipelineStageRunner* ptr_runner) {
+  const int status = config_.worker_pool ?
+      ptr_runner->Start(name, ptr_stage, config_.worker_pool,
+                        config_.worker_priority) :
+      ptr_runner->Start(name, ptr_stage);
   if (status) {
-    LOG(ERROR) << "EncodeAudioBuffer failed: " << status;
-    return status;
+    LOG(ERROR) << name << " stage Start failed: " << status;
+    return kRunFailed;
   }
+  return kSuccess;
+}
 
-  // Store the next video timestamp.
-  int64 video_timestamp = 0;
-  status = PeekVideoTimestamp(&video_timestamp);
-  if (status < 0) {
-    LOG(ERROR) << "Video timestamp peek failed: " << status;
-    return status;
-  }
+void WebmEncoder::StopEncodeStages() {
+  convert_runner_.Stop(false);
+  audio_encode_runner_.Stop(false);
+  video_encode_runner_.Stop(false);
+}
 
-  // Read compressed audio until no more remains, or the compressed buffer
-  // timestamp is greater than |video_timestamp|.
-  bool vorbis_buffered = false;
-  AudioBuffer& vorb_buf = vorbis_audio_buffer_;
-  VorbisEncoder& vorb_enc = vorbis_encoder_;
-  if (vorb_enc.time_encoded() <= video_timestamp) {
-    while ((status = vorb_enc.ReadCompressedAudio(&vorb_buf)) == kSuccess) {
-      if (video_timestamp < vorb_buf.timestamp()) {
-        vorbis_buffered = true;
-        break;
-      }
-      status = ptr_muxer_->WriteAudioBuffer(vorb_buf);
-      if (status) {
-        LOG(ERROR) << "audio mux failed: " << status;
-        return status;
-      }
-      vorbis_buffered = false;
-      LOG(INFO) << "muxed (audio) "
-                << vorbis_audio_buffer_.timestamp() / 1000.0;
+int WebmEncoder::StageStatus() const {
+  const PipelineStageRunner* const runners[] = {
+    &convert_runner_, &audio_encode_runner_, &video_encode_runner_,
+    &sink_runner_,
+  };
+  const int kNumRunners = sizeof(runners) / sizeof(runners[0]);
+  for (int i = 0; i < kNumRunners; ++i) {
+    const int status = runners[i]->status();
+    if (status) {
+      return status;
     }
   }
+  return kSuccess;
+}
 
-  // Attempt to encode video frames when |video_timestamp| is less than the
-  // next estimated compressed audio buffer timestamp.
-  while (status != BufferPool<VideoFrame>::kEmpty &&
-         video_timestamp <= vorb_enc.time_encoded()) {
-    VLOG(3) << "attempting video mux vid_ts=" << video_timestamp
-              << " vorb_enc time_encoded=" << vorb_enc.time_encoded();
-    status = EncodeVideoFrame();
-    if (status) {
-      LOG(ERROR) << "EncodeVideoFrame failed: " << status;
+// Runs on the audio convert stage thread when |ptr_audio_converter_| is
+// non-NULL:
+// - Commits the buffer held from the last pass when |converted_audio_queue_|
+//   was full, and returns when it is still full.
+// - Attempts to read an uncompressed audio block sized for |audio_encoder_|
+//   from |audio_queue_|, converts it, and commits it to
+//   |converted_audio_queue_|.
+int WebmEncoder::ConvertAudioBuffer(bool* ptr_did_work) {
+  *ptr_did_work = false;
+  if (convert_commit_blocked_) {
+    const int status = CommitConvertedAudio(ptr_did_work);
+    if (status || convert_commit_blocked_) {
       return status;
     }
-    status = PeekVideoTimestamp(&video_timestamp);
-    if (status < 0) {
-      LOG(ERROR) << "Video timestamp peek failed: " << status;
-      return status;
+  }
+
+  int status = ReadAudioBlock(AudioBlockFrames(), &raw_audio_buffer_);
+  if (status) {
+    if (status != AudioQueue::kEmpty) {
+      // Really an error; not just an empty queue.
+      LOG(ERROR) << "AudioQueue Read failed! " << status;
+      return kAudioSinkError;
     }
+    VLOG(4) << "Not enough samples in AudioQueue";
+    return kSuccess;
   }
+  *ptr_did_work = true;
 
-  // TODO(tomfinegan): Update libwebm to handle non-monotonic timestamps on
-  //                   audio by buffering samples in some way, and get rid
-  //                   of this extra bit of audio handling code.
+  status = OffsetTimestamp(timestamp_offset_, &raw_audio_buffer_);
+  if (status) {
+    LOG(ERROR) << "audio timestamp offset failed: " << status;
+    return kAudioEncoderError;
+  }
+  status = ptr_audio_converter_->Convert(raw_audio_buffer_,
+                                         &converted_audio_buffer_);
+  if (status == AudioConverter::kNoSamples) {
+    return kSuccess;
+  } else if (status) {
+    LOG(ERROR) << "audio conversion failed " << status;
+    return kAudioEncoderError;
+  }
+  return CommitConvertedAudio(ptr_did_work);
+}
 
-  // Mux compressed audio stored because its buffer timestamp was greater than
-  // |video_timestamp|.
-  if (vorbis_buffered) {
-    status = ptr_muxer_->WriteAudioBuffer(vorb_buf);
-    if (status) {
-      LOG(ERROR) << "buffered audio mux failed: " << status;
-      return status;
-    }
-    VLOG(3) << "muxed (audio) " << vorbis_audio_buffer_.timestamp() / 1000.0;
+int WebmEncoder::CommitConvertedAudio(bool* ptr_did_work) {
+  const int status = converted_audio_queue_.TryPush(&converted_audio_buffer_);
+  if (status == AudioBufferQueue::kFull) {
+    convert_commit_blocked_ = true;
+    return kSuccess;
+  } else if (status) {
+    LOG(ERROR) << "converted AudioBuffer queue push failed: " << status;
+    return kAudioEncoderError;
   }
+  convert_commit_blocked_ = false;
+  *ptr_did_work = true;
   return kSuccess;
 }
 
-// On each encoding pass, either a call from |EncoderThread()| via
-// |ptr_encode_func_| or a call from |AVEncode()|:
-// - Attempts to read one frame from |video_pool_|, and compresses it using
-//   |video_encoder_| when a frame is available.
-// - Passes the compressed frame to |ptr_muxer_| for muxing.
-int WebmEncoder::EncodeVideoFrame() {
+// Runs on the video encode stage thread:
+// - Commits the frame held from the last pass when |compressed_video_queue_|
+//   was full, and returns when it is still full.
+// - Attempts to read one frame from |video_pool_|, compresses it using
+//   |video_encoder_|, and commits it to |compressed_video_queue_|.
+int WebmEncoder::EncodeVideoFrame(bool* ptr_did_work) {
+  *ptr_did_work = false;
+  if (video_commit_blocked_) {
+    const int status = CommitCompressedVideo(ptr_did_work);
+    if (status || video_commit_blocked_) {
+      return status;
+    }
+  }
+
   // Try reading a video frame from the pool.
   int status = video_pool_.Decommit(&raw_frame_);
   if (status) {
@@ -539,6 +998,7 @@ int WebmEncoder::EncodeVideoFrame() {
     VLOG(4) << "No frames in VideoFrame pool";
     return kSuccess;
   }
+  *ptr_did_work = true;
 
   VLOG(4) << "Encoder thread read raw frame.";
 
@@ -548,7 +1008,7 @@ int WebmEncoder::EncodeVideoFrame() {
     return kVideoEncoderError;
   }
 
-  // Encode the video frame, and pass it to the muxer.
+  // Encode the video frame, and pass it to the mux stage.
   status = video_encoder_.EncodeFrame(raw_frame_, &vpx_frame_);
   if (status == kDropped) {
     return kSuccess;
@@ -556,50 +1016,293 @@ int WebmEncoder::EncodeVideoFrame() {
     LOG(ERROR) << "Video frame encode failed: " << status;
     return kVideoEncoderError;
   }
+  return CommitCompressedVideo(ptr_did_work);
+}
 
-  // Update encoded duration if able to obtain the lock.
-  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-  if (lock.owns_lock()) {
-    encoded_duration_ = std::max(vpx_frame_.timestamp(), encoded_duration_);
+int WebmEncoder::CommitCompressedVideo(bool* ptr_did_work) {
+  const int64 timestamp = vpx_frame_.timestamp();
+  const int status = compressed_video_queue_.TryPush(&vpx_frame_);
+  if (status == VideoFrameQueue::kFull) {
+    if (!video_commit_blocked_) {
+      video_commit_blocked_ = true;
+      WakeMuxer();
+    }
+    return kSuccess;
+  } else if (status) {
+    LOG(ERROR) << "compressed VideoFrame queue push failed: " << status;
+    return kVideoEncoderError;
   }
+  video_commit_blocked_ = false;
+  newest_video_timestamp_ = timestamp;
+  *ptr_did_work = true;
+  WakeMuxer();
+  VLOG(3) << "encoded (video) " << timestamp / 1000.0;
+  return kSuccess;
+}
 
-  status = ptr_muxer_->WriteVideoFrame(vpx_frame_);
-  if (status) {
-    LOG(ERROR) << "Video frame mux failed: " << status;
+// Runs on the audio encode stage thread:
+// - Commits compressed audio held from the last pass when
+//   |compressed_audio_queue_| was full, and returns when it is still full.
+// - Attempts to read an uncompressed audio block from |converted_audio_queue_|,
+//   or from |audio_queue_| when there is no conversion stage, and passes it
+//   to |audio_encoder_|.
+// - Commits all compressed audio produced by |audio_encoder_| to
+//   |compressed_audio_queue_|.
+int WebmEncoder::EncodeAudioBuffer(bool* ptr_did_work) {
+  *ptr_did_work = false;
+  if (audio_commit_blocked_) {
+    const int status = CommitCompressedAudio(ptr_did_work);
+    if (status || audio_commit_blocked_) {
+      return status;
+    }
   }
-  VLOG(3) << "muxed (video) " << vpx_frame_.timestamp() / 1000.0;
-  return status;
-}
 
-int WebmEncoder::EncodeAudioBuffer() {
-  // Try reading an audio buffer from the pool.
-  int status = audio_pool_.Decommit(&raw_audio_buffer_);
-  if (status) {
-    if (status != BufferPool<AudioBuffer>::kEmpty) {
-      // Really an error; not just an empty pool.
-      LOG(ERROR) << "AudioBuffer pool Decommit failed! " << status;
-      return kAudioSinkError;
+  int status = kSuccess;
+  if (ptr_audio_converter_) {
+    status = converted_audio_queue_.TryPop(&encoder_input_buffer_);
+    if (status) {
+      if (status != AudioBufferQueue::kEmpty) {
+        LOG(ERROR) << "converted AudioBuffer queue pop failed! " << status;
+        return kAudioSinkError;
+      }
+      return kSuccess;
     }
-    VLOG(4) << "No buffers in AudioBuffer pool";
   } else {
-    VLOG(4) << "Encoder thread read raw audio buffer.";
-
-    status = OffsetTimestamp(timestamp_offset_, &raw_audio_buffer_);
+    // Try reading a block of the size preferred by the encoder from the
+    // queue.
+    status = ReadAudioBlock(AudioBlockFrames(), &encoder_input_buffer_);
+    if (status) {
+      if (status != AudioQueue::kEmpty) {
+        // Really an error; not just an empty queue.
+        LOG(ERROR) << "AudioQueue Read failed! " << status;
+        return kAudioSinkError;
+      }
+      VLOG(4) << "Not enough samples in AudioQueue";
+      return kSuccess;
+    }
+    status = OffsetTimestamp(timestamp_offset_, &encoder_input_buffer_);
     if (status) {
       LOG(ERROR) << "audio timestamp offset failed: " << status;
       return kAudioEncoderError;
     }
+  }
+  *ptr_did_work = true;
 
-    // Pass the uncompressed audio to libvorbis.
-    status = vorbis_encoder_.Encode(raw_audio_buffer_);
-    if (status) {
-      LOG(ERROR) << "vorbis encode failed " << status;
+  VLOG(4) << "Encoder thread read raw audio buffer.";
+
+  // Pass the uncompressed audio to the audio encoder.
+  status = audio_encoder_.Encode(encoder_input_buffer_);
+  if (status) {
+    LOG(ERROR) << "audio encode failed " << status;
+    return kAudioEncoderError;
+  }
+  return CommitCompressedAudio(ptr_did_work);
+}
+
+int32 WebmEncoder::AudioBlockFrames() const {
+  const int32 encoder_block_size = audio_encoder_.preferred_block_size();
+  return ptr_audio_converter_ ?
+      ptr_audio_converter_->InputFramesFor(encoder_block_size) :
+      encoder_block_size;
+}
+
+int WebmEncoder::ReadAudioBlock(int32 num_frames, AudioBuffer* ptr_buffer) {
+  return flush_audio_ ? audio_queue_.ReadPadded(num_frames, ptr_buffer) :
+      audio_queue_.Read(num_frames, ptr_buffer);
+}
+
+// The stage functions run on the mux thread here. Muxing in between passes,
+// in timestamp order, makes room in |compressed_audio_queue_| when the encoder
+// fills it.
+void WebmEncoder::FlushAudio() {
+  flush_audio_ = true;
+  for (;;) {
+    bool converted = false;
+    if (ptr_audio_converter_ && ConvertAudioBuffer(&converted)) {
+      LOG(ERROR) << "audio flush failed in the convert stage.";
+      break;
+    }
+    bool encoded = false;
+    if (EncodeAudioBuffer(&encoded)) {
+      LOG(ERROR) << "audio flush failed in the encode stage.";
+      break;
+    }
+    bool muxed = false;
+    if (MuxCompressedPackets(false, &muxed)) {
+      LOG(ERROR) << "audio flush failed in the mux stage.";
+      break;
+    }
+    if (!converted && !encoded && !muxed) {
+      break;
+    }
+  }
+}
+
+// Reads compressed audio until no more is available from |audio_encoder_|,
+// starting with |compressed_audio_buffer_| when it was held back by a full
+// queue.
+int WebmEncoder::CommitCompressedAudio(bool* ptr_did_work) {
+  AudioBuffer* const ab = &compressed_audio_buffer_;
+  for (;;) {
+    if (!audio_commit_blocked_) {
+      const int status = audio_encoder_.ReadCompressedAudio(ab);
+      if (status < 0) {
+        LOG(ERROR) << "Error reading compressed audio: " << status;
+        return kAudioEncoderError;
+      } else if (status != kSuccess) {
+        break;
+      }
+    }
+    const int64 timestamp = ab->timestamp();
+    const int status = compressed_audio_queue_.TryPush(ab);
+    if (status == AudioBufferQueue::kFull) {
+      if (!audio_commit_blocked_) {
+        audio_commit_blocked_ = true;
+        WakeMuxer();
+      }
+      break;
+    } else if (status) {
+      LOG(ERROR) << "compressed AudioBuffer queue push failed: " << status;
       return kAudioEncoderError;
     }
+    audio_commit_blocked_ = false;
+    newest_audio_timestamp_ = timestamp;
+    *ptr_did_work = true;
+    WakeMuxer();
+    VLOG(3) << "encoded (audio) " << timestamp / 1000.0;
   }
   return kSuccess;
 }
 
+// Each pass through the loop muxes the head packet with the lowest timestamp
+// when both compressed queues have packets waiting. When only one queue has a
+// packet waiting its head is muxed only when the other track cannot produce an
+// earlier packet:
+// - the other track is disabled,
+// - |flush| is true,
+// - the track's encode stage is holding a packet its full queue has no room
+//   for, or
+// - the track's encoder has moved |WebmEncoderConfig::mux_reorder_window|
+//   milliseconds past the head packet.
+int WebmEncoder::MuxCompressedPackets(bool flush, bool* ptr_muxed) {
+  *ptr_muxed = false;
+  for (;;) {
+    const AudioBuffer* const ptr_audio_head =
+        config_.disable_audio ? NULL : compressed_audio_queue_.Front();
+    const bool have_audio = (ptr_audio_head != NULL);
+    const int64 audio_timestamp = have_audio ? ptr_audio_head->timestamp() : 0;
+
+    const VideoFrame* const ptr_video_head =
+        config_.disable_video ? NULL : compressed_video_queue_.Front();
+    const bool have_video = (ptr_video_head != NULL);
+    const int64 video_timestamp = have_video ? ptr_video_head->timestamp() : 0;
+
+    bool mux_audio = false;
+    if (have_audio && have_video) {
+      mux_audio = audio_timestamp <= video_timestamp;
+    } else if (have_audio) {
+      mux_audio = config_.disable_video || flush ||
+          ReorderWindowExpired(audio_timestamp, newest_audio_timestamp_,
+                               audio_commit_blocked_);
+      if (!mux_audio) {
+        break;
+      }
+    } else if (have_video) {
+      const bool mux_video = config_.disable_audio || flush ||
+          ReorderWindowExpired(video_timestamp, newest_video_timestamp_,
+                               video_commit_blocked_);
+      if (!mux_video) {
+        break;
+      }
+    } else {
+      break;
+    }
+
+    int status = kSuccess;
+    int64 timestamp = 0;
+    if (mux_audio) {
+      if (compressed_audio_queue_.TryPop(&mux_audio_buffer_)) {
+        LOG(ERROR) << "compressed AudioBuffer queue pop failed!";
+        return kAudioSinkError;
+      }
+      if (mux_audio_buffer_.timestamp() < last_mux_timestamp_) {
+        LOG(WARNING) << "late audio packet " << mux_audio_buffer_.timestamp()
+                     << " muxed at " << last_mux_timestamp_;
+        mux_audio_buffer_.set_timestamp(last_mux_timestamp_);
+      }
+      status = audio_muxer()->WriteAudioBuffer(mux_audio_buffer_);
+      if (status) {
+        LOG(ERROR) << "audio mux failed: " << status;
+        return status;
+      }
+      timestamp = mux_audio_buffer_.timestamp();
+      VLOG(3) << "muxed (audio) " << timestamp / 1000.0;
+    } else {
+      if (compressed_video_queue_.TryPop(&mux_video_frame_)) {
+        LOG(ERROR) << "compressed VideoFrame queue pop failed!";
+        return kVideoSinkError;
+      }
+      if (mux_video_frame_.timestamp() < last_mux_timestamp_) {
+        LOG(WARNING) << "late video frame " << mux_video_frame_.timestamp()
+                     << " muxed at " << last_mux_timestamp_;
+        mux_video_frame_.set_timestamp(last_mux_timestamp_);
+      }
+      const int64 video_clusters = ptr_muxer_->clusters_started();
+      status = ptr_muxer_->WriteVideoFrame(mux_video_frame_);
+      if (status) {
+        LOG(ERROR) << "Video frame mux failed: " << status;
+        return status;
+      }
+
+      // Start an audio cluster with the next audio packet whenever the frame
+      // started a video cluster. The first video cluster is skipped: audio
+      // muxed before the first frame belongs to the first audio cluster.
+      const bool cluster_started =
+          ptr_muxer_->clusters_started() != video_clusters;
+      if (ptr_audio_muxer_ && video_clusters > 0 && cluster_started) {
+        ptr_audio_muxer_->ForceNewCluster();
+      }
+
+      // Ask for a keyframe once the cluster is full, so that the next
+      // cluster starts with one.
+      if (cluster_started) {
+        split_keyframe_requested_ = false;
+        if (video_clusters > 0 && !mux_video_frame_.keyframe()) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          ++cluster_stats_.delta_frame_splits;
+        }
+      } else if (config_.max_cluster_size > 0 &&
+                 config_.cluster_split_policy !=
+                     WebmEncoderConfig::kSplitAtAnyFrame &&
+                 !split_keyframe_requested_ &&
+                 ptr_muxer_->cluster_size() >= config_.max_cluster_size) {
+        VLOG(1) << "cluster size " << ptr_muxer_->cluster_size()
+                << ", requesting keyframe.";
+        video_encoder_.RequestKeyframe();
+        split_keyframe_requested_ = true;
+      }
+      timestamp = mux_video_frame_.timestamp();
+      VLOG(3) << "muxed (video) " << timestamp / 1000.0;
+    }
+    last_mux_timestamp_ = timestamp;
+    *ptr_muxed = true;
+
+    // Update encoded duration if able to obtain the lock.
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (lock.owns_lock()) {
+      encoded_duration_ = std::max(timestamp, encoded_duration_);
+    }
+  }
+  return kSuccess;
+}
+
+bool WebmEncoder::ReorderWindowExpired(int64 head_timestamp,
+                                       int64 newest_timestamp,
+                                       bool commit_blocked) const {
+  return commit_blocked ||
+      newest_timestamp - head_timestamp >= config_.mux_reorder_window;
+}
+
 int WebmEncoder::WaitForSamples() {
   // Wait for samples from the input stream(s).
   bool got_audio = config_.disable_audio;
@@ -609,7 +1312,7 @@ int WebmEncoder::WaitForSamples() {
       return kSuccess;
     }
     if (!got_audio) {
-      got_audio = !audio_pool_.IsEmpty();
+      got_audio = !audio_queue_.IsEmpty();
     }
     if (!got_video) {
       got_video = !video_pool_.IsEmpty();
@@ -623,7 +1326,7 @@ int WebmEncoder::WaitForSamples() {
   int64 first_audio_timestamp = 0;
   if (!config_.disable_audio) {
     int64& a_ts = first_audio_timestamp;
-    const int status = audio_pool_.ActiveBufferTimestamp(&a_ts);
+    const int status = audio_queue_.HeadTimestamp(&a_ts);
     if (status) {
       LOG(ERROR) << "cannot read first audio timestamp: " << status;
       return status;
@@ -655,25 +1358,4 @@ int WebmEncoder::WaitForSamples() {
   return kSuccess;
 }
 
-int WebmEncoder::PeekVideoTimestamp(int64* timestamp) {
-  CHECK_NOTNULL(timestamp);
-  const int status = video_pool_.ActiveBufferTimestamp(timestamp);
-  if (status < 0) {
-    LOG(ERROR) << "VideoFrame pool timestamp check failed: " << status;
-    return kVideoSinkError;
-  }
-  if (status == BufferPool<VideoFrame>::kEmpty) {
-    // When |video_pool_| is empty use the timestamp of the last encoded video
-    // frame added to the calculated time per frame.
-    const int time_per_frame =
-        static_cast<int>(kTimebase / config_.actual_video_config.frame_rate);
-    *timestamp = video_encoder_.last_timestamp() + time_per_frame;
-    VLOG(3) << "NO video frame available ts=" << *timestamp;
-  } else {
-    *timestamp += timestamp_offset_;
-    VLOG(3) << "video frame available ts=" << *timestamp;
-  }
-  return status;
-}
-
 }  // namespace webmlive
@@ -8,23 +8,39 @@
 #ifndef WEBMLIVE_ENCODER_WEBM_ENCODER_H_
 #define WEBMLIVE_ENCODER_WEBM_ENCODER_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include "encoder/audio_converter.h"
 #include "encoder/audio_encoder.h"
+#include "encoder/audio_queue.h"
 #include "encoder/basictypes.h"
 #include "encoder/buffer_pool.h"
 #include "encoder/encoder_base.h"
 #include "encoder/data_sink.h"
+#include "encoder/data_sink_stage.h"
+#include "encoder/pipeline_stage.h"
+#include "encoder/spsc_queue.h"
+#include "encoder/worker_pool.h"
 #include "encoder/video_encoder.h"
-#include "encoder/vorbis_encoder.h"
 
 namespace webmlive {
 // All timestamps are in milliseconds.
 const int kTimebase = 1000;
 // Special value meaning use system default device.
 const int kUseDefaultDevice = -1;
+// Default capacity of the uncompressed audio queue, in milliseconds.
+const int kDefaultAudioQueueDuration = 2000;
+// Default mux reorder window, in milliseconds.
+const int kDefaultMuxReorderWindow = 500;
+// Default sink queue size, in bytes, at which chunks spill to disk.
+const int64 kDefaultSpillThreshold = 16 * 1024 * 1024;
 
 struct WebmEncoderConfig {
   // User interface control structure. |MediaSourceImpl| will attempt to
@@ -38,11 +54,44 @@ struct WebmEncoderConfig {
     bool manual_video_config;   // Show video source configuration interface.
   };
 
+  // Controls how a video cluster that reaches |max_cluster_size| is split.
+  enum ClusterSplitPolicy {
+    // Request a keyframe from the video encoder, and start the next cluster
+    // with it, so that every cluster still starts with a keyframe. Frames
+    // encoded before the request still go into the full cluster; one that
+    // reaches twice |max_cluster_size| first is split at the next frame.
+    kSplitAtKeyframe = 0,
+
+    // Start the next cluster with the next video frame, keyframe or not.
+    // Players cannot start decoding video at such a cluster.
+    kSplitAtAnyFrame = 1,
+
+    // Request a keyframe, and never split before it arrives, so that every
+    // cluster starts with a keyframe. Clusters grow past |max_cluster_size|
+    // until the encoder delivers the keyframe. Required when clusters become
+    // DASH segment files or recordings are rotated.
+    kSplitAtKeyframeOnly = 2,
+  };
+
   WebmEncoderConfig()
       : disable_audio(false),
         disable_video(false),
         audio_device_index(kUseDefaultDevice),
-        video_device_index(kUseDefaultDevice) {}
+        video_device_index(kUseDefaultDevice),
+        audio_codec(kAudioFormatVorbis),
+        audio_queue_duration(kDefaultAudioQueueDuration),
+        mux_reorder_window(kDefaultMuxReorderWindow),
+        sink_queue_length(DataSinkStage::kDefaultQueueLength),
+        spill_threshold(kDefaultSpillThreshold),
+        low_latency(false),
+        native_clusters(false),
+        max_cluster_size(0),
+        cluster_split_policy(kSplitAtKeyframe),
+        per_track_output(false),
+        dash_live_manifest(false),
+        dash_time_shift_buffer_depth(0),
+        worker_pool(NULL),
+        worker_priority(WorkerPool::kNormalPriority) {}
 
   // Audio/Video disable flags.
   bool disable_audio;
@@ -66,15 +115,91 @@ struct WebmEncoderConfig {
   // Actual audio capture settings.
   AudioConfig actual_audio_config;
 
+  // Optional conversion of captured audio before encoding. Leave fields set to
+  // 0 to encode at the capture sample rate and channel count.
+  AudioConverterConfig audio_conversion;
+
+  // Audio settings passed to the audio encoder: |actual_audio_config| after
+  // conversion. Set by |WebmEncoder::Init()|.
+  AudioConfig encoded_audio_config;
+
   // Requested video capture settings.
   VideoConfig requested_video_config;
 
   // Actual video capture settings.
   VideoConfig actual_video_config;
 
+  // Audio codec used for the output stream. Must be |kAudioFormatVorbis| or
+  // |kAudioFormatOpus|.
+  AudioFormat audio_codec;
+
   // Vorbis audio encoder settings.
   VorbisConfig vorbis_config;
 
+  // Opus audio encoder settings.
+  OpusConfig opus_config;
+
+  // Maximum duration of uncompressed audio, in milliseconds, held between
+  // capture and the audio encoder. Older samples are dropped when the encoder
+  // falls further behind.
+  int audio_queue_duration;
+
+  // Maximum time, in milliseconds, that compressed packets from one track
+  // wait for packets from the other before they are muxed anyway. Late
+  // packets are muxed with their timestamp raised to keep the stream
+  // monotonic.
+  int mux_reorder_window;
+
+  // Number of WebM chunks queued between the mux stage and the data sink. The
+  // mux stage stops muxing while the queue is full.
+  int sink_queue_length;
+
+  // Directory for the disk spill of the sink queue. When set, chunks that do
+  // not fit in the sink queue, or that would take it past |spill_threshold|
+  // bytes, are written to memory-mapped files in the directory, and muxing
+  // never waits for the data sink. Leave empty to disable spilling.
+  std::string spill_directory;
+  int64 spill_threshold;
+
+  // Passes partial clusters to the data sink as soon as they are muxed,
+  // instead of waiting for each cluster to complete. Cuts latency from one
+  // cluster duration (the keyframe interval) to about one frame.
+  bool low_latency;
+
+  // Writes clusters with |WebmClusterWriter|, which appends each block to the
+  // chunk buffer in one step, instead of with libwebm. libwebm still writes
+  // the metadata chunk.
+  bool native_clusters;
+
+  // Size, in bytes, at which clusters are split before the keyframe interval
+  // ends. Bounds the muxer buffer and the size of each chunk at high
+  // bitrates. Audio only streams split at the next audio frame, and video
+  // clusters as chosen by |cluster_split_policy|. 0 disables the limit.
+  int64 max_cluster_size;
+  ClusterSplitPolicy cluster_split_policy;
+
+  // Muxes each track into its own WebM stream, as advertised in the DASH
+  // manifest: every track gets its own metadata chunk and media chunks.
+  // Audio clusters start where video clusters start, so chunk N of each
+  // track covers the same time span.
+  bool per_track_output;
+
+  // Writes a dynamic DASH manifest with a SegmentTimeline, and passes an
+  // updated manifest to the data sink after each completed media chunk.
+  bool dash_live_manifest;
+
+  // Time, in seconds, that segments stay listed in the dynamic manifest. 0
+  // lists every segment.
+  int dash_time_shift_buffer_depth;
+
+  // Pool that runs the convert, encode, and sink stages, shared with other
+  // encoders, or NULL to run each stage on its own thread. The pool must be
+  // running, and must outlive the encoder.
+  WorkerPool* worker_pool;
+
+  // Priority of the stages in |worker_pool|.
+  WorkerPool::Priority worker_priority;
+
   // VP8 encoder settings.
   VpxConfig vpx_config;
 
@@ -82,16 +207,66 @@ struct WebmEncoderConfig {
   UserInterfaceOptions ui_opts;
 };
 
+// Distribution of the sizes and durations of the complete clusters passed to
+// the data sink, all tracks together. Values are counted in power of two
+// buckets: bucket 0 counts 0, and bucket N counts values from 2^(N-1) to
+// 2^N - 1.
+struct ClusterStats {
+  static const int kNumBuckets = 48;
+
+  ClusterStats();
+
+  // Counts a cluster of |size| bytes lasting |duration| milliseconds.
+  void AddCluster(int64 size, int64 duration);
+
+  // Return an upper bound of the |percentile|th (0 to 100) cluster size, in
+  // bytes, or duration, in milliseconds: the top of the bucket holding it,
+  // capped by the largest value counted.
+  int64 SizePercentile(double percentile) const;
+  int64 DurationPercentile(double percentile) const;
+
+  int64 clusters;
+  int64 total_size;
+  int64 total_duration;
+  int64 max_size;
+  int64 max_duration;
+
+  // Video clusters started by a frame that is not a keyframe.
+  int64 delta_frame_splits;
+
+  int64 size_buckets[kNumBuckets];
+  int64 duration_buckets[kNumBuckets];
+};
+
+class DashWriter;
 class MediaSourceImpl;
 class LiveWebmMuxer;
 
 // Top level WebM encoder class. Manages capture from A/V input devices, VP8
-// encoding, Vorbis encoding, and muxing into a WebM stream.
+// encoding, Vorbis or Opus encoding, and muxing into a WebM stream.
+//
+// Work after capture is split into pipeline stages, each run on its own thread
+// by a |PipelineStageRunner|, or on |WebmEncoderConfig::worker_pool|:
+//   capture -> convert -> encode (audio, video) -> mux -> sink
+// Stages are connected by bounded queues and never block on a full output;
+// they leave their input queued instead, so a slow stage pushes back on the
+// stages ahead of it until capture starts dropping input. |EncoderThread()| is
+// the mux stage, and also starts and stops the other stages. The mux stage
+// stays on |EncoderThread()| even with a worker pool: it owns the muxers and
+// the stop sequence (final mux, |LiveWebmMuxer::Finalize()|, and the sink
+// drain), which must run in order on one thread. It waits on
+// |mux_work_ready_| when idle; the encode stages signal it when they commit
+// packets, and the sink stage when it makes room.
 class WebmEncoder : public AudioSamplesCallbackInterface,
+                    public SinkSpaceCallbackInterface,
                     public VideoFrameCallbackInterface {
  public:
   // Default size of |chunk_buffer_|.
   static const int kDefaultChunkBufferSize = 100 * 1024;
+
+  // Longest time the mux stage waits for the other stages before it checks
+  // the media source and stage status again.
+  static const int kMuxIdleWaitMilliseconds = 10;
   enum {
     // AV capture implementation unable to setup audio buffer sink.
     kAudioSinkError = -116,
@@ -166,6 +341,9 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   // Returns encoded duration in milliseconds.
   int64 encoded_duration() const;
 
+  // Returns the cluster size and duration distribution so far.
+  ClusterStats cluster_stats() const;
+
   // Returns |WebmEncoderConfig| with fields set to default values.
   static WebmEncoderConfig DefaultConfig();
   WebmEncoderConfig config() const { return config_; }
@@ -175,44 +353,181 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   // |EncoderThread()|.
   virtual int OnSamplesReceived(AudioBuffer* ptr_buffer);
 
+  // |SinkSpaceCallbackInterface| methods
+  // Called on the sink stage thread when the sink stage has room for another
+  // chunk. Wakes |EncoderThread()|.
+  virtual void OnSinkSpaceAvailable();
+
   // |VideoFrameCallbackInterface| methods
   // Method used by |MediaSourceImpl| to push video frames into
   // |EncoderThread()|.
   virtual int OnVideoFrameReceived(VideoFrame* ptr_frame);
 
  private:
-  // Function pointer type used for indirect access to the encoder loop
-  // methods from |EncoderThread()|.
-  typedef int (WebmEncoder::*EncoderLoopFunc)();
+  // Lock free hand-off queues between the convert, encode, and mux stages.
+  typedef SpscQueue<AudioBuffer, SpscBufferExchange<AudioBuffer> >
+      AudioBufferQueue;
+  typedef SpscQueue<VideoFrame, SpscBufferExchange<VideoFrame> >
+      VideoFrameQueue;
+
+  // A chunk copied out of |chunk_buffer_| to wait for sink stage space.
+  struct HeldChunk {
+    ChunkInfo info;
+    std::vector<uint8> data;
+  };
 
   // Returns true when user wants the encode thread to stop.
   bool StopRequested();
 
-  // Reads chunk from |ptr_muxer_| and reallocates |chunk_buffer_| when
-  // necessary. Returns true when successful.
-  bool ReadChunkFromMuxer(int32 chunk_length);
+  // Wakes |EncoderThread()| when it waits in |WaitForMuxWork()|. Called when
+  // an encode stage commits or blocks on a packet, when the sink stage makes
+  // room, and by |Stop()|.
+  void WakeMuxer();
 
-  // Encoding thread function.
-  void EncoderThread();
+  // Waits until |WakeMuxer()| is called, or for at most
+  // |kMuxIdleWaitMilliseconds|.
+  void WaitForMuxWork();
 
-  // Audio/Video |EncoderLoopFunc|s. Called by |EncoderThread()| via
-  // |ptr_encode_func_|. All loop functions return |kSuccess| when the encode
-  // pass succeeds.
-  int EncodeAudioOnly();
-  int AVEncode();
-  int EncodeVideoFrame();
+  // Constructs and initializes a |LiveWebmMuxer| in |ptr_muxer|. Returns
+  // |kSuccess| when successful.
+  int CreateMuxer(int32 cluster_duration_milliseconds,
+                  std::unique_ptr<LiveWebmMuxer>* ptr_muxer);
+
+  // Returns the muxer that receives audio.
+  LiveWebmMuxer* audio_muxer() const;
+
+  // Reads chunk from |ptr_muxer| and reallocates |chunk_buffer_| when
+  // necessary. Returns true when successful.
+  bool ReadChunkFromMuxer(LiveWebmMuxer* ptr_muxer, int32 chunk_length);
+
+  // Moves one chunk from |ptr_muxer| to the sink stage when a chunk is ready
+  // and the sink queue has room, and sets |ptr_moved| to true when it does.
+  // A chunk the sink stage refuses with |DataSinkStage::kFull| is kept in
+  // |chunk_buffer_| and retried by the next call for the same muxer; calls
+  // for other muxers do nothing meanwhile. Returns false when reading or
+  // queueing the chunk fails.
+  bool MoveChunkToSink(LiveWebmMuxer* ptr_muxer, bool* ptr_moved);
+
+  // Adds the chunk to the manifest and the cluster stats once the sink stage
+  // has accepted it.
+  void ChunkQueued(const ChunkInfo& info, int32 length);
+
+  // Queues the chunk held by |MoveChunkToSink| with |QueueForSink()|.
+  // Returns true when there is none, or when it is queued.
+  bool WritePendingChunk();
+
+  // Queues |data_length| bytes from |ptr_data| for the sink stage. When the
+  // sink stage is full the chunk is copied to |held_chunks_|, and every later
+  // chunk is held behind it to keep the order. Used for the final chunks.
+  // Returns false when the sink stage fails.
+  bool QueueForSink(const ChunkInfo& info,
+                    const uint8* ptr_data,
+                    int32 data_length);
+
+  // Moves chunks from |held_chunks_| to the sink stage until it is full.
+  // Returns false when the sink stage fails.
+  bool WriteHeldChunks();
+
+  // Calls |LiveWebmMuxer::Finalize()| on |ptr_muxer|, and queues the final
+  // chunks for the sink stage.
+  void FinalizeMuxer(LiveWebmMuxer* ptr_muxer);
+
+  // Creates |ptr_dash_writer_|, and queues the initial DASH manifest for the
+  // sink stage.
+  void QueueManifest();
+
+  // Appends the segment described by |info| to the dynamic manifest when
+  // |info| describes a complete media chunk.
+  void AddManifestSegment(const ChunkInfo& info);
+
+  // Adds the |chunk_length| bytes of the media chunk described by |info| to
+  // the size of its cluster, and counts the cluster in |cluster_stats_| when
+  // the chunk completes it.
+  void UpdateClusterStats(const ChunkInfo& info, int32 chunk_length);
+
+  // Logs |cluster_stats_|.
+  void LogClusterStats() const;
+
+  // Queues the dynamic manifest for the sink stage when segments have been
+  // added since it was last queued. Queues the update with |QueueForSink()|
+  // when |hold| is true, and otherwise leaves it pending while the queue is
+  // full. Returns false when queueing fails.
+  bool QueueManifestUpdate(bool hold);
+
+  // Mux stage thread function. Starts and stops the other pipeline stages.
+  void EncoderThread();
 
-  // Utility function used to encode a single audio input buffer.
-  int EncodeAudioBuffer();
+  // Starts the convert, encode, and sink stages.
+  int StartStages();
+
+  // Starts |ptr_stage| on |ptr_runner|, on |config_.worker_pool| when set.
+  int StartStage(const std::string& name,
+                 PipelineStageInterface* ptr_stage,
+                 PipelineStageRunner* ptr_runner);
+
+  // Stops the convert and encode stages.
+  void StopEncodeStages();
+
+  // Returns the first error reported by a running stage, or |kSuccess|.
+  int StageStatus() const;
+
+  // Pipeline stage functions, run via |MemberFunctionStage|. Each sets
+  // |ptr_did_work| to true when it made progress, and returns |kSuccess|
+  // unless an error occurred.
+  //
+  // Reads one block from |audio_queue_|, converts it, and commits it to
+  // |converted_audio_queue_|.
+  int ConvertAudioBuffer(bool* ptr_did_work);
+
+  // Reads one frame from |video_pool_|, compresses it, and commits it to
+  // |compressed_video_queue_|.
+  int EncodeVideoFrame(bool* ptr_did_work);
+
+  // Reads one block from |converted_audio_queue_|, or from |audio_queue_| when
+  // there is no conversion stage, compresses it, and commits all compressed
+  // audio to |compressed_audio_queue_|.
+  int EncodeAudioBuffer(bool* ptr_did_work);
+
+  // Returns the number of sample frames the first audio stage reads from
+  // |audio_queue_| at a time.
+  int32 AudioBlockFrames() const;
+
+  // Reads |num_frames| from |audio_queue_| into |ptr_buffer|. Pads the last
+  // partial block with silence when |flush_audio_| is true.
+  int ReadAudioBlock(int32 num_frames, AudioBuffer* ptr_buffer);
+
+  // Runs the audio stages on the mux thread after they are stopped, until
+  // the samples left in |audio_queue_| are encoded.
+  void FlushAudio();
+
+  // Commit helpers for the stage functions. When the target queue is full the
+  // sample stays in place and its blocked flag is set; the next pass retries
+  // the commit before reading more input.
+  int CommitConvertedAudio(bool* ptr_did_work);
+  int CommitCompressedVideo(bool* ptr_did_work);
+  int CommitCompressedAudio(bool* ptr_did_work);
+
+  // Moves compressed packets from |compressed_audio_queue_| and
+  // |compressed_video_queue_| into the muxers in timestamp order. When
+  // |flush| is false, packets from one track wait for the other track until
+  // |WebmEncoderConfig::mux_reorder_window| is exceeded. Sets |ptr_muxed| to
+  // true when at least one packet was muxed.
+  int MuxCompressedPackets(bool flush, bool* ptr_muxed);
+
+  // Returns true when the head packet of one track, with timestamp
+  // |head_timestamp|, may be muxed while the other track has no packet
+  // waiting. |newest_timestamp| is the timestamp of the last packet the
+  // track's encoder committed, and |commit_blocked| is true while the
+  // encoder holds a packet its queue has no room for.
+  bool ReorderWindowExpired(int64 head_timestamp,
+                            int64 newest_timestamp,
+                            bool commit_blocked) const;
 
   // Waits for input samples from |ptr_media_source_| and sets
   // |timestamp_offset_| when one or both streams start with a negative
   // timestamp.
   int WaitForSamples();
 
-  // Returns the timestamp of the next available video frame via |timestamp|.
-  int PeekVideoTimestamp(int64* timestamp);
-
   // Set to true when |Init()| is successful.
   bool initialized_;
 
@@ -224,18 +539,68 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   std::unique_ptr<uint8[]> chunk_buffer_;
   int32 chunk_buffer_size_;
 
+  // Muxer that produced the chunk in |chunk_buffer_| when the sink stage
+  // refused it, and the chunk's info and length. NULL when no chunk waits.
+  LiveWebmMuxer* ptr_pending_muxer_;
+  ChunkInfo pending_chunk_info_;
+  int32 pending_chunk_length_;
+
+  // Final chunks waiting for sink stage space. Used only by the mux stage.
+  std::deque<HeldChunk> held_chunks_;
+
+  // Wakeup state for |WaitForMuxWork()|. |mux_work_pending_| is protected by
+  // |mux_work_mutex_|.
+  std::mutex mux_work_mutex_;
+  std::condition_variable mux_work_ready_;
+  bool mux_work_pending_;
+
   // Pointer to platform specific audio/video source object implementation.
   std::unique_ptr<MediaSourceImpl> ptr_media_source_;
 
-  // Pointer to live WebM muxer.
+  // Pointer to live WebM muxer. Receives both tracks, or only video when
+  // |ptr_audio_muxer_| is non-NULL.
   std::unique_ptr<LiveWebmMuxer> ptr_muxer_;
 
+  // Audio muxer used when |WebmEncoderConfig::per_track_output| is true and
+  // both tracks are enabled. NULL otherwise.
+  std::unique_ptr<LiveWebmMuxer> ptr_audio_muxer_;
+
+  // DASH manifest writer, and a flag set while the sink has not received
+  // the dynamic manifest listing the latest segments.
+  std::unique_ptr<DashWriter> ptr_dash_writer_;
+  bool manifest_update_pending_;
+
   // Mutex providing synchronization between user interface and encoder thread.
   mutable std::mutex mutex_;
 
   // Encoder thread object.
   std::shared_ptr<std::thread> encode_thread_;
 
+  // Timestamps of the newest packets committed to the compressed queues, and
+  // flags set while an encode stage holds a packet its queue has no room for.
+  std::atomic<int64> newest_audio_timestamp_;
+  std::atomic<int64> newest_video_timestamp_;
+  std::atomic<bool> audio_commit_blocked_;
+  std::atomic<bool> video_commit_blocked_;
+
+  // Set while the convert stage holds a buffer |converted_audio_queue_| has no
+  // room for. Used only by the convert stage.
+  bool convert_commit_blocked_;
+
+  // Timestamp of the last packet passed to the muxers.
+  int64 last_mux_timestamp_;
+
+  // Set when the mux stage has asked |video_encoder_| for a keyframe to split
+  // a full cluster, until the next video cluster starts.
+  bool split_keyframe_requested_;
+
+  // Bytes read so far from the cluster being read from each muxer, indexed by
+  // |ChunkInfo::Track|. Used only by the mux stage.
+  int64 cluster_bytes_read_[3];
+
+  // Cluster statistics. Protected by |mutex_|.
+  ClusterStats cluster_stats_;
+
   // Data sink to which WebM chunks are written.
   DataSinkInterface* ptr_data_sink_;
 
@@ -249,34 +614,73 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   // Most recent frame from |video_encoder_|.
   VideoFrame vpx_frame_;
 
+  // Compressed video frames waiting for |MuxCompressedPackets()|. The video
+  // encode stage is the only producer and the mux stage the only consumer.
+  VideoFrameQueue compressed_video_queue_;
+
+  // Most recent frame from |compressed_video_queue_|.
+  VideoFrame mux_video_frame_;
+
   // Video encoder.
   VideoEncoder video_encoder_;
 
   // Encoded duration in milliseconds.
   int64 encoded_duration_;
 
-  // Buffer object used to push |AudioBuffer|s from |MediaSourceImpl| into
+  // Sample ring used to push audio from |MediaSourceImpl| into
   // |EncoderThread()|.
-  BufferPool<AudioBuffer> audio_pool_;
+  AudioQueue audio_queue_;
 
-  // Most recent uncompressed audio buffer from |audio_pool_|.
+  // Most recent uncompressed audio buffer from |audio_queue_|.
   AudioBuffer raw_audio_buffer_;
 
-  // Most recent vorbis audio buffer from |vorbis_encoder_|.
-  AudioBuffer vorbis_audio_buffer_;
+  // Set by |FlushAudio()|.
+  bool flush_audio_;
+
+  // Sample rate and channel converter. NULL when the capture format is passed
+  // to |audio_encoder_| unchanged.
+  std::unique_ptr<AudioConverter> ptr_audio_converter_;
+
+  // Most recent buffer from |ptr_audio_converter_|.
+  AudioBuffer converted_audio_buffer_;
+
+  // Converted audio waiting for the audio encode stage. The convert stage is
+  // the only producer.
+  AudioBufferQueue converted_audio_queue_;
 
-  // Vorbis encoder object.
-  VorbisEncoder vorbis_encoder_;
+  // Most recent buffer from |converted_audio_queue_|.
+  AudioBuffer encoder_input_buffer_;
+
+  // Most recent compressed audio buffer from |audio_encoder_|.
+  AudioBuffer compressed_audio_buffer_;
+
+  // Audio encoder object.
+  AudioEncoder audio_encoder_;
+
+  // Compressed audio buffers waiting for |MuxCompressedPackets()|. The audio
+  // encode stage is the only producer and the mux stage the only consumer.
+  AudioBufferQueue compressed_audio_queue_;
+
+  // Most recent buffer from |compressed_audio_queue_|.
+  AudioBuffer mux_audio_buffer_;
 
   // Encoder configuration.
   WebmEncoderConfig config_;
 
-  // Encoder loop function pointer.
-  EncoderLoopFunc ptr_encode_func_;
-
   // Timestamp adjustment value. Expressed in milliseconds. Used to change
   // input buffer timestamps when a stream starts with a timestamp less than 0.
   int64 timestamp_offset_;
+
+  // Pipeline stages. Runners are declared last so that they are destroyed,
+  // and their threads joined, before the state the stages use.
+  DataSinkStage sink_stage_;
+  MemberFunctionStage<WebmEncoder> convert_stage_;
+  MemberFunctionStage<WebmEncoder> audio_encode_stage_;
+  MemberFunctionStage<WebmEncoder> video_encode_stage_;
+  PipelineStageRunner convert_runner_;
+  PipelineStageRunner audio_encode_runner_;
+  PipelineStageRunner video_encode_runner_;
+  PipelineStageRunner sink_runner_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmEncoder);
 };
 
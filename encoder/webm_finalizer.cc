@@ -0,0 +1,348 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/webm_finalizer.h"
+
+#include <cstdio>
+#include <functional>
+#include <new>
+#include <vector>
+
+#include "glog/logging.h"
+#include "libwebm/mkvmuxer.hpp"
+#include "libwebm/mkvparser.hpp"
+#include "libwebm/mkvreader.hpp"
+#include "libwebm/mkvwriter.hpp"
+
+namespace {
+
+const char kRemuxFileSuffix[] = ".remux";
+const char kTempFileSuffix[] = ".tmp";
+
+// Renames |from| to |to|, replacing |to| when it exists. Returns true when
+// successful.
+bool RenameReplacing(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+  return MoveFileExA(from.c_str(), to.c_str(),
+                     MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+  return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+// Lowers the priority of the calling thread below capture and encoding.
+void LowerThreadPriority() {
+#ifdef _WIN32
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#endif
+}
+
+// Adds a track matching |parser_track| to |ptr_segment|. Returns the number
+// of the new track, or 0 when the track cannot be added.
+uint64 CopyTrack(const mkvparser::Track& parser_track,
+                 mkvmuxer::Segment* ptr_segment) {
+  const int32 number = static_cast<int32>(parser_track.GetNumber());
+  uint64 track_num = 0;
+  if (parser_track.GetType() == mkvparser::Track::kVideo) {
+    const mkvparser::VideoTrack& video =
+        static_cast<const mkvparser::VideoTrack&>(parser_track);
+    track_num = ptr_segment->AddVideoTrack(
+        static_cast<int32>(video.GetWidth()),
+        static_cast<int32>(video.GetHeight()), number);
+  } else if (parser_track.GetType() == mkvparser::Track::kAudio) {
+    const mkvparser::AudioTrack& audio =
+        static_cast<const mkvparser::AudioTrack&>(parser_track);
+    track_num = ptr_segment->AddAudioTrack(
+        static_cast<int32>(audio.GetSamplingRate()),
+        static_cast<int32>(audio.GetChannels()), number);
+    mkvmuxer::AudioTrack* const ptr_audio_track =
+        static_cast<mkvmuxer::AudioTrack*>(
+            ptr_segment->GetTrackByNumber(track_num));
+    if (ptr_audio_track && audio.GetBitDepth() > 0) {
+      ptr_audio_track->set_bit_depth(audio.GetBitDepth());
+    }
+  } else {
+    LOG(WARNING) << "finalizer skipped track " << number << " of type "
+                 << parser_track.GetType();
+    return 0;
+  }
+  mkvmuxer::Track* const ptr_track = ptr_segment->GetTrackByNumber(track_num);
+  if (!ptr_track) {
+    LOG(ERROR) << "cannot add track " << number;
+    return 0;
+  }
+  ptr_track->set_codec_id(parser_track.GetCodecId());
+  ptr_track->set_codec_delay(parser_track.GetCodecDelay());
+  ptr_track->set_seek_pre_roll(parser_track.GetSeekPreRoll());
+  size_t private_length = 0;
+  const uint8* const ptr_private =
+      parser_track.GetCodecPrivate(private_length);
+  if (ptr_private && private_length > 0 &&
+      !ptr_track->SetCodecPrivate(ptr_private, private_length)) {
+    LOG(ERROR) << "cannot copy codec private data of track " << number;
+    return 0;
+  }
+  return track_num;
+}
+
+}  // namespace
+
+namespace webmlive {
+
+WebmFinalizer::WebmFinalizer() : stop_(false) {
+}
+
+WebmFinalizer::~WebmFinalizer() {
+  Stop();
+}
+
+int WebmFinalizer::Run() {
+  using std::bind;
+  using std::nothrow;
+  using std::shared_ptr;
+  using std::thread;
+  stop_ = false;
+  thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&WebmFinalizer::FinalizerThread,  // NOLINT
+                                this)));
+  if (!thread_) {
+    LOG(ERROR) << "cannot construct finalizer thread.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+void WebmFinalizer::Stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    if (!queue_.empty()) {
+      LOG(INFO) << "finalizing " << queue_.size() << " recording(s)...";
+    }
+  }
+  file_queued_.notify_one();
+  thread_->join();
+  thread_.reset();
+}
+
+int WebmFinalizer::Enqueue(const std::string& path) {
+  if (path.empty()) {
+    LOG(ERROR) << "cannot finalize empty path.";
+    return kInvalidArg;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(path);
+  }
+  file_queued_.notify_one();
+  return kSuccess;
+}
+
+int WebmFinalizer::Finalize(const std::string& path) {
+  const std::string remux_path = path + kRemuxFileSuffix;
+  const std::string temp_path = path + kTempFileSuffix;
+  const int status = Remux(path, remux_path, temp_path);
+  remove(remux_path.c_str());
+  if (status) {
+    remove(temp_path.c_str());
+    return status;
+  }
+  if (!RenameReplacing(temp_path, path)) {
+    LOG(ERROR) << "cannot rename " << temp_path << " to " << path;
+    remove(temp_path.c_str());
+    return kFileError;
+  }
+  LOG(INFO) << "finalized " << path;
+  return kSuccess;
+}
+
+int WebmFinalizer::Remux(const std::string& input_path,
+                         const std::string& remux_path,
+                         const std::string& output_path) {
+  mkvparser::MkvReader reader;
+  if (reader.Open(input_path.c_str())) {
+    LOG(ERROR) << "cannot open " << input_path;
+    return kFileError;
+  }
+  mkvparser::EBMLHeader ebml_header;
+  long long pos = 0;  // NOLINT
+  if (ebml_header.Parse(&reader, pos) < 0) {
+    LOG(ERROR) << "no EBML header in " << input_path;
+    return kParseError;
+  }
+  mkvparser::Segment* ptr_parser_segment = NULL;
+  if (mkvparser::Segment::CreateInstance(&reader, pos, ptr_parser_segment)) {
+    LOG(ERROR) << "no segment in " << input_path;
+    return kParseError;
+  }
+  std::unique_ptr<mkvparser::Segment> parser_segment(ptr_parser_segment);
+  if (parser_segment->ParseHeaders() < 0) {
+    LOG(ERROR) << "cannot parse headers of " << input_path;
+    return kParseError;
+  }
+
+  mkvmuxer::MkvWriter remux_writer;
+  if (!remux_writer.Open(remux_path.c_str())) {
+    LOG(ERROR) << "cannot open " << remux_path;
+    return kFileError;
+  }
+  mkvmuxer::Segment segment;
+  if (!segment.Init(&remux_writer)) {
+    LOG(ERROR) << "cannot Init Segment.";
+    return kMuxerError;
+  }
+  segment.set_mode(mkvmuxer::Segment::kFile);
+  segment.OutputCues(true);
+  const mkvparser::SegmentInfo* const ptr_info = parser_segment->GetInfo();
+  mkvmuxer::SegmentInfo* const ptr_segment_info = segment.GetSegmentInfo();
+  ptr_segment_info->set_timecode_scale(ptr_info->GetTimeCodeScale());
+  std::string app_name = kClientName;
+  app_name += " v";
+  app_name += kClientVersion;
+  ptr_segment_info->set_writing_app(app_name.c_str());
+
+  // Copy the tracks, and index the video track, or the first audio track
+  // when there is no video.
+  const mkvparser::Tracks* const ptr_tracks = parser_segment->GetTracks();
+  uint64 cues_track = 0;
+  bool cues_on_video = false;
+  for (unsigned long i = 0; i < ptr_tracks->GetTracksCount(); ++i) {  // NOLINT
+    const mkvparser::Track* const ptr_track = ptr_tracks->GetTrackByIndex(i);
+    if (!ptr_track) {
+      continue;
+    }
+    const uint64 track_num = CopyTrack(*ptr_track, &segment);
+    if (!track_num) {
+      if (ptr_track->GetType() == mkvparser::Track::kVideo ||
+          ptr_track->GetType() == mkvparser::Track::kAudio) {
+        return kMuxerError;
+      }
+      continue;
+    }
+    const bool video = ptr_track->GetType() == mkvparser::Track::kVideo;
+    if (!cues_track || (video && !cues_on_video)) {
+      cues_track = track_num;
+      cues_on_video = video;
+    }
+  }
+  if (!cues_track || !segment.CuesTrack(cues_track)) {
+    LOG(ERROR) << "no audio or video track in " << input_path;
+    return kMuxerError;
+  }
+
+  // Copy the frames. Clusters are loaded as they are reached, and frame data
+  // is read into |frame| one frame at a time. mkvparser has no way to unload
+  // a cluster, so the clusters read stay in |parser_segment|.
+  std::vector<uint8> frame;
+  int64 first_time = -1;
+  const mkvparser::Cluster* ptr_cluster = parser_segment->GetFirst();
+  while (ptr_cluster && !ptr_cluster->EOS()) {
+    const mkvparser::BlockEntry* ptr_entry = NULL;
+    long status = ptr_cluster->GetFirst(ptr_entry);  // NOLINT
+    while (status >= 0 && ptr_entry && !ptr_entry->EOS()) {
+      const mkvparser::Block* const ptr_block = ptr_entry->GetBlock();
+      const int64 block_time = ptr_block->GetTime(ptr_cluster);
+      if (first_time < 0) {
+        first_time = block_time;
+      }
+      const uint64 timestamp =
+          block_time > first_time ? block_time - first_time : 0;
+      const uint64 track_num = ptr_block->GetTrackNumber();
+      if (segment.GetTrackByNumber(track_num)) {
+        for (int f = 0; f < ptr_block->GetFrameCount(); ++f) {
+          const mkvparser::Block::Frame& block_frame = ptr_block->GetFrame(f);
+          if (block_frame.len <= 0) {
+            // Nothing to copy, and |frame| has no element to point at.
+            LOG(WARNING) << "skipped empty frame in " << input_path;
+            continue;
+          }
+          frame.resize(static_cast<size_t>(block_frame.len));
+          if (block_frame.Read(&reader, &frame[0])) {
+            LOG(ERROR) << "cannot read frame in " << input_path;
+            return kParseError;
+          }
+          const int64 discard_padding = ptr_block->GetDiscardPadding();
+          const bool added = discard_padding ?
+              segment.AddFrameWithDiscardPadding(&frame[0], frame.size(),
+                                                 discard_padding, track_num,
+                                                 timestamp,
+                                                 ptr_block->IsKey()) :
+              segment.AddFrame(&frame[0], frame.size(), track_num, timestamp,
+                               ptr_block->IsKey());
+          if (!added) {
+            LOG(ERROR) << "cannot add frame from " << input_path;
+            return kMuxerError;
+          }
+        }
+      }
+      status = ptr_cluster->GetNext(ptr_entry, ptr_entry);
+    }
+    if (status < 0) {
+      // A recording cut short ends in a partial cluster; keep what parsed.
+      LOG(WARNING) << "truncated cluster in " << input_path;
+      break;
+    }
+    ptr_cluster = parser_segment->GetNext(ptr_cluster);
+  }
+  if (first_time < 0) {
+    LOG(ERROR) << "no frames in " << input_path;
+    return kParseError;
+  }
+
+  // Finalize writes the duration and the Cues after the clusters. The copy
+  // moves the Cues ahead of the clusters.
+  if (!segment.Finalize()) {
+    LOG(ERROR) << "cannot Finalize " << remux_path;
+    return kMuxerError;
+  }
+  remux_writer.Close();
+
+  mkvparser::MkvReader remux_reader;
+  if (remux_reader.Open(remux_path.c_str())) {
+    LOG(ERROR) << "cannot open " << remux_path;
+    return kFileError;
+  }
+  mkvmuxer::MkvWriter output_writer;
+  if (!output_writer.Open(output_path.c_str())) {
+    LOG(ERROR) << "cannot open " << output_path;
+    return kFileError;
+  }
+  if (!segment.CopyAndMoveCuesBeforeClusters(&remux_reader, &output_writer)) {
+    LOG(ERROR) << "cannot move Cues before clusters in " << output_path;
+    return kMuxerError;
+  }
+  output_writer.Close();
+  remux_reader.Close();
+  return kSuccess;
+}
+
+void WebmFinalizer::FinalizerThread() {
+  LowerThreadPriority();
+  LOG(INFO) << "finalizer thread running...";
+  for (;;) {
+    std::string path;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      file_queued_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        break;
+      }
+      path = queue_.front();
+      queue_.pop_front();
+    }
+    const int status = Finalize(path);
+    if (status) {
+      LOG(ERROR) << "cannot finalize " << path << ", status=" << status;
+    }
+  }
+  LOG(INFO) << "finalizer thread done";
+}
+
+}  // namespace webmlive
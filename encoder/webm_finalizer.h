@@ -0,0 +1,89 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WEBM_FINALIZER_H_
+#define WEBMLIVE_ENCODER_WEBM_FINALIZER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+// Rewrites live WebM files, which have no Cues and no duration, as seekable
+// on demand WebM files with the Cues element ahead of the clusters.
+//
+// Notes:
+// - Frame data is copied one frame at a time, but memory use still grows
+//   with the file: the parser keeps every cluster and block entry it has
+//   read until the remux ends, roughly 130 bytes per block, or about 40 MB
+//   for an hour of 30 fps video with audio. The muxer's Cues add one entry
+//   per cluster.
+// - Timestamps are rebased so that each file starts at 0.
+// - The finalized file replaces the original only once it is complete. The
+//   original is left in place when finalizing fails.
+// - Files passed to |Enqueue()| are finalized on a low priority thread, so
+//   finalizing does not compete with capture and encoding.
+class WebmFinalizer {
+ public:
+  enum {
+    kParseError = -5,
+    kMuxerError = -4,
+    kFileError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  WebmFinalizer();
+  ~WebmFinalizer();
+
+  // Starts the finalizer thread.
+  int Run();
+
+  // Finalizes all queued files, and stops the finalizer thread.
+  void Stop();
+
+  // Queues |path| for the finalizer thread. Returns |kSuccess| when
+  // successful.
+  int Enqueue(const std::string& path);
+
+  // Finalizes |path| on the calling thread. Returns |kSuccess| when
+  // successful.
+  static int Finalize(const std::string& path);
+
+ private:
+  // Remuxes |input_path| into a seekable file with the Cues element ahead of
+  // the clusters at |output_path|. |remux_path| holds the intermediate file
+  // with Cues after the clusters.
+  static int Remux(const std::string& input_path,
+                   const std::string& remux_path,
+                   const std::string& output_path);
+
+  // Finalizer thread function. Finalizes queued files until stopped and the
+  // queue is empty.
+  void FinalizerThread();
+
+  // All protected by |mutex_|.
+  std::deque<std::string> queue_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable file_queued_;
+
+  std::shared_ptr<std::thread> thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmFinalizer);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WEBM_FINALIZER_H_
@@ -0,0 +1,105 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/webm_finalizer.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "libwebm/mkvmuxer.hpp"
+#include "libwebm/mkvparser.hpp"
+#include "libwebm/mkvreader.hpp"
+#include "libwebm/mkvwriter.hpp"
+
+namespace webmlive {
+namespace {
+
+const char kTestFile[] = "webm_finalizer_unittest.webm";
+const int kNumFrames = 90;
+const uint64 kFrameDuration = 33000000ULL;  // In nanoseconds.
+const uint64 kFirstFrameTime = 5000000000ULL;
+const int kKeyframeInterval = 30;
+
+class WebmFinalizerTest : public ::testing::Test {
+ protected:
+  virtual ~WebmFinalizerTest() {
+    remove(kTestFile);
+  }
+
+  // Writes a live mode recording of one video track, with a keyframe cluster
+  // every |kKeyframeInterval| frames, starting at |kFirstFrameTime|.
+  void WriteLiveFile() {
+    mkvmuxer::MkvWriter writer;
+    ASSERT_TRUE(writer.Open(kTestFile));
+    mkvmuxer::Segment segment;
+    ASSERT_TRUE(segment.Init(&writer));
+    segment.set_mode(mkvmuxer::Segment::kLive);
+    const uint64 track_num = segment.AddVideoTrack(320, 240, 1);
+    ASSERT_NE(0u, track_num);
+    const std::vector<uint8> frame(1000, 0x55);
+    for (int i = 0; i < kNumFrames; ++i) {
+      ASSERT_TRUE(segment.AddFrame(&frame[0], frame.size(), track_num,
+                                   kFirstFrameTime + i * kFrameDuration,
+                                   i % kKeyframeInterval == 0));
+    }
+    ASSERT_TRUE(segment.Finalize());
+    writer.Close();
+  }
+};
+
+// The finalized file has a duration, Cues ahead of the first cluster, and
+// timestamps that start at 0.
+TEST_F(WebmFinalizerTest, CuesBeforeClusters) {
+  WriteLiveFile();
+  ASSERT_EQ(WebmFinalizer::kSuccess, WebmFinalizer::Finalize(kTestFile));
+
+  mkvparser::MkvReader reader;
+  ASSERT_EQ(0, reader.Open(kTestFile));
+  mkvparser::EBMLHeader ebml_header;
+  long long pos = 0;  // NOLINT
+  ASSERT_GE(ebml_header.Parse(&reader, pos), 0);
+  mkvparser::Segment* ptr_segment = NULL;
+  ASSERT_EQ(0, mkvparser::Segment::CreateInstance(&reader, pos, ptr_segment));
+  std::unique_ptr<mkvparser::Segment> segment(ptr_segment);
+  ASSERT_GE(segment->ParseHeaders(), 0);
+  EXPECT_GT(segment->GetInfo()->GetDuration(), 0);
+
+  const mkvparser::Cues* const ptr_cues = segment->GetCues();
+  ASSERT_TRUE(ptr_cues != NULL);
+  const mkvparser::Cluster* const ptr_cluster = segment->GetFirst();
+  ASSERT_TRUE(ptr_cluster != NULL);
+  ASSERT_FALSE(ptr_cluster->EOS());
+  EXPECT_LT(ptr_cues->m_element_start, ptr_cluster->m_element_start);
+
+  const mkvparser::BlockEntry* ptr_entry = NULL;
+  ASSERT_GE(ptr_cluster->GetFirst(ptr_entry), 0);
+  ASSERT_TRUE(ptr_entry != NULL);
+  EXPECT_EQ(0, ptr_entry->GetBlock()->GetTime(ptr_cluster));
+
+  // Every frame was copied.
+  int frames = 0;
+  for (const mkvparser::Cluster* ptr_next = ptr_cluster;
+       ptr_next && !ptr_next->EOS(); ptr_next = segment->GetNext(ptr_next)) {
+    const mkvparser::BlockEntry* ptr_block_entry = NULL;
+    long status = ptr_next->GetFirst(ptr_block_entry);  // NOLINT
+    while (status >= 0 && ptr_block_entry && !ptr_block_entry->EOS()) {
+      frames += ptr_block_entry->GetBlock()->GetFrameCount();
+      status = ptr_next->GetNext(ptr_block_entry, ptr_block_entry);
+    }
+  }
+  EXPECT_EQ(kNumFrames, frames);
+}
+
+TEST_F(WebmFinalizerTest, MissingFile) {
+  EXPECT_EQ(WebmFinalizer::kFileError, WebmFinalizer::Finalize(kTestFile));
+}
+
+}  // namespace
+}  // namespace webmlive
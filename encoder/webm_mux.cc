@@ -8,9 +8,15 @@
 
 #include "encoder/webm_mux.h"
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
 #include <new>
+#include <sstream>
 #include <vector>
 
+#include "encoder/webm_buffer_parser.h"
+#include "encoder/webm_cluster_writer.h"
 #include "glog/logging.h"
 #include "libwebm/mkvmuxer.hpp"
 #include "libwebm/webmids.hpp"
@@ -43,12 +49,28 @@ class WebmMuxWriter : public mkvmuxer::IMkvWriter {
   int32 Init(LiveWebmMuxer::WriteBuffer* ptr_write_buffer);
 
   // Accessors.
+  int64 bytes_buffered() const { return bytes_buffered_; }
   int64 bytes_written() const { return bytes_written_; }
   int64 chunk_end() const { return chunk_end_; }
+  int64 clusters_started() const { return clusters_started_; }
+  int64 cluster_position() const { return cluster_position_; }
+  const std::deque<int64>& block_positions() const { return block_positions_; }
 
-  // Erases chunk from |ptr_write_buffer_|, resets |chunk_end_| to 0, and
-  // updates |bytes_buffered_|.
-  void EraseChunk();
+  // Returns the stream position of the first byte in |ptr_write_buffer_|.
+  int64 buffer_position() const { return bytes_written_ - bytes_buffered_; }
+
+  // Erases |chunk_length| bytes from the front of |ptr_write_buffer_|, moves
+  // |chunk_end_| back by the same amount, and updates |bytes_buffered_| and
+  // |block_positions_|.
+  void EraseChunk(int32 chunk_length);
+
+  // Keeps the EBML header, segment info, and tracks libwebm wrote with the
+  // first frame, and discards the cluster libwebm started after them.
+  void KeepHeaderOnly();
+
+  // Accounts for the elements |WebmClusterWriter| appended to
+  // |ptr_write_buffer_| at |offsets|.
+  void ClusterWriterAppended(const WebmClusterWriter::FrameOffsets& offsets);
 
   // mkvmuxer::IMkvWriter methods
   // Returns total bytes of data passed to |Write|.
@@ -71,6 +93,13 @@ class WebmMuxWriter : public mkvmuxer::IMkvWriter {
   int64 bytes_buffered_;
   int64 bytes_written_;
   int64 chunk_end_;
+  int64 clusters_started_;
+
+  // Stream position of the last cluster started.
+  int64 cluster_position_;
+
+  // Stream positions of the blocks in |ptr_write_buffer_|, oldest first.
+  std::deque<int64> block_positions_;
   LiveWebmMuxer::WriteBuffer* ptr_write_buffer_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmMuxWriter);
 };
@@ -79,6 +108,8 @@ WebmMuxWriter::WebmMuxWriter()
     : bytes_buffered_(0),
       bytes_written_(0),
       chunk_end_(0),
+      clusters_started_(0),
+      cluster_position_(0),
       ptr_write_buffer_(NULL) {
 }
 
@@ -94,16 +125,48 @@ int32 WebmMuxWriter::Init(LiveWebmMuxer::WriteBuffer* ptr_write_buffer) {
   return kSuccess;
 }
 
-void WebmMuxWriter::EraseChunk() {
+void WebmMuxWriter::EraseChunk(int32 chunk_length) {
   if (ptr_write_buffer_) {
     LiveWebmMuxer::WriteBuffer::iterator erase_end_pos =
-        ptr_write_buffer_->begin() + static_cast<int32>(chunk_end_);
+        ptr_write_buffer_->begin() + chunk_length;
     ptr_write_buffer_->erase(ptr_write_buffer_->begin(), erase_end_pos);
     bytes_buffered_ = ptr_write_buffer_->size();
-    chunk_end_ = 0;
+    chunk_end_ = chunk_end_ > chunk_length ? chunk_end_ - chunk_length : 0;
+    while (!block_positions_.empty() &&
+           block_positions_.front() < buffer_position()) {
+      block_positions_.pop_front();
+    }
   }
 }
 
+// Nothing has been read from the buffer when the first frame is written, so
+// the header is the data before the first cluster, or all data when libwebm
+// holds the frame back.
+void WebmMuxWriter::KeepHeaderOnly() {
+  const int64 header_length =
+      clusters_started_ > 0 ? chunk_end_ : bytes_buffered_;
+  ptr_write_buffer_->resize(static_cast<size_t>(header_length));
+  bytes_written_ = header_length;
+  bytes_buffered_ = header_length;
+  chunk_end_ = 0;
+  clusters_started_ = 0;
+  cluster_position_ = 0;
+  block_positions_.clear();
+}
+
+void WebmMuxWriter::ClusterWriterAppended(
+    const WebmClusterWriter::FrameOffsets& offsets) {
+  if (offsets.cluster_offset >= 0) {
+    chunk_end_ = offsets.cluster_offset;
+    cluster_position_ = buffer_position() + offsets.cluster_offset;
+    ++clusters_started_;
+  }
+  block_positions_.push_back(buffer_position() + offsets.block_offset);
+  const int64 buffer_length = static_cast<int64>(ptr_write_buffer_->size());
+  bytes_written_ += buffer_length - bytes_buffered_;
+  bytes_buffered_ = buffer_length;
+}
+
 int32 WebmMuxWriter::Write(const void* ptr_buffer, uint32 buffer_length) {
   if (!ptr_write_buffer_) {
     LOG(ERROR) << "Cannot Write, not Initialized.";
@@ -125,8 +188,13 @@ int32 WebmMuxWriter::Write(const void* ptr_buffer, uint32 buffer_length) {
 void WebmMuxWriter::ElementStartNotify(uint64 element_id, int64 position) {
   if (element_id == mkvmuxer::kMkvCluster) {
     chunk_end_ = bytes_buffered_;
+    cluster_position_ = position;
+    ++clusters_started_;
     VLOG(1) << "chunk_end_=" << chunk_end_;
     VLOG(1) << "position=" << position;
+  } else if (element_id == mkvmuxer::kMkvSimpleBlock ||
+             element_id == mkvmuxer::kMkvBlock) {
+    block_positions_.push_back(position);
   }
 }
 
@@ -135,17 +203,27 @@ void WebmMuxWriter::ElementStartNotify(uint64 element_id, int64 position) {
 //
 
 LiveWebmMuxer::LiveWebmMuxer()
-    : audio_track_num_(0),
+    : metadata_written_(false),
+      audio_track_num_(0),
       video_track_num_(0),
-      muxer_time_(0) {
+      muxer_time_(0),
+      low_latency_(false),
+      muxer_end_time_(0),
+      cluster_partly_read_(false),
+      cluster_start_time_(0),
+      metadata_read_(false),
+      chunk_track_(ChunkInfo::kAllTracks),
+      chunk_number_(1) {
 }
 
 LiveWebmMuxer::~LiveWebmMuxer() {
 }
 
-int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds) {
-  if (cluster_duration_milliseconds < 1) {
-    LOG(ERROR) << "bad cluster duration, must be greater than 1 millisecond.";
+int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds,
+                        bool low_latency,
+                        bool native_clusters) {
+  if (cluster_duration_milliseconds < 0) {
+    LOG(ERROR) << "bad cluster duration, must not be negative.";
     return kInvalidArg;
   }
 
@@ -191,6 +269,20 @@ int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds) {
   app_name += " v";
   app_name += kClientVersion;
   ptr_segment_info->set_writing_app(app_name.c_str());
+  low_latency_ = low_latency;
+
+  if (native_clusters) {
+    ptr_cluster_writer_.reset(
+        new (std::nothrow) WebmClusterWriter());  // NOLINT
+    if (!ptr_cluster_writer_) {
+      LOG(ERROR) << "cannot construct WebmClusterWriter.";
+      return kNoMemory;
+    }
+    if (ptr_cluster_writer_->Init(cluster_duration_milliseconds)) {
+      LOG(ERROR) << "cannot Init WebmClusterWriter.";
+      return kMuxerError;
+    }
+  }
   return kSuccess;
 }
 
@@ -241,24 +333,37 @@ int LiveWebmMuxer::AddTrack(const AudioConfig& audio_config,
   ptr_private_data += vcp.comments_length;
   memcpy(ptr_private_data, vcp.ptr_setup, vcp.setup_length);
 
-  audio_track_num_ = ptr_segment_->AddAudioTrack(audio_config.sample_rate,
-                                                 audio_config.channels,
-                                                 kAutoAssignTrackNum);
-  if (!audio_track_num_) {
-    LOG(ERROR) << "cannot AddAudioTrack on segment.";
-    return kVideoTrackError;
+  mkvmuxer::AudioTrack* ptr_audio_track = NULL;
+  const int status = AddAudioTrack(audio_config, private_data.get(),
+                                   header_length, &ptr_audio_track);
+  if (status) {
+    return status;
   }
-  mkvmuxer::AudioTrack* const ptr_audio_track =
-      static_cast<mkvmuxer::AudioTrack*>(
-          ptr_segment_->GetTrackByNumber(audio_track_num_));
-  if (!ptr_audio_track) {
-    LOG(ERROR) << "Unable to access audio track.";
-    return kAudioTrackError;
+  audio_track_num_ = ptr_audio_track->number();
+  return kSuccess;
+}
+
+int LiveWebmMuxer::AddTrack(const AudioConfig& audio_config,
+                            const OpusCodecPrivate& codec_private) {
+  if (audio_track_num_ != 0) {
+    LOG(ERROR) << "Cannot add audio track: it already exists.";
+    return kAudioTrackAlreadyExists;
   }
-  if (!ptr_audio_track->SetCodecPrivate(private_data.get(), header_length)) {
-    LOG(ERROR) << "Unable to write audio track codec private data.";
-    return kAudioTrackError;
+  const OpusCodecPrivate& ocp = codec_private;
+  if (!ocp.ptr_opus_head || ocp.opus_head_length <= 0) {
+    LOG(ERROR) << "Cannot add audio track: NULL OpusHead.";
+    return kAudioPrivateDataInvalid;
+  }
+  mkvmuxer::AudioTrack* ptr_audio_track = NULL;
+  const int status = AddAudioTrack(audio_config, ocp.ptr_opus_head,
+                                   ocp.opus_head_length, &ptr_audio_track);
+  if (status) {
+    return status;
   }
+  ptr_audio_track->set_codec_id(mkvmuxer::Tracks::kOpusCodecId);
+  ptr_audio_track->set_codec_delay(ocp.codec_delay);
+  ptr_audio_track->set_seek_pre_roll(ocp.seek_pre_roll);
+  audio_track_num_ = ptr_audio_track->number();
   return kSuccess;
 }
 
@@ -286,11 +391,42 @@ int LiveWebmMuxer::AddTrack(const VideoConfig& video_config) {
     video_track->set_codec_id(mkvmuxer::Tracks::kVp9CodecId);
   }
 
+  if (ptr_cluster_writer_) {
+    ptr_cluster_writer_->set_video_track_number(video_track_num_);
+  }
+  return kSuccess;
+}
+
+int LiveWebmMuxer::AddAudioTrack(const AudioConfig& audio_config,
+                                 const uint8* ptr_private_data,
+                                 int32 private_data_length,
+                                 mkvmuxer::AudioTrack** ptr_audio_track) {
+  const uint64 track_num = ptr_segment_->AddAudioTrack(audio_config.sample_rate,
+                                                       audio_config.channels,
+                                                       kAutoAssignTrackNum);
+  if (!track_num) {
+    LOG(ERROR) << "cannot AddAudioTrack on segment.";
+    return kAudioTrackError;
+  }
+  mkvmuxer::AudioTrack* const ptr_track =
+      static_cast<mkvmuxer::AudioTrack*>(
+          ptr_segment_->GetTrackByNumber(track_num));
+  if (!ptr_track) {
+    LOG(ERROR) << "Unable to access audio track.";
+    return kAudioTrackError;
+  }
+  if (!ptr_track->SetCodecPrivate(ptr_private_data, private_data_length)) {
+    LOG(ERROR) << "Unable to write audio track codec private data.";
+    return kAudioTrackError;
+  }
+  *ptr_audio_track = ptr_track;
   return kSuccess;
 }
 
 int LiveWebmMuxer::Finalize() {
-  if (!ptr_segment_->Finalize()) {
+  // Native clusters have unknown size and are never held back, so there is
+  // nothing to finalize.
+  if (!ptr_cluster_writer_ && !ptr_segment_->Finalize()) {
     LOG(ERROR) << "libwebm mkvmuxer Finalize failed.";
     return kMuxerError;
   }
@@ -322,61 +458,168 @@ int LiveWebmMuxer::WriteVideoFrame(const VideoFrame& vpx_frame) {
     LOG(ERROR) << "cannot write non-VPx frame.";
     return kInvalidArg;
   }
-  const int64 timecode = milliseconds_to_timecode_ticks(vpx_frame.timestamp());
-  if (!ptr_segment_->AddFrame(vpx_frame.buffer(),
-                              vpx_frame.buffer_length(),
-                              video_track_num_,
-                              timecode,
-                              vpx_frame.keyframe())) {
+  if (!AddFrame(video_track_num_, vpx_frame.buffer(),
+                vpx_frame.buffer_length(), vpx_frame.timestamp(),
+                vpx_frame.keyframe())) {
     LOG(ERROR) << "AddFrame (video) failed.";
     return kVideoWriteError;
   }
   muxer_time_ = vpx_frame.timestamp();
+  UpdateEndTime(vpx_frame.timestamp(), vpx_frame.duration());
   return kSuccess;
 }
 
-int LiveWebmMuxer::WriteAudioBuffer(const AudioBuffer& vorbis_buffer) {
+int LiveWebmMuxer::WriteAudioBuffer(const AudioBuffer& audio_buffer) {
   if (audio_track_num_ == 0) {
     LOG(ERROR) << "Cannot WriteAudioBuffer without an audio track.";
     return kNoAudioTrack;
   }
-  if (!vorbis_buffer.buffer()) {
+  if (!audio_buffer.buffer()) {
     LOG(ERROR) << "cannot write empty audio buffer.";
     return kInvalidArg;
   }
-  if (vorbis_buffer.config().format_tag != kAudioFormatVorbis) {
-    LOG(ERROR) << "cannot write non-Vorbis audio buffer.";
+  const uint16 format_tag = audio_buffer.config().format_tag;
+  if (format_tag != kAudioFormatVorbis && format_tag != kAudioFormatOpus) {
+    LOG(ERROR) << "cannot write non-Vorbis/Opus audio buffer.";
     return kInvalidArg;
   }
-  const int64 timecode =
-      milliseconds_to_timecode_ticks(vorbis_buffer.timestamp());
-  if (!ptr_segment_->AddFrame(vorbis_buffer.buffer(),
-                              vorbis_buffer.buffer_length(),
-                              audio_track_num_,
-                              timecode,
-                              true)) {
+  if (!AddFrame(audio_track_num_, audio_buffer.buffer(),
+                audio_buffer.buffer_length(), audio_buffer.timestamp(),
+                true)) {
     LOG(ERROR) << "AddFrame (audio) failed.";
     return kAudioWriteError;
   }
-  muxer_time_ = vorbis_buffer.timestamp();
+  muxer_time_ = audio_buffer.timestamp();
+  UpdateEndTime(audio_buffer.timestamp(), audio_buffer.duration());
   return kSuccess;
 }
 
-// A chunk is ready when |WebmMuxWriter::chunk_length()| returns a value
-// greater than 0.
+void LiveWebmMuxer::ForceNewCluster() {
+  if (ptr_cluster_writer_) {
+    ptr_cluster_writer_->ForceNewCluster();
+  } else {
+    ptr_segment_->ForceNewClusterOnNextFrame();
+  }
+}
+
+void LiveWebmMuxer::set_max_cluster_size(int64 max_cluster_size) {
+  const int64 cluster_size = std::max<int64>(max_cluster_size, 0);
+  ptr_segment_->set_max_cluster_size(static_cast<uint64>(cluster_size));
+  if (ptr_cluster_writer_) {
+    ptr_cluster_writer_->set_max_cluster_size(cluster_size);
+  }
+}
+
+int64 LiveWebmMuxer::clusters_started() const {
+  return ptr_writer_->clusters_started();
+}
+
+int64 LiveWebmMuxer::cluster_size() const {
+  if (ptr_writer_->clusters_started() == 0) {
+    return 0;
+  }
+  return ptr_writer_->bytes_written() - ptr_writer_->cluster_position();
+}
+
+// libwebm writes the segment headers with the first frame it is given. In
+// native mode only that first call reaches libwebm: the headers it wrote are
+// kept, and the frame is written again by |ptr_cluster_writer_|.
+//
+// A cluster started while a frame is added starts with that frame: libwebm
+// writes the audio it holds back before it starts the cluster.
+bool LiveWebmMuxer::AddFrame(uint64 track_num,
+                             const uint8* ptr_data,
+                             int32 data_length,
+                             int64 timestamp,
+                             bool keyframe) {
+  const int64 clusters = ptr_writer_->clusters_started();
+  if (!ptr_cluster_writer_ || !metadata_written_) {
+    if (!ptr_segment_->AddFrame(ptr_data, data_length, track_num,
+                                milliseconds_to_timecode_ticks(timestamp),
+                                keyframe)) {
+      return false;
+    }
+    if (ptr_cluster_writer_) {
+      ptr_writer_->KeepHeaderOnly();
+      metadata_written_ = true;
+    }
+  }
+  if (ptr_cluster_writer_) {
+    WebmClusterWriter::FrameOffsets offsets;
+    if (ptr_cluster_writer_->WriteFrame(track_num, timestamp, keyframe,
+                                        ptr_data, data_length, &buffer_,
+                                        &offsets)) {
+      return false;
+    }
+    ptr_writer_->ClusterWriterAppended(offsets);
+  }
+  if (ptr_writer_->clusters_started() != clusters) {
+    cluster_keyframes_.push_back(
+        video_track_num_ == 0 || (track_num == video_track_num_ && keyframe));
+  }
+  return true;
+}
+
 bool LiveWebmMuxer::ChunkReady(int32* ptr_chunk_length) {
-  if (ptr_chunk_length) {
-    const int32 chunk_length = static_cast<int32>(ptr_writer_->chunk_end());
-    if (chunk_length > 0) {
-      *ptr_chunk_length = chunk_length;
-      return true;
+  ChunkInfo info;
+  return ChunkReady(ptr_chunk_length, &info);
+}
+
+// A chunk is ready when |WebmMuxWriter::chunk_end()| returns a value greater
+// than 0. In low latency mode, when no cluster has started since the last
+// read, all buffered data is a partial chunk.
+bool LiveWebmMuxer::ChunkReady(int32* ptr_chunk_length,
+                               ChunkInfo* ptr_info) {
+  if (!ptr_chunk_length || !ptr_info) {
+    return false;
+  }
+  int32 chunk_length = static_cast<int32>(ptr_writer_->chunk_end());
+  bool chunk_complete = true;
+  if (chunk_length == 0 && low_latency_) {
+    chunk_length = static_cast<int32>(ptr_writer_->bytes_buffered());
+    chunk_complete = false;
+  }
+  if (chunk_length > 0) {
+    *ptr_chunk_length = chunk_length;
+    ptr_info->type = metadata_read_ ? ChunkInfo::kMedia : ChunkInfo::kMetadata;
+    ptr_info->complete = chunk_complete;
+    ptr_info->keyframe = false;
+    ptr_info->track = chunk_track_;
+    ptr_info->number = metadata_read_ ? chunk_number_ : 0;
+    ptr_info->start_time = 0;
+    ptr_info->duration = 0;
+    if (metadata_read_) {
+      // Media chunks start with a cluster unless the cluster has been partly
+      // read.
+      int64& start_time = ptr_info->start_time;
+      if (cluster_partly_read_) {
+        start_time = cluster_start_time_;
+      } else if (!ReadClusterTimecode(0, &start_time)) {
+        LOG(WARNING) << "cannot read cluster timecode.";
+      }
+      if (chunk_complete) {
+        int64 end_time = muxer_end_time_;
+        if (chunk_length < static_cast<int32>(buffer_.size()) &&
+            !ReadClusterTimecode(chunk_length, &end_time)) {
+          LOG(WARNING) << "cannot read next cluster timecode.";
+        }
+        ptr_info->duration = std::max<int64>(end_time - start_time, 0);
+      }
+      BuildChunkIndex(chunk_length, start_time, &ptr_info->index);
+
+      // Clusters libwebm starts in |Finalize()| hold audio only.
+      ptr_info->keyframe = cluster_keyframes_.empty() ?
+          video_track_num_ == 0 : cluster_keyframes_.front();
+    } else {
+      ptr_info->index.clear();
     }
+    return true;
   }
   return false;
 }
 
-// Copies the buffered chunk data into |ptr_buf|, erases it from |buffer_|, and
-// calls |WebmMuxWriter::ResetChunkEnd()| to zero the chunk end position.
+// Copies the buffered chunk data into |ptr_buf|, and calls
+// |WebmMuxWriter::EraseChunk()| to erase it from |buffer_|.
 int LiveWebmMuxer::ReadChunk(int32 buffer_capacity, uint8* ptr_buf) {
   if (!ptr_buf) {
     LOG(ERROR) << "NULL buffer pointer.";
@@ -385,7 +628,8 @@ int LiveWebmMuxer::ReadChunk(int32 buffer_capacity, uint8* ptr_buf) {
 
   // Make sure there's a chunk ready.
   int32 chunk_length = 0;
-  if (!ChunkReady(&chunk_length)) {
+  ChunkInfo info;
+  if (!ChunkReady(&chunk_length, &info)) {
     LOG(ERROR) << "No chunk ready.";
     return kNoChunkReady;
   }
@@ -396,14 +640,145 @@ int LiveWebmMuxer::ReadChunk(int32 buffer_capacity, uint8* ptr_buf) {
     return kUserBufferTooSmall;
   }
 
-  LOG(INFO) << "ReadChunk capacity=" << buffer_capacity
-            << " length=" << chunk_length
-            << " total buffered=" << buffer_.size();
+  VLOG(1) << "ReadChunk capacity=" << buffer_capacity
+          << " length=" << chunk_length
+          << " total buffered=" << buffer_.size();
 
   // Copy chunk to user buffer, and erase it from |buffer_|.
   memcpy(ptr_buf, &buffer_[0], chunk_length);
-  ptr_writer_->EraseChunk();
+  ptr_writer_->EraseChunk(chunk_length);
+  if (info.type == ChunkInfo::kMedia) {
+    if (info.complete) {
+      ++chunk_number_;
+      if (!cluster_keyframes_.empty()) {
+        cluster_keyframes_.pop_front();
+      }
+    }
+    cluster_partly_read_ = !info.complete;
+    cluster_start_time_ = info.start_time;
+  }
+  metadata_read_ = true;
   return kSuccess;
 }
 
+// Clusters written by libwebm start with the cluster element header and the
+// Timecode element. Timecodes are in milliseconds since |kTimecodeScale| is 1
+// millisecond.
+bool LiveWebmMuxer::ReadClusterTimecode(int64 offset,
+                                        int64* ptr_timecode) const {
+  const int64 buffer_length = static_cast<int64>(buffer_.size());
+  if (offset >= buffer_length) {
+    return false;
+  }
+  const uint8* ptr_data = &buffer_[static_cast<size_t>(offset)];
+  int64 length = buffer_length - offset;
+  WebmBufferParser::ElementHeader header;
+  if (WebmBufferParser::ReadElementHeader(ptr_data, length, &header) ||
+      header.id != mkvmuxer::kMkvCluster) {
+    return false;
+  }
+  ptr_data += header.header_length;
+  length -= header.header_length;
+
+  // Read the Timecode element.
+  if (WebmBufferParser::ReadElementHeader(ptr_data, length, &header) ||
+      header.id != mkvmuxer::kMkvTimecode ||
+      header.size > static_cast<int64>(sizeof(uint64)) ||
+      length - header.header_length < header.size) {
+    return false;
+  }
+  ptr_data += header.header_length;
+  uint64 timecode = 0;
+  for (int64 i = 0; i < header.size; ++i) {
+    timecode = (timecode << 8) | ptr_data[i];
+  }
+  *ptr_timecode = static_cast<int64>(timecode);
+  return true;
+}
+
+// Blocks are read from the positions |WebmMuxWriter| recorded as libwebm
+// started them. Track numbers assigned by |LiveWebmMuxer| fit in one byte, so
+// the block header is the track number, a 16 bit timecode relative to the
+// cluster, and the flags. Only SimpleBlocks carry a keyframe flag.
+void LiveWebmMuxer::BuildChunkIndex(int32 chunk_length,
+                                    int64 cluster_timecode,
+                                    std::string* ptr_index) const {
+  struct TrackTimes {
+    int track_number;
+    int64 first;
+    int64 last;
+  };
+  const int kMaxTracks = 2;
+  TrackTimes tracks[kMaxTracks];
+  int num_tracks = 0;
+  int64 num_blocks = 0;
+  std::ostringstream keyframes;
+
+  const std::deque<int64>& positions = ptr_writer_->block_positions();
+  const int64 buffer_position = ptr_writer_->buffer_position();
+  for (size_t i = 0; i < positions.size(); ++i) {
+    const int64 offset = positions[i] - buffer_position;
+    if (offset >= chunk_length) {
+      break;
+    }
+    const uint8* const ptr_block = &buffer_[static_cast<size_t>(offset)];
+    WebmBufferParser::ElementHeader header;
+    const int kBlockHeaderLength = 4;
+    if (WebmBufferParser::ReadElementHeader(ptr_block, chunk_length - offset,
+                                            &header) ||
+        header.size < kBlockHeaderLength ||
+        chunk_length - offset < header.header_length + kBlockHeaderLength) {
+      LOG(WARNING) << "cannot read block at offset " << offset;
+      continue;
+    }
+    const uint8* const ptr_header = ptr_block + header.header_length;
+    if (!(ptr_header[0] & 0x80)) {
+      LOG(WARNING) << "unexpected track number length at offset " << offset;
+      continue;
+    }
+    const int track_number = ptr_header[0] & 0x7F;
+    const int16 relative_timecode =
+        static_cast<int16>((ptr_header[1] << 8) | ptr_header[2]);
+    const int64 timestamp = cluster_timecode + relative_timecode;
+    const bool keyframe =
+        header.id == mkvmuxer::kMkvSimpleBlock && (ptr_header[3] & 0x80);
+
+    int track = 0;
+    while (track < num_tracks && tracks[track].track_number != track_number) {
+      ++track;
+    }
+    if (track == num_tracks) {
+      if (num_tracks == kMaxTracks) {
+        LOG(WARNING) << "unexpected track number " << track_number;
+        continue;
+      }
+      tracks[track].track_number = track_number;
+      tracks[track].first = timestamp;
+      ++num_tracks;
+    }
+    tracks[track].last = timestamp;
+    if (keyframe) {
+      keyframes << (keyframes.tellp() > 0 ? "," : "") << offset;
+    }
+    ++num_blocks;
+  }
+
+  std::ostringstream index;
+  index << "{\"timecode\":" << cluster_timecode
+        << ",\"blocks\":" << num_blocks
+        << ",\"tracks\":[";
+  for (int i = 0; i < num_tracks; ++i) {
+    index << (i > 0 ? "," : "")
+          << "{\"track\":" << tracks[i].track_number
+          << ",\"first\":" << tracks[i].first
+          << ",\"last\":" << tracks[i].last << "}";
+  }
+  index << "],\"keyframes\":[" << keyframes.str() << "]}";
+  *ptr_index = index.str();
+}
+
+void LiveWebmMuxer::UpdateEndTime(int64 timestamp, int64 duration) {
+  muxer_end_time_ = std::max(muxer_end_time_, timestamp + duration);
+}
+
 }  // namespace webmlive
@@ -8,6 +8,7 @@
 #ifndef WEBMLIVE_ENCODER_WEBM_MUX_H_
 #define WEBMLIVE_ENCODER_WEBM_MUX_H_
 
+#include <deque>
 #include <memory>
 #include <vector>
 
@@ -17,6 +18,7 @@
 
 // Forward declarations of libwebm muxer types used by |LiveWebmMuxer|.
 namespace mkvmuxer {
+class AudioTrack;
 class Segment;
 }
 
@@ -24,6 +26,7 @@ namespace webmlive {
 
 // Forward declaration of class implementing IMkvWriter interface for libwebm.
 class WebmMuxWriter;
+class WebmClusterWriter;
 
 struct VorbisCodecPrivate {
   VorbisCodecPrivate()
@@ -42,6 +45,22 @@ struct VorbisCodecPrivate {
   int32 setup_length;
 };
 
+struct OpusCodecPrivate {
+  OpusCodecPrivate()
+      : ptr_opus_head(NULL),
+        opus_head_length(0),
+        codec_delay(0),
+        seek_pre_roll(0) {}
+
+  // OpusHead structure stored as the track Codec Private element.
+  const uint8* ptr_opus_head;
+  int32 opus_head_length;
+
+  // Codec delay and seek pre-roll values in nanoseconds.
+  uint64 codec_delay;
+  uint64 seek_pre_roll;
+};
+
 // WebM muxing object built atop libwebm. Provides buffers containing WebM
 // "chunks" of two types:
 //  Metadata Chunk
@@ -52,8 +71,23 @@ struct VorbisCodecPrivate {
 // Notes:
 // - Only the first chunk written is metadata. All other chunks are clusters.
 //
+// - In low latency mode chunks may also be partial clusters: everything
+//   libwebm has written is readable as soon as it is written, which is the
+//   cluster header and SimpleBlocks added since the last read. A partial chunk
+//   never crosses a cluster boundary, and |ChunkReady()| reports whether the
+//   chunk completes the metadata chunk or a cluster via |ChunkInfo|.
+//
 // - All element size values are set to unknown (an EBML encoded -1).
 //
+// - With native clusters, libwebm writes only the metadata chunk, and
+//   |WebmClusterWriter| writes the clusters straight into |buffer_|. Frames
+//   must then be written in timestamp order; see |WebmClusterWriter| for how
+//   its clusters differ from libwebm's.
+//
+// - Per-track output uses one |LiveWebmMuxer| per track. |set_chunk_track()|
+//   labels the chunks, and |ForceNewCluster()| lets the user start the audio
+//   muxer's clusters where the video muxer's clusters start.
+//
 // - Users MUST call |Init()| before any other method.
 //
 // - Users MUST call |Finalize()| to avoid losing the final cluster; libwebm
@@ -81,7 +115,8 @@ class LiveWebmMuxer {
     // |WriteAudioBuffer()| called without adding an audio track.
     kNoAudioTrack = -12,
 
-    // Invalid |VorbisCodecPrivate| passed to |AddTrack()|.
+    // Invalid |VorbisCodecPrivate| or |OpusCodecPrivate| passed to
+    // |AddTrack()|.
     kAudioPrivateDataInvalid = -11,
 
     // |AddTrack()| called for audio, but the audio track has already been
@@ -125,8 +160,14 @@ class LiveWebmMuxer {
   // |ptr_segment_|. Passing a NULL configuration pointer disables the track of
   // that type. Returns |kSuccess| when successful. Returns |kInvalidArg| if
   // both configuration pointers are NULL. Returns |kInvalidArg| when
-  // |cluster_duration| is < 1.
-  int Init(int32 cluster_duration_milliseconds);
+  // |cluster_duration| is < 0. A |cluster_duration| of 0 disables duration
+  // based clustering: after the first, clusters start only when requested via
+  // |ForceNewCluster()|. When |low_latency| is true partial clusters are
+  // returned by |ReadChunk()|. When |native_clusters| is true clusters are
+  // written by |WebmClusterWriter| instead of libwebm.
+  int Init(int32 cluster_duration_milliseconds,
+           bool low_latency,
+           bool native_clusters);
 
   // Adds an audio track to |ptr_segment_| and returns |kSuccess|. Returns
   // |kAudioTrackAlreadyExists| when the audio track has already been added.
@@ -134,6 +175,11 @@ class LiveWebmMuxer {
   int AddTrack(const AudioConfig& audio_config,
                const VorbisCodecPrivate& codec_private);
 
+  // Adds an Opus audio track to |ptr_segment_|. Return values are the same as
+  // those of the Vorbis |AddTrack()| overload.
+  int AddTrack(const AudioConfig& audio_config,
+               const OpusCodecPrivate& codec_private);
+
   // Adds a video track to |ptr_segment_|, and returns |kSuccess|. Returns
   // |kVideoTrackAlreadyExists| when the video track has already been added.
   // Returns |kVideoTrackError| when adding the track to the segment fails.
@@ -146,20 +192,45 @@ class LiveWebmMuxer {
   // returns without error.
   int Finalize();
 
-  // Writes |vorbis_buffer| to the audio track and returns |kSuccess|. Returns
-  // |kInvalidArg| when |vorbis_buffer| is empty or contains non-Vorbis audio.
-  // Returns |kAudioWriteError| when libwebm returns an error.
-  int WriteAudioBuffer(const AudioBuffer& vorbis_buffer);
+  // Writes |audio_buffer| to the audio track and returns |kSuccess|. Returns
+  // |kInvalidArg| when |audio_buffer| is empty or contains audio that is
+  // neither Vorbis nor Opus. Returns |kAudioWriteError| when libwebm returns an
+  // error.
+  int WriteAudioBuffer(const AudioBuffer& audio_buffer);
 
   // Writes |vpx_frame| to the video track and returns |kSuccess|. Returns
   // |kInvalidArg| when |vpx_frame| is empty or contains a non-VPx frame.
   // Returns |kVideoWriteError| when libwebm returns an error.
   int WriteVideoFrame(const VideoFrame& vpx_frame);
 
+  // Starts a new cluster with the next frame written.
+  void ForceNewCluster();
+
+  // Starts a new cluster with the next frame written once the current cluster
+  // holds |max_cluster_size| bytes or more. Only video frames start clusters
+  // when the muxer has a video track, so a cluster can exceed the limit by
+  // the size of one video frame and the audio muxed with it. The frame that
+  // starts the cluster need not be a keyframe. 0, the default, disables size
+  // based clustering. Must be called before the first frame is written.
+  void set_max_cluster_size(int64 max_cluster_size);
+
   // Returns true and writes chunk length to |ptr_chunk_length| when |buffer_|
-  // contains a complete WebM chunk.
+  // contains a complete WebM chunk, or in low latency mode when |buffer_|
+  // contains any data.
   bool ChunkReady(int32* ptr_chunk_length);
 
+  // Same as above, and describes the chunk in |ptr_info|. The chunk type is
+  // |ChunkInfo::kMetadata| until the first chunk has been read, and
+  // |ChunkInfo::kMedia| after. |ChunkInfo::complete| is always true outside
+  // of low latency mode. |ChunkInfo::track| is the value passed to
+  // |set_chunk_track()|, and media chunks are numbered from 1. The media time
+  // span is read from the timecodes of the cluster and of the next cluster,
+  // or taken from the end of the last frame when the muxer is finalized.
+  // |ChunkInfo::index| lists the blocks in media chunks, and
+  // |ChunkInfo::keyframe| is set for clusters started by a video keyframe,
+  // and for all clusters of a muxer without a video track.
+  bool ChunkReady(int32* ptr_chunk_length, ChunkInfo* ptr_info);
+
   // Moves WebM chunk data into |ptr_buf|. The data has been from removed from
   // |buffer_| when |kSuccess| is returned.  Returns |kUserBufferTooSmall| if
   // |buffer_capacity| is less than |chunk_length|.
@@ -167,14 +238,80 @@ class LiveWebmMuxer {
 
   // Accessors.
   int64 muxer_time() const { return muxer_time_; }
+  void set_chunk_track(ChunkInfo::Track track) { chunk_track_ = track; }
+
+  // Returns the number of clusters libwebm has started.
+  int64 clusters_started() const;
+
+  // Returns the bytes muxed into the current cluster so far, read or not.
+  // Frames libwebm holds back are not counted until they are written.
+  int64 cluster_size() const;
 
  private:
+  // Reads the timecode of the cluster starting at |offset| in |buffer_| into
+  // |ptr_timecode|. Returns false when |buffer_| does not hold a cluster
+  // header at |offset|.
+  bool ReadClusterTimecode(int64 offset, int64* ptr_timecode) const;
+
+  // Writes the |ChunkInfo::index| of the first |chunk_length| bytes in
+  // |buffer_| to |ptr_index|. |cluster_timecode| is the timecode of the
+  // cluster the chunk belongs to.
+  void BuildChunkIndex(int32 chunk_length, int64 cluster_timecode,
+                       std::string* ptr_index) const;
+
+  // Updates |muxer_end_time_|.
+  void UpdateEndTime(int64 timestamp, int64 duration);
+
+  // Writes a frame of |track_num| at |timestamp| milliseconds through libwebm,
+  // or through |ptr_cluster_writer_| once libwebm has written the metadata
+  // chunk. Returns true when successful.
+  bool AddFrame(uint64 track_num,
+                const uint8* ptr_data,
+                int32 data_length,
+                int64 timestamp,
+                bool keyframe);
+
+  // Adds the audio track to |ptr_segment_|, stores |ptr_private_data| as its
+  // codec private data, and returns the track via |ptr_audio_track|. Returns
+  // |kAudioTrackError| when the track cannot be added or configured. Callers
+  // set |audio_track_num_| once they finish configuring the track.
+  int AddAudioTrack(const AudioConfig& audio_config,
+                    const uint8* ptr_private_data,
+                    int32 private_data_length,
+                    mkvmuxer::AudioTrack** ptr_audio_track);
+
   std::unique_ptr<WebmMuxWriter> ptr_writer_;
   std::unique_ptr<mkvmuxer::Segment> ptr_segment_;
+
+  // Non-NULL when clusters are written natively. |metadata_written_| is set
+  // once libwebm has written the metadata chunk.
+  std::unique_ptr<WebmClusterWriter> ptr_cluster_writer_;
+  bool metadata_written_;
   uint64 audio_track_num_;
   uint64 video_track_num_;
   WriteBuffer buffer_;
   int64 muxer_time_;
+  bool low_latency_;
+
+  // End time, in milliseconds, of the latest frame muxed.
+  int64 muxer_end_time_;
+
+  // Set while a cluster has been partly read in low latency mode, and the
+  // start time of that cluster.
+  bool cluster_partly_read_;
+  int64 cluster_start_time_;
+
+  // Set once the metadata chunk has been read.
+  bool metadata_read_;
+
+  // One entry per cluster started and not yet completely read, oldest first:
+  // true when decoding can start with the cluster.
+  std::deque<bool> cluster_keyframes_;
+
+  // Track label and number of the media chunk returned by the next
+  // |ReadChunk()|.
+  ChunkInfo::Track chunk_track_;
+  int64 chunk_number_;
   friend class WebmMuxWriter;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LiveWebmMuxer);
 };
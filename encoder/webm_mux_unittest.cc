@@ -0,0 +1,166 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/webm_mux.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "encoder/video_encoder.h"
+#include "encoder/webm_buffer_parser.h"
+#include "gtest/gtest.h"
+#include "libwebm/webmids.hpp"
+
+namespace webmlive {
+namespace {
+
+const int32 kClusterDuration = 1000;
+const int kNumFrames = 100;
+const int64 kFrameDuration = 33;
+const int kKeyframeInterval = 20;
+const int32 kFrameLength = 500;
+
+// Walks the clusters in |chunk|, and returns the index |BuildChunkIndex()|
+// should produce for it, or an empty string when |chunk| cannot be parsed.
+// Only video SimpleBlocks of one track are expected. Adds the number of
+// keyframes to |ptr_keyframes|, and sets |ptr_starts_with_keyframe|.
+std::string IndexChunk(const std::vector<uint8>& chunk,
+                       int* ptr_keyframes,
+                       bool* ptr_starts_with_keyframe) {
+  const int64 chunk_length = static_cast<int64>(chunk.size());
+  int64 timecode = -1;
+  int64 num_blocks = 0;
+  int track_number = 0;
+  int64 first = 0;
+  int64 last = 0;
+  std::ostringstream keyframes;
+  int64 offset = 0;
+  *ptr_starts_with_keyframe = false;
+  while (offset < chunk_length) {
+    WebmBufferParser::ElementHeader header;
+    if (WebmBufferParser::ReadElementHeader(&chunk[offset],
+                                            chunk_length - offset, &header)) {
+      return "";
+    }
+    const uint8* const ptr_body = &chunk[offset] + header.header_length;
+    if (header.id == mkvmuxer::kMkvCluster) {
+      // Descend into the cluster; its size may be unknown in live mode.
+      offset += header.header_length;
+      continue;
+    }
+    if (header.size == WebmBufferParser::kUnknownSize ||
+        offset + header.header_length + header.size > chunk_length) {
+      return "";
+    }
+    if (header.id == mkvmuxer::kMkvTimecode) {
+      timecode = 0;
+      for (int64 i = 0; i < header.size; ++i) {
+        timecode = (timecode << 8) | ptr_body[i];
+      }
+    } else if (header.id == mkvmuxer::kMkvSimpleBlock) {
+      if (header.size < 4 || !(ptr_body[0] & 0x80)) {
+        return "";
+      }
+      const int64 timestamp =
+          timecode + static_cast<int16>((ptr_body[1] << 8) | ptr_body[2]);
+      if (num_blocks == 0) {
+        track_number = ptr_body[0] & 0x7F;
+        first = timestamp;
+      }
+      last = timestamp;
+      if (ptr_body[3] & 0x80) {
+        *ptr_starts_with_keyframe |= num_blocks == 0;
+        ++*ptr_keyframes;
+        keyframes << (keyframes.tellp() > 0 ? "," : "") << offset;
+      }
+      ++num_blocks;
+    }
+    offset += header.header_length + header.size;
+  }
+
+  std::ostringstream index;
+  index << "{\"timecode\":" << timecode << ",\"blocks\":" << num_blocks
+        << ",\"tracks\":[";
+  if (num_blocks > 0) {
+    index << "{\"track\":" << track_number << ",\"first\":" << first
+          << ",\"last\":" << last << "}";
+  }
+  index << "],\"keyframes\":[" << keyframes.str() << "]}";
+  return index.str();
+}
+
+class WebmMuxTest : public ::testing::Test {
+ protected:
+  WebmMuxTest() : media_chunks_(0), keyframes_(0) {}
+
+  // Muxes |kNumFrames| VP8 frames, with a keyframe every |kKeyframeInterval|
+  // frames, and checks the index of every media chunk read.
+  void MuxAndCheckIndex(bool native_clusters) {
+    ASSERT_EQ(LiveWebmMuxer::kSuccess,
+              muxer_.Init(kClusterDuration, false, native_clusters));
+    VideoConfig config;
+    config.format = kVideoFormatVP8;
+    config.width = 320;
+    config.height = 240;
+    ASSERT_EQ(LiveWebmMuxer::kSuccess, muxer_.AddTrack(config));
+
+    for (int i = 0; i < kNumFrames; ++i) {
+      const std::vector<uint8> data(kFrameLength, static_cast<uint8>(i));
+      VideoFrame frame;
+      ASSERT_EQ(VideoFrame::kSuccess,
+                frame.Init(config, i % kKeyframeInterval == 0,
+                           i * kFrameDuration, kFrameDuration, &data[0],
+                           kFrameLength));
+      ASSERT_EQ(LiveWebmMuxer::kSuccess, muxer_.WriteVideoFrame(frame));
+      ReadChunks();
+    }
+    ASSERT_EQ(LiveWebmMuxer::kSuccess, muxer_.Finalize());
+    ReadChunks();
+    EXPECT_EQ(kNumFrames / kKeyframeInterval, keyframes_);
+  }
+
+  // Reads the chunks ready, and compares the index of each media chunk with
+  // the one |IndexChunk()| builds from its bytes.
+  void ReadChunks() {
+    int32 chunk_length = 0;
+    ChunkInfo info;
+    while (muxer_.ChunkReady(&chunk_length, &info)) {
+      std::vector<uint8> chunk(chunk_length);
+      ASSERT_EQ(LiveWebmMuxer::kSuccess,
+                muxer_.ReadChunk(chunk_length, &chunk[0]));
+      if (info.type != ChunkInfo::kMedia) {
+        EXPECT_TRUE(info.index.empty());
+        continue;
+      }
+      ++media_chunks_;
+      bool starts_with_keyframe = false;
+      const std::string index =
+          IndexChunk(chunk, &keyframes_, &starts_with_keyframe);
+      ASSERT_FALSE(index.empty()) << "chunk " << info.number;
+      EXPECT_EQ(index, info.index) << "chunk " << info.number;
+      EXPECT_EQ(starts_with_keyframe, info.keyframe) << "chunk " << info.number;
+    }
+  }
+
+  LiveWebmMuxer muxer_;
+  int media_chunks_;
+  int keyframes_;
+};
+
+TEST_F(WebmMuxTest, LibwebmClusterIndex) {
+  MuxAndCheckIndex(false);
+  EXPECT_GT(media_chunks_, 0);
+}
+
+TEST_F(WebmMuxTest, NativeClusterIndex) {
+  MuxAndCheckIndex(true);
+  EXPECT_GT(media_chunks_, 0);
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -0,0 +1,347 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/worker_pool.h"
+
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <thread>
+
+#include "encoder/pipeline_stage.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+// Defined here because |std::chrono::milliseconds| binds it to a reference.
+const int WorkerPool::kIdleSleepMilliseconds;
+
+struct WorkerPool::Stage {
+  Stage()
+      : ptr_stage(NULL),
+        priority(kNormalPriority),
+        ptr_status(NULL),
+        removed(false) {}
+
+  std::string name;
+  PipelineStageInterface* ptr_stage;
+  Priority priority;
+  std::atomic<int>* ptr_status;
+
+  // Held while a pass runs. |removed| is protected by |run_mutex|; queued
+  // copies of a removed stage are dropped when a worker takes them.
+  std::mutex run_mutex;
+  bool removed;
+};
+
+struct WorkerPool::Worker {
+  Worker() : passes(0) {}
+
+  // Stages queued on the worker, per priority. Protected by |mutex|.
+  std::mutex mutex;
+  std::deque<StagePtr> queues[kNumPriorities];
+
+  std::shared_ptr<std::thread> thread;
+
+  // Passes run by the worker. Used only on the worker thread.
+  int64 passes;
+};
+
+WorkerPool::WorkerPool()
+    : num_workers_(0),
+      stop_(false),
+      next_worker_(0),
+      waiting_workers_(0),
+      passes_(0),
+      idle_passes_(0),
+      steals_(0) {
+}
+
+WorkerPool::~WorkerPool() {
+  Stop();
+}
+
+int WorkerPool::Init(int num_workers) {
+  if (num_workers < 0) {
+    LOG(ERROR) << "invalid worker count: " << num_workers;
+    return kInvalidArg;
+  }
+  if (num_workers == 0) {
+    num_workers = std::max(1U, std::thread::hardware_concurrency());
+  }
+  num_workers_ = num_workers;
+  workers_.clear();
+  for (int i = 0; i < num_workers_; ++i) {
+    std::unique_ptr<Worker> worker(new (std::nothrow) Worker());  // NOLINT
+    if (!worker) {
+      LOG(ERROR) << "cannot construct worker.";
+      return kNoMemory;
+    }
+    workers_.push_back(std::move(worker));
+  }
+  return kSuccess;
+}
+
+int WorkerPool::Run() {
+  if (workers_.empty()) {
+    LOG(ERROR) << "WorkerPool cannot Run, Init required.";
+    return kRunFailed;
+  }
+  using std::bind;
+  using std::nothrow;
+  using std::shared_ptr;
+  using std::thread;
+  stop_ = false;
+  for (int i = 0; i < num_workers_; ++i) {
+    workers_[i]->thread = shared_ptr<thread>(
+        new (nothrow) thread(bind(&WorkerPool::WorkerThread,  // NOLINT
+                                  this, i)));
+    if (!workers_[i]->thread) {
+      LOG(ERROR) << "cannot construct worker thread.";
+      Stop();
+      return kRunFailed;
+    }
+  }
+  LOG(INFO) << "worker pool running " << num_workers_ << " workers.";
+  return kSuccess;
+}
+
+void WorkerPool::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stop_ = true;
+  }
+  work_ready_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    if (workers_[i]->thread) {
+      workers_[i]->thread->join();
+      workers_[i]->thread.reset();
+    }
+  }
+}
+
+int WorkerPool::AddStage(const std::string& name,
+                         PipelineStageInterface* ptr_stage,
+                         Priority priority,
+                         std::atomic<int>* ptr_status) {
+  if (!ptr_stage || !ptr_status || priority < kLowPriority ||
+      priority > kHighPriority) {
+    LOG(ERROR) << "invalid AddStage argument.";
+    return kInvalidArg;
+  }
+  if (workers_.empty()) {
+    LOG(ERROR) << "WorkerPool cannot AddStage, Init required.";
+    return kRunFailed;
+  }
+  StagePtr stage(new (std::nothrow) Stage());  // NOLINT
+  if (!stage) {
+    LOG(ERROR) << "cannot construct stage.";
+    return kNoMemory;
+  }
+  stage->name = name;
+  stage->ptr_stage = ptr_stage;
+  stage->priority = priority;
+  stage->ptr_status = ptr_status;
+  {
+    std::lock_guard<std::mutex> lock(stages_mutex_);
+    if (stages_.count(ptr_stage)) {
+      LOG(ERROR) << "stage " << name << " already in the pool.";
+      return kInvalidArg;
+    }
+    stages_[ptr_stage] = stage;
+  }
+  QueueStage(next_worker_++ % num_workers_, stage);
+  LOG(INFO) << name << " stage added to the worker pool.";
+  return kSuccess;
+}
+
+void WorkerPool::RemoveStage(PipelineStageInterface* ptr_stage) {
+  StagePtr stage;
+  {
+    std::lock_guard<std::mutex> lock(stages_mutex_);
+    const std::map<PipelineStageInterface*, StagePtr>::iterator it =
+        stages_.find(ptr_stage);
+    if (it == stages_.end()) {
+      return;
+    }
+    stage = it->second;
+    stages_.erase(it);
+  }
+  std::lock_guard<std::mutex> lock(stage->run_mutex);
+  stage->removed = true;
+  LOG(INFO) << stage->name << " stage removed from the worker pool.";
+}
+
+void WorkerPool::GetStats(WorkerPoolStats* ptr_stats) const {
+  if (ptr_stats) {
+    ptr_stats->passes = passes_;
+    ptr_stats->idle_passes = idle_passes_;
+    ptr_stats->steals = steals_;
+  }
+}
+
+void WorkerPool::WorkerThread(int index) {
+  Worker& worker = *workers_[index];
+  while (!stop_) {
+    ++worker.passes;
+    Priority first_priority = kHighPriority;
+    if (worker.passes % kLowPriorityInterval == 0) {
+      first_priority = kLowPriority;
+    } else if (worker.passes % kNormalPriorityInterval == 0) {
+      first_priority = kNormalPriority;
+    }
+    StagePtr stage;
+    if (PopStage(index, first_priority, &stage)) {
+      RunStage(index, stage);
+    } else {
+      WaitForWork(index);
+    }
+  }
+}
+
+bool WorkerPool::PopStage(int index,
+                          Priority first_priority,
+                          StagePtr* ptr_stage) {
+  if (PopStageOfPriority(index, first_priority, ptr_stage)) {
+    return true;
+  }
+  for (int priority = kHighPriority; priority >= kLowPriority; --priority) {
+    if (priority != first_priority &&
+        PopStageOfPriority(index, priority, ptr_stage)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool WorkerPool::PopStageOfPriority(int index,
+                                    int priority,
+                                    StagePtr* ptr_stage) {
+  // Own queue first, oldest stage first, so that stages take turns.
+  Worker& worker = *workers_[index];
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    std::deque<StagePtr>& queue = worker.queues[priority];
+    if (!queue.empty()) {
+      *ptr_stage = queue.front();
+      queue.pop_front();
+      return true;
+    }
+  }
+
+  // Then the newest stage of another worker's queue.
+  for (int i = 1; i < num_workers_; ++i) {
+    Worker& victim = *workers_[(index + i) % num_workers_];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    std::deque<StagePtr>& queue = victim.queues[priority];
+    if (!queue.empty()) {
+      *ptr_stage = queue.back();
+      queue.pop_back();
+      ++steals_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkerPool::RunStage(int index, const StagePtr& stage) {
+  bool did_work = false;
+  {
+    std::lock_guard<std::mutex> lock(stage->run_mutex);
+    if (stage->removed) {
+      return;
+    }
+    const int status = stage->ptr_stage->Process(&did_work);
+    if (status) {
+      LOG(ERROR) << stage->name << " stage Process failed: " << status;
+      *stage->ptr_status = status;
+      stage->removed = true;
+      return;
+    }
+  }
+  ++passes_;
+  if (did_work) {
+    QueueStage(index, stage);
+    return;
+  }
+  ++idle_passes_;
+  IdleStage idle_stage;
+  idle_stage.stage = stage;
+  std::lock_guard<std::mutex> lock(idle_mutex_);
+  idle_stage.wake_time =
+      Clock::now() + std::chrono::milliseconds(kIdleSleepMilliseconds);
+  idle_stages_.push_back(idle_stage);
+
+  // Wake times only grow, so the stage is the earliest only when it is the
+  // only one. Waiting workers then have no wake time yet.
+  if (idle_stages_.size() == 1 && waiting_workers_ > 0) {
+    work_ready_.notify_one();
+  }
+}
+
+void WorkerPool::QueueStage(int index, const StagePtr& stage) {
+  Worker& worker = *workers_[index];
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.queues[stage->priority].push_back(stage);
+  }
+  // A worker increments |waiting_workers_| before it checks the queues, and
+  // holds |idle_mutex_| from then until it waits; taking |idle_mutex_| here
+  // makes sure the notification cannot come between the check and the wait.
+  if (waiting_workers_ > 0) {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    work_ready_.notify_one();
+  }
+}
+
+bool WorkerPool::StageQueued() {
+  for (int i = 0; i < num_workers_; ++i) {
+    Worker& worker = *workers_[i];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    for (int priority = 0; priority < kNumPriorities; ++priority) {
+      if (!worker.queues[priority].empty()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void WorkerPool::WaitForWork(int index) {
+  std::vector<StagePtr> due_stages;
+  {
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    if (stop_) {
+      return;
+    }
+    const Clock::time_point now = Clock::now();
+    while (!idle_stages_.empty() && idle_stages_.front().wake_time <= now) {
+      due_stages.push_back(idle_stages_.front().stage);
+      idle_stages_.pop_front();
+    }
+    if (due_stages.empty()) {
+      // Sleep until the earliest idle stage is due, or until |QueueStage()|
+      // or |Stop()| wakes the worker. A stage queued after |PopStage()| found
+      // none is caught by the check below.
+      ++waiting_workers_;
+      if (!StageQueued()) {
+        if (idle_stages_.empty()) {
+          work_ready_.wait(lock);
+        } else {
+          work_ready_.wait_until(lock, idle_stages_.front().wake_time);
+        }
+      }
+      --waiting_workers_;
+      return;
+    }
+  }
+  for (size_t i = 0; i < due_stages.size(); ++i) {
+    QueueStage(index, due_stages[i]);
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,173 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WORKER_POOL_H_
+#define WEBMLIVE_ENCODER_WORKER_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+class PipelineStageInterface;
+
+struct WorkerPoolStats {
+  WorkerPoolStats() : passes(0), idle_passes(0), steals(0) {}
+
+  // |Process()| calls, and calls that did no work.
+  int64 passes;
+  int64 idle_passes;
+
+  // Stages a worker took from the queue of another worker.
+  int64 steals;
+};
+
+// Runs the pipeline stages of any number of encoders on a fixed set of
+// worker threads, so that a process hosting many streams runs about one
+// thread per core instead of one thread per stage.
+//
+// Notes:
+// - Workers run one |Process()| pass of a stage at a time. A stage that did
+//   work is queued again behind the other stages of its priority on the same
+//   worker, so that stages take turns. A stage that did no work waits
+//   |kIdleSleepMilliseconds| before its next pass, as it would on a
+//   dedicated thread. Workers with nothing to run block on a condition
+//   variable until a stage is queued or the earliest idle stage is due.
+// - Each worker has its own queues. Workers with nothing queued steal stages
+//   from the back of the queues of the other workers.
+// - Workers run the stages of higher priority first, except that every
+//   |kNormalPriorityInterval|th pass of a worker starts with the normal
+//   priority stages, and every |kLowPriorityInterval|th with the low priority
+//   stages, so that no priority is starved.
+// - A stage runs on one worker at a time.
+class WorkerPool {
+ public:
+  enum {
+    kRunFailed = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  enum Priority {
+    kLowPriority = 0,
+    kNormalPriority = 1,
+    kHighPriority = 2,
+  };
+  static const int kNumPriorities = kHighPriority + 1;
+
+  static const int kIdleSleepMilliseconds = 1;
+  static const int kNormalPriorityInterval = 4;
+  static const int kLowPriorityInterval = 16;
+
+  WorkerPool();
+  ~WorkerPool();
+
+  // Sets the number of worker threads. |num_workers| 0 runs one worker per
+  // core. Returns |kSuccess| when successful.
+  int Init(int num_workers);
+
+  // Starts the worker threads.
+  int Run();
+
+  // Stops the worker threads. Stages still in the pool are not run again.
+  void Stop();
+
+  // Adds |ptr_stage| to the pool, to run at |priority|. |name| is used in log
+  // messages. When a |Process()| call fails the stage is not run again, and
+  // the error is stored in |ptr_status|. Both pointers must stay valid until
+  // |RemoveStage()| returns.
+  int AddStage(const std::string& name,
+               PipelineStageInterface* ptr_stage,
+               Priority priority,
+               std::atomic<int>* ptr_status);
+
+  // Removes |ptr_stage| from the pool. Waits for a pass in progress to end;
+  // |Process()| is not called again once this returns.
+  void RemoveStage(PipelineStageInterface* ptr_stage);
+
+  int num_workers() const { return num_workers_; }
+
+  // Copies the pass counts to |ptr_stats|.
+  void GetStats(WorkerPoolStats* ptr_stats) const;
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+  struct Stage;
+  struct Worker;
+  typedef std::shared_ptr<Stage> StagePtr;
+
+  // Stage waiting after a pass that did no work.
+  struct IdleStage {
+    StagePtr stage;
+    Clock::time_point wake_time;
+  };
+
+  // Worker thread function. Runs stages until |Stop()| is called.
+  void WorkerThread(int index);
+
+  // Takes the next stage to run for worker |index| from its own queues, or
+  // from those of the other workers. Searches |first_priority|, then the
+  // other priorities from the highest down. Returns false when no stage is
+  // queued.
+  bool PopStage(int index, Priority first_priority, StagePtr* ptr_stage);
+
+  // Takes the oldest stage of |priority| queued on worker |index|, or the
+  // newest queued on another worker.
+  bool PopStageOfPriority(int index, int priority, StagePtr* ptr_stage);
+
+  // Runs one pass of |stage| on worker |index|, and queues it again.
+  void RunStage(int index, const StagePtr& stage);
+
+  // Queues |stage| on worker |index|.
+  void QueueStage(int index, const StagePtr& stage);
+
+  // Moves the idle stages due to run to worker |index|, or waits until one
+  // is due or a stage is queued.
+  void WaitForWork(int index);
+
+  // Returns true when a stage is queued on any worker.
+  bool StageQueued();
+
+  int num_workers_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<bool> stop_;
+
+  // Worker that receives the next stage added.
+  std::atomic<int> next_worker_;
+
+  // Stages in the pool.
+  std::mutex stages_mutex_;
+  std::map<PipelineStageInterface*, StagePtr> stages_;
+
+  // Idle stages, in wake time order, and the workers waiting for work. Both
+  // are changed only under |idle_mutex_|; |QueueStage()| reads
+  // |waiting_workers_| without it.
+  std::mutex idle_mutex_;
+  std::condition_variable work_ready_;
+  std::deque<IdleStage> idle_stages_;
+  std::atomic<int> waiting_workers_;
+
+  std::atomic<int64> passes_;
+  std::atomic<int64> idle_passes_;
+  std::atomic<int64> steals_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WORKER_POOL_H_
@@ -0,0 +1,190 @@
+// Copyright (c) 2012 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/worker_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "encoder/pipeline_stage.h"
+#include "gtest/gtest.h"
+
+namespace webmlive {
+namespace {
+
+// Stage that counts its passes, does work on every |work_interval|th pass,
+// and fails on pass |fail_pass| when it is not 0.
+class CountingStage : public PipelineStageInterface {
+ public:
+  CountingStage() : passes(0), drains(0), work_interval(1), fail_pass(0) {}
+  virtual ~CountingStage() {}
+
+  virtual int Process(bool* ptr_did_work) {
+    const int pass = ++passes;
+    if (pass == fail_pass) {
+      return -1;
+    }
+    *ptr_did_work = pass % work_interval == 0;
+    return 0;
+  }
+  virtual int Drain() {
+    ++drains;
+    return 0;
+  }
+
+  std::atomic<int> passes;
+  std::atomic<int> drains;
+  int work_interval;
+  int fail_pass;
+};
+
+// Waits up to a second for |stage| to reach |passes| passes.
+bool WaitForPasses(const CountingStage& stage, int passes) {
+  for (int i = 0; i < 1000 && stage.passes < passes; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return stage.passes >= passes;
+}
+
+TEST(WorkerPoolTest, RejectsInvalidArgs) {
+  WorkerPool pool;
+  EXPECT_EQ(WorkerPool::kInvalidArg, pool.Init(-1));
+  EXPECT_EQ(WorkerPool::kRunFailed, pool.Run());
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Init(1));
+  std::atomic<int> status(0);
+  EXPECT_EQ(WorkerPool::kInvalidArg,
+            pool.AddStage("null", NULL, WorkerPool::kNormalPriority,
+                          &status));
+  CountingStage stage;
+  ASSERT_EQ(WorkerPool::kSuccess,
+            pool.AddStage("stage", &stage, WorkerPool::kNormalPriority,
+                          &status));
+  EXPECT_EQ(WorkerPool::kInvalidArg,
+            pool.AddStage("stage", &stage, WorkerPool::kNormalPriority,
+                          &status));
+  pool.RemoveStage(&stage);
+}
+
+TEST(WorkerPoolTest, RunsStagesOnAllPriorities) {
+  WorkerPool pool;
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Init(1));
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Run());
+  CountingStage stages[WorkerPool::kNumPriorities];
+  std::atomic<int> statuses[WorkerPool::kNumPriorities];
+  for (int i = 0; i < WorkerPool::kNumPriorities; ++i) {
+    statuses[i] = 0;
+    ASSERT_EQ(WorkerPool::kSuccess,
+              pool.AddStage("stage", &stages[i],
+                            static_cast<WorkerPool::Priority>(i),
+                            &statuses[i]));
+  }
+
+  // Every stage always has work, and none is starved by the higher
+  // priorities.
+  for (int i = 0; i < WorkerPool::kNumPriorities; ++i) {
+    EXPECT_TRUE(WaitForPasses(stages[i], 10));
+  }
+  for (int i = 0; i < WorkerPool::kNumPriorities; ++i) {
+    pool.RemoveStage(&stages[i]);
+    EXPECT_EQ(0, statuses[i]);
+  }
+  pool.Stop();
+}
+
+TEST(WorkerPoolTest, FailedStageStops) {
+  WorkerPool pool;
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Init(2));
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Run());
+  CountingStage stage;
+  stage.fail_pass = 5;
+  std::atomic<int> status(0);
+  ASSERT_EQ(WorkerPool::kSuccess,
+            pool.AddStage("failing", &stage, WorkerPool::kHighPriority,
+                          &status));
+  ASSERT_TRUE(WaitForPasses(stage, 5));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(-1, status);
+  EXPECT_EQ(5, stage.passes);
+  pool.RemoveStage(&stage);
+  pool.Stop();
+}
+
+// Idle stages are run again after their sleep, so a stage that rarely has
+// work still makes progress.
+TEST(WorkerPoolTest, IdleStagesWake) {
+  WorkerPool pool;
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Init(1));
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Run());
+  CountingStage stage;
+  stage.work_interval = 1000000;
+  std::atomic<int> status(0);
+  ASSERT_EQ(WorkerPool::kSuccess,
+            pool.AddStage("idle", &stage, WorkerPool::kNormalPriority,
+                          &status));
+  EXPECT_TRUE(WaitForPasses(stage, 5));
+  WorkerPoolStats stats;
+  pool.GetStats(&stats);
+  EXPECT_GT(stats.idle_passes, 0);
+  pool.RemoveStage(&stage);
+  pool.Stop();
+}
+
+// |Process()| is never called once |RemoveStage()| or |Stop()| returns, and
+// |Stop()| returns promptly while stages are idle or busy.
+TEST(WorkerPoolTest, Shutdown) {
+  WorkerPool pool;
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Init(2));
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Run());
+  CountingStage busy;
+  CountingStage idle;
+  idle.work_interval = 1000000;
+  std::atomic<int> busy_status(0);
+  std::atomic<int> idle_status(0);
+  ASSERT_EQ(WorkerPool::kSuccess,
+            pool.AddStage("busy", &busy, WorkerPool::kNormalPriority,
+                          &busy_status));
+  ASSERT_EQ(WorkerPool::kSuccess,
+            pool.AddStage("idle", &idle, WorkerPool::kLowPriority,
+                          &idle_status));
+  ASSERT_TRUE(WaitForPasses(busy, 100));
+  ASSERT_TRUE(WaitForPasses(idle, 2));
+
+  pool.RemoveStage(&busy);
+  const int busy_passes = busy.passes;
+  pool.Stop();
+  const int idle_passes = idle.passes;
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(busy_passes, busy.passes);
+  EXPECT_EQ(idle_passes, idle.passes);
+  EXPECT_EQ(0, busy.drains);
+
+  // Stopping again, and destroying a stopped pool, are harmless.
+  pool.Stop();
+  pool.RemoveStage(&idle);
+}
+
+TEST(WorkerPoolTest, RunnerDrainsPooledStage) {
+  WorkerPool pool;
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Init(1));
+  ASSERT_EQ(WorkerPool::kSuccess, pool.Run());
+  CountingStage stage;
+  PipelineStageRunner runner;
+  ASSERT_EQ(PipelineStageRunner::kSuccess,
+            runner.Start("pooled", &stage, &pool,
+                         WorkerPool::kNormalPriority));
+  EXPECT_TRUE(runner.running());
+  ASSERT_TRUE(WaitForPasses(stage, 3));
+  runner.Stop(true);
+  EXPECT_FALSE(runner.running());
+  EXPECT_EQ(1, stage.drains);
+  EXPECT_EQ(PipelineStageRunner::kSuccess, runner.status());
+  pool.Stop();
+}
+
+}  // namespace
+}  // namespace webmlive
@@ -8,6 +8,7 @@
 import cgi
 import datetime
 import os.path
+import re
 import time
 
 from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
@@ -15,34 +16,147 @@ from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
 FILENAME = 'test.webm'
 POSTCOUNT = 0
 
+# Chunk upload state, keyed by request path and X-WebM-Chunk-Sequence value:
+# bytes received so far, the file they were written to, and the chunks
+# received whole. Retries of whole chunks are dropped, and the encoder's HEAD
+# request learns where to resume a partial chunk.
+RECEIVED = {}
+CHUNK_FILES = {}
+COMPLETE = set()
+
+CONTENT_RANGE = re.compile(r'bytes (\d+)-(\d+)/(\d+)')
+
 class WebMStreamServer(BaseHTTPRequestHandler):
+  def chunk_key(self):
+    sequence = self.headers.getheader('x-webm-chunk-sequence')
+    if sequence is None:
+      return None
+    return (self.path, sequence)
+
+  def do_HEAD(self):
+    # Resume query: report how much of the chunk arrived.
+    key = self.chunk_key()
+    self.send_response(200)
+    if key is not None:
+      self.send_header('X-WebM-Chunk-Received', str(RECEIVED.get(key, 0)))
+    self.end_headers()
+
+  def read_chunk(self):
+    """Reads the request body. Returns (data, resumed), or (None, False) when
+    the request was answered here: a retry of a chunk already received whole,
+    or a Content-Range that does not continue what was received."""
+    length = int(self.headers['content-length'])
+    key = self.chunk_key()
+    if key in COMPLETE:
+      print "duplicate chunk %s dropped" % key[1]
+      self.rfile.read(length)
+      self.send_response(200)
+      self.end_headers()
+      return (None, False)
+    start = 0
+    total = None
+    content_range = self.headers.getheader('content-range')
+    if content_range:
+      match = CONTENT_RANGE.match(content_range)
+      if not match:
+        self.send_response(400)
+        self.end_headers()
+        return (None, False)
+      start = int(match.group(1))
+      total = int(match.group(3))
+    if start > 0 and (key is None or start != RECEIVED.get(key, 0)):
+      print "cannot resume chunk at %d" % start
+      self.rfile.read(length)
+      self.send_response(416)
+      self.end_headers()
+      return (None, False)
+    # Reads less than |length| when the encoder drops the connection.
+    data = self.rfile.read(length)
+    if key is not None:
+      RECEIVED[key] = start + len(data)
+      if RECEIVED[key] == (total or length):
+        COMPLETE.add(key)
+    return (data, start > 0)
+
+  def set_chunk_file(self, fname):
+    # Remember where the chunk went before responding; the response fails
+    # when the encoder has already dropped the connection.
+    key = self.chunk_key()
+    if key is not None:
+      CHUNK_FILES[key] = fname
+
+  def resume_chunk(self, data):
+    # Append the rest of a partial chunk to the file that holds its start.
+    print "resumed chunk %s" % self.chunk_key()[1]
+    out_file = open(CHUNK_FILES[self.chunk_key()], 'ab')
+    out_file.write(data)
+    out_file.close()
+    self.send_response(200)
+    self.end_headers()
+
   def do_POST(self):
     global POSTCOUNT
     try:
       ctype, pdict = cgi.parse_header(self.headers.getheader('content-type'))
+      body = None
+      if ctype != 'multipart/form-data':
+        body, resumed = self.read_chunk()
+        if body is None:
+          return
+        if resumed:
+          self.resume_chunk(body)
+          return
       self.file = file(FILENAME, 'ab')
-      if self.path.startswith("/dash"):
+      self.set_chunk_file(FILENAME)
+      query = {}
+      if self.path.find('?') != -1:
+        query = cgi.parse_qs(self.path.split('?', 1)[1])
+      if self.path.startswith("/dash") and query.has_key('track'):
+        # Per-track output: the encoder names the track and chunk, and the
+        # files match the DashWriter SegmentTemplate patterns.
+        track = query['track'][0]
+        if query.has_key('metadata'):
+          print "header chunk, track " + track
+          fname = "webmlive_" + track + "_webmlive.hdr"
+          mode = 'wb'
+        else:
+          # Low latency mode sends a chunk in parts; append them.
+          chunk = query['chunk'][0]
+          print "media chunk, track " + track + " chunk " + chunk
+          print "index: %s" % self.headers.getheader('x-webm-chunk-index')
+          fname = "webmlive_" + track + "_webmlive_" + chunk + ".chk"
+          mode = 'ab'
+        out_file = open(fname, mode)
+        out_file.write(body)
+        out_file.close()
+        self.set_chunk_file(fname)
+        self.send_response(200)
+        POSTCOUNT += 1
+      elif self.path.startswith("/dash"):
         # Hooooorible... terrrrrrible hack: post count is magic!
         if POSTCOUNT == 0:
           # this is the manifest
           print "manifest"
           print "%s" % self.headers
           mpd_file = open('webmlive.mpd', 'w')
-          mpd_file.write(self.rfile.read(int(self.headers['content-length'])))
+          mpd_file.write(body)
           mpd_file.close()
         elif POSTCOUNT == 1:
           # this is the hdr chunk
           print "header chunk"
           hdr_file = open('webmlive_webmlive.hdr', 'wb')
-          hdr_file.write(self.rfile.read(int(self.headers['content-length'])))
+          hdr_file.write(body)
           hdr_file.close()
+          self.set_chunk_file('webmlive_webmlive.hdr')
         else:
           # this and all following chunks are media data
           print "media chunk"
+          print "index: %s" % self.headers.getheader('x-webm-chunk-index')
           fname = "webmlive_webmlive_" + str(POSTCOUNT-1) + ".chk"
           chk_file = open(fname, 'wb')
-          chk_file.write(self.rfile.read(int(self.headers['content-length'])))
+          chk_file.write(body)
           chk_file.close()
+          self.set_chunk_file(fname)
         self.send_response(200)
         POSTCOUNT += 1
         print "POSTCOUNT = " + str(POSTCOUNT)
@@ -55,9 +169,8 @@ class WebMStreamServer(BaseHTTPRequestHandler):
           self.send_response(200)
           self.wfile.write('Post OK')
         elif ctype == 'video/webm':
-          length = int(self.headers['content-length'])
-          if length > 0:
-            self.file.write(self.rfile.read(length))
+          if len(body) > 0:
+            self.file.write(body)
             self.send_response(200)
             self.wfile.write('Post OK')
           else:
@@ -30,6 +30,7 @@ cat << EOF
     --help: Display this message and exit.
     --keep-work-dir: Keep the work directory.
     --ogg-version: Dotted version number of libogg release to download.
+    --opus-version: Dotted version number of libopus release to download.
     --show-program-output: Show output from each step.
     --verbose: Show more output.
     --vorbis-version: Dotted version number of libvorbis release to download.
@@ -64,6 +65,13 @@ decompress() {
   vlog "Done."
 }
 
+# libopus releases are published only as gzipped tarballs.
+decompress_tarball() {
+  vlog "Decompressing $1..."
+  eval tar xzf "$@" ${devnull}
+  vlog "Done."
+}
+
 trap cleanup EXIT
 
 # Picks curl or wget (or terminates the script with an error) and echoes the
@@ -139,6 +147,17 @@ fix_libvorbis_vcxproj() {
     "${libvorbis_vcxproj}" ${devnull}
 }
 
+# Set all debug information formats in opus.vcxproj to ProgramDatabase, and
+# link the C runtime statically, as in fix_libvorbis_vcxproj().
+fix_libopus_vcxproj() {
+  libopus_vcxproj="${MSBUILD_OPUS_PATH}/${MSBUILD_OPUS_PROJECT}"
+  eval sed -i \
+    -e "s/MultiThreadedDebugDLL/MultiThreadedDebug/" \
+    -e "s/MultiThreadedDLL/MultiThreaded/" \
+    -e "s/EditAndContinue/ProgramDatabase/" \
+    "${libopus_vcxproj}" ${devnull}
+}
+
 install_ogg_files() {
   cp -p libogg/include/ogg/*.h ../libogg/ogg/
   for platform in ${MSBUILD_PLATFORMS}; do
@@ -188,9 +207,37 @@ install_vorbis_files() {
   done
 }
 
+install_opus_files() {
+  mkdir -p ../libopus/opus
+  cp -p libopus/COPYING ../libopus/
+  cp -p libopus/include/*.h ../libopus/opus/
+  for platform in ${MSBUILD_PLATFORMS}; do
+    for config in ${MSBUILD_CONFIGURATIONS}; do
+      opus_dirs="${opus_dirs} ${MSBUILD_OPUS_PATH}/${platform}/${config}"
+    done
+  done
+
+  webmlive_dirs=""
+  for platform in ${WEBMLIVE_PLATFORMS}; do
+    for config in ${WEBMLIVE_CONFIGURATIONS}; do
+      webmlive_dirs="${webmlive_dirs} ../libopus/win/${platform}/${config}"
+    done
+  done
+
+  opus_dir_array=(${opus_dirs})
+  webmlive_dir_array=(${webmlive_dirs})
+
+  for (( i = 0; i < ${#opus_dir_array[@]}; ++i )); do
+    mkdir -p "${webmlive_dir_array[$i]}"
+    eval cp -p "${opus_dir_array[$i]}/opus.lib" \
+      "${webmlive_dir_array[$i]}" ${devnull}
+  done
+}
+
 # Defaults for command line options.
 KEEP_WORK_DIR=""
 OGG_VERSION="1.3.2"
+OPUS_VERSION="1.1"
 VORBIS_VERSION="1.3.4"
 
 # Parse the command line.
@@ -207,6 +254,10 @@ while [[ -n "$1" ]]; do
       OGG_VERSION="$2"
       shift
       ;;
+    --opus-version)
+      OPUS_VERSION="$2"
+      shift
+      ;;
     --show-program-output)
       devnull=
       ;;
@@ -237,21 +288,27 @@ readonly MSBUILD_OGG_PATH="libogg/win32/VS2010"
 readonly MSBUILD_OGG_PROJECT="libogg_static.vcxproj"
 readonly MSBUILD_VORBIS_PATH="libvorbis/win32/VS2010/libvorbis"
 readonly MSBUILD_VORBIS_PROJECT="libvorbis_static.vcxproj"
+readonly MSBUILD_OPUS_PATH="libopus/win32/VS2010"
+readonly MSBUILD_OPUS_PROJECT="opus.vcxproj"
 readonly MSBUILD_TOOLSET="v120"
 readonly THIRD_PARTY="$(pwd)"
 readonly WORK_DIR="tmp_$(date +%Y%m%d_%H%M%S)"
 readonly LIBOGG_ARCHIVE="libogg-${OGG_VERSION}.zip"
 readonly LIBVORBIS_ARCHIVE="libvorbis-${VORBIS_VERSION}.zip"
+readonly LIBOPUS_ARCHIVE="opus-${OPUS_VERSION}.tar.gz"
 readonly XIPH_DL_SERVER="http://downloads.xiph.org"
 readonly XIPH_DL_LIBOGG="releases/ogg/${LIBOGG_ARCHIVE}"
 readonly XIPH_DL_LIBVORBIS="releases/vorbis/${LIBVORBIS_ARCHIVE}"
+readonly XIPH_DL_LIBOPUS="releases/opus/${LIBOPUS_ARCHIVE}"
 
 if [[ "${VERBOSE}" = "yes" ]]; then
 cat << EOF
   KEEP_WORK_DIR=${KEEP_WORK_DIR}
   OGG_VERSION=${OGG_VERSION}
+  OPUS_VERSION=${OPUS_VERSION}
   LIBOGG_ARCHIVE=${LIBOGG_ARCHIVE}
   LIBVORBIS_ARCHIVE=${LIBVORBIS_ARCHIVE}
+  LIBOPUS_ARCHIVE=${LIBOPUS_ARCHIVE}
   MSBUILD_CONFIGURATIONS=${MSBUILD_CONFIGURATIONS}
   MSBUILD_PLATFORMS=${MSBUILD_PLATFORMS}
   MSBUILD_TOOLSET=${MSBUILD_TOOLSET}
@@ -261,6 +318,7 @@ cat << EOF
   XIPH_DL_SERVER=${XIPH_DL_SERVER}
   XIPH_DL_LIBOGG=${XIPH_DL_LIBOGG}
   XIPH_DL_LIBVORBIS=${XIPH_DL_LIBVORBIS}
+  XIPH_DL_LIBOPUS=${XIPH_DL_LIBOPUS}
 EOF
 fi
 
@@ -281,17 +339,20 @@ cd "${WORK_DIR}"
 # Download release archives.
 download "${XIPH_DL_SERVER}/${XIPH_DL_LIBOGG}"
 download "${XIPH_DL_SERVER}/${XIPH_DL_LIBVORBIS}"
+download "${XIPH_DL_SERVER}/${XIPH_DL_LIBOPUS}"
 
 # Decompress the archives.
 decompress "${LIBOGG_ARCHIVE}"
 decompress "${LIBVORBIS_ARCHIVE}"
+decompress_tarball "${LIBOPUS_ARCHIVE}"
 
 # Strip the version number from directory names to avoid include and library
 # path related compile and link errors.
 mv "$(basename ${LIBOGG_ARCHIVE} .zip)" libogg
 mv "$(basename ${LIBVORBIS_ARCHIVE} .zip)" libvorbis
+mv "$(basename ${LIBOPUS_ARCHIVE} .tar.gz)" libopus
 
-# Build the Ogg and Vorbis libraries.
+# Build the Ogg, Vorbis, and Opus libraries.
 enable_libogg_release_pdb_generation
 build_libs "${MSBUILD_OGG_PATH}/${MSBUILD_OGG_PROJECT}"
 # libvorbis_static.vcxproj doesn't really produce statically linkable libraries
@@ -299,14 +360,17 @@ build_libs "${MSBUILD_OGG_PATH}/${MSBUILD_OGG_PROJECT}"
 # building.
 fix_libvorbis_vcxproj
 build_libs "${MSBUILD_VORBIS_PATH}/${MSBUILD_VORBIS_PROJECT}"
+fix_libopus_vcxproj
+build_libs "${MSBUILD_OPUS_PATH}/${MSBUILD_OPUS_PROJECT}"
 
 # Install headers and libraries.
 install_ogg_files
 install_vorbis_files
+install_opus_files
 
 # Echo the new text for README.webmlive.
 cat << EOF
-Ogg and Vorbis libraries updated. README.webmlive information follows:
+Ogg, Vorbis, and Opus libraries updated. README.webmlive information follows:
 
 libogg
 Version: ${OGG_VERSION}
@@ -315,6 +379,10 @@ URL: ${XIPH_DL_SERVER}/${XIPH_DL_LIBOGG}
 libvorbis
 Version: ${VORBIS_VERSION}
 URL: ${XIPH_DL_SERVER}/${XIPH_DL_LIBVORBIS}
+
+libopus
+Version: ${OPUS_VERSION}
+URL: ${XIPH_DL_SERVER}/${XIPH_DL_LIBOPUS}
 EOF
 
 vlog "Done."